@@ -93,6 +93,11 @@ int main(int argc, const char * argv[]) {
 #if defined (NEVER_EWM)
     runSyncTest (ethNetworkMainnet,  account, mode, timestamp,  5 * 60, path);
 //    runSyncMany(ethereumMainnet, mode, 10 * 60, 1000);
+#endif
+
+#if defined (PERF_KECCAK)
+    // keccak-256 of addresses and log topics, singly and batched, per backend
+    BRRunKeccakPerfTests (1000000);
 #endif
     return 0;
 }
@@ -94,6 +94,7 @@ void testWalletKitWithAccountAndNetworkBTC  (void);
 void testWalletKitWithAccountAndNetworkBCH  (void);
 void testBTCWalletManager                   (void);
 void testWalletKitWithAccountAndNetworkETH  (void);
+void testPerfWalletKitTransfers             (void);
 
 // Support
 void testJSONSUP                            (void);
@@ -102,6 +103,8 @@ void testUtilSUP                            (void);
 
 // Ethereum
 void testEventETH                           (void);
+void testPerfEventQueue                     (void);
+void testPerfEventAlarm                     (void);
 void testBaseETH                            (void);
 void testBlockchainETH                      (void);
 void testTransactionETH                     (void);
@@ -119,6 +122,16 @@ void testTezos                              (void);
 
 // Bitcoin
 void testBitcoinSupport                     (void);
+void testPerfFileService                    (void);
+void testPerfTransactionSign               (void);
+void testPerfWalletCoinSelection            (void);
+void testPerfBloomFilter                    (void);
+void testPerfTransactionParse               (void);
+void testPerfSHA256                         (void);
+void testPerfBIP39Derive                    (void);
+void testPerfAES                            (void);
+void testPerfKeccak                         (void);
+void testPerfKeyVerify                      (void);
 void testBitcoin                            (void);
 void testBitcoinSyncOne                     (void);
 
@@ -210,6 +223,10 @@ void testBTCWalletManager(void) {
     runBTCWalletManagerTests();
 }
 
+void testPerfWalletKitTransfers(void) {
+    runWalletKitTransferPerfTests (100000);
+}
+
 void testWalletKitWithAccountAndNetworkETH(void) {
     WKAccount   account;
     WKNetwork   network;
@@ -262,6 +279,14 @@ void testEventETH(void) {
     runEventTests();
 }
 
+void testPerfEventQueue(void) {
+    assert (1 == runEventQueuePerfTests (8, 250000));
+}
+
+void testPerfEventAlarm(void) {
+    assert (1 == runEventAlarmPerfTests (10000, 2000));
+}
+
 void testBaseETH(void) {
     runBaseTests();
 }
@@ -313,6 +338,49 @@ void testBitcoinSupport(void) {
     assert (1 == BRRunSupTests());
 }
 
+void testPerfFileService(void) {
+    assert (1 == BRRunSupFileServicePerfTests (200000));
+}
+
+void testPerfTransactionSign(void) {
+    assert (1 == BRRunTransactionSignPerfTests (1));
+    assert (1 == BRRunTransactionSignPerfTests (100));
+    assert (1 == BRRunTransactionSignPerfTests (1000));
+}
+
+void testPerfWalletCoinSelection(void) {
+    assert (1 == BRRunWalletCoinSelectionPerfTests (10000));
+}
+
+void testPerfBloomFilter(void) {
+    assert (1 == BRRunBloomFilterPerfTests (1000));
+    assert (1 == BRRunBloomFilterPerfTests (10000));
+}
+
+void testPerfTransactionParse(void) {
+    assert (1 == BRRunTransactionParsePerfTests (100000));
+}
+
+void testPerfSHA256(void) {
+    assert (1 == BRRunSHA256PerfTests (1000000));
+}
+
+void testPerfBIP39Derive(void) {
+    assert (1 == BRRunBIP39DerivePerfTests (200));
+}
+
+void testPerfAES(void) {
+    assert (1 == BRRunAESPerfTests (16*1024*1024));
+}
+
+void testPerfKeccak(void) {
+    assert (1 == BRRunKeccakPerfTests (1000000));
+}
+
+void testPerfKeyVerify(void) {
+    assert (1 == BRRunKeyVerifyPerfTests (10000));
+}
+
 void testBitcoin(void) {
     assert (1 == BRRunTests());
 }
@@ -588,6 +656,7 @@ static TestDef allTests[] = {
     {SLOW,  "testWalletKitBCH",     testWalletKitWithAccountAndNetworkBCH  },
     {SLOW,  "testWalletKitETH",     testWalletKitWithAccountAndNetworkETH  },
     {QUICK, "testBTCWalletManager", testBTCWalletManager                   },
+    {SLOW,  "perfWalletKitTransfers", testPerfWalletKitTransfers           },
 
     // Support
     {QUICK, "testRLP",              testRLPSUP                          },
@@ -596,6 +665,8 @@ static TestDef allTests[] = {
     
     // Ethereum
     {QUICK, "testEvent",            testEventETH                        },
+    {SLOW,  "perfEventQueue",       testPerfEventQueue                  },
+    {SLOW,  "perfEventAlarm",       testPerfEventAlarm                  },
     {QUICK, "testBase",             testBaseETH                         },
     {QUICK, "testBC",               testBlockchainETH                   },
     {QUICK, "testTransactions",     testTransactionETH                  },
@@ -613,6 +684,16 @@ static TestDef allTests[] = {
 
     // Bitcoin
     {QUICK, "testSupportBTC",       testBitcoinSupport                  },
+    {SLOW,  "perfFileService",      testPerfFileService                 },
+    {SLOW,  "perfTransactionSign",  testPerfTransactionSign             },
+    {SLOW,  "perfCoinSelection",    testPerfWalletCoinSelection         },
+    {SLOW,  "perfBloomFilter",      testPerfBloomFilter                 },
+    {SLOW,  "perfTransactionParse", testPerfTransactionParse            },
+    {SLOW,  "perfSHA256",           testPerfSHA256                      },
+    {SLOW,  "perfBIP39Derive",      testPerfBIP39Derive                 },
+    {SLOW,  "perfAES",              testPerfAES                         },
+    {SLOW,  "perfKeccak",           testPerfKeccak                      },
+    {SLOW,  "perfKeyVerify",        testPerfKeyVerify                   },
     {QUICK, "testBTC",              testBitcoin                         },
     {SLOW,  "testSyncOneBTC",       testBitcoinSyncOne                  },
     
@@ -183,6 +183,18 @@ final class WalletKitCoreTests: XCTestCase {
         runEventTests ()
     }
 
+    func XtestPerformanceEventQueue () {
+        self.measure {
+            XCTAssert(1 == runEventQueuePerfTests (8, 250_000))
+        }
+    }
+
+    func XtestPerformanceEventAlarm () {
+        self.measure {
+            XCTAssert(1 == runEventAlarmPerfTests (10_000, 2_000))
+        }
+    }
+
     func testBaseETH () {
         runBaseTests()
     }
@@ -316,6 +328,75 @@ final class WalletKitCoreTests: XCTestCase {
         }
     }
 
+    func XtestPerformanceWalletKitTransfers() {
+        self.measure {
+            runWalletKitTransferPerfTests (100_000);
+        }
+    }
+
+    func XtestPerformanceFileService() {
+        self.measure {
+            XCTAssert(1 == BRRunSupFileServicePerfTests (200_000))
+        }
+    }
+
+    func XtestPerformanceTransactionSign() {
+        self.measure {
+            XCTAssert(1 == BRRunTransactionSignPerfTests (1))
+            XCTAssert(1 == BRRunTransactionSignPerfTests (100))
+            XCTAssert(1 == BRRunTransactionSignPerfTests (1000))
+        }
+    }
+
+    func XtestPerformanceWalletCoinSelection() {
+        self.measure {
+            XCTAssert(1 == BRRunWalletCoinSelectionPerfTests (10_000))
+        }
+    }
+
+    func XtestPerformanceBloomFilter() {
+        self.measure {
+            XCTAssert(1 == BRRunBloomFilterPerfTests (1_000))
+            XCTAssert(1 == BRRunBloomFilterPerfTests (10_000))
+        }
+    }
+
+    func XtestPerformanceTransactionParse() {
+        self.measure {
+            XCTAssert(1 == BRRunTransactionParsePerfTests (100_000))
+        }
+    }
+
+    func XtestPerformanceSHA256() {
+        self.measure {
+            XCTAssert(1 == BRRunSHA256PerfTests (1_000_000))
+        }
+    }
+
+    func XtestPerformanceBIP39Derive() {
+        self.measure {
+            XCTAssert(1 == BRRunBIP39DerivePerfTests (200))
+        }
+    }
+
+    func XtestPerformanceAES() {
+        self.measure {
+            XCTAssert(1 == BRRunAESPerfTests (16 * 1024 * 1024))
+        }
+    }
+
+    func XtestPerformanceKeccak() {
+        self.measure {
+            XCTAssert(1 == BRRunKeccakPerfTests (1000000))
+        }
+    }
+
+    func XtestPerformanceKeyVerify() {
+        self.measure {
+            XCTAssert(1 == BRRunKeyVerifyPerfTests (10000))
+        }
+    }
+
     // MARK: - WalletConnect 1.0
     func testWalletConnect() {
         runWalletConnectTests();
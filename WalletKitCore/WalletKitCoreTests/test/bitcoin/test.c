@@ -42,8 +42,10 @@
 #include "dogecoin/BRDogecoinParams.h"
 
 #include "bitcoin/BRBitcoinBloomFilter.h"
+#include "bitcoin/BRBitcoinCompactFilter.h"
 #include "bitcoin/BRBitcoinMerkleBlock.h"
 #include "bitcoin/BRBitcoinWallet.h"
+#include "bitcoin/BRBitcoinCoinSelection.h"
 #include "bitcoin/BRBitcoinPeer.h"
 #include "bitcoin/BRBitcoinPeerManager.h"
 #include "bitcoin/BRBitcoinChainParams.h"
@@ -60,8 +62,18 @@
 #include <time.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <poll.h>
 #include <pthread.h>
 
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#elif defined(__GLIBC__) && defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 33)
+#include <malloc.h>
+#define BTC_TEST_HAS_MALLINFO2 1
+#endif
+#endif
+
 #define SKIP_BIP38 1
 
 #ifdef __ANDROID__
@@ -823,6 +835,30 @@ int BRHashTests()
                     "\x14\x7c\x4e\x72\xb9\x80\x77\x85\xaf\xee\x48\xbb", *(UInt256 *)md))
         r = 0, fprintf(stderr, "\n***FAILED*** %s: BRSHA256() test 6", __func__);
 
+    // test sha256 backends and batches against the portable code, for lengths around the block and padding boundaries
+
+    for (BRSHA256Backend b = BR_SHA256_BACKEND_AVX2; b <= BR_SHA256_BACKEND_SHA_NI; b++) {
+        uint8_t msgs[19*130], refs[19*32], mds[19*32];
+
+        for (size_t i = 0; i < sizeof(msgs); i++) msgs[i] = (uint8_t)(i*7 + 3);
+
+        for (size_t len = 0; len <= 130 && BRSHA256SetBackend(BR_SHA256_BACKEND_PORTABLE); len++) {
+            for (size_t j = 0; j < 19; j++) BRSHA256_2(&refs[j*32], &msgs[j*len], len);
+            if (! BRSHA256SetBackend(b)) break; // not supported by this cpu
+            for (size_t j = 0; j < 19; j++) BRSHA256_2(&mds[j*32], &msgs[j*len], len);
+
+            if (memcmp(mds, refs, sizeof(refs)) != 0)
+                r = 0, fprintf(stderr, "\n***FAILED*** %s: BRSHA256_2() backend %d length %zu", __func__, b, len);
+            memset(mds, 0, sizeof(mds));
+            BRSHA256_2Batch(mds, msgs, len, 19);
+            if (memcmp(mds, refs, sizeof(refs)) != 0)
+                r = 0, fprintf(stderr, "\n***FAILED*** %s: BRSHA256_2Batch() backend %d length %zu", __func__, b, len);
+        }
+    }
+
+    if (! BRSHA256SetBackend(BR_SHA256_BACKEND_SHA_NI) && ! BRSHA256SetBackend(BR_SHA256_BACKEND_AVX2))
+        BRSHA256SetBackend(BR_SHA256_BACKEND_PORTABLE);
+
     // test sha512
     
     s = "Free online SHA512 Calculator, type text here...";
@@ -968,6 +1004,26 @@ int BRHashTests()
                     "\x82\x27\x3b\x7b\xfa\xd8\x04\x5d\x85\xa4\x70", *(UInt256 *)md))
         r = 0, fprintf(stderr, "***FAILED*** %s: Keccak-256() test 1\n", __func__);
 
+    // test keccak backends and batches against single messages, for lengths around the block and padding boundaries
+
+    for (BRKeccakBackend b = BR_KECCAK_BACKEND_PORTABLE; b <= BR_KECCAK_BACKEND_AVX2; b++) {
+        uint8_t msgs[11*280], refs[11*32], mds[11*32];
+
+        if (! BRKeccakSetBackend(b)) continue; // not supported by this cpu
+        for (size_t i = 0; i < sizeof(msgs); i++) msgs[i] = (uint8_t)(i*7 + 3);
+
+        for (size_t len = 0; len <= 280; len++) {
+            for (size_t j = 0; j < 11; j++) BRKeccak256(&refs[j*32], &msgs[j*len], len);
+            memset(mds, 0, sizeof(mds));
+            BRKeccak256Batch(mds, msgs, len, 11);
+            if (memcmp(mds, refs, sizeof(refs)) != 0)
+                r = 0, fprintf(stderr, "***FAILED*** %s: BRKeccak256Batch() backend %d length %zu\n", __func__, b, len);
+        }
+    }
+
+    if (! BRKeccakSetBackend(BR_KECCAK_BACKEND_AVX2) && ! BRKeccakSetBackend(BR_KECCAK_BACKEND_SSE2))
+        BRKeccakSetBackend(BR_KECCAK_BACKEND_PORTABLE);
+
     // test murmurHash3-x86_32
     
     if (BRMurmur3_32("", 0, 0) != 0)
@@ -1055,6 +1111,27 @@ int BRMacTests()
                "\x27\x0c\xd7\xea\x25\x05\x54\x97\x58\xbf\x75\xc0\x5a\x99\x4a\x6d\x03\x4f\x65\xf8\xf0\xe6\xfd\xca\xea"
                "\xb1\xa3\x4d\x4a\x6b\x4b\x63\x6e\x07\x0a\x38\xbc\xe7\x37", mac, 64) != 0)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRHMAC() sha512 test 2\n", __func__);
+
+    BRHMACSHA512Context ctx;
+    const size_t keyLens[] = { 0, 20, 128, 131 }; // keys shorter than, equal to and longer than a block
+    uint8_t hk[131], hd[300], hmac[64];
+
+    for (size_t i = 0; i < sizeof(hk); i++) hk[i] = (uint8_t)(0xaa ^ i);
+    for (size_t i = 0; i < sizeof(hd); i++) hd[i] = (uint8_t)(i*13);
+
+    for (size_t i = 0; i < sizeof(keyLens)/sizeof(*keyLens); i++) {
+        BRHMACSHA512Init(&ctx, hk, keyLens[i]);
+
+        for (size_t dataLen = 0; dataLen < sizeof(hd); dataLen += 37) {
+            BRHMAC(mac, BRSHA512, 512/8, hk, keyLens[i], hd, dataLen);
+            BRHMACSHA512(hmac, &ctx, hd, dataLen);
+            if (memcmp(mac, hmac, 64) != 0)
+                r = 0, fprintf(stderr, "***FAILED*** %s: BRHMACSHA512() key %zu data %zu\n", __func__, keyLens[i],
+                               dataLen);
+        }
+    }
+
+    mem_clean(&ctx, sizeof(ctx));
     
     // test poly1305
 
@@ -1505,6 +1582,48 @@ int BRAesTests()
     BRAESCTR(buf, &key3, 32, iv, in3, 64);
     if (memcmp(buf, plain, 64) != 0) r = 0, fprintf(stderr, "\n***FAILED*** %s: BRAESCTR() test 3", __func__);
     
+    // test each backend with the vectors above, and a ctr stream in pieces against the bitsliced backend in one piece
+    const UInt256 *keys[] = { &key1, &key2, &key3 };
+    const char *ciphers[] = { cipher1, cipher2, cipher3 }, *ins[] = { in1, in2, in3 };
+    const size_t pieces[] = { 16, 48, 128, 8 };
+    uint8_t stream[200], refs[3][200], out[200], ctr[16];
+    BRAESContext ctx;
+
+    for (size_t i = 0; i < sizeof(stream); i++) stream[i] = (uint8_t)(i*31);
+
+    for (BRAESBackend b = BR_AES_BACKEND_BITSLICED; b <= BR_AES_BACKEND_AES_NI; b++) {
+        if (! BRAESSetBackend(b)) continue; // not supported by this cpu
+
+        for (size_t i = 0; i < 3; i++) {
+            BRAESContextInit(&ctx, keys[i], 16 + i*8);
+            memcpy(buf, plain, 16);
+            BRAESContextEncrypt(&ctx, buf);
+            if (memcmp(buf, ciphers[i], 16) != 0)
+                r = 0, fprintf(stderr, "\n***FAILED*** %s: BRAESContextEncrypt() backend %d test %zu", __func__, b, i);
+            BRAESContextDecrypt(&ctx, buf);
+            if (memcmp(buf, plain, 16) != 0)
+                r = 0, fprintf(stderr, "\n***FAILED*** %s: BRAESContextDecrypt() backend %d test %zu", __func__, b, i);
+            memcpy(ctr, iv, 16);
+            BRAESContextCTR(&ctx, buf, ctr, ins[i], 64);
+            if (memcmp(buf, plain, 64) != 0)
+                r = 0, fprintf(stderr, "\n***FAILED*** %s: BRAESContextCTR() backend %d test %zu", __func__, b, i);
+
+            memcpy(ctr, iv, 16);
+            if (b == BR_AES_BACKEND_BITSLICED) BRAESContextCTR(&ctx, refs[i], ctr, stream, sizeof(stream));
+
+            memcpy(ctr, iv, 16);
+            for (size_t j = 0, off = 0; j < sizeof(pieces)/sizeof(*pieces); off += pieces[j++]) {
+                BRAESContextCTR(&ctx, &out[off], ctr, &stream[off], pieces[j]);
+            }
+
+            if (memcmp(out, refs[i], sizeof(out)) != 0)
+                r = 0, fprintf(stderr, "\n***FAILED*** %s: BRAESContextCTR() backend %d stream %zu", __func__, b, i);
+        }
+    }
+
+    mem_clean(&ctx, sizeof(ctx));
+    if (! BRAESSetBackend(BR_AES_BACKEND_AES_NI)) BRAESSetBackend(BR_AES_BACKEND_BITSLICED);
+
     if (! r) fprintf(stderr, "\n                                    ");
     return r;
 }
@@ -2320,6 +2439,14 @@ int BRBIP39MnemonicTests()
                     "\xf4\x76\xc4\x5c\x88\x25\x32\x76\xd9\xfd\x0d\xf6\xef\x48\x60\x9e\x8b\xb7\xdc\xa8"))
         r = 0, fprintf(stderr, "***FAILED*** %s: BRBIP39DeriveKey() test 8\n", __func__);
 
+    const char *phrases[] = { phrase, phrase2, phrase8 }, *passphrases[] = { "TREZOR", NULL, "TREZOR" };
+    UInt512 keys[3], key2;
+
+    BRBIP39DeriveKeys(keys, phrases, passphrases, 3);
+    BRBIP39DeriveKey(key2.u8, phrase2, NULL);
+    if (! UInt512Eq(keys[1], key2) || ! UInt512Eq(keys[2], key))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRBIP39DeriveKeys() test\n", __func__);
+
     return r;
 }
 
@@ -2366,6 +2493,27 @@ int BRBIP32SequenceTests()
                     uint256("7b6a7dd645507d775215a9035be06700e1ed8c541da9351b4bd14bd50ab61428")))
         r = 0, fprintf(stderr, "***FAILED*** %s: BRBIP32PubKey() test\n", __func__);
 
+    uint8_t pubKeys[25][33], pubKey2[33];
+    size_t pubKeysCount;
+
+    for (uint32_t chain = SEQUENCE_EXTERNAL_CHAIN; chain <= SEQUENCE_INTERNAL_CHAIN; chain++) {
+        pubKeysCount = BRBIP32PubKeyRange(pubKeys, mpk, chain, 3, 25);
+        if (pubKeysCount != 25) r = 0, fprintf(stderr, "***FAILED*** %s: BRBIP32PubKeyRange() test 1\n", __func__);
+
+        for (size_t i = 0; i < pubKeysCount; i++) { // must match single key derivation, with or without a cached chain
+            BRBIP32PubKey(pubKey2, mpk, chain, (uint32_t)(3 + i));
+            if (memcmp(pubKeys[i], pubKey2, sizeof(pubKey2)) != 0)
+                r = 0, fprintf(stderr, "***FAILED*** %s: BRBIP32PubKeyRange() test 2\n", __func__);
+        }
+    }
+
+    if (BRBIP32PubKeyRange(pubKeys, mpk, SEQUENCE_EXTERNAL_CHAIN, BIP32_HARD - 2, 25) != 2)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRBIP32PubKeyRange() test 3\n", __func__);
+
+    BRBIP32PubKeyRange(pubKeys, mpk, SEQUENCE_EXTERNAL_CHAIN, 0, 1);
+    if (memcmp(pubKeys[0], pubKey, sizeof(pubKey)) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRBIP32PubKeyRange() test 4\n", __func__);
+
     UInt512 dk;
     BRAddress addr;
 
@@ -2702,6 +2850,19 @@ int btcTransactionTests()
             r = 0, fprintf(stderr, "\n***FAILED*** %s: BRTransaction w/ Coinbase input txHash not empty test 5", __func__);
     }
     btcTransactionFree(txCoinbase);
+
+    // a parsed or copied tx shares one allocation with its scripts, adding to it must keep the existing ones intact
+    btcTransactionAddOutput(txCoinbaseCopy, SATOSHIS, script, scriptLen);
+    uint8_t buf11[btcTransactionSerialize(txCoinbaseCopy, NULL, 0)];
+    size_t len11 = btcTransactionSerialize(txCoinbaseCopy, buf11, sizeof(buf11));
+    txCoinbase = btcTransactionParse(buf11, len11);
+
+    if (! txCoinbase || txCoinbase->outCount != 2 || ! btcTxInputEqual(&txCoinbase->inputs[0], &txCoinbaseCopy->inputs[0]) ||
+        ! btcTxOutputEqual(&txCoinbase->outputs[0], &txCoinbaseCopy->outputs[0]) ||
+        ! btcTxOutputEqual(&txCoinbase->outputs[1], &txCoinbaseCopy->outputs[1]) ||
+        txCoinbase->inputs[0].sigLen != 0x4d || memcmp(txCoinbase->inputs[0].signature, &buf10[42], 0x4d) != 0)
+        r = 0, fprintf(stderr, "\n***FAILED*** %s: btcTransactionAddOutput() to parsed tx test 6", __func__);
+    if (txCoinbase) btcTransactionFree(txCoinbase);
     btcTransactionFree(txCoinbaseCopy);
 
     if (! r) fprintf(stderr, "\n                                    ");
@@ -2737,6 +2898,334 @@ static void walletTxDeleted(void *info, UInt256 txHash, int notifyUser, int reco
 // TODO: test tx ordering for multiple tx with same block height
 // TODO: port all applicable tests from bitcoinj and bitcoincore
 
+static uint64_t btcCoinSelectionTestFee(void *info, size_t vsize)
+{
+    return vsize*10; // 10 satoshis-per-byte
+}
+
+int btcCoinSelectionTests()
+{
+    int r = 1;
+    const size_t inSize = TX_INPUT_SIZE, txSize = 8 + 1 + TX_OUTPUT_SIZE; // one P2PKH output
+    BRBitcoinCoinSelectionParams params = {
+        100000, 10000, 5000, txSize, TX_OUTPUT_SIZE, TX_MAX_SIZE, NULL, btcCoinSelectionTestFee
+    };
+    uint64_t exact = params.amount + (txSize + 1 + inSize)*10; // pays amount and fee, one input, no change
+    BRBitcoinCoin coins[] = {
+        { 30000, inSize, 0 }, { 70000, inSize, 0 }, { exact + 50, inSize, 0 }, { 500000, inSize, 0 }
+    };
+    size_t selected[4];
+    BRBitcoinCoinSelectionResult result;
+    BRBitcoinCoinSelection selection;
+
+    // wallet order: the first three coins, with change
+    if (! btcCoinSelect(BITCOIN_COIN_SELECTION_WALLET_ORDER, coins, 4, &params, selected, &result) ||
+        result.count != 3 || selected[0] != 0 || selected[1] != 1 || selected[2] != 2 ||
+        result.change != result.total - params.amount - (txSize + 1 + 3*inSize + TX_OUTPUT_SIZE)*10)
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcCoinSelect() wallet order\n", __func__);
+
+    // largest first: the largest coin, with change
+    if (! btcCoinSelect(BITCOIN_COIN_SELECTION_LARGEST_FIRST, coins, 4, &params, selected, &result) ||
+        result.count != 1 || selected[0] != 3 || result.change == 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcCoinSelect() largest first\n", __func__);
+
+    // branch and bound: the coin that needs no change
+    if (! btcCoinSelect(BITCOIN_COIN_SELECTION_BRANCH_AND_BOUND, coins, 4, &params, selected, &result) ||
+        result.count != 1 || selected[0] != 2 || result.change != 0 || result.vsize != txSize + 1 + inSize)
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcCoinSelect() branch and bound\n", __func__);
+
+    // branch and bound: two coins that together need no change
+    coins[2].amount = 500000;
+    coins[1].amount = params.amount + (txSize + 1 + 2*inSize)*10 - coins[0].amount;
+    if (! btcCoinSelect(BITCOIN_COIN_SELECTION_BRANCH_AND_BOUND, coins, 4, &params, selected, &result) ||
+        result.count != 2 || result.change != 0 || result.total != coins[0].amount + coins[1].amount)
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcCoinSelect() branch and bound pair\n", __func__);
+
+    // consolidate: every coin, with change
+    if (! btcCoinSelect(BITCOIN_COIN_SELECTION_CONSOLIDATE, coins, 4, &params, selected, &result) ||
+        result.count != 4 || result.change != result.total - params.amount - (txSize + 1 + 4*inSize + TX_OUTPUT_SIZE)*10)
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcCoinSelect() consolidate\n", __func__);
+
+    // insufficient funds
+    params.amount = 2000000;
+    for (selection = 0; selection < NUMBER_OF_BITCOIN_COIN_SELECTIONS; selection++) {
+        if (btcCoinSelect(selection, coins, 4, &params, selected, &result))
+            r = 0, fprintf(stderr, "***FAILED*** %s: btcCoinSelect() insufficient funds %d\n", __func__, selection);
+    }
+
+    for (selection = 0; selection < NUMBER_OF_BITCOIN_COIN_SELECTIONS; selection++) {
+        BRBitcoinCoinSelection named;
+
+        if (! btcCoinSelectionFromName(btcCoinSelectionName(selection), &named) || named != selection)
+            r = 0, fprintf(stderr, "***FAILED*** %s: btcCoinSelectionFromName() %d\n", __func__, selection);
+    }
+
+    if (btcCoinSelectionFromName("Random", NULL) || ! btcCoinSelectionFromName("branchandbound", NULL))
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcCoinSelectionFromName()\n", __func__);
+
+    return r;
+}
+
+int btcWalletBalanceIsConsistentTest(BRBitcoinWallet *wallet);
+
+// restores a copy of wallet from its snapshot, checking that it matches a copy restored by replaying its transactions
+static int btcWalletSnapshotTests(const BRBitcoinChainParams *params, BRMasterPubKey mpk, BRBitcoinWallet *wallet)
+{
+    int r = 1;
+    size_t i, txCount = btcWalletTransactions(wallet, NULL, 0), utxoCount = btcWalletUTXOs(wallet, NULL, 0),
+           len = btcWalletSnapshot(wallet, NULL, 0);
+    BRBitcoinTransaction **txs = calloc(txCount + 1, sizeof(*txs)), **txs2 = calloc(txCount + 1, sizeof(*txs2)),
+                         **txs3 = calloc(txCount + 1, sizeof(*txs3));
+    BRBitcoinUTXO *utxos = calloc(utxoCount + 1, sizeof(*utxos)), *utxos2 = calloc(utxoCount + 1, sizeof(*utxos2));
+    uint8_t *snapshot = malloc(len + 1), *snapshot2 = malloc(len + 1);
+    BRBitcoinWallet *w2, *w3;
+
+    if (len == 0 || btcWalletSnapshot(wallet, snapshot, len) != len)
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcWalletSnapshot() test 1\n", __func__);
+
+    btcWalletTransactions(wallet, txs, txCount);
+    btcWalletUTXOs(wallet, utxos, utxoCount);
+    for (i = 0; i < txCount; i++) txs2[txCount - i - 1] = btcTransactionCopy(txs[i]), txs3[i] = btcTransactionCopy(txs[i]);
+
+    w2 = btcWalletNewWithSnapshot(params->addrParams, txs2, txCount, mpk, NULL, 0, NULL, 0, snapshot, len);
+    if (btcWalletBalance(w2) != btcWalletBalance(wallet) || btcWalletTotalSent(w2) != btcWalletTotalSent(wallet) ||
+        btcWalletTotalReceived(w2) != btcWalletTotalReceived(wallet) ||
+        btcWalletUTXOs(w2, utxos2, utxoCount) != utxoCount || btcWalletTransactions(w2, txs2, txCount) != txCount)
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcWalletNewWithSnapshot() test 1\n", __func__);
+
+    for (i = 0; r && i < utxoCount; i++) {
+        if (! UInt256Eq(utxos2[i].hash, utxos[i].hash) || utxos2[i].n != utxos[i].n)
+            r = 0, fprintf(stderr, "***FAILED*** %s: btcWalletNewWithSnapshot() test 2 %zu\n", __func__, i);
+    }
+
+    for (i = 0; r && i < txCount; i++) {
+        if (! btcTransactionEq(txs2[i], txs[i]) || btcWalletBalanceAfterTx(w2, txs2[i]) != btcWalletBalanceAfterTx(wallet, txs[i]))
+            r = 0, fprintf(stderr, "***FAILED*** %s: btcWalletNewWithSnapshot() test 3 %zu\n", __func__, i);
+    }
+
+    if (btcWalletSnapshot(w2, snapshot2, len) != len || memcmp(snapshot, snapshot2, len) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcWalletSnapshot() test 2\n", __func__);
+
+    if (! btcWalletBalanceIsConsistentTest(w2))
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcWalletBalanceIsConsistentTest()\n", __func__);
+
+    snapshot[len/2] ^= 0x01; // a corrupt snapshot is ignored, and the transactions replayed
+    w3 = btcWalletNewWithSnapshot(params->addrParams, txs3, txCount, mpk, NULL, 0, NULL, 0, snapshot, len);
+    if (btcWalletBalance(w3) != btcWalletBalance(wallet) || btcWalletUTXOs(w3, NULL, 0) != utxoCount)
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcWalletNewWithSnapshot() test 4\n", __func__);
+
+    snapshot[len/2] ^= 0x01;
+
+    // a stale snapshot, of a tx missing from those loaded or of a tx at another block height, is ignored, and the
+    // transactions replayed as btcWalletNew() does
+    for (size_t stale = 0; txCount > 1 && stale < 2; stale++) {
+        BRBitcoinWallet *w4, *w5;
+        size_t n = 0;
+
+        for (i = 0; i < txCount; i++) {
+            if (stale == 0 && i == txCount/2) continue; // missing
+            txs2[n] = btcTransactionCopy(txs[i]), txs3[n] = btcTransactionCopy(txs[i]);
+            if (stale == 1 && i == txCount/2) txs2[n]->blockHeight += 1, txs3[n]->blockHeight += 1; // another height
+            n++;
+        }
+
+        w4 = btcWalletNewWithSnapshot(params->addrParams, txs2, n, mpk, NULL, 0, NULL, 0, snapshot, len);
+        w5 = btcWalletNew(params->addrParams, txs3, n, mpk);
+        if (! w4 || ! w5 || btcWalletBalance(w4) != btcWalletBalance(w5) ||
+            btcWalletTotalSent(w4) != btcWalletTotalSent(w5) ||
+            btcWalletTotalReceived(w4) != btcWalletTotalReceived(w5) ||
+            btcWalletUTXOs(w4, NULL, 0) != btcWalletUTXOs(w5, NULL, 0) || ! btcWalletBalanceIsConsistentTest(w4))
+            r = 0, fprintf(stderr, "***FAILED*** %s: btcWalletNewWithSnapshot() test %zu\n", __func__, 5 + stale);
+
+        if (w5) btcWalletFree(w5);
+        if (w4) btcWalletFree(w4);
+    }
+
+    btcWalletFree(w3);
+    btcWalletFree(w2);
+    free(snapshot2);
+    free(snapshot);
+    free(utxos2);
+    free(utxos);
+    free(txs3);
+    free(txs2);
+    free(txs);
+    return r;
+}
+
+// registers `count` transactions, each either a receive from a non-wallet key or a spend of wallet UTXOs, checking
+// that the incrementally updated balance matches a full update after each
+static int btcWalletIncrementalBalanceTests(const BRBitcoinChainParams *params, UInt512 seed, BRMasterPubKey mpk,
+                                            size_t count)
+{
+    int r = 1;
+    UInt256 secret = uint256("0000000000000000000000000000000000000000000000000000000000000001");
+    BRBitcoinWallet *w = btcWalletNew(params->addrParams, NULL, 0, mpk);
+    BRKey k;
+    BRAddress addr;
+
+    BRKeySetSecret(&k, &secret, 1);
+    BRKeyAddress(&k, addr.s, sizeof(addr), params->addrParams);
+
+    uint8_t inScript[BRAddressScriptPubKey(NULL, 0, params->addrParams, addr.s)];
+    size_t inScriptLen = BRAddressScriptPubKey(inScript, sizeof(inScript), params->addrParams, addr.s);
+
+    for (size_t i = 0; i < count; i++) {
+        BRBitcoinTransaction *tx = NULL;
+
+        if (i % 3 == 2) { // spend
+            tx = btcWalletCreateTransaction(w, SATOSHIS/10, addr.s);
+            if (tx) btcWalletSignTransaction(w, tx, 0x00, params->bip32depth, params->bip32child, &seed, sizeof(seed));
+        }
+
+        if (! tx) { // receive
+            BRAddress recvAddr = btcWalletReceiveAddress(w);
+            uint8_t outScript[BRAddressScriptPubKey(NULL, 0, params->addrParams, recvAddr.s)];
+            size_t outScriptLen = BRAddressScriptPubKey(outScript, sizeof(outScript), params->addrParams, recvAddr.s);
+            UInt256 inHash = UINT256_ZERO;
+
+            UInt32SetLE(inHash.u8, (uint32_t) i + 1);
+            tx = btcTransactionNew();
+            btcTransactionAddInput(tx, inHash, 0, 1, inScript, inScriptLen, NULL, 0, NULL, 0, TXIN_SEQUENCE);
+            btcTransactionAddOutput(tx, SATOSHIS, outScript, outScriptLen);
+            btcTransactionSign(tx, 0, &k, 1);
+        }
+
+        tx->timestamp = (uint32_t) i + 1;
+        if (! btcWalletRegisterTransaction(w, tx)) {
+            r = 0, fprintf(stderr, "***FAILED*** %s: btcWalletRegisterTransaction() %zu\n", __func__, i);
+            btcTransactionFree(tx);
+        }
+        else if (i % 5 == 4) { // confirm, as a block would
+            btcWalletUpdateTransactions(w, &tx->txHash, 1, (uint32_t) i + 1, (uint32_t) i + 1);
+        }
+
+        if (! btcWalletBalanceIsConsistentTest(w))
+            r = 0, fprintf(stderr, "***FAILED*** %s: btcWalletBalanceIsConsistentTest() %zu\n", __func__, i);
+    }
+
+    size_t txCount = btcWalletTransactions(w, NULL, 0);
+    BRBitcoinTransaction **txs = calloc(txCount + 1, sizeof(*txs));
+    UInt256 *txHashes = calloc(txCount + 1, sizeof(*txHashes));
+
+    btcWalletTransactions(w, txs, txCount);
+    for (size_t i = 0; i < txCount; i++) txHashes[i] = txs[i]->txHash;
+    btcWalletUpdateTransactions(w, txHashes, txCount, (uint32_t) count + 1, (uint32_t) count + 1); // confirm the rest
+    if (btcWalletSnapshot(w, NULL, 0) == 0 || ! btcWalletSnapshotTests(params, mpk, w))
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcWalletSnapshotTests()\n", __func__);
+
+    free(txHashes);
+    free(txs);
+    btcWalletSetTxUnconfirmedAfter(w, (uint32_t) count/2); // as a reorg would
+    if (! btcWalletBalanceIsConsistentTest(w))
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcWalletSetTxUnconfirmedAfter()\n", __func__);
+
+    btcWalletFree(w);
+    return r;
+}
+
+// the fee estimated for each coin selection must be that of the tx created with it
+static int btcWalletFeeForTxAmountCoinSelectionTests(const BRBitcoinChainParams *params, BRMasterPubKey mpk)
+{
+    int r = 1;
+    UInt256 secret = uint256("0000000000000000000000000000000000000000000000000000000000000001");
+    const uint64_t amounts[] = { 25000, SATOSHIS/100, SATOSHIS/10 };
+    BRBitcoinWallet *w = btcWalletNew(params->addrParams, NULL, 0, mpk);
+    BRAddress addr, recvAddr = btcWalletLegacyAddress(w);
+    BRBitcoinTransaction *tx = btcTransactionNew();
+    UInt256 inHash = UINT256_ZERO;
+    uint32_t lcg = 1;
+    BRKey k;
+
+    BRKeySetSecret(&k, &secret, 1);
+    BRKeyLegacyAddr(&k, addr.s, sizeof(addr), params->addrParams);
+
+    uint8_t inScript[BRAddressScriptPubKey(NULL, 0, params->addrParams, addr.s)];
+    size_t inScriptLen = BRAddressScriptPubKey(inScript, sizeof(inScript), params->addrParams, addr.s);
+    uint8_t outScript[BRAddressScriptPubKey(NULL, 0, params->addrParams, recvAddr.s)];
+    size_t outScriptLen = BRAddressScriptPubKey(outScript, sizeof(outScript), params->addrParams, recvAddr.s);
+
+    UInt32SetLE(inHash.u8, 1);
+    btcTransactionAddInput(tx, inHash, 0, 1, inScript, inScriptLen, NULL, 0, NULL, 0, TXIN_SEQUENCE);
+
+    for (size_t i = 0; i < 60; i++) { // 0.00001 to ~0.01 BTC
+        lcg = lcg*1103515245 + 12345;
+        btcTransactionAddOutput(tx, 1000 + (uint64_t)((lcg >> 8) % 1000)*((lcg >> 4) % 1000), outScript, outScriptLen);
+    }
+
+    btcTransactionSign(tx, 0, &k, 1);
+    tx->timestamp = 1;
+    if (! btcWalletRegisterTransaction(w, tx)) btcTransactionFree(tx), r = 0;
+
+    for (size_t i = 0; i < sizeof(amounts)/sizeof(*amounts); i++) {
+        for (BRBitcoinCoinSelection selection = 0; selection < NUMBER_OF_BITCOIN_COIN_SELECTIONS; selection++) {
+            BRBitcoinTxOutput o = BR_TX_OUTPUT_NONE;
+            uint64_t fee = btcWalletFeeForTxAmountWithCoinSelection(w, UINT64_MAX, amounts[i], selection);
+
+            o.amount = amounts[i];
+            btcTxOutputSetAddress(&o, params->addrParams, addr.s);
+            tx = btcWalletCreateTxForOutputsWithCoinSelection(w, UINT64_MAX, &o, 1, selection);
+            btcTxOutputSetAddress(&o, params->addrParams, NULL);
+
+            if (! tx || fee == 0 || btcWalletFeeForTx(w, tx) != fee)
+                r = 0, fprintf(stderr, "***FAILED*** %s: btcWalletFeeForTxAmountWithCoinSelection() %s %" PRIu64 "\n",
+                               __func__, btcCoinSelectionName(selection), amounts[i]);
+
+            if (tx) btcTransactionFree(tx);
+        }
+    }
+
+    btcWalletFree(w);
+    return r;
+}
+
+static int btcWalletAddrChainTests(const BRBitcoinChainParams *params, BRMasterPubKey mpk)
+{
+    int r = 1;
+    BRBitcoinWallet *w = btcWalletNew(params->addrParams, NULL, 0, mpk), *w2, *w3;
+    uint8_t pubKey[33];
+    UInt160 pkh;
+
+    btcWalletUnusedAddrs(w, NULL, 1500, SEQUENCE_EXTERNAL_CHAIN); // enough to be derived in parallel
+
+    size_t externalCount = btcWalletAddrChain(w, SEQUENCE_EXTERNAL_CHAIN, NULL, 0),
+           internalCount = btcWalletAddrChain(w, SEQUENCE_INTERNAL_CHAIN, NULL, 0);
+    UInt160 *externalPKHs = calloc(externalCount, sizeof(*externalPKHs)),
+            *internalPKHs = calloc(internalCount, sizeof(*internalPKHs));
+
+    btcWalletAddrChain(w, SEQUENCE_EXTERNAL_CHAIN, externalPKHs, externalCount);
+    btcWalletAddrChain(w, SEQUENCE_INTERNAL_CHAIN, internalPKHs, internalCount);
+    if (externalCount < 1500 || internalCount < SEQUENCE_GAP_LIMIT_INTERNAL_EXTENDED)
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcWalletAddrChain() test 1\n", __func__);
+
+    for (size_t i = 0; i < externalCount; i++) {
+        BRBIP32PubKey(pubKey, mpk, SEQUENCE_EXTERNAL_CHAIN, (uint32_t)i);
+        BRHash160(&pkh, pubKey, sizeof(pubKey));
+        if (! UInt160Eq(pkh, externalPKHs[i]))
+            r = 0, fprintf(stderr, "***FAILED*** %s: btcWalletAddrChain() test 2 %zu\n", __func__, i);
+    }
+
+    w2 = btcWalletNewWithAddrChains(params->addrParams, NULL, 0, mpk, externalPKHs, externalCount,
+                                    internalPKHs, internalCount);
+    if (btcWalletAddrChain(w2, SEQUENCE_EXTERNAL_CHAIN, NULL, 0) != externalCount ||
+        btcWalletAllAddrs(w2, NULL, 0) != SEQUENCE_GAP_LIMIT_EXTERNAL_EXTENDED + SEQUENCE_GAP_LIMIT_INTERNAL_EXTENDED)
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcWalletNewWithAddrChains() test 1\n", __func__);
+
+    externalPKHs[externalCount - 1].u8[0] ^= 0x01; // a chain not from mpk is ignored
+    w3 = btcWalletNewWithAddrChains(params->addrParams, NULL, 0, mpk, externalPKHs, externalCount,
+                                    internalPKHs, internalCount);
+    if (btcWalletAddrChain(w3, SEQUENCE_EXTERNAL_CHAIN, NULL, 0) != SEQUENCE_GAP_LIMIT_EXTERNAL_EXTENDED ||
+        btcWalletAddrChain(w3, SEQUENCE_INTERNAL_CHAIN, NULL, 0) != internalCount)
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcWalletNewWithAddrChains() test 2\n", __func__);
+
+    free(internalPKHs);
+    free(externalPKHs);
+    btcWalletFree(w3);
+    btcWalletFree(w2);
+    btcWalletFree(w);
+    return r;
+}
+
 int btcWalletTests()
 {
     int r = 1;
@@ -2872,6 +3361,15 @@ int btcWalletTests()
     printf("                                    ");
     btcWalletFree(w);
 
+    if (! btcWalletIncrementalBalanceTests(btcMainNetParams, seed, mpk, 60))
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcWalletIncrementalBalanceTests()\n", __func__);
+
+    if (! btcWalletAddrChainTests(btcMainNetParams, mpk))
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcWalletAddrChainTests()\n", __func__);
+
+    if (! btcWalletFeeForTxAmountCoinSelectionTests(btcMainNetParams, mpk))
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcWalletFeeForTxAmountCoinSelectionTests()\n", __func__);
+
     int64_t amt, bal, fee;
     
     tx = btcTransactionNew();
@@ -2990,6 +3488,117 @@ int btcBloomFilterTests()
         r = 0, fprintf(stderr, "***FAILED*** %s: btcBloomFilterSerialize() test 2\n", __func__);
     
     btcBloomFilterFree(f);
+
+    BRBitcoinBlockedBloomFilter *bf = btcBlockedBloomFilterNew(0.01, 3, 0);
+
+    btcBlockedBloomFilterInsertData(bf, (uint8_t *)data1, sizeof(data1) - 1);
+    if (! btcBlockedBloomFilterContainsData(bf, (uint8_t *)data1, sizeof(data1) - 1))
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcBlockedBloomFilterContainsData() test 1\n", __func__);
+
+    if (btcBlockedBloomFilterContainsData(bf, (uint8_t *)data2, sizeof(data2) - 1))
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcBlockedBloomFilterContainsData() test 2\n", __func__);
+
+    btcBlockedBloomFilterInsertData(bf, (uint8_t *)data3, sizeof(data3) - 1);
+    btcBlockedBloomFilterInsertData(bf, (uint8_t *)data4, sizeof(data4) - 1);
+    if (! btcBlockedBloomFilterContainsData(bf, (uint8_t *)data3, sizeof(data3) - 1) ||
+        ! btcBlockedBloomFilterContainsData(bf, (uint8_t *)data4, sizeof(data4) - 1))
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcBlockedBloomFilterContainsData() test 3\n", __func__);
+
+    if (bf->elemCount != 3 || ((uintptr_t)bf->blocks % (BLOCKED_BLOOM_BLOCK_WORDS*sizeof(uint32_t))) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcBlockedBloomFilterNew() test\n", __func__);
+
+    btcBlockedBloomFilterFree(bf);
+    bf = btcBlockedBloomFilterNew(0.001, 1000, 1);
+
+    UInt256 hash = UINT256_ZERO;
+    size_t falsePositives = 0;
+
+    for (uint32_t i = 0; i < 1000; i++) {
+        UInt32SetLE(hash.u8, i);
+        btcBlockedBloomFilterInsertData(bf, hash.u8, sizeof(hash));
+    }
+
+    for (uint32_t i = 0; i < 1000; i++) {
+        UInt32SetLE(hash.u8, i);
+        if (! btcBlockedBloomFilterContainsData(bf, hash.u8, sizeof(hash)))
+            r = 0, fprintf(stderr, "***FAILED*** %s: btcBlockedBloomFilterContainsData() test 4\n", __func__);
+    }
+
+    for (uint32_t i = 1000; i < 101000; i++) {
+        UInt32SetLE(hash.u8, i);
+        if (btcBlockedBloomFilterContainsData(bf, hash.u8, sizeof(hash))) falsePositives++;
+    }
+
+    if (falsePositives > 200) // false positive rate within twice what the filter was sized for
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcBlockedBloomFilterContainsData() test 5\n", __func__);
+
+    btcBlockedBloomFilterFree(bf);
+    return r;
+}
+
+int btcCompactFilterTests()
+{
+    int r = 1;
+    // BIP158 basic filter test vector: the testnet genesis block, holding only its coinbase output script
+    UInt256 blockHash = UInt256Reverse(uint256("000000000933ea01ad0ee984209779baaec3ced90fa3f408719526f8d77f4943"));
+    const char script[] = "\x41\x04\x67\x8a\xfd\xb0\xfe\x55\x48\x27\x19\x67\xf1\xa6\x71\x30\xb7\x10\x5c\xd6\xa8\x28"
+    "\xe0\x39\x09\xa6\x79\x62\xe0\xea\x1f\x61\xde\xb6\x49\xf6\xbc\x3f\x4c\xef\x38\xc4\xf3\x55\x04\xe5\x1e\xc1\x12\xde"
+    "\x5c\x38\x4d\xf7\xba\x0b\x8d\x57\x8a\x4c\x70\x2b\x6b\xf1\x1d\x5f\xac", other[] = "\x01\x02\x03";
+    const uint8_t *items[] = { (const uint8_t *)script }, *others[] = { (const uint8_t *)other };
+    size_t itemLens[] = { sizeof(script) - 1 }, otherLens[] = { sizeof(other) - 1 };
+    uint8_t filter[btcCompactFilterBuild(NULL, 0, blockHash, items, itemLens, 1)];
+    size_t i, len = btcCompactFilterBuild(filter, sizeof(filter), blockHash, items, itemLens, 1), fpCount = 0;
+    UInt256 header = btcCompactFilterHeader(btcCompactFilterHash(filter, len), UINT256_ZERO);
+
+    if (len != 4 || memcmp(filter, "\x01\x9d\xfc\xa8", 4) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcCompactFilterBuild() test 1\n", __func__);
+
+    if (! UInt256Eq(header, UInt256Reverse(uint256("21584579b7eb08997773e5aeff3a7f932700042d0ed2a6129012b7d7ae81b750"))))
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcCompactFilterHeader() test 1\n", __func__);
+
+    if (! btcCompactFilterMatchAny(filter, len, blockHash, items, itemLens, 1))
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcCompactFilterMatchAny() test 1\n", __func__);
+
+    if (btcCompactFilterMatchAny(filter, len, blockHash, others, otherLens, 1))
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcCompactFilterMatchAny() test 2\n", __func__);
+
+    if (! btcCompactFilterMatchAny(filter, len - 1, blockHash, others, otherLens, 1)) // truncated filters match
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcCompactFilterMatchAny() test 3\n", __func__);
+
+    // every item in a larger filter matches, and other items almost never do (1 in BIP158_BASIC_M)
+    uint8_t data[2000][25];
+    const uint8_t *dataItems[2000];
+    size_t dataLens[2000];
+
+    for (i = 0; i < 2000; i++) {
+        for (size_t j = 0; j < sizeof(data[i]); j++) data[i][j] = (uint8_t)BRRand(256);
+        dataItems[i] = data[i];
+        dataLens[i] = sizeof(data[i]);
+    }
+
+    uint8_t filter2[btcCompactFilterBuild(NULL, 0, blockHash, dataItems, dataLens, 1000)];
+
+    len = btcCompactFilterBuild(filter2, sizeof(filter2), blockHash, dataItems, dataLens, 1000);
+
+    if (len != sizeof(filter2) || btcCompactFilterBuild(filter2, len - 1, blockHash, dataItems, dataLens, 1000) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcCompactFilterBuild() test 2\n", __func__);
+
+    for (i = 0; i < 1000; i++) {
+        if (! btcCompactFilterMatchAny(filter2, len, blockHash, &dataItems[i], &dataLens[i], 1))
+            r = 0, fprintf(stderr, "***FAILED*** %s: btcCompactFilterMatchAny() test 4, item %zu\n", __func__, i);
+        if (btcCompactFilterMatchAny(filter2, len, blockHash, &dataItems[1000 + i], &dataLens[1000 + i], 1)) fpCount++;
+    }
+
+    if (fpCount > 1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcCompactFilterMatchAny() test 5, %zu false positives\n", __func__,
+                       fpCount);
+
+    if (! btcCompactFilterMatchAny(filter2, len, blockHash, &dataItems[999], dataLens, 2))
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcCompactFilterMatchAny() test 6\n", __func__);
+
+    if (btcCompactFilterMatchAny(filter2, len, UINT256_ZERO, dataItems, dataLens, 10)) // keyed by block hash
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcCompactFilterMatchAny() test 7\n", __func__);
+
     return r;
 }
 
@@ -3028,7 +3637,7 @@ int btcMerkleBlockTests()
     "\xab\x74\x1f\xa7\x82\x76\x22\x26\x51\x20\x9f\xe1\xa2\xc4\xc0\xfa\x1c\x58\x51\x0a\xec\x8b\x09\x0d\xd1\xeb\x1f\x82"
     "\xf9\xd2\x61\xb8\x27\x3b\x52\x5b\x02\xff\x1a";
     uint8_t block2[sizeof(block) - 1];
-    BRBitcoinMerkleBlock *b;
+    BRBitcoinMerkleBlock *b, *c;
     
     b = btcMerkleBlockParse((uint8_t *)block, sizeof(block) - 1);
     
@@ -3039,6 +3648,20 @@ int btcMerkleBlockTests()
     if (! btcMerkleBlockIsValid(b, (uint32_t)time(NULL)))
         r = 0, fprintf(stderr, "***FAILED*** %s: btcMerkleBlockIsValid() test\n", __func__);
     
+    // the same block with its two flag bytes padded to far more than its tree could need is invalid, so it's parsed as a
+    // header
+    uint8_t padded[sizeof(block) - 4 + 3 + 0x1000] = { 0 };
+
+    memcpy(padded, block, sizeof(block) - 4);
+    memcpy(&padded[sizeof(block) - 4], "\xfd\x00\x10", 3); // flagsLen of 0x1000
+    memcpy(&padded[sizeof(block) - 1], &block[sizeof(block) - 3], 2);
+    c = btcMerkleBlockParse(padded, sizeof(padded));
+
+    if (! c || c->totalTx != 0 || c->flagsLen != 0 || ! UInt256Eq(c->blockHash, b->blockHash))
+        r = 0, fprintf(stderr, "***FAILED*** %s: btcMerkleBlockIsValid() padded flags test\n", __func__);
+
+    if (c) btcMerkleBlockFree(c);
+
     if (btcMerkleBlockSerialize(b, block2, sizeof(block2)) != sizeof(block2) ||
         memcmp(block, block2, sizeof(block2)) != 0)
         r = 0, fprintf(stderr, "***FAILED*** %s: btcMerkleBlockSerialize() test\n", __func__);
@@ -3071,7 +3694,7 @@ int btcMerkleBlockTests()
     
     // TODO: test (CVE-2012-2459) vulnerability
 
-    BRBitcoinMerkleBlock *c = btcMerkleBlockCopy(b);
+    c = btcMerkleBlockCopy(b);
 
     if (!btcMerkleBlockEqual(b, c))
         r = 0, fprintf(stderr, "***FAILED*** %s: btcMerkleBlockEqual() test 1\n", __func__);
@@ -3084,7 +3707,50 @@ int btcMerkleBlockTests()
 
 
     if (b) btcMerkleBlockFree(b);
-    
+
+    // build partial merkle trees for blocks of n tx, matching every third tx and the last one
+    for (size_t n = 1; n <= 13; n++) {
+        UInt256 hashes[n], row[n], pair[2], matched[n];
+        uint8_t matches[n];
+        size_t i, count, matchCount = 0;
+
+        for (i = 0; i < n; i++) {
+            for (size_t j = 0; j < sizeof(UInt256); j++) hashes[i].u8[j] = (uint8_t)BRRand(256);
+            matches[i] = ((i % 3) == 0 || i + 1 == n);
+            if (matches[i]) matched[matchCount++] = hashes[i];
+            row[i] = hashes[i];
+        }
+
+        for (count = n; count > 1; count = (count + 1)/2) { // the merkle root, duplicating the odd hash in each row
+            for (i = 0; i < count; i += 2) {
+                pair[0] = row[i], pair[1] = row[(i + 1 < count) ? i + 1 : i];
+                BRSHA256_2(&row[i/2], pair, sizeof(pair));
+            }
+        }
+
+        b = btcMerkleBlockNew();
+        b->merkleRoot = row[0];
+        b->target = 0x1d00ffff;
+        btcMerkleBlockSetTxMatches(b, hashes, matches, n);
+
+        if (b->totalTx != n || ! btcMerkleBlockIsValid(b, (uint32_t)time(NULL)))
+            r = 0, fprintf(stderr, "***FAILED*** %s: btcMerkleBlockSetTxMatches() test 1, %zu tx\n", __func__, n);
+
+        UInt256 txHashes2[n];
+
+        if (btcMerkleBlockTxHashes(b, txHashes2, n) != matchCount ||
+            memcmp(txHashes2, matched, matchCount*sizeof(UInt256)) != 0)
+            r = 0, fprintf(stderr, "***FAILED*** %s: btcMerkleBlockSetTxMatches() test 2, %zu tx\n", __func__, n);
+
+        memset(matches, 0, sizeof(matches));
+        btcMerkleBlockSetTxMatches(b, hashes, matches, n);
+
+        if (! btcMerkleBlockIsValid(b, (uint32_t)time(NULL)) || btcMerkleBlockTxHashes(b, NULL, 0) != 0)
+            r = 0, fprintf(stderr, "***FAILED*** %s: btcMerkleBlockSetTxMatches() test 3, %zu tx\n", __func__, n);
+
+        btcMerkleBlockFree(b);
+    }
+
 //    b = btcMerkleBlockNew();
 //    b->timestamp = 1607600095;
 //    b->target = 0x180458b3;
@@ -3549,6 +4215,1353 @@ int btcPeerTests()
     return r;
 }
 
+typedef struct {
+    size_t cfHeadersCount, cfilterCount, blockCount;
+    UInt256 filterHeader;
+    int filterMatched;
+    UInt256 txHash;
+} BRPeerCompactFilterTestInfo;
+
+static void _testRelayedCFHeaders(void *info, UInt256 stopHash, UInt256 prevHeader, const UInt256 filterHashes[],
+                                  size_t filterCount)
+{
+    BRPeerCompactFilterTestInfo *testInfo = info;
+
+    testInfo->cfHeadersCount++;
+    testInfo->filterHeader = prevHeader;
+    for (size_t i = 0; i < filterCount; i++) testInfo->filterHeader = btcCompactFilterHeader(filterHashes[i],
+                                                                                             testInfo->filterHeader);
+}
+
+static void _testRelayedCFilter(void *info, UInt256 blockHash, const uint8_t *filter, size_t filterLen)
+{
+    BRPeerCompactFilterTestInfo *testInfo = info;
+    const uint8_t script[] = { 0x41, 0x04, 0x67, 0x8a, 0xfd, 0xb0, 0xfe, 0x55, 0x48, 0x27, 0x19, 0x67, 0xf1, 0xa6,
+        0x71, 0x30, 0xb7, 0x10, 0x5c, 0xd6, 0xa8, 0x28, 0xe0, 0x39, 0x09, 0xa6, 0x79, 0x62, 0xe0, 0xea, 0x1f, 0x61, 0xde,
+        0xb6, 0x49, 0xf6, 0xbc, 0x3f, 0x4c, 0xef, 0x38, 0xc4, 0xf3, 0x55, 0x04, 0xe5, 0x1e, 0xc1, 0x12, 0xde, 0x5c, 0x38,
+        0x4d, 0xf7, 0xba, 0x0b, 0x8d, 0x57, 0x8a, 0x4c, 0x70, 0x2b, 0x6b, 0xf1, 0x1d, 0x5f, 0xac }, *items[] = { script };
+    size_t itemLens[] = { sizeof(script) };
+
+    testInfo->cfilterCount++;
+    testInfo->filterMatched = btcCompactFilterMatchAny(filter, filterLen, blockHash, items, itemLens, 1);
+}
+
+static void _testRelayedFullBlock(void *info, BRBitcoinMerkleBlock *block, BRBitcoinTransaction *txs[],
+                                  size_t txCount)
+{
+    BRPeerCompactFilterTestInfo *testInfo = info;
+
+    testInfo->blockCount++;
+    if (txCount == 1 && block->totalTx == 1) testInfo->txHash = txs[0]->txHash;
+    for (size_t i = 0; i < txCount; i++) btcTransactionFree(txs[i]);
+    btcMerkleBlockFree(block);
+}
+
+// feeds recorded BIP157 messages for the testnet genesis block to a peer in compact filter mode
+int btcPeerCompactFilterTests()
+{
+    int r = 1;
+    const BRBitcoinChainParams *params = btcChainParams(false);
+    BRBitcoinPeer *p = btcPeerNew(params->magicNumber);
+    BRPeerCompactFilterTestInfo info = { 0 };
+    UInt256 blockHash = UInt256Reverse(uint256("000000000933ea01ad0ee984209779baaec3ced90fa3f408719526f8d77f4943"));
+    uint8_t cfheaders[1 + 32 + 32 + 1 + 32] = { BIP158_FILTER_TYPE_BASIC },
+            cfilter[] = { BIP158_FILTER_TYPE_BASIC, [33] = 4, 0x01, 0x9d, 0xfc, 0xa8 };
+    const char block[] = // the genesis block, header followed by its coinbase tx
+    "\x01\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+    "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x3b\xa3\xed\xfd\x7a\x7b\x12\xb2\x7a\xc7\x2c\x3e"
+    "\x67\x76\x8f\x61\x7f\xc8\x1b\xc3\x88\x8a\x51\x32\x3a\x9f\xb8\xaa\x4b\x1e\x5e\x4a\xda\xe5\x49\x4d"
+    "\xff\xff\x00\x1d\x1a\xa4\xae\x18\x01\x01\x00\x00\x00\x01\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+    "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\xff\xff"
+    "\xff\xff\x4d\x04\xff\xff\x00\x1d\x01\x04\x45\x54\x68\x65\x20\x54\x69\x6d\x65\x73\x20\x30\x33\x2f"
+    "\x4a\x61\x6e\x2f\x32\x30\x30\x39\x20\x43\x68\x61\x6e\x63\x65\x6c\x6c\x6f\x72\x20\x6f\x6e\x20\x62"
+    "\x72\x69\x6e\x6b\x20\x6f\x66\x20\x73\x65\x63\x6f\x6e\x64\x20\x62\x61\x69\x6c\x6f\x75\x74\x20\x66"
+    "\x6f\x72\x20\x62\x61\x6e\x6b\x73\xff\xff\xff\xff\x01\x00\xf2\x05\x2a\x01\x00\x00\x00\x43\x41\x04"
+    "\x67\x8a\xfd\xb0\xfe\x55\x48\x27\x19\x67\xf1\xa6\x71\x30\xb7\x10\x5c\xd6\xa8\x28\xe0\x39\x09\xa6"
+    "\x79\x62\xe0\xea\x1f\x61\xde\xb6\x49\xf6\xbc\x3f\x4c\xef\x38\xc4\xf3\x55\x04\xe5\x1e\xc1\x12\xde"
+    "\x5c\x38\x4d\xf7\xba\x0b\x8d\x57\x8a\x4c\x70\x2b\x6b\xf1\x1d\x5f\xac\x00\x00\x00\x00"
+    ;
+
+    btcPeerSetCallbacks(p, &info, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
+    btcPeerSetCompactFilterCallbacks(p, _testRelayedCFHeaders, _testRelayedCFilter, _testRelayedFullBlock);
+    UInt256Set(&cfheaders[1], blockHash); // stop hash, followed by a zero previous filter header
+    cfheaders[65] = 1;
+    UInt256Set(&cfheaders[66], btcCompactFilterHash(&cfilter[34], 4));
+    UInt256Set(&cfilter[1], blockHash);
+
+    btcPeerAcceptMessageTest(p, cfheaders, sizeof(cfheaders), MSG_CFHEADERS);
+
+    if (info.cfHeadersCount != 1 ||
+        ! UInt256Eq(info.filterHeader,
+                    UInt256Reverse(uint256("21584579b7eb08997773e5aeff3a7f932700042d0ed2a6129012b7d7ae81b750"))))
+        r = 0, fprintf(stderr, "***FAILED*** %s: cfheaders test\n", __func__);
+
+    btcPeerAcceptMessageTest(p, cfilter, sizeof(cfilter), MSG_CFILTER);
+
+    if (info.cfilterCount != 1 || ! info.filterMatched)
+        r = 0, fprintf(stderr, "***FAILED*** %s: cfilter test 1\n", __func__);
+
+    cfilter[0] = 0x01; // unknown filter types are dropped
+    btcPeerAcceptMessageTest(p, cfilter, sizeof(cfilter), MSG_CFILTER);
+    cfilter[0] = BIP158_FILTER_TYPE_BASIC;
+    btcPeerAcceptMessageTest(p, cfilter, sizeof(cfilter) - 1, MSG_CFILTER); // malformed
+
+    if (info.cfilterCount != 1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: cfilter test 2\n", __func__);
+
+    btcPeerAcceptMessageTest(p, (const uint8_t *)block, sizeof(block) - 1, MSG_BLOCK); // not requested
+
+    if (info.blockCount != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: block test 1\n", __func__);
+
+    btcPeerSendGetdata(p, NULL, 0, &blockHash, 1); // the peer isn't connected, but now expects a block
+    btcPeerAcceptMessageTest(p, (const uint8_t *)block, sizeof(block) - 1, MSG_BLOCK);
+
+    if (info.blockCount != 1 ||
+        ! UInt256Eq(info.txHash, uint256("3ba3edfd7a7b12b27ac72c3e67768f617fc81bc3888a51323a9fb8aa4b1e5e4a")))
+        r = 0, fprintf(stderr, "***FAILED*** %s: block test 2\n", __func__);
+
+    btcPeerFree(p);
+    return r;
+}
+
+//
+// Mock Peer - a local 'remote' peer, speaking just enough protocol for a BRBitcoinPeer to connect, ping and
+// disconnect.  Replies are written in fragments, and preceded by a large unknown message, so that the receiving
+// side must parse incrementally.
+//
+#define MOCK_PEER_BIG_MESSAGE_LENGTH   (300000)
+
+typedef struct {
+    uint32_t magicNumber;
+    int listenSocket;
+    uint16_t port;
+    size_t peersCount;
+    pthread_mutex_t lock;
+    size_t connected, ponged, disconnected, cleanedUp;
+} BRMockPeerContext;
+
+// writes the message, preceded by its 24 byte header, to buf; returns the number of bytes written
+static size_t
+mockPeerFrame (uint32_t magicNumber, uint8_t *buf, const char *type, const uint8_t *msg, size_t msgLen) {
+    uint8_t hash[32];
+    size_t off = 0;
+
+    UInt32SetLE (&buf[off], magicNumber);           off += sizeof(uint32_t);
+    strncpy ((char *) &buf[off], type, 12);         off += 12;
+    UInt32SetLE (&buf[off], (uint32_t) msgLen);     off += sizeof(uint32_t);
+    BRSHA256_2 (hash, msg, msgLen);
+    memcpy (&buf[off], hash, sizeof(uint32_t));     off += sizeof(uint32_t);
+    if (msgLen) memcpy (&buf[off], msg, msgLen);
+    off += msgLen;
+
+    return off;
+}
+
+static void
+mockPeerWrite (BRMockPeerContext *mock, int socket, const char *type, const uint8_t *msg, size_t msgLen) {
+    uint8_t *buf = calloc (3 + 24 + msgLen, 1);
+    size_t off = 3; // some junk, preceding the magic number, to be skipped
+
+    off += mockPeerFrame (mock->magicNumber, &buf[off], type, msg, msgLen);
+
+    // write the header in two parts, with a pause, and then the payload
+    for (size_t sent = 0, part = 10; sent < off; sent += part, part = off - sent) {
+        if (write (socket, &buf[sent], part) != (ssize_t) part) break;
+        nanosleep (&(struct timespec) { 0, 2000000 }, NULL);
+    }
+
+    free (buf);
+}
+
+static void
+mockPeerAcceptMessage (BRMockPeerContext *mock, int socket, const char *type, const uint8_t *msg, size_t msgLen) {
+    if (0 == strncmp (type, MSG_VERSION, 12)) {
+        uint8_t version[86] = { 0 };
+
+        UInt32SetLE (&version[0], 70015);   // version; the remaining fields are zero; an empty user agent
+        mockPeerWrite (mock, socket, MSG_VERSION, version, sizeof (version));
+        mockPeerWrite (mock, socket, MSG_VERACK, NULL, 0);
+    }
+    else if (0 == strncmp (type, MSG_PING, 12)) {
+        uint8_t *big = calloc (MOCK_PEER_BIG_MESSAGE_LENGTH, 1);
+
+        mockPeerWrite (mock, socket, "mockbig", big, MOCK_PEER_BIG_MESSAGE_LENGTH);
+        mockPeerWrite (mock, socket, MSG_PONG, msg, msgLen);
+        free (big);
+    }
+}
+
+static void *
+mockPeerThread (void *context) {
+    BRMockPeerContext *mock = context;
+    size_t accepted = 0, closed = 0;
+    int sockets[mock->peersCount];
+    uint8_t *buffers[mock->peersCount];
+    size_t buffersCount[mock->peersCount];
+
+    while (closed < mock->peersCount) {
+        struct pollfd fds[1 + mock->peersCount];
+        nfds_t fdsCount = 0;
+
+        fds[fdsCount++] = (struct pollfd) { (accepted < mock->peersCount ? mock->listenSocket : -1), POLLIN, 0 };
+        for (size_t i = 0; i < accepted; i++)
+            fds[fdsCount++] = (struct pollfd) { sockets[i], POLLIN, 0 };
+
+        if (poll (fds, fdsCount, 10000) <= 0) break;
+
+        if (fds[0].revents) {
+            sockets[accepted]  = accept (mock->listenSocket, NULL, NULL);
+            buffers[accepted]  = malloc (24 + MOCK_PEER_BIG_MESSAGE_LENGTH);
+            buffersCount[accepted] = 0;
+            accepted++;
+        }
+
+        for (size_t i = 0; i < fdsCount - 1; i++) {
+            if (0 == fds[1 + i].revents || sockets[i] < 0) continue;
+
+            ssize_t n = read (sockets[i], &buffers[i][buffersCount[i]], 24 + MOCK_PEER_BIG_MESSAGE_LENGTH - buffersCount[i]);
+            if (n <= 0) {
+                close (sockets[i]);
+                free (buffers[i]);
+                sockets[i] = -1;
+                closed++;
+                continue;
+            }
+            buffersCount[i] += (size_t) n;
+
+            while (buffersCount[i] >= 24 && buffersCount[i] >= 24 + UInt32GetLE (&buffers[i][16])) {
+                size_t msgLen = UInt32GetLE (&buffers[i][16]);
+
+                mockPeerAcceptMessage (mock, sockets[i], (const char *) &buffers[i][4], &buffers[i][24], msgLen);
+                memmove (buffers[i], &buffers[i][24 + msgLen], buffersCount[i] - 24 - msgLen);
+                buffersCount[i] -= 24 + msgLen;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void
+mockPeerPonged (void *info, int success) {
+    BRMockPeerContext *mock = info;
+
+    pthread_mutex_lock (&mock->lock);
+    if (success) mock->ponged++;
+    pthread_mutex_unlock (&mock->lock);
+}
+
+static void
+mockPeerConnected (void *info) {
+    BRMockPeerContext *mock = ((void **) info)[0];
+    BRBitcoinPeer *peer = ((void **) info)[1];
+
+    pthread_mutex_lock (&mock->lock);
+    mock->connected++;
+    pthread_mutex_unlock (&mock->lock);
+
+    btcPeerSendPing (peer, mock, mockPeerPonged);
+}
+
+static void
+mockPeerDisconnected (void *info, int error) {
+    BRMockPeerContext *mock = ((void **) info)[0];
+
+    pthread_mutex_lock (&mock->lock);
+    mock->disconnected++;
+    pthread_mutex_unlock (&mock->lock);
+}
+
+static void
+mockPeerThreadCleanup (void *info) {
+    BRMockPeerContext *mock = ((void **) info)[0];
+
+    pthread_mutex_lock (&mock->lock);
+    mock->cleanedUp++;
+    pthread_mutex_unlock (&mock->lock);
+}
+
+static size_t
+mockPeerWaitFor (pthread_mutex_t *lock, size_t *count, size_t target) {
+    size_t value = 0;
+
+    for (size_t tries = 0; tries < 1000; tries++) {  // ~10 seconds
+        pthread_mutex_lock (lock);
+        value = *count;
+        pthread_mutex_unlock (lock);
+        if (value >= target) break;
+        nanosleep (&(struct timespec) { 0, 10000000 }, NULL);
+    }
+
+    return value;
+}
+
+extern int
+btcPeerMockTests (size_t peersCount) {
+    const BRBitcoinChainParams *params = btcChainParams (true);
+    BRMockPeerContext mock = { params->magicNumber, -1, 0, peersCount };
+    struct sockaddr_in addr = { 0 };
+    socklen_t addrLen = sizeof (addr);
+    BRBitcoinPeer *peers[peersCount];
+    void *infos[peersCount][2];
+    pthread_t thread;
+    int r = 1;
+
+    pthread_mutex_init (&mock.lock, NULL);
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    addr.sin_port = 0; // any
+
+    mock.listenSocket = socket (AF_INET, SOCK_STREAM, 0);
+    if (mock.listenSocket < 0 ||
+        bind (mock.listenSocket, (struct sockaddr *) &addr, sizeof (addr)) < 0 ||
+        listen (mock.listenSocket, (int) peersCount) < 0 ||
+        getsockname (mock.listenSocket, (struct sockaddr *) &addr, &addrLen) < 0) {
+        fprintf(stderr, "***FAILED*** %s: mock peer listen: %s\n", __func__, strerror (errno));
+        return 0;
+    }
+    mock.port = ntohs (addr.sin_port);
+
+    pthread_create (&thread, NULL, mockPeerThread, &mock);
+
+    for (size_t i = 0; i < peersCount; i++) {
+        peers[i] = btcPeerNew (mock.magicNumber);
+        peers[i]->address = ((UInt128) { .u8 = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 127, 0, 0, 1 } });
+        peers[i]->port = mock.port;
+
+        infos[i][0] = &mock;
+        infos[i][1] = peers[i];
+        btcPeerSetCallbacks (peers[i], infos[i], mockPeerConnected, mockPeerDisconnected,
+                             NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, mockPeerThreadCleanup);
+        btcPeerConnect (peers[i]);
+    }
+
+    if (peersCount != mockPeerWaitFor (&mock.lock, &mock.connected, peersCount))
+        r = 0, fprintf(stderr, "***FAILED*** %s: connected: %zu of %zu\n", __func__, mock.connected, peersCount);
+
+    if (peersCount != mockPeerWaitFor (&mock.lock, &mock.ponged, peersCount))
+        r = 0, fprintf(stderr, "***FAILED*** %s: ponged: %zu of %zu\n", __func__, mock.ponged, peersCount);
+
+    for (size_t i = 0; i < peersCount; i++)
+        btcPeerDisconnect (peers[i]);
+
+    if (peersCount != mockPeerWaitFor (&mock.lock, &mock.cleanedUp, peersCount) || peersCount != mock.disconnected)
+        r = 0, fprintf(stderr, "***FAILED*** %s: disconnected: %zu of %zu\n", __func__, mock.disconnected, peersCount);
+
+    pthread_join (thread, NULL);
+    close (mock.listenSocket);
+
+    for (size_t i = 0; i < peersCount; i++)
+        btcPeerFree (peers[i]);
+
+    pthread_mutex_destroy (&mock.lock);
+    return r;
+}
+
+//
+// Mock Chain - mock peers, each listening on its own port, serving a chain of block headers and merkleblocks to a
+// BRBitcoinPeerManager, which downloads the merkleblocks in ranges from every connected peer.  Each getdata is answered
+// highest block first, so that the merkleblocks, and the wallet tx in them, arrive out of order.
+//
+#define MOCK_CHAIN_PEERS_COUNT       (PEER_MAX_CONNECTIONS + 1) // a spare, to replace a disconnected peer
+#define MOCK_CHAIN_CONNECTIONS_COUNT (32)
+#define MOCK_CHAIN_BUFFER_LENGTH     (24 + 100000)
+#define MOCK_CHAIN_HEIGHT            (1600)
+#define MOCK_CHAIN_RECEIVE_HEIGHT    (100) // the block with a tx paying to the wallet
+#define MOCK_CHAIN_NEXT_HEIGHT       (400) // the block with a tx paying to a wallet address generated after that
+#define MOCK_CHAIN_DROP_HEIGHT       (250)
+
+typedef struct {
+    uint32_t magicNumber;
+    int listenSockets[MOCK_CHAIN_PEERS_COUNT];
+    uint16_t ports[MOCK_CHAIN_PEERS_COUNT];
+    BRBitcoinMerkleBlock *blocks[MOCK_CHAIN_HEIGHT + 1]; // blocks[0] is the checkpoint
+    BRBitcoinTransaction *txs[MOCK_CHAIN_HEIGHT + 1];    // the tx matched in each merkleblock, if any
+    uint32_t dropHeight; // the first connection asked for this merkleblock disconnects instead of sending it
+    uint32_t requested[MOCK_CHAIN_HEIGHT + 1]; // the connections that requested each merkleblock, one bit each
+    pthread_mutex_t lock;
+    int dropped, done, syncError;
+    size_t syncStopped, savedCount, savedHeaders;
+} BRMockChainContext;
+
+static uint32_t
+mockChainHeight (BRMockChainContext *chain, UInt256 blockHash) {
+    for (uint32_t height = 0; height <= MOCK_CHAIN_HEIGHT; height++)
+        if (UInt256Eq (chain->blocks[height]->blockHash, blockHash)) return height;
+
+    return BLOCK_UNKNOWN_HEIGHT;
+}
+
+static void
+mockChainWrite (BRMockChainContext *chain, int socket, const char *type, const uint8_t *msg, size_t msgLen) {
+    uint8_t *buf = malloc (24 + msgLen);
+    size_t len = mockPeerFrame (chain->magicNumber, buf, type, msg, msgLen);
+
+    for (size_t sent = 0; sent < len; ) {
+        ssize_t n = write (socket, &buf[sent], len - sent);
+        if (n <= 0) break;
+        sent += (size_t) n;
+    }
+
+    free (buf);
+}
+
+// returns false if the connection should be closed
+static int
+mockChainAcceptMessage (BRMockChainContext *chain, size_t connection, int socket, const char *type,
+                        const uint8_t *msg, size_t msgLen) {
+    uint8_t buf[1024];
+    size_t off = 0, len = 0, count;
+    uint32_t height;
+
+    if (0 == strncmp (type, MSG_VERSION, 12)) {
+        uint8_t version[86] = { 0 };
+
+        UInt32SetLE (&version[0], 70015);
+        UInt64SetLE (&version[4], SERVICES_NODE_NETWORK | SERVICES_NODE_BLOOM | SERVICES_NODE_WITNESS);
+        UInt32SetLE (&version[81], MOCK_CHAIN_HEIGHT); // the start height, following an empty user agent
+        mockChainWrite (chain, socket, MSG_VERSION, version, sizeof (version));
+        mockChainWrite (chain, socket, MSG_VERACK, NULL, 0);
+    }
+    else if (0 == strncmp (type, MSG_PING, 12)) {
+        mockChainWrite (chain, socket, MSG_PONG, msg, msgLen);
+    }
+    else if (0 == strncmp (type, MSG_GETHEADERS, 12) && msgLen >= sizeof(uint32_t)) {
+        off = sizeof(uint32_t);
+        count = (size_t) BRVarInt (&msg[off], msgLen - off, &len);
+        height = BLOCK_UNKNOWN_HEIGHT;
+
+        // the headers after the first locator on the chain
+        for (off += len; count > 0 && off + sizeof(UInt256) <= msgLen && BLOCK_UNKNOWN_HEIGHT == height; count--) {
+            height = mockChainHeight (chain, UInt256Get (&msg[off]));
+            off += sizeof(UInt256);
+        }
+
+        if (BLOCK_UNKNOWN_HEIGHT == height) height = 0;
+        count = MOCK_CHAIN_HEIGHT - height;
+
+        uint8_t *headers = calloc (BRVarIntSize (count) + 81*count, 1);
+
+        off = BRVarIntSet (headers, BRVarIntSize (count), count);
+        for (height++; height <= MOCK_CHAIN_HEIGHT; height++, off += 81) { // each 80 byte header is followed by a 0 tx count
+            btcMerkleBlockSerialize (chain->blocks[height], buf, sizeof (buf));
+            memcpy (&headers[off], buf, 80);
+        }
+
+        mockChainWrite (chain, socket, MSG_HEADERS, headers, off);
+        free (headers);
+    }
+    else if (0 == strncmp (type, MSG_MEMPOOL, 12)) {
+        // an inv of a tx the wallet already has, so the peer needn't wait for a mempool response that never comes
+        off = BRVarIntSet (buf, sizeof (buf), 1);
+        UInt32SetLE (&buf[off], 1); // a tx
+        UInt256Set (&buf[off + sizeof(uint32_t)], chain->txs[MOCK_CHAIN_RECEIVE_HEIGHT]->txHash);
+        mockChainWrite (chain, socket, MSG_INV, buf, off + 36);
+    }
+    else if (0 == strncmp (type, MSG_GETDATA, 12)) {
+        count = (size_t) BRVarInt (msg, msgLen, &len);
+        if (len + 36*count > msgLen) count = 0;
+
+        uint32_t heights[count + 1];
+
+        pthread_mutex_lock (&chain->lock);
+        for (size_t i = 0; i < count; i++) {
+            heights[i] = (3 == UInt32GetLE (&msg[len + 36*i]) // a filtered block
+                          ? mockChainHeight (chain, UInt256Get (&msg[len + 36*i + sizeof(uint32_t)]))
+                          : BLOCK_UNKNOWN_HEIGHT);
+            if (BLOCK_UNKNOWN_HEIGHT != heights[i]) chain->requested[heights[i]] |= 1u << connection;
+        }
+        pthread_mutex_unlock (&chain->lock);
+
+        for (size_t i = count; i > 0; i--) {
+            height = heights[i - 1];
+            if (BLOCK_UNKNOWN_HEIGHT == height) continue;
+
+            pthread_mutex_lock (&chain->lock);
+            int drop = (height == chain->dropHeight && ! chain->dropped);
+            if (drop) chain->dropped = 1;
+            pthread_mutex_unlock (&chain->lock);
+            if (drop) return 0;
+
+            len = btcMerkleBlockSerialize (chain->blocks[height], buf, sizeof (buf));
+            mockChainWrite (chain, socket, MSG_MERKLEBLOCK, buf, len);
+
+            if (NULL != chain->txs[height]) {
+                len = btcTransactionSerialize (chain->txs[height], buf, sizeof (buf));
+                mockChainWrite (chain, socket, MSG_TX, buf, len);
+            }
+        }
+    }
+
+    return 1;
+}
+
+static void *
+mockChainThread (void *context) {
+    BRMockChainContext *chain = context;
+    int sockets[MOCK_CHAIN_CONNECTIONS_COUNT], done = 0;
+    uint8_t *buffers[MOCK_CHAIN_CONNECTIONS_COUNT];
+    size_t buffersCount[MOCK_CHAIN_CONNECTIONS_COUNT], accepted = 0;
+
+    while (! done) {
+        struct pollfd fds[MOCK_CHAIN_PEERS_COUNT + MOCK_CHAIN_CONNECTIONS_COUNT];
+        size_t polled = accepted;
+
+        for (size_t i = 0; i < MOCK_CHAIN_PEERS_COUNT; i++)
+            fds[i] = (struct pollfd) {
+                (accepted < MOCK_CHAIN_CONNECTIONS_COUNT ? chain->listenSockets[i] : -1), POLLIN, 0 };
+        for (size_t i = 0; i < polled; i++)
+            fds[MOCK_CHAIN_PEERS_COUNT + i] = (struct pollfd) { sockets[i], POLLIN, 0 };
+
+        if (poll (fds, MOCK_CHAIN_PEERS_COUNT + polled, 100) < 0) break;
+
+        for (size_t i = 0; i < MOCK_CHAIN_PEERS_COUNT; i++) {
+            if (0 == fds[i].revents || accepted == MOCK_CHAIN_CONNECTIONS_COUNT) continue;
+            sockets[accepted] = accept (chain->listenSockets[i], NULL, NULL);
+            buffers[accepted] = malloc (MOCK_CHAIN_BUFFER_LENGTH);
+            buffersCount[accepted] = 0;
+            accepted++;
+        }
+
+        for (size_t i = 0; i < polled; i++) {
+            if (0 == fds[MOCK_CHAIN_PEERS_COUNT + i].revents || sockets[i] < 0) continue;
+
+            ssize_t n = read (sockets[i], &buffers[i][buffersCount[i]], MOCK_CHAIN_BUFFER_LENGTH - buffersCount[i]);
+            int open = (n > 0);
+
+            if (open) buffersCount[i] += (size_t) n;
+
+            while (open && buffersCount[i] >= 24 && buffersCount[i] >= 24 + UInt32GetLE (&buffers[i][16])) {
+                size_t msgLen = UInt32GetLE (&buffers[i][16]);
+
+                open = mockChainAcceptMessage (chain, i, sockets[i], (const char *) &buffers[i][4], &buffers[i][24],
+                                               msgLen);
+                memmove (buffers[i], &buffers[i][24 + msgLen], buffersCount[i] - 24 - msgLen);
+                buffersCount[i] -= 24 + msgLen;
+            }
+
+            if (! open) {
+                close (sockets[i]);
+                sockets[i] = -1;
+            }
+        }
+
+        pthread_mutex_lock (&chain->lock);
+        done = chain->done;
+        pthread_mutex_unlock (&chain->lock);
+    }
+
+    for (size_t i = 0; i < accepted; i++) {
+        if (sockets[i] >= 0) close (sockets[i]);
+        free (buffers[i]);
+    }
+
+    return NULL;
+}
+
+// returns a tx spending prevHash:prevIndex, an output to key's address, to the given address, signed with key
+static BRBitcoinTransaction *
+mockChainTransaction (BRKey *key, BRAddressParams addrParams, UInt256 prevHash, uint32_t prevIndex,
+                      const char *address, uint64_t amount) {
+    BRBitcoinTransaction *tx = btcTransactionNew ();
+    BRAddress keyAddr;
+
+    BRKeyAddress (key, keyAddr.s, sizeof (keyAddr), addrParams);
+
+    uint8_t keyScript[BRAddressScriptPubKey (NULL, 0, addrParams, keyAddr.s)];
+    size_t keyScriptLen = BRAddressScriptPubKey (keyScript, sizeof (keyScript), addrParams, keyAddr.s);
+    uint8_t script[BRAddressScriptPubKey (NULL, 0, addrParams, address)];
+    size_t scriptLen = BRAddressScriptPubKey (script, sizeof (script), addrParams, address);
+
+    btcTransactionAddInput (tx, prevHash, prevIndex, amount, keyScript, keyScriptLen, NULL, 0, NULL, 0, TXIN_SEQUENCE);
+    btcTransactionAddOutput (tx, amount, script, scriptLen);
+    btcTransactionSign (tx, 0x00, key, 1);
+    return tx;
+}
+
+static int
+mockChainVerifyDifficulty (const BRBitcoinMerkleBlock *block, const BRSet *blockSet) {
+    return 1; // every block has the minimum difficulty
+}
+
+static void
+mockChainSyncStopped (void *info, int error) {
+    BRMockChainContext *chain = info;
+
+    pthread_mutex_lock (&chain->lock);
+    chain->syncStopped++;
+    chain->syncError = error;
+    pthread_mutex_unlock (&chain->lock);
+}
+
+static void
+mockChainSaveBlocks (void *info, int replace, BRBitcoinMerkleBlock *blocks[], size_t blocksCount) {
+    BRMockChainContext *chain = info;
+
+    pthread_mutex_lock (&chain->lock);
+    for (size_t i = 0; i < blocksCount; i++) {
+        chain->savedCount++;
+        if (blocks[i]->height > 0 && 0 == blocks[i]->totalTx) chain->savedHeaders++; // never replaced by its merkleblock
+    }
+    pthread_mutex_unlock (&chain->lock);
+}
+
+// syncs a peer manager with mock peers, each sent a range of the merkleblocks to download; if dropHeight isn't zero, the
+// first peer asked for that merkleblock disconnects instead of sending it, and the rest of its range must be requested
+// from another peer
+static int
+btcPeerManagerMockChainTests (uint32_t dropHeight) {
+    const BRBitcoinChainParams *mainNetParams = btcChainParams (true);
+    static const char * const dnsSeeds[] = { "", NULL }; // never used, there are always enough peers to connect to
+    BRBitcoinChainParams params = *mainNetParams;
+    BRMockChainContext *chain = calloc (1, sizeof (BRMockChainContext));
+    BRBitcoinCheckPoint checkpoint;
+    BRBitcoinPeer peers[MOCK_CHAIN_PEERS_COUNT];
+    struct sockaddr_in addr = { 0 };
+    socklen_t addrLen = sizeof (addr);
+    uint32_t now = (uint32_t) time (NULL), timestamp = now - 10*60*(MOCK_CHAIN_HEIGHT + 1);
+    UInt256 secret = uint256("0000000000000000000000000000000000000000000000000000000000000001");
+    UInt512 seed;
+    BRKey k;
+    BRAddress addrs[SEQUENCE_GAP_LIMIT_EXTERNAL_EXTENDED + SEQUENCE_GAP_LIMIT_EXTERNAL];
+    pthread_t thread;
+    int r = 1;
+
+    BRBIP39DeriveKey (&seed, "a random seed", NULL);
+    BRKeySetSecret (&k, &secret, 1);
+
+    BRMasterPubKey mpk = BRBIP32MasterPubKey (&seed, sizeof (seed));
+    BRBitcoinWallet *wallet = btcWalletNew (params.addrParams, NULL, 0, mpk);
+
+    // a tx paying to the last wallet address in the peer manager's bloom filter, and a later one paying to an address
+    // past that, which only matches the wallet once the wallet has generated more addresses, after the first tx is
+    // registered; the later tx is sent first, so it must be kept until then
+    BRBitcoinWallet *unused = btcWalletNew (params.addrParams, NULL, 0, mpk);
+
+    btcWalletUnusedAddrs (unused, addrs, sizeof (addrs)/sizeof (*addrs), SEQUENCE_EXTERNAL_CHAIN);
+    btcWalletFree (unused);
+
+    BRBitcoinTransaction *receive = mockChainTransaction (&k, params.addrParams, secret, 0,
+                                                          addrs[SEQUENCE_GAP_LIMIT_EXTERNAL_EXTENDED - 1].s, SATOSHIS),
+                         *next = mockChainTransaction (&k, params.addrParams, secret, 1,
+                                                       addrs[sizeof (addrs)/sizeof (*addrs) - 1].s, SATOSHIS/2);
+
+    if (! btcTransactionIsSigned (receive) || ! btcTransactionIsSigned (next))
+        r = 0, fprintf(stderr, "***FAILED*** %s: tx not signed\n", __func__);
+
+    // the chain, each merkleblock with a single tx, matched if it's one of the wallet tx
+    chain->txs[MOCK_CHAIN_RECEIVE_HEIGHT] = receive;
+    chain->txs[MOCK_CHAIN_NEXT_HEIGHT]    = next;
+
+    for (uint32_t height = 0; height <= MOCK_CHAIN_HEIGHT; height++) {
+        BRBitcoinMerkleBlock *block = btcMerkleBlockNew ();
+        UInt256 txHash = UINT256_ZERO;
+        uint8_t match = (NULL != chain->txs[height]), buf[1024];
+
+        if (match) txHash = chain->txs[height]->txHash;
+        else UInt32SetLE (txHash.u8, height);
+
+        block->version = 1;
+        block->prevBlock = (height > 0 ? chain->blocks[height - 1]->blockHash : UINT256_ZERO);
+        block->merkleRoot = txHash;
+        block->timestamp = timestamp + 10*60*height;
+        block->target = 0x207fffff;
+        btcMerkleBlockSetTxMatches (block, &txHash, &match, 1);
+
+        chain->blocks[height] = btcMerkleBlockParse (buf, btcMerkleBlockSerialize (block, buf, sizeof (buf)));
+        chain->blocks[height]->height = height;
+        btcMerkleBlockFree (block);
+    }
+
+    checkpoint = (BRBitcoinCheckPoint) { 0, UInt256Reverse (chain->blocks[0]->blockHash), timestamp, 0x207fffff };
+    params.dnsSeeds = dnsSeeds;
+    params.verifyDifficulty = mockChainVerifyDifficulty;
+    params.checkpoints = &checkpoint;
+    params.checkpointsCount = 1;
+
+    chain->magicNumber = params.magicNumber;
+    chain->dropHeight = dropHeight;
+    pthread_mutex_init (&chain->lock, NULL);
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+    for (size_t i = 0; i < MOCK_CHAIN_PEERS_COUNT; i++) {
+        addr.sin_port = 0; // any
+        addrLen = sizeof (addr);
+        chain->listenSockets[i] = socket (AF_INET, SOCK_STREAM, 0);
+
+        if (chain->listenSockets[i] < 0 ||
+            bind (chain->listenSockets[i], (struct sockaddr *) &addr, sizeof (addr)) < 0 ||
+            listen (chain->listenSockets[i], 4) < 0 ||
+            getsockname (chain->listenSockets[i], (struct sockaddr *) &addr, &addrLen) < 0) {
+            fprintf(stderr, "***FAILED*** %s: mock peer listen: %s\n", __func__, strerror (errno));
+            return 0;
+        }
+
+        chain->ports[i] = ntohs (addr.sin_port);
+        peers[i] = ((const BRBitcoinPeer) {
+            ((UInt128) { .u8 = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 127, 0, 0, 1 } }), chain->ports[i],
+            SERVICES_NODE_NETWORK | SERVICES_NODE_BLOOM | SERVICES_NODE_WITNESS, now, 0 });
+    }
+
+    pthread_create (&thread, NULL, mockChainThread, chain);
+
+    BRBitcoinPeerManager *manager = btcPeerManagerNew (&params, wallet, timestamp, NULL, 0,
+                                                       peers, MOCK_CHAIN_PEERS_COUNT);
+
+    btcPeerManagerSetCallbacks (manager, chain, NULL, mockChainSyncStopped, NULL, mockChainSaveBlocks, NULL, NULL, NULL);
+    btcPeerManagerConnect (manager);
+
+    if (1 != mockPeerWaitFor (&chain->lock, &chain->syncStopped, 1) || 0 != chain->syncError)
+        r = 0, fprintf(stderr, "***FAILED*** %s: sync: %d\n", __func__, chain->syncError);
+
+    if (MOCK_CHAIN_HEIGHT != btcPeerManagerLastBlockHeight (manager))
+        r = 0, fprintf(stderr, "***FAILED*** %s: height: %"PRIu32"\n", __func__, btcPeerManagerLastBlockHeight (manager));
+
+    btcPeerManagerDisconnect (manager);
+
+    pthread_mutex_lock (&chain->lock);
+    chain->done = 1;
+    pthread_mutex_unlock (&chain->lock);
+    pthread_join (thread, NULL);
+
+    // every merkleblock was requested, and the ranges were spread over the peers
+    uint32_t connections = 0;
+
+    for (uint32_t height = 1; height <= MOCK_CHAIN_HEIGHT; height++) {
+        if (0 == chain->requested[height])
+            r = 0, fprintf(stderr, "***FAILED*** %s: merkleblock %"PRIu32" not requested\n", __func__, height);
+        connections |= chain->requested[height];
+    }
+
+    if (0 == (connections & (connections - 1)))
+        r = 0, fprintf(stderr, "***FAILED*** %s: merkleblocks requested from a single peer\n", __func__);
+
+    // the merkleblock the dropped peer didn't send was requested again, from another peer
+    if (dropHeight > 0 && (! chain->dropped ||
+                           0 == (chain->requested[dropHeight] & (chain->requested[dropHeight] - 1))))
+        r = 0, fprintf(stderr, "***FAILED*** %s: dropped range not reassigned\n", __func__);
+
+    // the merkleblocks, received out of order, replaced their headers in the chain that was saved
+    if (0 == chain->savedCount || 0 != chain->savedHeaders)
+        r = 0, fprintf(stderr, "***FAILED*** %s: saved %zu headers of %zu blocks\n", __func__,
+                       chain->savedHeaders, chain->savedCount);
+
+    // the later tx, received first, was registered once the earlier one was
+    BRBitcoinTransaction *tx = btcWalletTransactionForHash (wallet, next->txHash);
+
+    if (NULL == tx || MOCK_CHAIN_NEXT_HEIGHT != tx->blockHeight)
+        r = 0, fprintf(stderr, "***FAILED*** %s: next tx not registered\n", __func__);
+
+    tx = btcWalletTransactionForHash (wallet, receive->txHash);
+
+    if (NULL == tx || MOCK_CHAIN_RECEIVE_HEIGHT != tx->blockHeight)
+        r = 0, fprintf(stderr, "***FAILED*** %s: receive tx not registered\n", __func__);
+
+    if (SATOSHIS + SATOSHIS/2 != btcWalletBalance (wallet))
+        r = 0, fprintf(stderr, "***FAILED*** %s: balance: %"PRIu64"\n", __func__, btcWalletBalance (wallet));
+
+    btcPeerManagerFree (manager);
+    btcWalletFree (wallet);
+
+    for (size_t i = 0; i < MOCK_CHAIN_PEERS_COUNT; i++)
+        close (chain->listenSockets[i]);
+
+    for (uint32_t height = 0; height <= MOCK_CHAIN_HEIGHT; height++)
+        btcMerkleBlockFree (chain->blocks[height]);
+
+    btcTransactionFree (receive);
+    btcTransactionFree (next);
+    pthread_mutex_destroy (&chain->lock);
+    free (chain);
+    return r;
+}
+
+extern int
+btcPeerManagerMockTests (void) {
+    int r = 1;
+
+    if (! btcPeerManagerMockChainTests (0)) r = 0;
+    if (! btcPeerManagerMockChainTests (MOCK_CHAIN_DROP_HEIGHT)) r = 0;
+
+    return r;
+}
+
+static double btcTransactionPerfTime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// signs an `inputsCount` input tx, as a wallet consolidating its UTXOs would, for legacy, segwit and forkId signatures
+extern int BRRunTransactionSignPerfTests(size_t inputsCount)
+{
+    const struct { const char *name; int forkId; int isWitness; } kinds[] = {
+        { "P2PKH",        0x00, 0 },
+        { "P2WPKH",       0x00, 1 },
+        { "P2PKH/FORKID", 0x40, 0 }
+    };
+    const BRBitcoinChainParams *btcMainNetParams = btcChainParams(true);
+    UInt256 secret = uint256("0000000000000000000000000000000000000000000000000000000000000001");
+    BRKey k;
+    BRAddress addr;
+    int r = 1;
+
+    printf("==== BTC:TransactionSignPerf\n");
+    BRKeySetSecret(&k, &secret, 1);
+
+    for (size_t kind = 0; kind < sizeof(kinds)/sizeof(*kinds); kind++) {
+        if (kinds[kind].isWitness) BRKeyAddress(&k, addr.s, sizeof(addr), btcMainNetParams->addrParams);
+        else BRKeyLegacyAddr(&k, addr.s, sizeof(addr), btcMainNetParams->addrParams);
+
+        uint8_t script[BRAddressScriptPubKey(NULL, 0, btcMainNetParams->addrParams, addr.s)];
+        size_t scriptLen = BRAddressScriptPubKey(script, sizeof(script), btcMainNetParams->addrParams, addr.s);
+        BRBitcoinTransaction *tx = btcTransactionNew();
+
+        for (size_t i = 0; i < inputsCount; i++) {
+            UInt256 inHash = UINT256_ZERO;
+
+            UInt32SetLE(inHash.u8, (uint32_t) i + 1);
+            btcTransactionAddInput(tx, inHash, 0, SATOSHIS, script, scriptLen, NULL, 0, NULL, 0, TXIN_SEQUENCE);
+        }
+
+        btcTransactionAddOutput(tx, inputsCount*SATOSHIS - 10000, script, scriptLen);
+
+        double start = btcTransactionPerfTime();
+        if (! btcTransactionSign(tx, kinds[kind].forkId, &k, 1))
+            r = 0, fprintf(stderr, "***FAILED*** %s: btcTransactionSign() %s\n", __func__, kinds[kind].name);
+        double timeSign = btcTransactionPerfTime() - start;
+
+        printf("==== BTC:TransactionSignPerf: %zu Inputs: %s: %.3f s (%.3f ms/input)\n",
+               inputsCount, kinds[kind].name, timeSign, 1e3 * timeSign / inputsCount);
+        btcTransactionFree(tx);
+    }
+
+    return r;
+}
+
+// matches random 20 byte hashes, mostly not in the filter as with the outputs of relayed txs, against a BIP37 bloom
+// filter and a blocked bloom filter, each holding `elemCount` elements
+extern int BRRunBloomFilterPerfTests(size_t elemCount)
+{
+    const size_t matchCount = 1000000;
+    UInt160 *elems = malloc(elemCount*sizeof(*elems)), *hashes = malloc(matchCount*sizeof(*hashes));
+    BRBitcoinBloomFilter *f = btcBloomFilterNew(BLOOM_DEFAULT_FALSEPOSITIVE_RATE, elemCount, 0, BLOOM_UPDATE_ALL);
+    BRBitcoinBlockedBloomFilter *bf = btcBlockedBloomFilterNew(BLOOM_DEFAULT_FALSEPOSITIVE_RATE, elemCount, 0);
+    size_t matches = 0, blockedMatches = 0;
+    int r = 1;
+
+    assert(elems != NULL && hashes != NULL);
+    printf("==== BTC:BloomFilterPerf\n");
+
+    for (size_t i = 0; i < elemCount; i++) {
+        elems[i] = UINT160_ZERO;
+        UInt32SetLE(elems[i].u8, (uint32_t)i);
+        BRHash160(&elems[i], elems[i].u8, sizeof(elems[i]));
+        btcBloomFilterInsertData(f, elems[i].u8, sizeof(elems[i]));
+        btcBlockedBloomFilterInsertData(bf, elems[i].u8, sizeof(elems[i]));
+    }
+
+    for (size_t i = 0; i < matchCount; i++) {
+        hashes[i] = (i % 100 == 0) ? elems[(i/100) % elemCount] : UINT160_ZERO; // 1% are in the filters
+        if (i % 100 != 0) UInt32SetLE(hashes[i].u8, (uint32_t)(elemCount + i));
+        if (i % 100 != 0) BRHash160(&hashes[i], hashes[i].u8, sizeof(hashes[i]));
+    }
+
+    double start = btcTransactionPerfTime();
+    for (size_t i = 0; i < matchCount; i++) matches += btcBloomFilterContainsData(f, hashes[i].u8, sizeof(hashes[i]));
+    double timeBloom = btcTransactionPerfTime() - start;
+
+    start = btcTransactionPerfTime();
+    for (size_t i = 0; i < matchCount; i++) {
+        blockedMatches += btcBlockedBloomFilterContainsData(bf, hashes[i].u8, sizeof(hashes[i]));
+    }
+    double timeBlocked = btcTransactionPerfTime() - start;
+
+    printf("==== BTC:BloomFilterPerf: %zu Elements: BIP37:   %.1f M matches/s, %zu matched\n",
+           elemCount, matchCount/timeBloom/1e6, matches);
+    printf("==== BTC:BloomFilterPerf: %zu Elements: Blocked: %.1f M matches/s, %zu matched\n",
+           elemCount, matchCount/timeBlocked/1e6, blockedMatches);
+
+    for (size_t i = 0; i < elemCount; i++) {
+        if (! btcBlockedBloomFilterContainsData(bf, elems[i].u8, sizeof(elems[i]))) r = 0;
+    }
+
+    btcBlockedBloomFilterFree(bf);
+    btcBloomFilterFree(f);
+    free(hashes);
+    free(elems);
+    return r;
+}
+
+extern int BRRunSHA256PerfTests(size_t hashCount)
+{
+    static const char *names[] = { "Portable", "AVX2", "SHA-NI" };
+    BRSHA256Backend selected = BRSHA256GetBackend();
+    UInt256 *hashes = calloc(hashCount*2, sizeof(*hashes)), *mds = calloc(hashCount, sizeof(*mds)), *refs = NULL;
+    uint8_t *data = calloc(1024*1024, 1), md[32];
+    int r = 1;
+
+    assert(hashes != NULL && mds != NULL && data != NULL);
+    printf("==== BTC:SHA256Perf\n");
+    for (size_t i = 0; i < hashCount*2; i++) UInt32SetLE(hashes[i].u8, (uint32_t)i);
+
+    for (BRSHA256Backend b = BR_SHA256_BACKEND_PORTABLE; b <= BR_SHA256_BACKEND_SHA_NI; b++) {
+        if (! BRSHA256SetBackend(b)) {
+            printf("==== BTC:SHA256Perf: %-8s: not supported\n", names[b]);
+            continue;
+        }
+
+        double start = btcTransactionPerfTime();
+        for (size_t i = 0; i < 64; i++) BRSHA256(md, data, 1024*1024);
+        double timeBulk = btcTransactionPerfTime() - start;
+
+        start = btcTransactionPerfTime();
+        for (size_t i = 0; i < hashCount; i++) BRSHA256_2(&mds[i], &hashes[i*2], sizeof(UInt256)*2);
+        double timeNodes = btcTransactionPerfTime() - start;
+
+        start = btcTransactionPerfTime();
+        BRSHA256_2Batch(mds, hashes, sizeof(UInt256)*2, hashCount);
+        double timeBatch = btcTransactionPerfTime() - start;
+
+        printf("==== BTC:SHA256Perf: %-8s: %.0f MB/s, merkle nodes: %.2f M/s, batched: %.2f M/s\n", names[b],
+               64/timeBulk, hashCount/timeNodes/1e6, hashCount/timeBatch/1e6);
+
+        if (! refs) refs = mds, mds = calloc(hashCount, sizeof(*mds)), assert(mds != NULL);
+        else if (memcmp(refs, mds, hashCount*sizeof(*mds)) != 0) r = 0;
+    }
+
+    BRSHA256SetBackend(selected);
+    free(refs);
+    free(mds);
+    free(data);
+    free(hashes);
+    return r;
+}
+
+// the generic BRPBKDF2() path, which BRPBKDF2() skips for BRSHA512 itself
+static void btcBIP39PerfSHA512(void *md64, const void *data, size_t dataLen)
+{
+    BRSHA512(md64, data, dataLen);
+}
+
+extern int BRRunBIP39DerivePerfTests(size_t phraseCount)
+{
+    char (*phrases)[256] = calloc(phraseCount, sizeof(*phrases));
+    const char **phrasePtrs = calloc(phraseCount, sizeof(*phrasePtrs));
+    UInt512 *keys = calloc(phraseCount, sizeof(*keys)), key;
+    UInt128 entropy = UINT128_ZERO;
+    int r = 1;
+
+    assert(phrases != NULL && phrasePtrs != NULL && keys != NULL);
+    printf("==== BTC:BIP39DerivePerf\n");
+
+    for (size_t i = 0; i < phraseCount; i++) {
+        UInt32SetLE(entropy.u8, (uint32_t)i);
+        BRBIP39Encode(phrases[i], sizeof(phrases[i]), BRBIP39WordsEn, entropy.u8, sizeof(entropy));
+        phrasePtrs[i] = phrases[i];
+    }
+
+    double start = btcTransactionPerfTime();
+    for (size_t i = 0; i < phraseCount; i++) {
+        BRPBKDF2(keys[i].u8, 64, btcBIP39PerfSHA512, 512/8, phrases[i], strlen(phrases[i]), "mnemonic", 8, 2048);
+    }
+    double timeGeneric = btcTransactionPerfTime() - start;
+
+    start = btcTransactionPerfTime();
+    for (size_t i = 0; i < phraseCount; i++) {
+        BRBIP39DeriveKey(key.u8, phrases[i], NULL);
+        if (! UInt512Eq(key, keys[i])) r = 0;
+    }
+    double timeSerial = btcTransactionPerfTime() - start;
+
+    memset(keys, 0, phraseCount*sizeof(*keys));
+    start = btcTransactionPerfTime();
+    BRBIP39DeriveKeys(keys, phrasePtrs, NULL, phraseCount);
+    double timeBatch = btcTransactionPerfTime() - start;
+
+    for (size_t i = 0; i < phraseCount; i++) {
+        BRBIP39DeriveKey(key.u8, phrases[i], NULL);
+        if (! UInt512Eq(key, keys[i])) r = 0;
+    }
+
+    printf("==== BTC:BIP39DerivePerf: %zu Phrases: BRHMAC:  %.1f keys/s\n", phraseCount, phraseCount/timeGeneric);
+    printf("==== BTC:BIP39DerivePerf: %zu Phrases: Context: %.1f keys/s\n", phraseCount, phraseCount/timeSerial);
+    printf("==== BTC:BIP39DerivePerf: %zu Phrases: Batch:   %.1f keys/s\n", phraseCount, phraseCount/timeBatch);
+
+    free(keys);
+    free(phrasePtrs);
+    free(phrases);
+    return r;
+}
+
+extern int BRRunAESPerfTests(size_t dataLen)
+{
+    static const char *names[] = { "Bitsliced", "AES-NI" };
+    const size_t blockCount = 100000;
+    BRAESBackend selected = BRAESGetBackend();
+    uint8_t *data = calloc(dataLen, 1), *out = malloc(dataLen), *ref = NULL, key[32], iv[16], block[16];
+    BRAESContext ctx;
+    int r = 1;
+
+    assert(data != NULL && out != NULL);
+    printf("==== BTC:AESPerf\n");
+    for (size_t i = 0; i < sizeof(key); i++) key[i] = (uint8_t)i;
+    memset(iv, 0, sizeof(iv));
+    memset(block, 0, sizeof(block));
+
+    for (BRAESBackend b = BR_AES_BACKEND_BITSLICED; b <= BR_AES_BACKEND_AES_NI; b++) {
+        if (! BRAESSetBackend(b)) {
+            printf("==== BTC:AESPerf: %-9s: not supported\n", names[b]);
+            continue;
+        }
+
+        double start = btcTransactionPerfTime();
+        BRAESCTR(out, key, sizeof(key), iv, data, dataLen);
+        double timeCTR = btcTransactionPerfTime() - start;
+
+        BRAESContextInit(&ctx, key, sizeof(key));
+        start = btcTransactionPerfTime();
+        for (size_t i = 0; i < blockCount; i++) BRAESContextEncrypt(&ctx, block);
+        double timeBlock = btcTransactionPerfTime() - start;
+
+        printf("==== BTC:AESPerf: %-9s: aes-256 ctr: %.1f MB/s, single blocks: %.1f MB/s\n", names[b],
+               dataLen/timeCTR/1e6, blockCount*16/timeBlock/1e6);
+
+        if (! ref) ref = out, out = malloc(dataLen), assert(out != NULL);
+        else if (memcmp(ref, out, dataLen) != 0) r = 0;
+    }
+
+    BRAESSetBackend(selected);
+    mem_clean(&ctx, sizeof(ctx));
+    free(ref);
+    free(out);
+    free(data);
+    return r;
+}
+
+extern int BRRunKeccakPerfTests(size_t hashCount)
+{
+    static const char *names[] = { "Portable", "SSE2", "AVX2" };
+    BRKeccakBackend selected = BRKeccakGetBackend();
+    UInt256 *topics = calloc(hashCount, sizeof(*topics)), *mds = calloc(hashCount, sizeof(*mds)), *refs = NULL;
+    uint8_t *addresses = calloc(hashCount, 20), *data = calloc(1024*1024, 1), md[32];
+    int r = 1;
+
+    assert(topics != NULL && mds != NULL && addresses != NULL && data != NULL);
+    printf("==== BTC:KeccakPerf\n");
+
+    for (size_t i = 0; i < hashCount; i++) {
+        UInt32SetLE(&addresses[i*20], (uint32_t)i);
+        UInt32SetLE(topics[i].u8, (uint32_t)i);
+    }
+
+    double start = btcTransactionPerfTime();
+    for (size_t i = 0; i < 64; i++) BRKeccak256(md, data, 1024*1024);
+    printf("==== BTC:KeccakPerf: %.0f MB/s\n", 64/(btcTransactionPerfTime() - start));
+
+    start = btcTransactionPerfTime();
+    for (size_t i = 0; i < hashCount; i++) BRKeccak256(&mds[i], &addresses[i*20], 20);
+    printf("==== BTC:KeccakPerf: addresses: %.2f M/s\n", hashCount/(btcTransactionPerfTime() - start)/1e6);
+
+    for (BRKeccakBackend b = BR_KECCAK_BACKEND_PORTABLE; b <= BR_KECCAK_BACKEND_AVX2; b++) {
+        if (! BRKeccakSetBackend(b)) {
+            printf("==== BTC:KeccakPerf: %-8s: not supported\n", names[b]);
+            continue;
+        }
+
+        start = btcTransactionPerfTime();
+        BRKeccak256Batch(mds, addresses, 20, hashCount);
+        double timeAddresses = btcTransactionPerfTime() - start;
+
+        if (! refs) refs = mds, mds = calloc(hashCount, sizeof(*mds)), assert(mds != NULL);
+        else if (memcmp(refs, mds, hashCount*sizeof(*mds)) != 0) r = 0;
+
+        start = btcTransactionPerfTime();
+        BRKeccak256Batch(mds, topics, sizeof(UInt256), hashCount);
+        double timeTopics = btcTransactionPerfTime() - start;
+
+        printf("==== BTC:KeccakPerf: %-8s: batched addresses: %.2f M/s, batched topics: %.2f M/s\n", names[b],
+               hashCount/timeAddresses/1e6, hashCount/timeTopics/1e6);
+    }
+
+    BRKeccakSetBackend(selected);
+    free(refs);
+    free(mds);
+    free(data);
+    free(addresses);
+    free(topics);
+    return r;
+}
+
+extern int BRRunKeyVerifyPerfTests(size_t sigCount)
+{
+    BRKey *keys = calloc(sigCount, sizeof(*keys)), recovered;
+    UInt256 *mds = calloc(sigCount, sizeof(*mds)), secret;
+    uint8_t (*sigs)[73] = calloc(sigCount, sizeof(*sigs)), (*compactSigs)[65] = calloc(sigCount, sizeof(*compactSigs));
+    size_t *sigLens = calloc(sigCount, sizeof(*sigLens)), verified = 0, recoveredCount = 0;
+    int r = 1;
+
+    assert(keys != NULL && mds != NULL && sigs != NULL && compactSigs != NULL && sigLens != NULL);
+    printf("==== BTC:KeyVerifyPerf\n");
+
+    double start = btcTransactionPerfTime();
+    size_t tableSize = BRSecp256k1Precompute();
+    printf("==== BTC:KeyVerifyPerf: tables: %zu KiB, %.1f ms\n", tableSize/1024,
+           1000*(btcTransactionPerfTime() - start));
+
+    for (size_t i = 0; i < sigCount; i++) {
+        secret = UINT256_ZERO;
+        UInt32SetBE(&secret.u8[28], (uint32_t)(i + 1));
+        BRKeySetSecret(&keys[i], &secret, 1);
+        UInt32SetLE(mds[i].u8, (uint32_t)i);
+        sigLens[i] = BRKeySign(&keys[i], sigs[i], sizeof(sigs[i]), mds[i]);
+        BRKeyCompactSignEthereum(&keys[i], compactSigs[i], sizeof(compactSigs[i]), mds[i]);
+    }
+
+    start = btcTransactionPerfTime();
+    for (size_t i = 0; i < sigCount; i++) if (BRKeyVerify(&keys[i], mds[i], sigs[i], sigLens[i])) verified++;
+    double timeVerify = btcTransactionPerfTime() - start;
+
+    start = btcTransactionPerfTime();
+    for (size_t i = 0; i < sigCount; i++) {
+        if (BRKeyRecoverPubKeyEthereum(&recovered, mds[i], compactSigs[i], sizeof(compactSigs[i]))) recoveredCount++;
+    }
+    double timeRecover = btcTransactionPerfTime() - start;
+
+    if (verified != sigCount || recoveredCount != sigCount) r = 0;
+    printf("==== BTC:KeyVerifyPerf: verify: %.0f ops/s, recover: %.0f ops/s\n", sigCount/timeVerify,
+           sigCount/timeRecover);
+
+    for (size_t i = 0; i < sigCount; i++) BRKeyClean(&keys[i]);
+    free(sigLens);
+    free(compactSigs);
+    free(sigs);
+    free(mds);
+    free(keys);
+    return r;
+}
+
+// heap blocks currently allocated, where the platform reports it (glibc's mallinfo2() has no count of blocks in use)
+static long btcTransactionPerfHeapBlocks(void)
+{
+#ifdef __APPLE__
+    malloc_statistics_t stats;
+    malloc_zone_statistics(NULL, &stats);
+    return (long)stats.blocks_in_use;
+#else
+    return -1;
+#endif
+}
+
+// heap bytes currently allocated, including per block overhead, where the platform reports it
+static long btcTransactionPerfHeapBytes(void)
+{
+#ifdef __APPLE__
+    malloc_statistics_t stats;
+    malloc_zone_statistics(NULL, &stats);
+    return (long)stats.size_in_use;
+#elif defined(BTC_TEST_HAS_MALLINFO2)
+    struct mallinfo2 info = mallinfo2();
+    return (long)(info.uordblks + info.hblkhd);
+#else
+    return -1;
+#endif
+}
+
+// parses, copies and frees `txCount` copies of a signed 8 input segwit tx, and of a merkleblock, as a peer relaying
+// a block's worth of txs would, reporting time and heap blocks and bytes held per tx
+extern int BRRunTransactionParsePerfTests(size_t txCount)
+{
+    const BRBitcoinChainParams *btcMainNetParams = btcChainParams(true);
+    const size_t inputsCount = 8;
+    UInt256 secret = uint256("0000000000000000000000000000000000000000000000000000000000000001"), inHash;
+    UInt256 hashes[256], root[256];
+    uint8_t matches[256];
+    BRBitcoinTransaction *tx = btcTransactionNew(), **txs = calloc(txCount, sizeof(*txs));
+    BRBitcoinMerkleBlock *block = btcMerkleBlockNew(), **blocks = calloc(txCount, sizeof(*blocks));
+    BRKey k;
+    BRAddress addr;
+    long heapBlocks, heapBytes;
+    int r = 1;
+
+    assert(txs != NULL && blocks != NULL);
+    printf("==== BTC:TransactionParsePerf\n");
+    BRKeySetSecret(&k, &secret, 1);
+    BRKeyAddress(&k, addr.s, sizeof(addr), btcMainNetParams->addrParams);
+
+    uint8_t script[BRAddressScriptPubKey(NULL, 0, btcMainNetParams->addrParams, addr.s)];
+    size_t scriptLen = BRAddressScriptPubKey(script, sizeof(script), btcMainNetParams->addrParams, addr.s);
+
+    for (size_t i = 0; i < inputsCount; i++) {
+        inHash = UINT256_ZERO;
+        UInt32SetLE(inHash.u8, (uint32_t) i + 1);
+        btcTransactionAddInput(tx, inHash, 0, SATOSHIS, script, scriptLen, NULL, 0, NULL, 0, TXIN_SEQUENCE);
+    }
+
+    btcTransactionAddOutput(tx, SATOSHIS, script, scriptLen);
+    btcTransactionAddOutput(tx, (inputsCount - 1)*SATOSHIS - 10000, script, scriptLen);
+    if (! btcTransactionSign(tx, 0, &k, 1)) r = 0, fprintf(stderr, "***FAILED*** %s: btcTransactionSign()\n", __func__);
+
+    for (size_t i = 0; i < sizeof(hashes)/sizeof(*hashes); i++) {
+        hashes[i] = UINT256_ZERO;
+        UInt32SetLE(hashes[i].u8, (uint32_t) i + 1);
+        matches[i] = (i % 64 == 0); // a few wallet txs in a block
+        root[i] = hashes[i];
+    }
+
+    for (size_t n = sizeof(root)/sizeof(*root); n > 1; n /= 2) { // a full tree, so no hashes are duplicated
+        for (size_t i = 0; i < n/2; i++) BRSHA256_2(&root[i], &root[i*2], sizeof(UInt256)*2);
+    }
+
+    block->merkleRoot = root[0];
+    block->target = 0x1d00ffff;
+    btcMerkleBlockSetTxMatches(block, hashes, matches, sizeof(hashes)/sizeof(*hashes));
+
+    uint8_t txBuf[btcTransactionSerialize(tx, NULL, 0)], blockBuf[btcMerkleBlockSerialize(block, NULL, 0)];
+    size_t txLen = btcTransactionSerialize(tx, txBuf, sizeof(txBuf));
+    size_t blockLen = btcMerkleBlockSerialize(block, blockBuf, sizeof(blockBuf));
+
+    heapBlocks = btcTransactionPerfHeapBlocks();
+    heapBytes = btcTransactionPerfHeapBytes();
+    double start = btcTransactionPerfTime();
+    for (size_t i = 0; i < txCount; i++) txs[i] = btcTransactionParse(txBuf, txLen);
+    double timeParse = btcTransactionPerfTime() - start;
+    if (heapBlocks >= 0) heapBlocks = btcTransactionPerfHeapBlocks() - heapBlocks;
+    if (heapBytes >= 0) heapBytes = btcTransactionPerfHeapBytes() - heapBytes;
+
+    for (size_t i = 0; i < txCount; i++) {
+        if (! txs[i] || ! UInt256Eq(txs[i]->txHash, tx->txHash)) r = 0;
+    }
+
+    start = btcTransactionPerfTime();
+    for (size_t i = 0; i < txCount; i++) {
+        BRBitcoinTransaction *t = btcTransactionCopy(txs[i]);
+        btcTransactionFree(txs[i]);
+        txs[i] = t;
+    }
+    double timeCopy = btcTransactionPerfTime() - start;
+
+    start = btcTransactionPerfTime();
+    for (size_t i = 0; i < txCount; i++) btcTransactionFree(txs[i]);
+    double timeFree = btcTransactionPerfTime() - start;
+
+    printf("==== BTC:TransactionParsePerf: %zu Txs: %zu bytes: parse %.3f us/tx, copy %.3f us/tx, free %.3f us/tx\n",
+           txCount, txLen, 1e6 * timeParse / txCount, 1e6 * timeCopy / txCount, 1e6 * timeFree / txCount);
+    if (heapBlocks >= 0) printf("==== BTC:TransactionParsePerf: %zu Txs: %.1f heap blocks/tx\n",
+                                txCount, (double)heapBlocks / txCount);
+    if (heapBytes >= 0) printf("==== BTC:TransactionParsePerf: %zu Txs: %.1f heap bytes/tx\n",
+                               txCount, (double)heapBytes / txCount);
+
+    heapBlocks = btcTransactionPerfHeapBlocks();
+    heapBytes = btcTransactionPerfHeapBytes();
+    start = btcTransactionPerfTime();
+    for (size_t i = 0; i < txCount; i++) blocks[i] = btcMerkleBlockParse(blockBuf, blockLen);
+    timeParse = btcTransactionPerfTime() - start;
+    if (heapBlocks >= 0) heapBlocks = btcTransactionPerfHeapBlocks() - heapBlocks;
+    if (heapBytes >= 0) heapBytes = btcTransactionPerfHeapBytes() - heapBytes;
+
+    for (size_t i = 0; i < txCount; i++) {
+        if (! blocks[i] || blocks[i]->hashesCount != block->hashesCount) r = 0;
+        if (blocks[i]) btcMerkleBlockFree(blocks[i]);
+    }
+
+    printf("==== BTC:TransactionParsePerf: %zu MerkleBlocks: %zu bytes: parse %.3f us/block\n",
+           txCount, blockLen, 1e6 * timeParse / txCount);
+    if (heapBlocks >= 0) printf("==== BTC:TransactionParsePerf: %zu MerkleBlocks: %.1f heap blocks/block\n",
+                                txCount, (double)heapBlocks / txCount);
+    if (heapBytes >= 0) printf("==== BTC:TransactionParsePerf: %zu MerkleBlocks: %.1f heap bytes/block\n",
+                               txCount, (double)heapBytes / txCount);
+
+    if (! r) fprintf(stderr, "***FAILED*** %s: parsed %zu txs and merkleblocks\n", __func__, txCount);
+    btcMerkleBlockFree(block);
+    btcTransactionFree(tx);
+    free(blocks);
+    free(txs);
+    return r;
+}
+
+// creates, with each coin selection, a tx paying from a wallet holding `utxosCount` UTXOs of varied amounts
+extern int BRRunWalletCoinSelectionPerfTests(size_t utxosCount)
+{
+    const BRBitcoinChainParams *btcMainNetParams = btcChainParams(true);
+    const uint64_t amounts[] = { SATOSHIS/100, SATOSHIS/10, SATOSHIS };
+    const size_t outputsPerTx = 100;
+    UInt256 secret = uint256("0000000000000000000000000000000000000000000000000000000000000001");
+    UInt512 seed;
+    BRKey k;
+    BRAddress addr;
+    uint32_t lcg = 1;
+    int r = 1;
+
+    printf("==== BTC:WalletCoinSelectionPerf\n");
+    BRBIP39DeriveKey(&seed, "a random seed", NULL);
+    BRKeySetSecret(&k, &secret, 1);
+    BRKeyLegacyAddr(&k, addr.s, sizeof(addr), btcMainNetParams->addrParams);
+
+    BRMasterPubKey mpk = BRBIP32MasterPubKey(&seed, sizeof(seed));
+    BRBitcoinWallet *w = btcWalletNew(btcMainNetParams->addrParams, NULL, 0, mpk);
+    BRAddress recvAddr = btcWalletLegacyAddress(w);
+
+    uint8_t inScript[BRAddressScriptPubKey(NULL, 0, btcMainNetParams->addrParams, addr.s)];
+    size_t inScriptLen = BRAddressScriptPubKey(inScript, sizeof(inScript), btcMainNetParams->addrParams, addr.s);
+    uint8_t outScript[BRAddressScriptPubKey(NULL, 0, btcMainNetParams->addrParams, recvAddr.s)];
+    size_t outScriptLen = BRAddressScriptPubKey(outScript, sizeof(outScript), btcMainNetParams->addrParams, recvAddr.s);
+
+    for (size_t i = 0; i < utxosCount; i += outputsPerTx) {
+        BRBitcoinTransaction *tx = btcTransactionNew();
+        UInt256 inHash = UINT256_ZERO;
+
+        UInt32SetLE(inHash.u8, (uint32_t) i + 1);
+        btcTransactionAddInput(tx, inHash, 0, 1, inScript, inScriptLen, NULL, 0, NULL, 0, TXIN_SEQUENCE);
+
+        for (size_t j = i; j < i + outputsPerTx && j < utxosCount; j++) { // 0.00001 to ~0.01 BTC, mostly small
+            lcg = lcg*1103515245 + 12345;
+            btcTransactionAddOutput(tx, 1000 + (uint64_t) ((lcg >> 8) % 1000)*((lcg >> 4) % 1000), outScript, outScriptLen);
+        }
+
+        btcTransactionSign(tx, 0, &k, 1);
+        tx->timestamp = 1;
+        if (! btcWalletRegisterTransaction(w, tx)) btcTransactionFree(tx), r = 0;
+    }
+
+    printf("==== BTC:WalletCoinSelectionPerf: %zu UTXOs: Balance: %" PRIu64 "\n", utxosCount, btcWalletBalance(w));
+
+    for (size_t i = 0; i < sizeof(amounts)/sizeof(*amounts); i++) {
+        for (BRBitcoinCoinSelection selection = 0; selection < NUMBER_OF_BITCOIN_COIN_SELECTIONS; selection++) {
+            BRBitcoinTxOutput o = BR_TX_OUTPUT_NONE;
+
+            o.amount = amounts[i];
+            btcTxOutputSetAddress(&o, btcMainNetParams->addrParams, addr.s);
+
+            double start = btcTransactionPerfTime();
+            BRBitcoinTransaction *tx = btcWalletCreateTxForOutputsWithCoinSelection(w, UINT64_MAX, &o, 1, selection);
+            double timeSelect = btcTransactionPerfTime() - start;
+
+            btcTxOutputSetAddress(&o, btcMainNetParams->addrParams, NULL);
+
+            if (tx) {
+                printf("==== BTC:WalletCoinSelectionPerf: %14s: Amount: %10" PRIu64 ": %.3f s: Inputs: %5zu, "
+                       "Outputs: %zu, VSize: %6zu, Fee: %" PRIu64 "\n", btcCoinSelectionName(selection), o.amount,
+                       timeSelect, tx->inCount, tx->outCount, btcTransactionVSize(tx), btcWalletFeeForTx(w, tx));
+                btcTransactionFree(tx);
+            }
+            else if (selection != BITCOIN_COIN_SELECTION_CONSOLIDATE) { // a consolidation may exceed TX_MAX_SIZE
+                printf("==== BTC:WalletCoinSelectionPerf: %14s: Amount: %10" PRIu64 ": %.3f s: no tx\n",
+                       btcCoinSelectionName(selection), o.amount, timeSelect);
+                r = 0;
+            }
+        }
+    }
+
+    btcWalletFree(w);
+    return r;
+}
+
 int BRRunTests()
 {
     int fail = 0;
@@ -3599,16 +5612,26 @@ int BRRunTests()
     printf("%s\n", (BRBIP32SequenceTests()) ? "success" : (fail++, "***FAIL***"));
     printf("btcTransactionTests...              ");
     printf("%s\n", (btcTransactionTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("btcCoinSelectionTests...            ");
+    printf("%s\n", (btcCoinSelectionTests()) ? "success" : (fail++, "***FAIL***"));
     printf("btcWalletTests...                   ");
     printf("%s\n", (btcWalletTests()) ? "success" : (fail++, "***FAIL***"));
     printf("btcBloomFilterTests...              ");
     printf("%s\n", (btcBloomFilterTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("btcCompactFilterTests...            ");
+    printf("%s\n", (btcCompactFilterTests()) ? "success" : (fail++, "***FAIL***"));
     printf("btcMerkleBlockTests...              ");
     printf("%s\n", (btcMerkleBlockTests()) ? "success" : (fail++, "***FAIL***"));
     printf("btcPaymentProtocolTests...          ");
     printf("%s\n", (btcPaymentProtocolTests()) ? "success" : (fail++, "***FAIL***"));
     printf("btcPaymentProtocolEncryptionTests...");
     printf("%s\n", (btcPaymentProtocolEncryptionTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("btcPeerMockTests...                 ");
+    printf("%s\n", (btcPeerMockTests(8)) ? "success" : (fail++, "***FAIL***"));
+    printf("btcPeerManagerMockTests...          ");
+    printf("%s\n", (btcPeerManagerMockTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("btcPeerCompactFilterTests...        ");
+    printf("%s\n", (btcPeerCompactFilterTests()) ? "success" : (fail++, "***FAIL***"));
     printf("\n");
     
     if (fail > 0) printf("%d TEST FUNCTION(S) ***FAILED***\n", fail);
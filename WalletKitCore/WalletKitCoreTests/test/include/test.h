@@ -36,6 +36,8 @@ extern void runRlpTests (void);
 
 // Event
 extern void runEventTests (void);
+extern int runEventQueuePerfTests (size_t producersCount, size_t count);
+extern int runEventAlarmPerfTests (size_t count, unsigned int periodInMilliseconds);
 
 // Ethereum
 
@@ -98,6 +100,26 @@ getChainName (BRBitcoinChain chain);
 
 extern int BRRunSupTests (void);
 
+extern int BRRunSupFileServicePerfTests (size_t count);
+
+extern int BRRunTransactionSignPerfTests (size_t inputsCount);
+
+extern int BRRunWalletCoinSelectionPerfTests (size_t utxosCount);
+
+extern int BRRunBloomFilterPerfTests (size_t elemCount);
+
+extern int BRRunTransactionParsePerfTests (size_t txCount);
+
+extern int BRRunSHA256PerfTests (size_t hashCount);
+
+extern int BRRunBIP39DerivePerfTests (size_t phraseCount);
+
+extern int BRRunAESPerfTests (size_t dataLen);
+
+extern int BRRunKeccakPerfTests (size_t hashCount);
+
+extern int BRRunKeyVerifyPerfTests (size_t sigCount);
+
 extern int BRRunTests();
 
 extern int BRRunTestsSync (const char *paperKey,
@@ -128,6 +150,8 @@ extern void BRRandInit (void);
 // testWalletKit.c
 extern void runWalletKitTests (void);
 
+extern void runWalletKitTransferPerfTests (size_t count);
+
 // testWalletConnect.c
 extern void runWalletConnectTests (void);
 
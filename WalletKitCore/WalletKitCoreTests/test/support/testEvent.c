@@ -11,8 +11,11 @@
 #include <stdio.h>
 #include <assert.h>
 #include <pthread.h>
+#include <sys/time.h>
 #include "support/event/BREvent.h"
+#include "support/event/BREventQueue.h"
 #include "support/event/BREventAlarm.h"
+#include "support/BROSCompat.h"
 
 static pthread_cond_t testEventAlarmConditional = PTHREAD_COND_INITIALIZER;
 static pthread_mutex_t testEventAlarmMutex = PTHREAD_MUTEX_INITIALIZER;
@@ -49,7 +52,341 @@ runEventTest (void) {
     alarmClockDestroy(alarmClock);
 }
 
+//
+// Alarm Clock Jitter
+//
+typedef struct {
+    pthread_mutex_t *lock;
+    pthread_cond_t  *cond;
+    size_t expired;
+    double jitterSum;
+    double jitterMax;
+} TestEventAlarmJitter;
+
+static double
+testEventAlarmTime (void) {
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void
+testEventAlarmJitterCallback (BREventAlarmContext context,
+                              struct timespec expiration,
+                              BREventAlarmClock clock) {
+    TestEventAlarmJitter *jitter = context;
+
+    // Coalesced alarms may expire a bit early.
+    double late = testEventAlarmTime() - (expiration.tv_sec + expiration.tv_nsec / 1e9);
+    if (late < 0) late = -late;
+
+    pthread_mutex_lock (jitter->lock);
+    jitter->expired   += 1;
+    jitter->jitterSum += late;
+    if (late > jitter->jitterMax) jitter->jitterMax = late;
+    pthread_cond_signal (jitter->cond);
+    pthread_mutex_unlock (jitter->lock);
+}
+
+//
+// Add `count` one-shot alarms, expiring over `periodInMilliseconds`, then remove half.  Report the
+// time to add and to remove and the difference between each alarm's expiration and its callback.
+//
+extern int
+runEventAlarmPerfTests (size_t count, unsigned int periodInMilliseconds) {
+    printf ("==== Event Alarm Perf\n");
+
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t  cond = PTHREAD_COND_INITIALIZER;
+
+    TestEventAlarmJitter kept    = { &lock, &cond, 0, 0, 0 };
+    TestEventAlarmJitter removed = { &lock, &cond, 0, 0, 0 };
+
+    BREventAlarmClock clock = alarmClockCreate ();
+
+    BREventAlarmId *identifiers = calloc (count, sizeof (BREventAlarmId));
+
+    // Start expiring after the alarms are added and removed (and the clock is started).
+    double start = testEventAlarmTime();
+    double first = start + 0.5;
+
+    for (size_t index = 0; index < count; index++) {
+        double time = first + (periodInMilliseconds / 1e3) * index / count;
+
+        struct timespec expiration = { (time_t) time, (long) (1e9 * (time - (time_t) time)) };
+        identifiers[index] = alarmClockAddAlarm (clock,
+                                                 (0 == index % 2 ? &kept : &removed),
+                                                 testEventAlarmJitterCallback,
+                                                 expiration);
+    }
+    double timeAdd = testEventAlarmTime() - start;
+
+    start = testEventAlarmTime();
+    for (size_t index = 1; index < count; index += 2)
+        alarmClockRemAlarm (clock, identifiers[index]);
+    double timeRem = testEventAlarmTime() - start;
+
+    int success = 1;
+    size_t keptCount = (count + 1) / 2;
+
+    for (size_t index = 0; index < count; index++)
+        success &= ((0 == index % 2) == alarmClockHasAlarm (clock, identifiers[index]));
+
+    alarmClockStart (clock);
+
+    // Wait for the kept alarms
+    pthread_mutex_lock (&lock);
+    while (kept.expired < keptCount)
+        pthread_cond_wait (&cond, &lock);
+    pthread_mutex_unlock (&lock);
+
+    success &= (keptCount == kept.expired && 0 == removed.expired);
+
+    printf ("==== Event Alarm Perf: %zu Alarms: Add: %.2f us, Rem: %.2f us, Jitter: Mean: %.3f ms, Max: %.3f ms\n",
+            count,
+            1e6 * timeAdd / count,
+            1e6 * timeRem / (count / 2),
+            1e3 * kept.jitterSum / keptCount,
+            1e3 * kept.jitterMax);
+
+    alarmClockDestroy (clock);
+    free (identifiers);
+
+    return success;
+}
+
+//
+// Event Queue
+//
+typedef struct {
+    struct BREventRecord base;
+    size_t producer;
+    size_t index;
+} TestEventQueueEvent;
+
+static BREventType testEventQueueEventType = {
+    "Test Queue Event",
+    sizeof (TestEventQueueEvent),
+    NULL,
+    NULL
+};
+
+static void
+runEventQueueTest (BREventQueueType type, size_t count) {
+    BREventQueue queue = eventQueueCreate (sizeof (TestEventQueueEvent), type);
+    TestEventQueueEvent event = { { NULL, &testEventQueueEventType }, 0, 0 };
+
+    assert (!eventQueueHasPending (queue));
+    assert (EVENT_STATUS_NONE_PENDING == eventQueueDequeue (queue, (BREvent*) &event));
+
+    // Enqueue more than a ring holds; then an OOB event
+    for (size_t index = 0; index < count; index++) {
+        event.index = index;
+        eventQueueEnqueueTail (queue, (BREvent*) &event);
+    }
+    event.index = count;
+    eventQueueEnqueueHead (queue, (BREvent*) &event);
+    assert (eventQueueHasPending (queue));
+
+    // The OOB event is first; the others are FIFO.
+    assert (EVENT_STATUS_SUCCESS == eventQueueDequeue (queue, (BREvent*) &event));
+    assert (count == event.index);
+
+    for (size_t index = 0; index < count; index++) {
+        assert (EVENT_STATUS_SUCCESS == eventQueueDequeue (queue, (BREvent*) &event));
+        assert (index == event.index);
+        assert (&testEventQueueEventType == event.base.type);
+    }
+    assert (EVENT_STATUS_NONE_PENDING == eventQueueDequeue (queue, (BREvent*) &event));
+
+    // Clear
+    for (size_t index = 0; index < count; index++)
+        eventQueueEnqueueTail (queue, (BREvent*) &event);
+    eventQueueClear (queue);
+    assert (!eventQueueHasPending (queue));
+
+    eventQueueDestroy (queue);
+}
+
+typedef struct {
+    BREventQueue queue;
+    size_t producer;
+    size_t count;
+} TestEventQueueProducer;
+
+static void *
+testEventQueueProducerThread (TestEventQueueProducer *producer) {
+    TestEventQueueEvent event = { { NULL, &testEventQueueEventType }, producer->producer, 0 };
+
+    for (size_t index = 0; index < producer->count; index++) {
+        event.index = index;
+        eventQueueEnqueueTailSignal (producer->queue, (BREvent*) &event);
+    }
+    return NULL;
+}
+
+static double
+testEventQueueTime (void) {
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+//
+// Contention: `producersCount` threads each enqueue `count` events as one thread dequeues.
+// Return the events per second, or 0 on a dropped or misordered event.
+//
+static double
+runEventQueueContention (BREventQueueType type, size_t producersCount, size_t count) {
+    BREventQueue queue = eventQueueCreate (sizeof (TestEventQueueEvent), type);
+
+    TestEventQueueProducer *producers = calloc (producersCount, sizeof (TestEventQueueProducer));
+    pthread_t *threads = calloc (producersCount, sizeof (pthread_t));
+    size_t    *indices = calloc (producersCount, sizeof (size_t));
+
+    double start = testEventQueueTime();
+
+    for (size_t producer = 0; producer < producersCount; producer++) {
+        producers[producer] = (TestEventQueueProducer) { queue, producer, count };
+        pthread_create (&threads[producer], NULL, (void* (*) (void*)) testEventQueueProducerThread, &producers[producer]);
+    }
+
+    int success = 1;
+    TestEventQueueEvent event;
+
+    // Each producer's events arrive in order
+    for (size_t total = 0; success && total < producersCount * count; total++) {
+        success &= (EVENT_STATUS_SUCCESS == eventQueueDequeueWait (queue, (BREvent*) &event));
+        success &= (event.producer < producersCount && indices[event.producer] == event.index);
+        if (success) indices[event.producer] += 1;
+    }
+
+    double time = testEventQueueTime() - start;
+
+    for (size_t producer = 0; producer < producersCount; producer++)
+        pthread_join (threads[producer], NULL);
+
+    free (indices);
+    free (threads);
+    free (producers);
+    eventQueueDestroy (queue);
+
+    return success ? (producersCount * count) / time : 0;
+}
+
+extern int
+runEventQueuePerfTests (size_t producersCount, size_t count) {
+    printf ("==== Event Queue Perf\n");
+
+    double rateList = runEventQueueContention (EVENT_QUEUE_TYPE_LIST, producersCount, count);
+    double rateRing = runEventQueueContention (EVENT_QUEUE_TYPE_RING, producersCount, count);
+
+    printf ("==== Event Queue Perf: %zu Producers x %zu Events: List: %.0f/s, Ring: %.0f/s\n",
+            producersCount, count, rateList, rateRing);
+
+    return 0 != rateList && 0 != rateRing;
+}
+
+//
+// Event Executor
+//
+typedef struct {
+    pthread_mutex_t lock;
+    size_t dispatching;     // concurrent dispatches; never more than one
+    size_t count;
+    int success;
+} TestEventExecutorHandlerState;
+
+typedef struct {
+    struct BREventRecord base;
+    TestEventExecutorHandlerState *state;
+    size_t index;
+} TestEventExecutorEvent;
+
+static void
+testEventExecutorDispatcher (BREventHandler handler,
+                             TestEventExecutorEvent *event) {
+    TestEventExecutorHandlerState *state = event->state;
+
+    state->success &= (1 == ++state->dispatching);      // with `state->lock` as `lockOnDispatch`
+    state->success &= eventHandlerIsCurrentThread (handler);
+    state->success &= (state->count == event->index);   // in order
+    state->count += 1;
+    state->dispatching -= 1;
+}
+
+static BREventType testEventExecutorEventType = {
+    "Test Executor Event",
+    sizeof (TestEventExecutorEvent),
+    (BREventDispatcher) testEventExecutorDispatcher,
+    NULL
+};
+
+static const BREventType *testEventExecutorEventTypes[] = {
+    &testEventExecutorEventType
+};
+
+//
+// Dispatch `count` events for each of `handlersCount` handlers on an executor with
+// `threadsCount` threads.
+//
+static void
+runEventExecutorTest (size_t threadsCount, size_t handlersCount, size_t count) {
+    BREventExecutor executor = eventExecutorCreate ("Test Executor", threadsCount);
+
+    BREventHandler *handlers = calloc (handlersCount, sizeof (BREventHandler));
+    TestEventExecutorHandlerState *states = calloc (handlersCount, sizeof (TestEventExecutorHandlerState));
+
+    for (size_t index = 0; index < handlersCount; index++) {
+        pthread_mutex_init (&states[index].lock, NULL);
+        states[index].success = 1;
+
+        handlers[index] = eventHandlerCreate ("Test Handler", testEventExecutorEventTypes, 1, &states[index].lock);
+        eventHandlerSetExecutor (handlers[index], executor);
+    }
+
+    // Some events queued before start; others after.
+    for (size_t index = 0; index < count; index++) {
+        if (count / 2 == index)
+            for (size_t handler = 0; handler < handlersCount; handler++) {
+                eventHandlerStart (handlers[handler]);
+                assert (eventHandlerIsRunning (handlers[handler]));
+            }
+
+        for (size_t handler = 0; handler < handlersCount; handler++) {
+            TestEventExecutorEvent event = { { NULL, &testEventExecutorEventType }, &states[handler], index };
+            eventHandlerSignalEvent (handlers[handler], (BREvent*) &event);
+        }
+    }
+
+    // Wait for the dispatches
+    for (size_t handler = 0; handler < handlersCount; handler++) {
+        size_t dispatched;
+        do {
+            pthread_mutex_lock (&states[handler].lock);
+            dispatched = states[handler].count;
+            pthread_mutex_unlock (&states[handler].lock);
+            if (dispatched < count) pthread_yield_brd();
+        } while (dispatched < count);
+    }
+
+    for (size_t handler = 0; handler < handlersCount; handler++) {
+        eventHandlerDestroy (handlers[handler]);
+        assert (states[handler].success);
+        pthread_mutex_destroy (&states[handler].lock);
+    }
+
+    eventExecutorDestroy (executor);
+    free (states);
+    free (handlers);
+}
+
 extern void
 runEventTests (void) {
+    assert (1 == runEventAlarmPerfTests (1000, 100));
+    runEventExecutorTest (4, 20, 1000);
+    runEventQueueTest (EVENT_QUEUE_TYPE_LIST, 1000);
+    runEventQueueTest (EVENT_QUEUE_TYPE_RING, 1000);
+    assert (0 != runEventQueueContention (EVENT_QUEUE_TYPE_RING, 4, 10000));
     runEventTest();
 }
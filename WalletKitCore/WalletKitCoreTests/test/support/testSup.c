@@ -20,6 +20,7 @@
 #include "support/BRFileService.h"
 #include "support/BRAssert.h"
 #include "support/BROSCompat.h"
+#include "../vendor/sqlite3/sqlite3.h"
 
 /// MARK: - File Service Tests
 
@@ -54,6 +55,9 @@ fileServiceSetupError (const char *path, BRFileService fs) {
     return NULL;
 }
 
+/// The number of FILE_SERVICE_ENTITY errors reported to `fileServiceErrorHandler()`
+static size_t fileServiceEntityErrorCount = 0;
+
 static void
 fileServiceErrorHandler (BRFileServiceContext context,
                          BRFileService fs,
@@ -70,6 +74,7 @@ fileServiceErrorHandler (BRFileServiceContext context,
             break;
         case FILE_SERVICE_ENTITY:
             // This is likely a coding error too.
+            fileServiceEntityErrorCount += 1;
             printf ("  supFileServiceThread: FileService Error: ENTITY (%s): %s\n",
                     error.u.entity.type,
                     error.u.entity.reason);
@@ -228,6 +233,411 @@ static int runSupFileServiceMultiTests (void) {
     return fileServiceTestDone(path, success);
 }
 
+/// MARK: - File Service Batch Tests
+
+#define SUP_FILE_SERVICE_ENTITY_SIZE      (256)
+
+typedef struct {
+    UInt256 identifier;
+    uint8_t bytes[SUP_FILE_SERVICE_ENTITY_SIZE];
+} SupFileServiceEntity;
+
+static UInt256
+supFileServiceEntityIdentifier (BRFileServiceContext context,
+                                BRFileService fs,
+                                const void *entity) {
+    return ((const SupFileServiceEntity *) entity)->identifier;
+}
+
+static void *
+supFileServiceEntityReader (BRFileServiceContext context,
+                            BRFileService fs,
+                            uint8_t *bytes,
+                            uint32_t bytesCount) {
+    if (sizeof (SupFileServiceEntity) != bytesCount) return NULL;
+
+    SupFileServiceEntity *entity = malloc (sizeof (SupFileServiceEntity));
+    memcpy (entity, bytes, bytesCount);
+    return entity;
+}
+
+static uint8_t *
+supFileServiceEntityWriter (BRFileServiceContext context,
+                            BRFileService fs,
+                            const void* entity,
+                            uint32_t *bytesCount) {
+    *bytesCount = sizeof (SupFileServiceEntity);
+
+    uint8_t *bytes = malloc (*bytesCount);
+    memcpy (bytes, entity, *bytesCount);
+    return bytes;
+}
+
+static size_t
+supFileServiceEntityHash (const void *entity) {
+    return (size_t) ((const SupFileServiceEntity *) entity)->identifier.u64[0];
+}
+
+static int
+supFileServiceEntityEq (const void *entity1, const void *entity2) {
+    return UInt256Eq (((const SupFileServiceEntity *) entity1)->identifier,
+                      ((const SupFileServiceEntity *) entity2)->identifier);
+}
+
+static size_t
+supFileServiceLoadCount (BRFileService fs, const char *type) {
+    BRSetOf(SupFileServiceEntity*) entities = BRSetNew (supFileServiceEntityHash, supFileServiceEntityEq, 100);
+    size_t count = (fileServiceLoad (fs, entities, type, 1) ? BRSetCount (entities) : SIZE_MAX);
+    BRSetFreeAll (entities, free);
+    return count;
+}
+
+static BRFileService
+supFileServiceCreate (const char *path, const char *currency, const char *network, const char *type) {
+    BRFileService fs = fileServiceCreate (path, currency, network, NULL, fileServiceErrorHandler);
+    if (NULL == fs) return NULL;
+
+    if (1 != fileServiceDefineType (fs, type, 0, NULL,
+                                    supFileServiceEntityIdentifier,
+                                    supFileServiceEntityReader,
+                                    supFileServiceEntityWriter) ||
+        1 != fileServiceDefineCurrentVersion (fs, type, 0)) {
+        fileServiceRelease (fs);
+        return NULL;
+    }
+
+    return fs;
+}
+
+static SupFileServiceEntity *
+supFileServiceEntitiesCreate (size_t count) {
+    SupFileServiceEntity *entities = calloc (count, sizeof (SupFileServiceEntity));
+    for (size_t index = 0; index < count; index++) {
+        entities[index].identifier.u64[0] = index + 1;
+        memset (entities[index].bytes, (int) index, SUP_FILE_SERVICE_ENTITY_SIZE);
+    }
+    return entities;
+}
+
+//
+// Make every later insert of `entity` into the DB at `path` fail, from a separate connection, so
+// that a file service operation on it fails part way through.
+//
+static int
+supFileServiceFailInsert (const char *path, const char *currency, const char *network,
+                          const SupFileServiceEntity *entity) {
+    char sdbPath[1024];
+    snprintf (sdbPath, sizeof (sdbPath), "%s/%s-%s-%s", path, currency, network, "entities.db");
+
+    sqlite3 *sdb;
+    if (SQLITE_OK != sqlite3_open (sdbPath, &sdb)) return 0;
+
+    char *sql = sqlite3_mprintf ("CREATE TRIGGER FailInsert BEFORE INSERT ON Entity WHEN NEW.Hash = '%q' "
+                                 "BEGIN SELECT RAISE(ABORT, 'failed insert'); END;",
+                                 u256hex (entity->identifier));
+    int success = (SQLITE_OK == sqlite3_exec (sdb, sql, NULL, NULL, NULL));
+    sqlite3_free (sql);
+    sqlite3_close (sdb);
+    return success;
+}
+
+static double
+supFileServiceTime (void) {
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int runSupFileServiceBatchTests (size_t count) {
+    printf ("==== SUP:FileServiceBatch\n");
+
+    struct stat dirStat;
+
+    char *path = "private";
+    char *currency = "btc", *network = "mainnet";
+    char *type = "entity";
+
+    if (0 == stat  (path, &dirStat)) _rmdir (path);
+    if (0 != mkdir (path, 0700)) return 0;
+
+    BRFileService fs = supFileServiceCreate (path, currency, network, type);
+    if (NULL == fs) return fileServiceTestDone (path, 0);
+
+    SupFileServiceEntity *entities = supFileServiceEntitiesCreate (count);
+    const void **entityRefs = calloc (count, sizeof (SupFileServiceEntity *));
+    for (size_t index = 0; index < count; index++)
+        entityRefs[index] = &entities[index];
+
+    int success = 1;
+
+    // One DB transaction per entity
+    double start = supFileServiceTime();
+    for (size_t index = 0; index < count; index++)
+        success &= fileServiceSave (fs, type, &entities[index]);
+    double timeSave = supFileServiceTime() - start;
+    success &= (count == supFileServiceLoadCount (fs, type));
+
+    // One DB transaction for all entities
+    success &= fileServiceClear (fs, type);
+    start = supFileServiceTime();
+    success &= fileServiceSaveBatch (fs, type, entityRefs, count);
+    double timeSaveBatch = supFileServiceTime() - start;
+    success &= (count == supFileServiceLoadCount (fs, type));
+
+    // One DB transaction, from nested batches, for all entities
+    success &= fileServiceClear (fs, type);
+    start = supFileServiceTime();
+    success &= fileServiceBeginBatch (fs);
+    for (size_t index = 0; index < count; index++) {
+        if (0 == index % 100) success &= fileServiceBeginBatch (fs);
+        success &= fileServiceSave (fs, type, &entities[index]);
+        if (99 == index % 100 || count - 1 == index) success &= fileServiceCommitBatch (fs);
+    }
+    success &= fileServiceCommitBatch (fs);
+    double timeBeginCommit = supFileServiceTime() - start;
+    success &= (count == supFileServiceLoadCount (fs, type));
+
+    // A replace that fails part way, within a batch, rolls back only its own changes; the batch,
+    // and an enclosing batch (as if another caller's), still commit.
+    success &= fileServiceClear (fs, type);
+    success &= fileServiceSave (fs, type, &entities[0]);
+    success &= supFileServiceFailInsert (path, currency, network, &entities[count / 2]);
+    success &= fileServiceBeginBatch (fs);
+    success &= fileServiceBeginBatch (fs);
+    success &= fileServiceSave (fs, type, &entities[1]);
+    success &= (0 == fileServiceReplace (fs, type, entityRefs, count));
+    success &= fileServiceCommitBatch (fs);
+    success &= fileServiceSave (fs, type, &entities[2]);
+    success &= fileServiceCommitBatch (fs);
+    success &= (3 == supFileServiceLoadCount (fs, type));
+
+    // ... and the next batch commits as usual
+    success &= fileServiceBeginBatch (fs);
+    success &= fileServiceSave (fs, type, &entities[3]);
+    success &= fileServiceCommitBatch (fs);
+    success &= (4 == supFileServiceLoadCount (fs, type));
+
+    printf ("==== SUP:FileServiceBatch: %zu Entities: Save: %.0f/s, SaveBatch: %.0f/s, Begin/Commit: %.0f/s\n",
+            count,
+            count / timeSave,
+            count / timeSaveBatch,
+            count / timeBeginCommit);
+
+    free (entityRefs);
+    free (entities);
+
+    fileServiceRelease (fs);
+    return fileServiceTestDone (path, success);
+}
+
+//
+// Create a DB in the original schema, with hex-encoded entities, and confirm that it is migrated,
+// when opened, to the current schema.
+//
+static int runSupFileServiceMigrateTests (size_t count) {
+    printf ("==== SUP:FileServiceMigrate\n");
+
+    struct stat dirStat;
+
+    char *path = "private";
+    char *currency = "btc", *network = "mainnet";
+    char *type = "entity";
+
+    if (0 == stat  (path, &dirStat)) _rmdir (path);
+    if (0 != mkdir (path, 0700)) return 0;
+
+    char sdbPath[1024];
+    snprintf (sdbPath, sizeof (sdbPath), "%s/%s-%s-%s", path, currency, network, "entities.db");
+
+    sqlite3 *sdb;
+    if (SQLITE_OK != sqlite3_open (sdbPath, &sdb)) return fileServiceTestDone (path, 0);
+
+    int success = (SQLITE_OK == sqlite3_exec (sdb,
+                                              "CREATE TABLE IF NOT EXISTS Entity("
+                                              "Type CHAR(64) NOT NULL, Hash CHAR(64) NOT NULL, Data TEXT NOT NULL,"
+                                              "PRIMARY KEY (Type, Hash));"
+                                              "BEGIN;",
+                                              NULL, NULL, NULL));
+
+    SupFileServiceEntity *entities = supFileServiceEntitiesCreate (count);
+    for (size_t index = 0; success && index < count; index++) {
+        // {HeaderFormatVersion, Current(Type)Version, EntityBytesCount, EntityBytes}
+        uint8_t bytes[1 + 1 + sizeof (uint32_t) + sizeof (SupFileServiceEntity)];
+        bytes[0] = 0;
+        bytes[1] = 0;
+        UInt32SetBE (&bytes[2], sizeof (SupFileServiceEntity));
+        memcpy (&bytes[6], &entities[index], sizeof (SupFileServiceEntity));
+
+        char data[2 * sizeof (bytes) + 1];
+        for (size_t i = 0; i < sizeof (bytes); i++)
+            sprintf (&data[2 * i], "%02x", bytes[i]);
+
+        char *sql = sqlite3_mprintf ("INSERT INTO Entity (Type, Hash, Data) VALUES ('%q', '%q', '%q');",
+                                     type, u256hex (entities[index].identifier), data);
+        success &= (SQLITE_OK == sqlite3_exec (sdb, sql, NULL, NULL, NULL));
+        sqlite3_free (sql);
+    }
+    // An entity that can't be decoded is reported, when migrated, and dropped.
+    success &= (SQLITE_OK == sqlite3_exec (sdb,
+                                           "INSERT INTO Entity (Type, Hash, Data) VALUES ('entity', 'undecodable', 'xyz');",
+                                           NULL, NULL, NULL));
+    success &= (SQLITE_OK == sqlite3_exec (sdb, "COMMIT;", NULL, NULL, NULL));
+    sqlite3_close (sdb);
+
+    // Migrate on open; then again with no migration needed.
+    for (size_t pass = 0; success && pass < 2; pass++) {
+        fileServiceEntityErrorCount = 0;
+        BRFileService fs = supFileServiceCreate (path, currency, network, type);
+        if (NULL == fs) { success = 0; break; }
+        success &= ((0 == pass ? 1 : 0) == fileServiceEntityErrorCount);
+
+        BRSetOf(SupFileServiceEntity*) loaded = BRSetNew (supFileServiceEntityHash, supFileServiceEntityEq, count);
+        success &= fileServiceLoad (fs, loaded, type, 1);
+        success &= (count == BRSetCount (loaded));
+
+        for (size_t index = 0; success && index < count; index++) {
+            SupFileServiceEntity *entity = BRSetGet (loaded, &entities[index]);
+            success &= (NULL != entity && 0 == memcmp (entity, &entities[index], sizeof (SupFileServiceEntity)));
+        }
+
+        BRSetFreeAll (loaded, free);
+        fileServiceRelease (fs);
+    }
+
+    free (entities);
+    return fileServiceTestDone (path, success);
+}
+
+typedef struct {
+    UInt256 identifierMin;
+    UInt256 identifierMax;
+    size_t count;
+    size_t limit;
+    int success;
+} SupFileServiceIterateContext;
+
+static int
+supFileServiceIterateHandler (BRFileServiceContext context,
+                              BRFileService fs,
+                              const char *type,
+                              void *entity) {
+    SupFileServiceIterateContext *iterate = context;
+    SupFileServiceEntity *supEntity = entity;
+
+    iterate->success &= (0 <= memcmp (supEntity->identifier.u8, iterate->identifierMin.u8, sizeof (UInt256)) &&
+                         0 >= memcmp (supEntity->identifier.u8, iterate->identifierMax.u8, sizeof (UInt256)));
+    iterate->count += 1;
+
+    free (entity);
+    return iterate->count < iterate->limit;
+}
+
+//
+// Iterate over all, a range of and a limited number of entities.
+//
+static int runSupFileServiceIterateTests (size_t count) {
+    printf ("==== SUP:FileServiceIterate\n");
+
+    struct stat dirStat;
+
+    char *path = "private";
+    char *currency = "btc", *network = "mainnet";
+    char *type = "entity";
+
+    if (0 == stat  (path, &dirStat)) _rmdir (path);
+    if (0 != mkdir (path, 0700)) return 0;
+
+    BRFileService fs = supFileServiceCreate (path, currency, network, type);
+    if (NULL == fs) return fileServiceTestDone (path, 0);
+
+    SupFileServiceEntity *entities = supFileServiceEntitiesCreate (count);
+    const void **entityRefs = calloc (count, sizeof (SupFileServiceEntity *));
+    for (size_t index = 0; index < count; index++)
+        entityRefs[index] = &entities[index];
+
+    int success = fileServiceSaveBatch (fs, type, entityRefs, count);
+
+    UInt256 identifierLast;
+    memset (identifierLast.u8, 0xff, sizeof (identifierLast.u8));
+
+    // All
+    SupFileServiceIterateContext iterate = { UINT256_ZERO, identifierLast, 0, SIZE_MAX, 1 };
+    success &= fileServiceLoadIterate (fs, type, 1, NULL, NULL, &iterate, supFileServiceIterateHandler);
+    success &= iterate.success && count == iterate.count;
+
+    // A range; the identifiers compare bytewise, not as `index`
+    iterate = (SupFileServiceIterateContext) {
+        entities[count / 4].identifier,
+        entities[count / 2].identifier,
+        0, SIZE_MAX, 1
+    };
+
+    size_t rangeCount = 0;
+    for (size_t index = 0; index < count; index++)
+        if (0 <= memcmp (entities[index].identifier.u8, iterate.identifierMin.u8, sizeof (UInt256)) &&
+            0 >= memcmp (entities[index].identifier.u8, iterate.identifierMax.u8, sizeof (UInt256)))
+            rangeCount += 1;
+
+    success &= fileServiceLoadIterate (fs, type, 1, &iterate.identifierMin, &iterate.identifierMax,
+                                       &iterate, supFileServiceIterateHandler);
+    success &= iterate.success && rangeCount == iterate.count;
+
+    // Stop early
+    iterate = (SupFileServiceIterateContext) { UINT256_ZERO, identifierLast, 0, 10, 1 };
+    success &= fileServiceLoadIterate (fs, type, 1, NULL, NULL, &iterate, supFileServiceIterateHandler);
+    success &= iterate.success && 10 == iterate.count;
+
+    // Still all there
+    success &= (count == supFileServiceLoadCount (fs, type));
+
+    free (entityRefs);
+    free (entities);
+
+    fileServiceRelease (fs);
+    return fileServiceTestDone (path, success);
+}
+
+//
+// Report the time to open and load a DB with `count` entities; think 'App Startup'.
+//
+extern int BRRunSupFileServicePerfTests (size_t count) {
+    printf ("==== SUP:FileServicePerf\n");
+
+    struct stat dirStat;
+
+    char *path = "private";
+    char *currency = "btc", *network = "mainnet";
+    char *type = "entity";
+
+    if (0 == stat  (path, &dirStat)) _rmdir (path);
+    if (0 != mkdir (path, 0700)) return 0;
+
+    BRFileService fs = supFileServiceCreate (path, currency, network, type);
+    if (NULL == fs) return fileServiceTestDone (path, 0);
+
+    SupFileServiceEntity *entities = supFileServiceEntitiesCreate (count);
+    const void **entityRefs = calloc (count, sizeof (SupFileServiceEntity *));
+    for (size_t index = 0; index < count; index++)
+        entityRefs[index] = &entities[index];
+
+    int success = fileServiceSaveBatch (fs, type, entityRefs, count);
+    fileServiceRelease (fs);
+
+    free (entityRefs);
+    free (entities);
+
+    double start = supFileServiceTime();
+    fs = supFileServiceCreate (path, currency, network, type);
+    success &= (NULL != fs && count == supFileServiceLoadCount (fs, type));
+    double timeLoad = supFileServiceTime() - start;
+
+    if (NULL != fs) fileServiceRelease (fs);
+
+    printf ("==== SUP:FileServicePerf: %zu Entities: Load: %.3f s\n", count, timeLoad);
+
+    return fileServiceTestDone (path, success);
+}
+
 /// MARK: - Assert Tests
 
 #define DEFAULT_WORKERS     (5)
@@ -526,6 +936,9 @@ int BRRunSupTests (void) {
 
     success &= runSupFileServiceTests();
     success &= runSupFileServiceMultiTests ();
+    success &= runSupFileServiceBatchTests (5000);
+    success &= runSupFileServiceMigrateTests (1000);
+    success &= runSupFileServiceIterateTests (1000);
     success &= runSupAssertTests();
 
     return success;
@@ -14,6 +14,7 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "WKAmount.h"
@@ -302,10 +303,296 @@ transferTestsAddress (void) {
     wkCurrencyGive(btc);
 }
 
+//
+// The wallet's incrementally maintained balance matches a full recompute, through adds, state
+// changes and removes.
+//
+static void
+transferTestsWalletBalance (void) {
+    WKCurrency btc = wkCurrencyCreate ("BitcoinUIDS", "Bitcoin", "BTC", "native", NULL);
+    WKUnit     sat = wkUnitCreateAsBase (btc, "SatoshiUIDS", "Satoshi", "SAT");
+
+    BRMasterPubKey mpk = transferTestsGetMPK();
+    BRBitcoinWallet *wid = btcWalletNew (btcChainParams(false)->addrParams, NULL, 0, mpk);
+    btcWalletSetCallbacks (wid, NULL, NULL, NULL, NULL, NULL);
+
+    WKWallet wallet = wkWalletCreateAsBTC (WK_NETWORK_TYPE_BTC, WK_WALLET_LISTENER_EMPTY, sat, sat, wid);
+
+    WKTransfer transfers[numberOfTransferTests];
+    BRBitcoinTransaction *tids[numberOfTransferTests];
+    for (size_t index = 0; index < numberOfTransferTests; index++) {
+        WKTransferTest *test = &transferTests[index];
+
+        size_t   testRawSize;
+        uint8_t *testRawBytes = hexDecodeCreate(&testRawSize, test->rawChars, strlen (test->rawChars));
+
+        BRBitcoinTransaction *tid = btcTransactionParse (testRawBytes, testRawSize);
+        tid->blockHeight = test->blockHeight;
+        tid->timestamp   = test->timestamp;
+        btcWalletRegisterTransaction (wid, tid); // ownership given
+        tids[index] = tid;
+
+        transfers[index] = wkTransferCreateAsBTC (wallet->listenerTransfer,
+                                                  sat,
+                                                  sat,
+                                                  wid,
+                                                  btcTransactionCopy(tid), // ownership given
+                                                  WK_NETWORK_TYPE_BTC);
+        wkWalletAddTransfer (wallet, transfers[index]);
+        free (testRawBytes);
+    }
+
+    // No recompute is needed
+    WKWalletBalanceCounters counters = wkWalletGetBalanceCounters (wallet);
+    assert (numberOfTransferTests == counters.updates);
+    assert (0 == counters.recomputes);
+
+    // A full recompute agrees
+    WKAmount balanceIncremental = wkWalletGetBalance (wallet);
+    wkWalletUpdBalance (wallet, true);
+    WKAmount balanceRecomputed  = wkWalletGetBalance (wallet);
+    assert (WK_COMPARE_EQ == wkAmountCompare (balanceIncremental, balanceRecomputed));
+    assert (1 == wkWalletGetBalanceCounters(wallet).recomputes);
+    wkAmountGive (balanceRecomputed);
+    wkAmountGive (balanceIncremental);
+
+    // An ERRORED transfer does not contribute; no recompute is needed.
+    WKTransferState state = wkTransferStateErroredInit (wkTransferSubmitErrorCreate (WK_TRANSFER_SUBMIT_ERROR_UNKNOWN, NULL));
+    wkTransferSetState (transfers[0], state);
+    wkTransferStateGive (state);
+
+    counters = wkWalletGetBalanceCounters (wallet);
+    assert (1 == counters.recomputes);
+    assert (1 == counters.recomputesAvoided);
+
+    balanceIncremental = wkWalletGetBalance (wallet);
+    wkWalletUpdBalance (wallet, true);
+    balanceRecomputed  = wkWalletGetBalance (wallet);
+    assert (WK_COMPARE_EQ == wkAmountCompare (balanceIncremental, balanceRecomputed));
+    wkAmountGive (balanceRecomputed);
+    wkAmountGive (balanceIncremental);
+
+    // Replacing a transfer, as when a BTC transaction is signed, agrees with a full recompute; with
+    // WK_WALLET_BALANCE_VALIDATE defined as 1, every intermediate update is also validated.
+    WKTransfer replacement = wkTransferCreateAsBTC (wallet->listenerTransfer,
+                                                    sat,
+                                                    sat,
+                                                    wid,
+                                                    btcTransactionCopy(tids[1]), // ownership given
+                                                    WK_NETWORK_TYPE_BTC);
+    wkWalletReplaceTransfer (wallet, transfers[1], wkTransferTake (replacement));
+    assert (WK_TRUE  == wkWalletHasTransfer (wallet, replacement));
+    wkTransferGive (transfers[1]);
+    transfers[1] = replacement;
+
+    balanceIncremental = wkWalletGetBalance (wallet);
+    wkWalletUpdBalance (wallet, true);
+    balanceRecomputed  = wkWalletGetBalance (wallet);
+    assert (WK_COMPARE_EQ == wkAmountCompare (balanceIncremental, balanceRecomputed));
+    wkAmountGive (balanceRecomputed);
+    wkAmountGive (balanceIncremental);
+
+    // Removing every transfer leaves a zero balance
+    for (size_t index = 0; index < numberOfTransferTests; index++)
+        wkWalletRemTransfer (wallet, transfers[index]);
+
+    WKAmount balance = wkWalletGetBalance (wallet);
+    assert (WK_TRUE == wkAmountIsZero (balance));
+    wkAmountGive (balance);
+
+    for (size_t index = 0; index < numberOfTransferTests; index++)
+        wkTransferGive (transfers[index]);
+
+    wkWalletGive (wallet);
+    btcWalletFree (wid);
+    wkUnitGive (sat);
+    wkCurrencyGive (btc);
+}
+
+//
+// Create `count` BTC transfers, as if from transfer bundles, with distinct hashes and with block
+// numbers in [0, count).  The transfers are 'recovered' into `wallet` just like a QRY sync
+// does: lookup by hash or UIDS and, if not found, add.
+//
+static void
+transferTestsRecover (WKWallet wallet,
+                      BRBitcoinWallet *wid,
+                      WKUnit unit,
+                      size_t count,
+                      bool shuffle) {
+    for (size_t index = 0; index < count; index++) {
+        size_t blockNumber = (shuffle ? (index * 7919) % count : index);
+
+        BRBitcoinTransaction *tid = btcTransactionNew ();
+        tid->txHash = UINT256_ZERO;
+        tid->txHash.u64[0] = blockNumber + 1;
+        tid->blockHeight   = (uint32_t) blockNumber;
+        tid->timestamp     = 1519252723;
+
+        WKTransfer transfer = wkTransferCreateAsBTC (wallet->listenerTransfer,
+                                                     unit,
+                                                     unit,
+                                                     wid,
+                                                     tid, // ownership given
+                                                     WK_NETWORK_TYPE_BTC);
+
+        WKHash hash = wkTransferGetHash (transfer);
+        const char *uids = transfer->uids;
+
+        WKTransfer found = wkWalletGetTransferByHashOrUIDS (wallet, hash, uids);
+        assert (NULL == found);
+
+        wkWalletAddTransfer (wallet, transfer);
+
+        found = wkWalletGetTransferByHashOrUIDS (wallet, hash, uids);
+        assert (found == transfer);
+        wkTransferGive (found);
+
+        wkHashGive (hash);
+        wkTransferGive (transfer);
+    }
+}
+
+static void
+transferTestsIndex (void) {
+    WKCurrency btc = wkCurrencyCreate ("BitcoinUIDS", "Bitcoin", "BTC", "native", NULL);
+    WKUnit     sat = wkUnitCreateAsBase (btc, "SatoshiUIDS", "Satoshi", "SAT");
+
+    BRMasterPubKey mpk = transferTestsGetMPK();
+    BRBitcoinWallet *wid = btcWalletNew (btcChainParams(false)->addrParams, NULL, 0, mpk);
+    btcWalletSetCallbacks (wid, NULL, NULL, NULL, NULL, NULL);
+
+    WKWallet wallet = wkWalletCreateAsBTC (WK_NETWORK_TYPE_BTC, WK_WALLET_LISTENER_EMPTY, sat, sat, wid);
+
+    size_t count = 500;
+    transferTestsRecover (wallet, wid, sat, count, true);
+
+    size_t transfersCount;
+    WKTransfer *transfers = wkWalletGetTransfers (wallet, &transfersCount);
+    assert (count == transfersCount);
+
+    // Every transfer is found by hash and by itself.
+    for (size_t index = 0; index < transfersCount; index++) {
+        WKHash hash = wkTransferGetHash (transfers[index]);
+        WKTransfer found = wkWalletGetTransferByHash (wallet, hash);
+        assert (found == transfers[index]);
+        assert (WK_TRUE == wkWalletHasTransfer (wallet, transfers[index]));
+        wkTransferGive (found);
+        wkHashGive (hash);
+    }
+
+    // The block index orders transfers, irrespective of the order added
+    BRArrayOf(WKTransfer) inRange = wkWalletGetTransfersInBlockRange (wallet, 100, 200);
+    assert (100 == array_count (inRange));
+    for (size_t index = 0; index < array_count (inRange); index++) {
+        WKTransferState state = wkTransferGetState (inRange[index]);
+        assert (WK_TRANSFER_STATE_INCLUDED == state->type);
+        assert (100 + index == state->u.included.blockNumber);
+        wkTransferStateGive (state);
+    }
+    array_free_all (inRange, wkTransferGive);
+
+    // Remove half; the remaining half are still found
+    for (size_t index = 0; index < transfersCount; index += 2)
+        wkWalletRemTransfer (wallet, transfers[index]);
+
+    for (size_t index = 0; index < transfersCount; index++)
+        assert (AS_WK_BOOLEAN (1 == index % 2) == wkWalletHasTransfer (wallet, transfers[index]));
+
+    inRange = wkWalletGetTransfersInBlockRange (wallet, 0, BLOCK_NUMBER_UNKNOWN);
+    assert (count / 2 == array_count (inRange));
+    array_free_all (inRange, wkTransferGive);
+
+    // The remaining transfers keep the order in which they were added
+    size_t remainingCount;
+    WKTransfer *remaining = wkWalletGetTransfers (wallet, &remainingCount);
+    assert (count / 2 == remainingCount);
+    for (size_t index = 0; index < remainingCount; index++) {
+        assert (remaining[index] == transfers[2 * index + 1]);
+        wkTransferGive (remaining[index]);
+    }
+    free (remaining);
+
+    // A transfer whose hash changes, as when re-signed, is found by its new hash only
+    WKHash oldHash = wkTransferGetHash (transfers[1]);
+    wkTransferAsBTC (transfers[1])->txHash.u64[1] = 1;
+    wkWalletUpdTransferIndex (wallet, transfers[1]);
+    WKHash newHash = wkTransferGetHash (transfers[1]);
+
+    WKTransfer found = wkWalletGetTransferByHash (wallet, newHash);
+    assert (found == transfers[1]);
+    assert (NULL == wkWalletGetTransferByHash (wallet, oldHash));
+    wkTransferGive (found);
+    wkHashGive (newHash);
+    wkHashGive (oldHash);
+
+    // A replaced transfer takes the slot of the transfer it replaces
+    WKTransfer replacement = wkTransferCreateAsBTC (wallet->listenerTransfer,
+                                                    sat,
+                                                    sat,
+                                                    wid,
+                                                    btcTransactionCopy (wkTransferAsBTC (transfers[3])), // ownership given
+                                                    WK_NETWORK_TYPE_BTC);
+    wkWalletReplaceTransfer (wallet, transfers[3], wkTransferTake (replacement));
+    assert (WK_TRUE == wkWalletHasTransfer (wallet, replacement));
+
+    remaining = wkWalletGetTransfers (wallet, &remainingCount);
+    assert (count / 2 == remainingCount);
+    assert (remaining[1] == replacement);
+    for (size_t index = 0; index < remainingCount; index++)
+        wkTransferGive (remaining[index]);
+    free (remaining);
+
+    // Adding transfers already in the wallet avoids no recompute
+    WKWalletBalanceCounters counters = wkWalletGetBalanceCounters (wallet);
+    BRArrayOf(WKTransfer) existing;
+    array_new (existing, 1);
+    array_add (existing, wkTransferTake (replacement));
+    wkWalletAddTransfers (wallet, existing);
+    assert (counters.recomputesAvoided == wkWalletGetBalanceCounters(wallet).recomputesAvoided);
+    assert (counters.updates           == wkWalletGetBalanceCounters(wallet).updates);
+    wkTransferGive (replacement);
+
+    for (size_t index = 0; index < transfersCount; index++)
+        wkTransferGive (transfers[index]);
+    free (transfers);
+
+    wkWalletGive (wallet);
+    btcWalletFree (wid);
+    wkUnitGive (sat);
+    wkCurrencyGive (btc);
+}
+
 static void
 runWalletKitTransferTests (void) {
     transferTestsBalance();
     transferTestsAddress();
+    transferTestsWalletBalance();
+    transferTestsIndex();
+}
+
+extern void
+runWalletKitTransferPerfTests (size_t count) {
+    WKCurrency btc = wkCurrencyCreate ("BitcoinUIDS", "Bitcoin", "BTC", "native", NULL);
+    WKUnit     sat = wkUnitCreateAsBase (btc, "SatoshiUIDS", "Satoshi", "SAT");
+
+    BRMasterPubKey mpk = transferTestsGetMPK();
+    BRBitcoinWallet *wid = btcWalletNew (btcChainParams(false)->addrParams, NULL, 0, mpk);
+    btcWalletSetCallbacks (wid, NULL, NULL, NULL, NULL, NULL);
+
+    WKWallet wallet = wkWalletCreateAsBTC (WK_NETWORK_TYPE_BTC, WK_WALLET_LISTENER_EMPTY, sat, sat, wid);
+
+    clock_t start = clock();
+    transferTestsRecover (wallet, wid, sat, count, false);
+    clock_t recovered = clock();
+
+    printf ("WalletKit: Transfer Perf: Recovered %zu in %.3f seconds\n",
+            count, (double) (recovered - start) / CLOCKS_PER_SEC);
+
+    wkWalletGive (wallet);
+    btcWalletFree (wid);
+    wkUnitGive (sat);
+    wkCurrencyGive (btc);
 }
 
 ///
@@ -133,6 +133,27 @@ typedef enum {
     WK_SYNC_DEPTH_FROM_CREATION
 } WKSyncDepth;
 
+/// MARK: Sync Filter
+
+/**
+ * The filter a P2P sync uses to find the wallet's transactions.  Only the BTC network supports
+ * selecting a filter; other networks ignore it.
+ */
+typedef enum {
+    /**
+     * Load a BIP37 bloom filter of the wallet's addresses into each peer, which then relays just the
+     * matching transactions, including unconfirmed ones.  Peers can learn the wallet's addresses.
+     */
+    WK_SYNC_FILTER_BLOOM,
+
+    /**
+     * Download BIP157/158 compact block filters, match them locally, and fetch the full blocks
+     * that match.  Peers learn nothing of the wallet's addresses, but incoming transactions are
+     * only seen once they confirm.  Requires peers that serve compact block filters.
+     */
+    WK_SYNC_FILTER_COMPACT
+} WKSyncFilter;
+
 /// The Percent Complete (0...100.0) derived from the last block processed relative to the
 /// full block range in a sync.
 typedef float WKSyncPercentComplete;
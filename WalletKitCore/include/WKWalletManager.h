@@ -67,6 +67,19 @@ wkWalletManagerGetMode (WKWalletManager cwm);
 extern void
 wkWalletManagerSetMode (WKWalletManager cwm, WKSyncMode mode);
 
+/**
+ * Get the manager's P2P sync filter
+ */
+extern WKSyncFilter
+wkWalletManagerGetSyncFilter (WKWalletManager cwm);
+
+/**
+ * Set the manager's P2P sync filter.  If P2P is connected, it reconnects to sync with the new
+ * filter.
+ */
+extern void
+wkWalletManagerSetSyncFilter (WKWalletManager cwm, WKSyncFilter filter);
+
 /**
  * Get the manager's state
  */
@@ -75,6 +75,32 @@ void btcBloomFilterInsertData(BRBitcoinBloomFilter *filter, const uint8_t *data,
 // frees memory allocated for filter
 void btcBloomFilterFree(BRBitcoinBloomFilter *filter);
 
+// a blocked bloom filter keeps all the bits for an element within one 32 byte block, so a lookup touches a single cache
+// line and tests its eight bits, one per 32 bit word of the block, together; it's used for matching locally, such as
+// ruling out tx outputs and inputs that aren't for the wallet, and isn't BIP37 compatible so can't be sent to peers
+#define BLOCKED_BLOOM_BLOCK_WORDS 8
+
+typedef struct {
+    uint32_t *blocks; // blockCount blocks of BLOCKED_BLOOM_BLOCK_WORDS words, 32 byte aligned
+    size_t blockCount;
+    size_t elemCount;
+    size_t capacity; // number of elements the filter was sized for
+    uint32_t tweak;
+    void *mem;
+} BRBitcoinBlockedBloomFilter;
+
+// returns a newly allocated blocked bloom filter struct that must be freed by calling btcBlockedBloomFilterFree()
+BRBitcoinBlockedBloomFilter *btcBlockedBloomFilterNew(double falsePositiveRate, size_t elemCount, uint32_t tweak);
+
+// true if data may have been inserted in filter, false if it definitely wasn't
+int btcBlockedBloomFilterContainsData(const BRBitcoinBlockedBloomFilter *filter, const uint8_t *data, size_t dataLen);
+
+// add data to filter
+void btcBlockedBloomFilterInsertData(BRBitcoinBlockedBloomFilter *filter, const uint8_t *data, size_t dataLen);
+
+// frees memory allocated for filter
+void btcBlockedBloomFilterFree(BRBitcoinBlockedBloomFilter *filter);
+
 #ifdef __cplusplus
 }
 #endif
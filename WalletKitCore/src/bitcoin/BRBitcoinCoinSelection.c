@@ -0,0 +1,258 @@
+//
+//  BRBitcoinCoinSelection.c
+//  WalletKitCore
+//
+//  Copyright © 2026 Breadwinner AG. All rights reserved.
+//
+//  See the LICENSE file at the project root for license information.
+//  See the CONTRIBUTORS file at the project root for a list of contributors.
+//
+
+#include "BRBitcoinCoinSelection.h"
+#include "support/BRAddress.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+
+#define BRANCH_AND_BOUND_MAX_TRIES 100000
+
+static const char *_btcCoinSelectionNames[NUMBER_OF_BITCOIN_COIN_SELECTIONS] = {
+    "WalletOrder",
+    "BranchAndBound",
+    "LargestFirst",
+    "Consolidate"
+};
+
+typedef struct {
+    int64_t value;
+    size_t index;
+} BRBitcoinCoinRank;
+
+// orders by decreasing value, then by index so that equal values keep their wallet order
+static int _btcCoinRankCompare(const void *a, const void *b)
+{
+    const BRBitcoinCoinRank *r1 = a, *r2 = b;
+
+    if (r1->value != r2->value) return (r1->value > r2->value) ? -1 : 1;
+    return (r1->index < r2->index) ? -1 : (r1->index > r2->index);
+}
+
+// the tx vsize, as per btcTransactionVSize(), with inCount inputs totalling size and witSize bytes
+static size_t _btcCoinSelectionVSize(const BRBitcoinCoinSelectionParams *params, size_t inCount, size_t size,
+                                     size_t witSize, int hasChange)
+{
+    size += params->txSize + BRVarIntSize(inCount);
+    if (witSize > 0) witSize += 2 + inCount;
+    return (size*4 + witSize + 3)/4 + (hasChange ? params->changeSize : 0);
+}
+
+// fills in result for the first count coins of order; any change less than params->minChange is left to the fee
+static int _btcCoinSelectionResult(const BRBitcoinCoin coins[], const size_t order[], size_t count,
+                                   const BRBitcoinCoinSelectionParams *params, size_t selected[],
+                                   BRBitcoinCoinSelectionResult *result)
+{
+    size_t i, size = 0, witSize = 0;
+    uint64_t fee, total = 0;
+
+    for (i = 0; i < count; i++) {
+        selected[i] = order[i];
+        total += coins[order[i]].amount;
+        size += coins[order[i]].size;
+        witSize += coins[order[i]].witSize;
+    }
+
+    fee = params->fee(params->info, _btcCoinSelectionVSize(params, count, size, witSize, 1));
+    result->count = count;
+    result->total = total;
+    result->change = (total > params->amount + fee + params->minChange) ? total - (params->amount + fee) : 0;
+    result->vsize = _btcCoinSelectionVSize(params, count, size, witSize, result->change > 0);
+    return (total >= params->amount + fee);
+}
+
+// adds coins in order until they cover the amount and fee, leaving either no change or at least params->minChange,
+// or, if consolidating, until no more fit in the tx
+static int _btcCoinSelectInOrder(const BRBitcoinCoin coins[], size_t order[], size_t coinsCount,
+                                 const BRBitcoinCoinSelectionParams *params, int consolidate, size_t selected[],
+                                 BRBitcoinCoinSelectionResult *result)
+{
+    size_t i, size = 0, witSize = 0;
+    uint64_t fee, total = 0;
+
+    for (i = 0; i < coinsCount; i++) {
+        const BRBitcoinCoin *coin = &coins[order[i]];
+
+        if (consolidate &&
+            _btcCoinSelectionVSize(params, i + 1, size + coin->size, witSize + coin->witSize, 1) > params->maxSize) break;
+
+        total += coin->amount;
+        size += coin->size;
+        witSize += coin->witSize;
+        if (consolidate) continue;
+
+        fee = params->fee(params->info, _btcCoinSelectionVSize(params, i + 1, size, witSize, 1));
+
+        if (total == params->amount + fee || total >= params->amount + fee + params->minChange) {
+            i++;
+            break;
+        }
+    }
+
+    return _btcCoinSelectionResult(coins, order, i, params, selected, result);
+}
+
+// orders coins by decreasing amount, or by decreasing amount net of the fee to spend them; returns the number of coins
+// ranked, skipping any that cost more to spend than they are worth if netOfFee is true
+static size_t _btcCoinSelectionRank(const BRBitcoinCoin coins[], size_t coinsCount,
+                                    const BRBitcoinCoinSelectionParams *params, int netOfFee,
+                                    BRBitcoinCoinRank ranks[], size_t order[])
+{
+    size_t i, count = 0, vsize;
+
+    for (i = 0; i < coinsCount; i++) {
+        vsize = (coins[i].size*4 + coins[i].witSize + (coins[i].witSize > 0) + 3)/4;
+        ranks[count].value = (int64_t) coins[i].amount - (netOfFee ? (int64_t) ((vsize*params->feePerKb + 999)/1000) : 0);
+        ranks[count].index = i;
+        if (! netOfFee || ranks[count].value > 0) count++;
+    }
+
+    qsort(ranks, count, sizeof(*ranks), _btcCoinRankCompare);
+    for (i = 0; i < count; i++) order[i] = ranks[i].index;
+    return count;
+}
+
+// a depth first search, largest coins first, for the set of coins that covers the amount and fee without a change
+// output and with the least left over to the fee; the left over may be at most the cost of a change output
+// https://murch.one/wp-content/uploads/2016/11/erhardt2016coinselection.pdf
+static int _btcCoinSelectBranchAndBound(const BRBitcoinCoin coins[], size_t coinsCount,
+                                        const BRBitcoinCoinSelectionParams *params, BRBitcoinCoinRank ranks[],
+                                        size_t order[], size_t selected[], BRBitcoinCoinSelectionResult *result)
+{
+    size_t i, tries, depth, count = _btcCoinSelectionRank(coins, coinsCount, params, 1, ranks, order),
+           *path = malloc(count*sizeof(*path) + 1), pathLen = 0, *best = malloc(count*sizeof(*best) + 1), bestLen = 0,
+           size = 0, witSize = 0;
+    uint64_t value = 0, available = 0, waste = UINT64_MAX, fee,
+             target = params->amount + params->fee(params->info, _btcCoinSelectionVSize(params, 0, 0, 0, 0)),
+             window = params->minChange + (params->changeSize*params->feePerKb + 999)/1000;
+    int found = 0, backtrack;
+
+    assert(path != NULL && best != NULL);
+    for (i = 0; i < count; i++) available += (uint64_t) ranks[i].value; // ranked net of fee, so every value is > 0
+
+    for (tries = 0, depth = 0; tries < BRANCH_AND_BOUND_MAX_TRIES; tries++, depth++) {
+        backtrack = 0;
+
+        if (value + available < target || value > target + window) backtrack = 1; // can't reach target, or overshot
+        else if (value >= target) { // a match
+            if (value - target < waste) {
+                memcpy(best, path, pathLen*sizeof(*path));
+                bestLen = pathLen;
+                waste = value - target;
+            }
+
+            if (waste == 0) break;
+            backtrack = 1;
+        }
+
+        if (backtrack) { // exclude the last included coin, restoring to available any excluded after it
+            if (pathLen == 0) break; // searched everything
+            for (depth--; depth > path[pathLen - 1]; depth--) available += (uint64_t) ranks[depth].value;
+            value -= (uint64_t) ranks[depth].value;
+            pathLen--;
+        }
+        else { // include the coin at depth, unless excluding one of equal value already covered the same branch
+            available -= (uint64_t) ranks[depth].value;
+
+            if (pathLen == 0 || depth - 1 == path[pathLen - 1] || ranks[depth].value != ranks[depth - 1].value) {
+                path[pathLen++] = depth;
+                value += (uint64_t) ranks[depth].value;
+            }
+        }
+    }
+
+    for (i = 0, value = 0; i < bestLen; i++) {
+        selected[i] = ranks[best[i]].index;
+        value += coins[selected[i]].amount;
+        size += coins[selected[i]].size;
+        witSize += coins[selected[i]].witSize;
+    }
+
+    if (bestLen > 0) { // net of fee values are estimates, so check the match against the actual fee
+        result->vsize = _btcCoinSelectionVSize(params, bestLen, size, witSize, 0);
+        fee = params->fee(params->info, result->vsize);
+        found = (value >= params->amount + fee && value - (params->amount + fee) <= window &&
+                 result->vsize <= params->maxSize);
+        result->count = bestLen;
+        result->total = value;
+        result->change = 0;
+    }
+
+    free(best);
+    free(path);
+    return found;
+}
+
+// selects coins to pay params->amount plus fee, writing the index of each selected coin to selected, which must have
+// room for coinsCount indices; coins are considered in the given order by BITCOIN_COIN_SELECTION_WALLET_ORDER
+// returns true if the selected coins cover the amount and fee, false otherwise
+int btcCoinSelect(BRBitcoinCoinSelection selection, const BRBitcoinCoin coins[], size_t coinsCount,
+                  const BRBitcoinCoinSelectionParams *params, size_t selected[], BRBitcoinCoinSelectionResult *result)
+{
+    BRBitcoinCoinRank *ranks = NULL;
+    size_t i, *order = malloc(coinsCount*sizeof(*order) + 1);
+    int r = 0;
+
+    assert(coins != NULL || coinsCount == 0);
+    assert(params != NULL && params->fee != NULL);
+    assert(selected != NULL || coinsCount == 0);
+    assert(result != NULL);
+    assert(order != NULL);
+
+    if (selection != BITCOIN_COIN_SELECTION_WALLET_ORDER) {
+        ranks = malloc(coinsCount*sizeof(*ranks) + 1);
+        assert(ranks != NULL);
+    }
+
+    switch (selection) {
+        case BITCOIN_COIN_SELECTION_BRANCH_AND_BOUND:
+            r = _btcCoinSelectBranchAndBound(coins, coinsCount, params, ranks, order, selected, result);
+            if (r) break;
+            // fall through to largest first
+
+        case BITCOIN_COIN_SELECTION_LARGEST_FIRST:
+        case BITCOIN_COIN_SELECTION_CONSOLIDATE:
+            _btcCoinSelectionRank(coins, coinsCount, params, 0, ranks, order);
+            r = _btcCoinSelectInOrder(coins, order, coinsCount, params,
+                                      (selection == BITCOIN_COIN_SELECTION_CONSOLIDATE), selected, result);
+            break;
+
+        case BITCOIN_COIN_SELECTION_WALLET_ORDER:
+        default:
+            for (i = 0; i < coinsCount; i++) order[i] = i;
+            r = _btcCoinSelectInOrder(coins, order, coinsCount, params, 0, selected, result);
+            break;
+    }
+
+    if (ranks) free(ranks);
+    free(order);
+    return r;
+}
+
+// the name of selection, for example "BranchAndBound", or NULL if selection is invalid
+const char *btcCoinSelectionName(BRBitcoinCoinSelection selection)
+{
+    return (selection < NUMBER_OF_BITCOIN_COIN_SELECTIONS) ? _btcCoinSelectionNames[selection] : NULL;
+}
+
+// the selection named name, ignoring case, or false if there is none
+int btcCoinSelectionFromName(const char *name, BRBitcoinCoinSelection *selection)
+{
+    for (size_t i = 0; name && i < NUMBER_OF_BITCOIN_COIN_SELECTIONS; i++) {
+        if (0 == strcasecmp(name, _btcCoinSelectionNames[i])) {
+            if (selection) *selection = (BRBitcoinCoinSelection) i;
+            return 1;
+        }
+    }
+
+    return 0;
+}
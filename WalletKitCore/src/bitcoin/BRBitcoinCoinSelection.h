@@ -0,0 +1,75 @@
+//
+//  BRBitcoinCoinSelection.h
+//  WalletKitCore
+//
+//  Copyright © 2026 Breadwinner AG. All rights reserved.
+//
+//  See the LICENSE file at the project root for license information.
+//  See the CONTRIBUTORS file at the project root for a list of contributors.
+//
+
+#ifndef BRBitcoinCoinSelection_h
+#define BRBitcoinCoinSelection_h
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    BITCOIN_COIN_SELECTION_WALLET_ORDER,     // coins in wallet order until the outputs and fee are covered (default)
+    BITCOIN_COIN_SELECTION_BRANCH_AND_BOUND, // a set of coins needing no change output, if any; else largest first
+    BITCOIN_COIN_SELECTION_LARGEST_FIRST,    // the largest coins first, for the fewest inputs
+    BITCOIN_COIN_SELECTION_CONSOLIDATE       // as many coins as fit in a tx, all leftover funds going to change
+} BRBitcoinCoinSelection;
+
+#define NUMBER_OF_BITCOIN_COIN_SELECTIONS   (1 + BITCOIN_COIN_SELECTION_CONSOLIDATE)
+
+// a spendable output, with its estimated input size, as per btcTransactionVSize(), split into non-witness and
+// witness bytes
+typedef struct {
+    uint64_t amount;
+    size_t size;
+    size_t witSize;
+} BRBitcoinCoin;
+
+// returns the fee for a tx of vsize bytes
+typedef uint64_t (*BRBitcoinCoinSelectionFee)(void *info, size_t vsize);
+
+typedef struct {
+    uint64_t amount;        // total amount of the tx outputs
+    uint64_t feePerKb;      // the fee rate used to rank coins by their value net of their own fee
+    uint64_t minChange;     // a change output below this amount is instead left to the fee
+    size_t txSize;          // size of the tx without any inputs or input count, as per btcTransactionSize()
+    size_t changeSize;      // size of a change output
+    size_t maxSize;         // maximum tx vsize
+    void *info;
+    BRBitcoinCoinSelectionFee fee;
+} BRBitcoinCoinSelectionParams;
+
+typedef struct {
+    size_t count;           // number of selected coins, written to the `selected` indices
+    uint64_t total;         // total amount of the selected coins
+    uint64_t change;        // change output amount, or 0 if no change output
+    size_t vsize;           // estimated tx vsize, including any change output
+} BRBitcoinCoinSelectionResult;
+
+// selects coins to pay params->amount plus fee, writing the index of each selected coin to selected, which must have
+// room for coinsCount indices; coins are considered in the given order by BITCOIN_COIN_SELECTION_WALLET_ORDER
+// returns true if the selected coins cover the amount and fee, false otherwise
+int btcCoinSelect(BRBitcoinCoinSelection selection, const BRBitcoinCoin coins[], size_t coinsCount,
+                  const BRBitcoinCoinSelectionParams *params, size_t selected[], BRBitcoinCoinSelectionResult *result);
+
+// the name of selection, for example "BranchAndBound", or NULL if selection is invalid
+const char *btcCoinSelectionName(BRBitcoinCoinSelection selection);
+
+// the selection named name, ignoring case, or false if there is none
+int btcCoinSelectionFromName(const char *name, BRBitcoinCoinSelection *selection);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRBitcoinCoinSelection_h
@@ -0,0 +1,171 @@
+//
+//  BRBitcoinCompactFilter.c
+//  WalletKitCore
+//
+//  Copyright © 2026 Breadwinner AG. All rights reserved.
+//
+//  See the LICENSE file at the project root for license information.
+//  See the CONTRIBUTORS file at the project root for a list of contributors.
+//
+
+#include "BRBitcoinCompactFilter.h"
+#include "support/BRCrypto.h"
+#include "support/BRAddress.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+typedef struct {
+    const uint8_t *buf;
+    size_t len;
+    size_t bit; // offset, in bits, of the next bit to read
+} _BRGolombReader;
+
+// the high 64 bits of the 128 bit product a*b
+static uint64_t _mulHigh64(uint64_t a, uint64_t b)
+{
+    uint64_t aLo = (uint32_t)a, aHi = a >> 32, bLo = (uint32_t)b, bHi = b >> 32,
+             lo = aLo*bLo, mid1 = aHi*bLo, mid2 = aLo*bHi,
+             carry = ((lo >> 32) + (uint32_t)mid1 + (uint32_t)mid2) >> 32;
+
+    return aHi*bHi + (mid1 >> 32) + (mid2 >> 32) + carry;
+}
+
+static int _uint64Compare(const void *a, const void *b)
+{
+    return (*(const uint64_t *)a < *(const uint64_t *)b) ? -1 : (*(const uint64_t *)a > *(const uint64_t *)b);
+}
+
+// hashes each item, keyed by the first 16 bytes of blockHash, to a sorted set of values uniformly distributed in
+// [0, itemsCount*M)
+static void _btcCompactFilterHashItems(uint64_t values[], UInt256 blockHash, const uint8_t *items[],
+                                       const size_t itemLens[], size_t itemsCount, uint64_t range)
+{
+    uint64_t h;
+
+    for (size_t i = 0; i < itemsCount; i++) {
+        h = BRSip64(blockHash.u8, items[i], itemLens[i]);
+        values[i] = _mulHigh64(UInt64GetLE(&h), range);
+    }
+
+    qsort(values, itemsCount, sizeof(*values), _uint64Compare);
+}
+
+// writes the low count bits of x, most significant first, at bit offset *bit of buf; returns false past bufLen
+static int _btcGolombWriteBits(uint8_t *buf, size_t bufLen, size_t *bit, uint64_t x, int count)
+{
+    for (int i = count - 1; i >= 0; i--, (*bit)++) {
+        if (buf && *bit/8 >= bufLen) return 0;
+        if (buf && ((x >> i) & 1)) buf[*bit/8] |= 0x80 >> (*bit % 8);
+    }
+
+    return 1;
+}
+
+// returns the next count bits, most significant first, or sets *ok false past the end of the filter
+static uint64_t _btcGolombReadBits(_BRGolombReader *r, size_t count, int *ok)
+{
+    uint64_t x = 0;
+
+    if (r->bit + count > r->len*8) *ok = 0, count = 0;
+
+    for (size_t i = 0; i < count; i++, r->bit++) {
+        x = (x << 1) | ((r->buf[r->bit/8] >> (7 - r->bit % 8)) & 1);
+    }
+
+    return x;
+}
+
+// golomb-rice decodes the next delta: a unary quotient, 1 bits ended by a 0, then a P bit remainder
+static uint64_t _btcGolombDecode(_BRGolombReader *r, int *ok)
+{
+    uint64_t q = 0;
+
+    while (*ok && _btcGolombReadBits(r, 1, ok) == 1) q++;
+    return (q << BIP158_BASIC_P) | _btcGolombReadBits(r, BIP158_BASIC_P, ok);
+}
+
+// writes the basic filter for blockHash, holding the given distinct items, to buf
+// returns number of bytes written to buf, or total bufLen needed if buf is NULL
+size_t btcCompactFilterBuild(uint8_t *buf, size_t bufLen, UInt256 blockHash, const uint8_t *items[],
+                             const size_t itemLens[], size_t itemsCount)
+{
+    uint64_t *values = malloc(itemsCount*sizeof(*values) + 1), delta, prev = 0;
+    size_t i, off, bit = 0;
+    int r = 1;
+
+    assert(items != NULL || itemsCount == 0);
+    assert(itemLens != NULL || itemsCount == 0);
+    assert(values != NULL);
+    _btcCompactFilterHashItems(values, blockHash, items, itemLens, itemsCount, (uint64_t)itemsCount*BIP158_BASIC_M);
+    off = BRVarIntSet(buf, bufLen, itemsCount);
+    if (buf && off == 0) r = 0;
+    else if (buf) memset(&buf[off], 0, bufLen - off);
+
+    for (i = 0; r && i < itemsCount; i++) {
+        delta = values[i] - prev;
+        prev = values[i];
+
+        for (uint64_t q = delta >> BIP158_BASIC_P; r && q > 0; q--) {
+            r = _btcGolombWriteBits((buf ? &buf[off] : NULL), (off <= bufLen ? bufLen - off : 0), &bit, 1, 1);
+        }
+
+        if (r) r = _btcGolombWriteBits((buf ? &buf[off] : NULL), (off <= bufLen ? bufLen - off : 0), &bit, 0, 1);
+        if (r) r = _btcGolombWriteBits((buf ? &buf[off] : NULL), (off <= bufLen ? bufLen - off : 0), &bit, delta,
+                                       BIP158_BASIC_P);
+    }
+
+    free(values);
+    off += (bit + 7)/8;
+    return (! buf || (r && off <= bufLen)) ? off : 0;
+}
+
+// true if any of items is matched by the basic filter for blockHash, or if the filter is malformed
+int btcCompactFilterMatchAny(const uint8_t *filter, size_t filterLen, UInt256 blockHash, const uint8_t *items[],
+                             const size_t itemLens[], size_t itemsCount)
+{
+    size_t i, j = 0, off = 0;
+    uint64_t n = BRVarInt(filter, filterLen, &off), *values, value = 0;
+    _BRGolombReader r = { (filter ? &filter[off] : NULL), (off <= filterLen ? filterLen - off : 0), 0 };
+    int ok = (off > 0 && off <= filterLen && n <= r.len*8), match = 0;
+
+    assert(items != NULL || itemsCount == 0);
+    assert(itemLens != NULL || itemsCount == 0);
+    if (! ok) return 1; // a malformed filter may match anything
+    if (n == 0 || itemsCount == 0) return 0;
+    values = malloc(itemsCount*sizeof(*values));
+    assert(values != NULL);
+    _btcCompactFilterHashItems(values, blockHash, items, itemLens, itemsCount, n*BIP158_BASIC_M);
+
+    // both sets are sorted, so walk them together looking for a value in common
+    for (i = 0; ok && ! match && i < n && j < itemsCount; i++) {
+        value += _btcGolombDecode(&r, &ok);
+        while (j < itemsCount && values[j] < value) j++;
+        if (j < itemsCount && values[j] == value) match = 1;
+    }
+
+    free(values);
+    return (match || ! ok);
+}
+
+// the filter hash, as relayed in a cfheaders message
+UInt256 btcCompactFilterHash(const uint8_t *filter, size_t filterLen)
+{
+    UInt256 hash;
+
+    assert(filter != NULL || filterLen == 0);
+    BRSHA256_2(&hash, filter, filterLen);
+    return hash;
+}
+
+// the filter header for a filter with filterHash, chained to the header of the previous block's filter
+UInt256 btcCompactFilterHeader(UInt256 filterHash, UInt256 prevHeader)
+{
+    uint8_t buf[sizeof(UInt256)*2];
+    UInt256 header;
+
+    UInt256Set(buf, filterHash);
+    UInt256Set(&buf[sizeof(UInt256)], prevHeader);
+    BRSHA256_2(&header, buf, sizeof(buf));
+    return header;
+}
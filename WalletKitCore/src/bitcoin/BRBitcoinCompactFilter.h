@@ -0,0 +1,51 @@
+//
+//  BRBitcoinCompactFilter.h
+//  WalletKitCore
+//
+//  Copyright © 2026 Breadwinner AG. All rights reserved.
+//
+//  See the LICENSE file at the project root for license information.
+//  See the CONTRIBUTORS file at the project root for a list of contributors.
+//
+
+#ifndef BRBitcoinCompactFilter_h
+#define BRBitcoinCompactFilter_h
+
+#include "support/BRInt.h"
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// compact block filters are explained in BIP158: https://github.com/bitcoin/bips/blob/master/bip-0158.mediawiki
+// and are served by peers as described in BIP157: https://github.com/bitcoin/bips/blob/master/bip-0157.mediawiki
+
+#define BIP158_FILTER_TYPE_BASIC 0x00
+#define BIP158_BASIC_P           19     // golomb-rice coding parameter
+#define BIP158_BASIC_M           784931 // inverse false positive rate
+
+// the basic filter for a block holds each output script of the block, other than OP_RETURN outputs, and the output
+// script spent by each input, other than the coinbase; items are hashed with siphash, keyed by the block hash
+
+// writes the basic filter for blockHash, holding the given distinct items, to buf
+// returns number of bytes written to buf, or total bufLen needed if buf is NULL
+size_t btcCompactFilterBuild(uint8_t *buf, size_t bufLen, UInt256 blockHash, const uint8_t *items[],
+                             const size_t itemLens[], size_t itemsCount);
+
+// true if any of items is matched by the basic filter for blockHash, or if the filter is malformed
+int btcCompactFilterMatchAny(const uint8_t *filter, size_t filterLen, UInt256 blockHash, const uint8_t *items[],
+                             const size_t itemLens[], size_t itemsCount);
+
+// the filter hash, as relayed in a cfheaders message
+UInt256 btcCompactFilterHash(const uint8_t *filter, size_t filterLen);
+
+// the filter header for a filter with filterHash, chained to the header of the previous block's filter
+UInt256 btcCompactFilterHeader(UInt256 filterHash, UInt256 prevHeader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRBitcoinCompactFilter_h
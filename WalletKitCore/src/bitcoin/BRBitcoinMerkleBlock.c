@@ -90,6 +90,7 @@ typedef struct {
 typedef struct {
     BRBitcoinMerkleBlock block;
     _BRAuxPow *ap;
+    int isPacked; // hashes and flags are held in the same allocation as the block, following this struct
 } _BRAuxPowBlock;
 
 static void _BRAuxPowFree(_BRAuxPow *ap)
@@ -214,19 +215,40 @@ BRBitcoinMerkleBlock *btcMerkleBlockNew(void)
     return block;
 }
 
+// returns a new block holding copies of the given hashes and flags in the same allocation; hashes needn't be aligned
+static BRBitcoinMerkleBlock *_btcMerkleBlockNewPacked(const void *hashes, size_t hashesCount, const uint8_t *flags,
+                                                      size_t flagsLen)
+{
+    _BRAuxPowBlock *apBlock = calloc(1, sizeof(*apBlock) + hashesCount*sizeof(UInt256) + flagsLen);
+    BRBitcoinMerkleBlock *block = &apBlock->block;
+
+    assert(apBlock != NULL);
+    assert(hashes != NULL || hashesCount == 0);
+    assert(flags != NULL || flagsLen == 0);
+    apBlock->isPacked = 1;
+    block->height = BLOCK_UNKNOWN_HEIGHT;
+    block->hashes = (hashesCount > 0) ? memcpy(apBlock + 1, hashes, hashesCount*sizeof(UInt256)) : NULL;
+    block->hashesCount = hashesCount;
+    block->flags = (flagsLen > 0) ? memcpy((UInt256 *)(apBlock + 1) + hashesCount, flags, flagsLen) : NULL;
+    block->flagsLen = flagsLen;
+    return block;
+}
+
 // returns a deep copy of block and that must be freed by calling btcMerkleBlockFree()
 BRBitcoinMerkleBlock *btcMerkleBlockCopy(const BRBitcoinMerkleBlock *block)
 {
     assert(block != NULL);
     
-    BRBitcoinMerkleBlock *cpy = btcMerkleBlockNew();
+    BRBitcoinMerkleBlock *cpy = _btcMerkleBlockNewPacked(block->hashes, block->hashesCount, block->flags,
+                                                         block->flagsLen);
+    UInt256 *hashes = cpy->hashes;
+    uint8_t *flags = cpy->flags;
     size_t len = _BRAuxPowSerialize(((_BRAuxPowBlock *)block)->ap, NULL, 0, NULL);
     uint8_t _buf[0x1000], *buf = (len <= 0x1000) ? _buf : malloc(len);
 
     *cpy = *block;
-    cpy->hashes = NULL;
-    cpy->flags = NULL;
-    btcMerkleBlockSetTxHashes(cpy, block->hashes, block->hashesCount, block->flags, block->flagsLen);
+    cpy->hashes = hashes;
+    cpy->flags = flags;
     len = _BRAuxPowSerialize(((_BRAuxPowBlock *)block)->ap, buf, len, NULL);
     ((_BRAuxPowBlock *)cpy)->ap = _BRAuxPowParse(buf, len, block->blockHash, NULL);
     if (buf != _buf) free(buf);
@@ -237,12 +259,18 @@ BRBitcoinMerkleBlock *btcMerkleBlockCopy(const BRBitcoinMerkleBlock *block)
 // returns a merkle block struct that must be freed by calling btcMerkleBlockFree()
 BRBitcoinMerkleBlock *btcMerkleBlockParse(const uint8_t *buf, size_t bufLen)
 {
-    BRBitcoinMerkleBlock *block = (buf && 80 <= bufLen) ? btcMerkleBlockNew() : NULL;
-    _BRAuxPowBlock *apBlock = (_BRAuxPowBlock *)block;
+    _BRAuxPowBlock header;
+    BRBitcoinMerkleBlock *block = (buf && 80 <= bufLen) ? &header.block : NULL;
+    _BRAuxPowBlock *apBlock = &header;
+    UInt256 *hashes;
+    uint8_t *flags;
     size_t off = 0, len = 0, l = 0;
     
     assert(buf != NULL || bufLen == 0);
-    
+    memset(&header, 0, sizeof(header));
+    header.block.height = BLOCK_UNKNOWN_HEIGHT;
+
+    // the header is parsed onto the stack, and the block then allocated along with its hashes and flags
     if (block) {
         block->version = UInt32GetLE(&buf[off]);
         off += sizeof(uint32_t);
@@ -266,10 +294,14 @@ BRBitcoinMerkleBlock *btcMerkleBlockParse(const uint8_t *buf, size_t bufLen)
         block->flagsLen = (size_t)BRVarInt(&buf[off + len], (off + len <= bufLen ? bufLen - (off + len) : 0), &l);
         
         if (block->totalTx > 0 && off + len + l + block->flagsLen == bufLen) {
-            block->hashes = malloc(block->hashesCount*sizeof(UInt256));
-            memcpy(block->hashes, &buf[off + 4 + BRVarIntSize(block->hashesCount)], block->hashesCount*sizeof(UInt256));
-            block->flags = malloc(block->flagsLen);
-            memcpy(block->flags, &buf[off + len + l], block->flagsLen);
+            block = _btcMerkleBlockNewPacked(&buf[off + 4 + BRVarIntSize(block->hashesCount)], block->hashesCount,
+                                             &buf[off + len + l], block->flagsLen);
+            hashes = block->hashes;
+            flags = block->flags;
+            *block = header.block;
+            block->hashes = hashes;
+            block->flags = flags;
+            ((_BRAuxPowBlock *)block)->ap = header.ap;
 
             if (! btcMerkleBlockIsValid(block, block->timestamp + BLOCK_MAX_TIME_DRIFT)) { // parse as header
                 btcMerkleBlockFree(block);
@@ -277,7 +309,12 @@ BRBitcoinMerkleBlock *btcMerkleBlockParse(const uint8_t *buf, size_t bufLen)
             }
             else off = bufLen;
         }
-        else block->totalTx = block->hashesCount = block->flagsLen = 0;
+        else {
+            block->totalTx = block->hashesCount = block->flagsLen = 0;
+            block = btcMerkleBlockNew();
+            *block = header.block;
+            ((_BRAuxPowBlock *)block)->ap = header.ap;
+        }
         
         if (off > bufLen) {
             btcMerkleBlockFree(block);
@@ -374,15 +411,84 @@ void btcMerkleBlockSetTxHashes(BRBitcoinMerkleBlock *block, const UInt256 hashes
     assert(hashes != NULL || hashesCount == 0);
     assert(flags != NULL || flagsLen == 0);
     
-    if (block->hashes) free(block->hashes);
+    if (block->hashes && ! ((_BRAuxPowBlock *)block)->isPacked) free(block->hashes);
     block->hashes = (hashesCount > 0) ? malloc(hashesCount*sizeof(UInt256)) : NULL;
     if (block->hashes) memcpy(block->hashes, hashes, hashesCount*sizeof(UInt256));
-    if (block->flags) free(block->flags);
+    block->hashesCount = hashesCount;
+    if (block->flags && ! ((_BRAuxPowBlock *)block)->isPacked) free(block->flags);
+    ((_BRAuxPowBlock *)block)->isPacked = 0;
     block->flags = (flagsLen > 0) ? malloc(flagsLen) : NULL;
     if (block->flags) memcpy(block->flags, flags, flagsLen);
+    block->flagsLen = flagsLen;
+}
+
+// number of nodes at the given height above the leaves of a merkle tree with txCount leaves
+inline static size_t _btcMerkleTreeWidth(size_t txCount, uint32_t height)
+{
+    return (txCount + ((size_t)1 << height) - 1) >> height;
+}
+
+// hash of the merkle tree node at the given height and position, computed from all the tx hashes in the block
+static UInt256 _btcMerkleTreeNodeHash(const UInt256 txHashes[], size_t txCount, uint32_t height, size_t pos)
+{
+    UInt256 hashes[2], md;
+
+    if (height == 0) return txHashes[pos];
+    hashes[0] = _btcMerkleTreeNodeHash(txHashes, txCount, height - 1, pos*2);
+    hashes[1] = (pos*2 + 1 < _btcMerkleTreeWidth(txCount, height - 1)) ?
+                _btcMerkleTreeNodeHash(txHashes, txCount, height - 1, pos*2 + 1) : hashes[0];
+    BRSHA256_2(&md, hashes, sizeof(hashes));
+    return md;
 }
 
-// recursively walks the merkle tree to calculate the merkle root
+// recursively builds the partial merkle branch for the matched tx, in the depth-first order described above
+static void _btcMerkleBlockSetTxMatchesR(BRBitcoinMerkleBlock *block, const UInt256 txHashes[], const uint8_t matches[],
+                                         size_t txCount, uint32_t height, size_t pos)
+{
+    uint8_t flag = 0;
+
+    for (size_t i = pos << height; ! flag && i < ((pos + 1) << height) && i < txCount; i++) flag = matches[i];
+    if (flag) block->flags[block->flagsLen/8] |= (1 << (block->flagsLen % 8));
+    block->flagsLen++; // counts bits until the tree is built
+
+    if (! flag || height == 0) block->hashes[block->hashesCount++] = _btcMerkleTreeNodeHash(txHashes, txCount, height, pos);
+    else {
+        _btcMerkleBlockSetTxMatchesR(block, txHashes, matches, txCount, height - 1, pos*2); // left branch
+
+        if (pos*2 + 1 < _btcMerkleTreeWidth(txCount, height - 1)) { // right branch, if any
+            _btcMerkleBlockSetTxMatchesR(block, txHashes, matches, txCount, height - 1, pos*2 + 1);
+        }
+    }
+}
+
+// sets totalTx, and the hashes and flags fields, for a block created with btcMerkleBlockNew() or parsed from a header,
+// so that it proves the inclusion of each tx for which matches[i] is true; txHashes holds every tx in the block in order
+void btcMerkleBlockSetTxMatches(BRBitcoinMerkleBlock *block, const UInt256 txHashes[], const uint8_t matches[],
+                                size_t txCount)
+{
+    assert(block != NULL);
+    assert(txHashes != NULL || txCount == 0);
+    assert(matches != NULL || txCount == 0);
+
+    if (block->hashes && ! ((_BRAuxPowBlock *)block)->isPacked) free(block->hashes);
+    if (block->flags && ! ((_BRAuxPowBlock *)block)->isPacked) free(block->flags);
+    ((_BRAuxPowBlock *)block)->isPacked = 0;
+    block->totalTx = (uint32_t)txCount;
+    block->hashesCount = block->flagsLen = 0;
+    block->hashes = NULL;
+    block->flags = NULL;
+
+    if (txCount > 0) {
+        block->hashes = malloc(txCount*sizeof(UInt256)); // at most one hash per leaf
+        block->flags = calloc((txCount*2 + 64)/8, 1); // at most one bit per node
+        assert(block->hashes != NULL && block->flags != NULL);
+        _btcMerkleBlockSetTxMatchesR(block, txHashes, matches, txCount, _ceil_log2((uint32_t)txCount), 0);
+        block->flagsLen = (block->flagsLen + 7)/8;
+    }
+}
+
+// recursively walks the merkle tree to calculate the merkle root; the recursion is at most 33 levels deep, as totalTx is
+// 32 bits, and a CVE-2012-2459 duplicate anywhere in the tree makes every node above it, and so the root, zero
 // NOTE: this merkle tree design has a security vulnerability (CVE-2012-2459), which can be defended against by
 // considering the merkle root invalid if there are duplicate hashes in any rows with an even number of elements
 static UInt256 _btcMerkleBlockRootR(const BRBitcoinMerkleBlock *block, size_t *hashIdx, size_t *flagIdx, uint32_t depth)
@@ -398,7 +504,7 @@ static UInt256 _btcMerkleBlockRootR(const BRBitcoinMerkleBlock *block, size_t *h
             hashes[0] = _btcMerkleBlockRootR(block, hashIdx, flagIdx, depth + 1); // left branch
             hashes[1] = _btcMerkleBlockRootR(block, hashIdx, flagIdx, depth + 1); // right branch
 
-            if (! UInt256IsZero(hashes[0]) && ! UInt256Eq(hashes[0], hashes[1])) {
+            if (*hashIdx != SIZE_MAX && ! UInt256IsZero(hashes[0]) && ! UInt256Eq(hashes[0], hashes[1])) {
                 if (UInt256IsZero(hashes[1])) hashes[1] = hashes[0]; // if right branch is missing, dup left branch
                 BRSHA256_2(&md, hashes, sizeof(hashes));
             }
@@ -406,10 +512,22 @@ static UInt256 _btcMerkleBlockRootR(const BRBitcoinMerkleBlock *block, size_t *h
         }
         else md = block->hashes[(*hashIdx)++]; // leaf
     }
-    
+
     return md;
 }
 
+// calculates the merkle root, or returns zero if the block has more hashes or flags than its tree could need
+static UInt256 _btcMerkleBlockRoot(const BRBitcoinMerkleBlock *block)
+{
+    uint32_t depth = _ceil_log2(block->totalTx);
+    size_t hashIdx = 0, flagIdx = 0, maxNodes = 2*(size_t)block->totalTx + depth + 1; // a tree's rows sum to this
+
+    // each node walked is a hash or lies on the path from the root to one, and uses one flag bit
+    if (block->hashesCount*(depth + 1) < maxNodes) maxNodes = block->hashesCount*(depth + 1);
+    if (block->hashesCount > block->totalTx || block->flagsLen > (maxNodes + 7)/8) return UINT256_ZERO;
+    return _btcMerkleBlockRootR(block, &hashIdx, &flagIdx, 0);
+}
+
 // true if the given tx hash is known to be included in the block
 int btcMerkleBlockContainsTxHash(const BRBitcoinMerkleBlock *block, UInt256 txHash)
 {
@@ -435,8 +553,7 @@ int btcMerkleBlockIsValid(const BRBitcoinMerkleBlock *block, uint32_t currentTim
     // target is in "compact" format, where the most significant byte is the size of the value in bytes, next
     // bit is the sign, and the last 23 bits is the value after having been right shifted by (size - 3)*8 bits
     const uint32_t size = block->target >> 24, target = block->target & 0x007fffff;
-    size_t hashIdx = 0, flagIdx = 0;
-    UInt256 merkleRoot = _btcMerkleBlockRootR(block, &hashIdx, &flagIdx, 0);
+    UInt256 merkleRoot = _btcMerkleBlockRoot(block);
     _BRAuxPow *ap = ((_BRAuxPowBlock *)block)->ap;
     int r = 1;
     
@@ -542,8 +659,8 @@ const BRBitcoinMerkleBlock *btcMerkleBlockAuxPowParent(const BRBitcoinMerkleBloc
 void btcMerkleBlockFree(BRBitcoinMerkleBlock *block)
 {
     assert(block != NULL);
-    if (block->hashes) free(block->hashes);
-    if (block->flags) free(block->flags);
+    if (block->hashes && ! ((_BRAuxPowBlock *)block)->isPacked) free(block->hashes);
+    if (block->flags && ! ((_BRAuxPowBlock *)block)->isPacked) free(block->flags);
     _BRAuxPowFree(((_BRAuxPowBlock *)block)->ap);
     free(block);
 }
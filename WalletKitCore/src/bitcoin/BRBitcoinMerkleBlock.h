@@ -77,6 +77,11 @@ size_t btcMerkleBlockTxHashes(const BRBitcoinMerkleBlock *block, UInt256 *txHash
 void btcMerkleBlockSetTxHashes(BRBitcoinMerkleBlock *block, const UInt256 hashes[], size_t hashesCount,
                                const uint8_t *flags, size_t flagsLen);
 
+// sets totalTx, and the hashes and flags fields, for a block created with btcMerkleBlockNew() or parsed from a header,
+// so that it proves the inclusion of each tx for which matches[i] is true; txHashes holds every tx in the block in order
+void btcMerkleBlockSetTxMatches(BRBitcoinMerkleBlock *block, const UInt256 txHashes[], const uint8_t matches[],
+                                size_t txCount);
+
 // true if the given tx hash is known to be included in the block
 int btcMerkleBlockContainsTxHash(const BRBitcoinMerkleBlock *block, UInt256 txHash);
 
@@ -24,6 +24,7 @@
 
 #include "BRBitcoinPeer.h"
 #include "BRBitcoinMerkleBlock.h"
+#include "BRBitcoinCompactFilter.h"
 #include "support/BRBase.h"
 #include "support/BRAddress.h"
 #include "support/BRSet.h"
@@ -39,6 +40,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <netdb.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <netinet/in.h>	
@@ -57,6 +59,13 @@
 
 #define PTHREAD_STACK_SIZE  (512 * 1024)
 
+// All peer sockets are owned by a small, fixed set of reactor threads rather than a thread per peer.  Each reactor
+// waits in poll() on its peers' sockets and accepts complete messages from a per-peer receive buffer.
+#define PEER_REACTOR_COUNT         (2)
+#define PEER_REACTOR_BUFFER_SIZE   (0x10000)
+#define PEER_REACTOR_POLL_MAX_MS   (1000)   // wake at least this often to pick up a (re)scheduled disconnect
+#define PEER_REACTOR_READ_LIMIT    (16)     // reads from one peer per poll(), so a busy peer can't starve the others
+
 // the standard blockchain download protocol works as follows (for SPV mode):
 // - local peer sends getblocks
 // - remote peer reponds with inv containing up to 500 block hashes
@@ -107,8 +116,8 @@ typedef struct {
     uint32_t version, lastblock, earliestKeyTime, currentBlockHeight;
     double startTime, pingTime;
     volatile double disconnectTime, mempoolTime;
-    int sentVerack, gotVerack, sentGetaddr, sentFilter, sentGetdata, sentMempool, sentGetblocks;
-    UInt256 lastBlockHash;
+    int sentVerack, gotVerack, sentGetaddr, sentFilter, sentGetdata, sentMempool, sentGetblocks, headersFirst;
+    UInt256 lastBlockHash, lastHeaderHash;
     BRBitcoinMerkleBlock *currentBlock;
     UInt256 *currentBlockTxHashes, *knownBlockHashes, *knownTxHashes;
     BRSet *knownTxHashSet;
@@ -127,11 +136,19 @@ typedef struct {
     BRBitcoinTransaction *(*requestedTx)(void *info, UInt256 txHash);
     int (*networkIsReachable)(void *info);
     void (*threadCleanup)(void *info);
+    void (*relayedCFHeaders)(void *info, UInt256 stopHash, UInt256 prevHeader, const UInt256 filterHashes[],
+                             size_t filterCount);
+    void (*relayedCFilter)(void *info, UInt256 blockHash, const uint8_t *filter, size_t filterLen);
+    void (*relayedFullBlock)(void *info, BRBitcoinMerkleBlock *block, BRBitcoinTransaction *txs[], size_t txCount);
     void **volatile pongInfo;
     void (**volatile pongCallback)(void *info, int success);
     void *volatile mempoolInfo;
     void (*volatile mempoolCallback)(void *info, int success);
-    pthread_t thread;
+    struct BRBitcoinPeerReactorRecord *reactor;
+    int connecting; // waiting on a non-blocking connect(); reactor only
+    uint8_t *buffer; // received bytes, bufferStart through bufferEnd, not yet accepted; reactor only
+    size_t bufferSize, bufferStart, bufferEnd;
+    double msgTimeout; // time by which a partially received message must complete; reactor only
     pthread_mutex_t lock;
 } BRBitcoinPeerContext;
 
@@ -359,6 +376,13 @@ static int _btcPeerAcceptInvMessage(BRBitcoinPeer *peer, const uint8_t *msg, siz
             r = 0;
         }
         else {
+            if (ctx->relayedCFilter && blockCount > 0 && ! UInt256IsZero(ctx->lastHeaderHash)) {
+                UInt256 locators[] = { ctx->lastHeaderHash };
+
+                btcPeerSendGetheaders(peer, locators, 1, UINT256_ZERO); // compact filter mode syncs headers only
+                blockCount = 0;
+            }
+
             if (! ctx->sentFilter && ! ctx->sentGetblocks) blockCount = 0;
             if (blockCount == 1 && UInt256Eq(ctx->lastBlockHash, UInt256Get(blocks[0]))) blockCount = 0;
             if (blockCount == 1) ctx->lastBlockHash = UInt256Get(blocks[0]);
@@ -468,7 +492,9 @@ static int _btcPeerAcceptHeadersMessage(BRBitcoinPeer *peer, const uint8_t *msg,
     
     peer_log(peer, "got %zu header(s)", count);
     
-    if (count < 2000 && (timestamp == 0 || timestamp + 7*24*60*60 + BLOCK_MAX_TIME_DRIFT < ctx->earliestKeyTime)) {
+    // when requesting headers all the way to the chain tip, no headers means we already have the tip
+    if (count < 2000 && (count > 0 || ! (ctx->headersFirst || ctx->relayedCFilter)) &&
+        (timestamp == 0 || timestamp + 7*24*60*60 + BLOCK_MAX_TIME_DRIFT < ctx->earliestKeyTime)) {
         peer_log(peer, "non-standard headers message, %zu is fewer header(s) than expected", count);
         r = 0;
     }
@@ -487,8 +513,17 @@ static int _btcPeerAcceptHeadersMessage(BRBitcoinPeer *peer, const uint8_t *msg,
         }
         else {
             if (i == 0) locators[1] = block->blockHash;
-            
-            if (! sentRequest && block->timestamp + 7*24*60*60 + BLOCK_MAX_TIME_DRIFT >= ctx->earliestKeyTime) {
+            ctx->lastHeaderHash = block->blockHash;
+
+            if (ctx->headersFirst || ctx->relayedCFilter) { // request headers all the way to the chain tip
+                // in headers first mode, the caller paces the download and requests each batch itself
+                if (! ctx->headersFirst && ! sentRequest && i + 1 == count && count >= 2000) {
+                    locators[0] = block->blockHash;
+                    btcPeerSendGetheaders(peer, locators, 2, UINT256_ZERO); // request next 2000 headers
+                    sentRequest = 1;
+                }
+            }
+            else if (! sentRequest && block->timestamp + 7*24*60*60 + BLOCK_MAX_TIME_DRIFT >= ctx->earliestKeyTime) {
                 locators[0] = block->blockHash;
                 btcPeerSendGetblocks(peer, locators, 2, UINT256_ZERO); // switch to requesting filtered blocks
                 sentRequest = 1;
@@ -748,6 +783,119 @@ static int _btcPeerAcceptMerkleblockMessage(BRBitcoinPeer *peer, const uint8_t *
     return r;
 }
 
+// a full block, requested in compact filter mode after its filter matched the wallet
+static int _btcPeerAcceptBlockMessage(BRBitcoinPeer *peer, const uint8_t *msg, size_t msgLen)
+{
+    BRBitcoinPeerContext *ctx = (BRBitcoinPeerContext *)peer;
+    BRBitcoinMerkleBlock *block = btcMerkleBlockParse(msg, (msgLen < 80) ? msgLen : 80);
+    size_t i, len, off = 80, count = (size_t)BRVarInt(&msg[(msgLen < off) ? msgLen : off],
+                                                      (off <= msgLen ? msgLen - off : 0), &len);
+    BRBitcoinTransaction **txs = NULL;
+    int r = 1;
+
+    off += len;
+
+    if (! block || off > msgLen || count == 0 || count > (msgLen - off)/60) { // a tx is at least 60 bytes
+        peer_log(peer, "malformed block message with length: %zu", msgLen);
+        r = 0;
+    }
+    else if (! btcMerkleBlockIsValid(block, (uint32_t)time(NULL))) {
+        peer_log(peer, "invalid block: %s", u256hex(block->blockHash));
+        r = 0;
+    }
+    else if (! ctx->sentGetdata) {
+        peer_log(peer, "got block message before requesting one");
+        r = 0;
+    }
+    else {
+        txs = calloc(count, sizeof(*txs));
+        assert(txs != NULL);
+
+        for (i = 0; r && i < count; i++) {
+            txs[i] = btcTransactionParse(&msg[off], msgLen - off);
+            if (txs[i]) off += btcTransactionSerialize(txs[i], NULL, 0);
+
+            if (! txs[i] || off > msgLen) {
+                peer_log(peer, "malformed block message, tx %zu of %zu in block: %s", i, count, u256hex(block->blockHash));
+                r = 0;
+            }
+        }
+    }
+
+    if (r && ctx->relayedFullBlock) {
+        peer_log(peer, "got block: %s with %zu tx", u256hex(block->blockHash), count);
+        block->totalTx = (uint32_t)count;
+        ctx->relayedFullBlock(ctx->info, block, txs, count);
+    }
+    else {
+        for (i = 0; txs && i < count; i++) {
+            if (txs[i]) btcTransactionFree(txs[i]);
+        }
+
+        if (block) btcMerkleBlockFree(block);
+    }
+
+    if (txs) free(txs);
+    return r;
+}
+
+// described in BIP157: https://github.com/bitcoin/bips/blob/master/bip-0157.mediawiki
+static int _btcPeerAcceptCFHeadersMessage(BRBitcoinPeer *peer, const uint8_t *msg, size_t msgLen)
+{
+    BRBitcoinPeerContext *ctx = (BRBitcoinPeerContext *)peer;
+    size_t len = 0, off = sizeof(uint8_t) + sizeof(UInt256)*2,
+           count = (size_t)BRVarInt(&msg[(msgLen < off) ? msgLen : off], (off <= msgLen ? msgLen - off : 0), &len);
+    int r = 1;
+
+    off += len;
+
+    if (off > msgLen || off + count*sizeof(UInt256) > msgLen) {
+        peer_log(peer, "malformed cfheaders message, length is %zu, should be %zu for %zu filter hash(es)", msgLen,
+                 off + count*sizeof(UInt256), count);
+        r = 0;
+    }
+    else if (msg[0] != BIP158_FILTER_TYPE_BASIC) {
+        peer_log(peer, "dropping cfheaders message, unknown filter type %u", msg[0]);
+    }
+    else {
+        UInt256 filterHashes[(count > 0) ? count : 1];
+
+        peer_log(peer, "got cfheaders with %zu filter hash(es)", count);
+        for (size_t i = 0; i < count; i++) filterHashes[i] = UInt256Get(&msg[off + i*sizeof(UInt256)]);
+
+        if (ctx->relayedCFHeaders) {
+            ctx->relayedCFHeaders(ctx->info, UInt256Get(&msg[sizeof(uint8_t)]),
+                                  UInt256Get(&msg[sizeof(uint8_t) + sizeof(UInt256)]), filterHashes, count);
+        }
+    }
+
+    return r;
+}
+
+// described in BIP157: https://github.com/bitcoin/bips/blob/master/bip-0157.mediawiki
+static int _btcPeerAcceptCFilterMessage(BRBitcoinPeer *peer, const uint8_t *msg, size_t msgLen)
+{
+    BRBitcoinPeerContext *ctx = (BRBitcoinPeerContext *)peer;
+    size_t len = 0, off = sizeof(uint8_t) + sizeof(UInt256),
+           filterLen = (size_t)BRVarInt(&msg[(msgLen < off) ? msgLen : off], (off <= msgLen ? msgLen - off : 0), &len);
+    int r = 1;
+
+    off += len;
+
+    if (off > msgLen || off + filterLen != msgLen) {
+        peer_log(peer, "malformed cfilter message, length is %zu, should be %zu", msgLen, off + filterLen);
+        r = 0;
+    }
+    else if (msg[0] != BIP158_FILTER_TYPE_BASIC) {
+        peer_log(peer, "dropping cfilter message, unknown filter type %u", msg[0]);
+    }
+    else if (ctx->relayedCFilter) {
+        ctx->relayedCFilter(ctx->info, UInt256Get(&msg[sizeof(uint8_t)]), &msg[off], filterLen);
+    }
+
+    return r;
+}
+
 // described in BIP61: https://github.com/bitcoin/bips/blob/master/bip-0061.mediawiki
 static int _btcPeerAcceptRejectMessage(BRBitcoinPeer *peer, const uint8_t *msg, size_t msgLen)
 {
@@ -846,19 +994,109 @@ static int _btcPeerAcceptMessage(BRBitcoinPeer *peer, const uint8_t *msg, size_t
     else if (strncmp(MSG_MERKLEBLOCK, type, 12) == 0) r = _btcPeerAcceptMerkleblockMessage(peer, msg, msgLen);
     else if (strncmp(MSG_REJECT, type, 12) == 0) r = _btcPeerAcceptRejectMessage(peer, msg, msgLen);
     else if (strncmp(MSG_FEEFILTER, type, 12) == 0) r = _btcPeerAcceptFeeFilterMessage(peer, msg, msgLen);
+    else if (strncmp(MSG_BLOCK, type, 12) == 0 && ctx->relayedFullBlock) r = _btcPeerAcceptBlockMessage(peer, msg, msgLen);
+    else if (strncmp(MSG_CFHEADERS, type, 12) == 0) r = _btcPeerAcceptCFHeadersMessage(peer, msg, msgLen);
+    else if (strncmp(MSG_CFILTER, type, 12) == 0) r = _btcPeerAcceptCFilterMessage(peer, msg, msgLen);
     else peer_log(peer, "dropping %s, length %zu, not implemented", type, msgLen);
 
     return r;
 }
 
-static int _btcPeerOpenSocket(BRBitcoinPeer *peer, int domain, double timeout, int *error)
+typedef struct BRBitcoinPeerReactorRecord {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    int wakeFds[2]; // a byte written to wakeFds[1] interrupts poll()
+    BRBitcoinPeer **added; // peers handed over by btcPeerConnect(), not yet owned by the reactor thread
+    size_t peersCount; // all peers, added or owned; used to balance peers across reactors
+} BRBitcoinPeerReactor;
+
+static BRBitcoinPeerReactor _peerReactors[PEER_REACTOR_COUNT];
+static pthread_once_t _peerReactorsOnce = PTHREAD_ONCE_INIT;
+
+static void _peerReactorWake(BRBitcoinPeerReactor *reactor)
+{
+    uint8_t byte = 0;
+
+    // a full pipe is already a pending wakeup
+    if (write(reactor->wakeFds[1], &byte, sizeof(byte)) < 0 && errno != EWOULDBLOCK && errno != EAGAIN) {
+        _peer_log("reactor wake error: %s\n", strerror(errno));
+    }
+}
+
+static double _peerTime(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + (double)tv.tv_usec/1000000;
+}
+
+static int _peerGetSocket (BRBitcoinPeerContext *ctx) {
+    int socket;
+
+    pthread_mutex_lock(&ctx->lock);
+    socket = ctx->socket;
+    pthread_mutex_unlock(&ctx->lock);
+
+    return socket;
+}
+
+static double _peerGetDisconnectTime (BRBitcoinPeerContext *ctx) {
+    double value;
+
+    pthread_mutex_lock(&ctx->lock);
+    value = ctx->disconnectTime;
+    pthread_mutex_unlock(&ctx->lock);
+
+    return value;
+}
+
+static double _peerGetMempoolTime (BRBitcoinPeerContext *ctx) {
+    double value;
+
+    pthread_mutex_lock(&ctx->lock);
+    value = ctx->mempoolTime;
+    pthread_mutex_unlock(&ctx->lock);
+
+    return value;
+}
+
+// called once a non-blocking connect() completes; returns an errno.h code or 0
+static int _btcPeerDidOpenSocket(BRBitcoinPeer *peer)
+{
+    BRBitcoinPeerContext *ctx = (BRBitcoinPeerContext *)peer;
+    socklen_t optLen = sizeof(int);
+    int sock = _peerGetSocket(ctx), arg, err = 0;
+
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &optLen) < 0) err = errno;
+
+    if (! err) {
+        // sends remain blocking, with the one second timeout; the reactor reads with MSG_DONTWAIT
+        arg = fcntl(sock, F_GETFL, NULL);
+        if (arg < 0 || fcntl(sock, F_SETFL, arg & ~O_NONBLOCK) < 0) err = errno;
+    }
+
+    if (err) {
+        peer_log(peer, "connect error: %s", strerror(err));
+    }
+    else {
+        peer_log(peer, "socket connected");
+        ctx->connecting = 0;
+        ctx->startTime = _peerTime();
+        btcPeerSendVersionMessage(peer);
+    }
+
+    return err;
+}
+
+// starts a non-blocking connect(), returns an errno.h code or 0
+static int _btcPeerOpenSocket(BRBitcoinPeer *peer, int domain)
 {
     BRBitcoinPeerContext *ctx = (BRBitcoinPeerContext *)peer;
     struct sockaddr_storage addr;
     struct timeval tv;
-    fd_set fds;
-    socklen_t addrLen, optLen;
-    int count, arg = 0, err = 0, on = 1, r = 1;
+    socklen_t addrLen;
+    int arg = 0, err = 0, on = 1;
     int sock;
 
     pthread_mutex_lock(&ctx->lock);
@@ -867,10 +1105,9 @@ static int _btcPeerOpenSocket(BRBitcoinPeer *peer, int domain, double timeout, i
 
     if (sock < 0) {
         err = errno;
-        r = 0;
     }
     else {
-        tv.tv_sec = 1; // one second timeout for send/receive, so thread doesn't block for too long
+        tv.tv_sec = 1; // one second timeout for send, so a sender doesn't block for too long
         tv.tv_usec = 0;
         setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
         setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
@@ -879,11 +1116,10 @@ static int _btcPeerOpenSocket(BRBitcoinPeer *peer, int domain, double timeout, i
         setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
 #endif
         arg = fcntl(sock, F_GETFL, NULL);
-        if (arg < 0 || fcntl(sock, F_SETFL, arg | O_NONBLOCK) < 0) r = 0; // temporarily set socket non-blocking
-        if (! r) err = errno;
+        if (arg < 0 || fcntl(sock, F_SETFL, arg | O_NONBLOCK) < 0) err = errno; // non-blocking until connected
     }
 
-    if (r) {
+    if (! err) {
         memset(&addr, 0, sizeof(addr));
         
         if (domain == PF_INET6) {
@@ -899,196 +1135,188 @@ static int _btcPeerOpenSocket(BRBitcoinPeer *peer, int domain, double timeout, i
             addrLen = sizeof(struct sockaddr_in);
         }
         
+        ctx->connecting = 1;
         if (connect(sock, (struct sockaddr *)&addr, addrLen) < 0) err = errno;
         
         if (err == EINPROGRESS) {
-            err = 0;
-            optLen = sizeof(err);
-            tv.tv_sec  = (long)  timeout;
-            tv.tv_usec = (long) (timeout*1000000) % 1000000;
-            FD_ZERO(&fds);
-            FD_SET(sock, &fds);
-            count = select(sock + 1, NULL, &fds, NULL, &tv);
-
-            if (count <= 0 || getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &optLen) < 0 || err) {
-                if (count == 0) err = ETIMEDOUT;
-                if (count < 0 || ! err) err = errno;
-                r = 0;
-            }
+            err = 0; // the reactor polls for the connect() to complete
         }
         else if (err && domain == PF_INET6 && _btcPeerIsIPv4(peer)) {
-            return _btcPeerOpenSocket(peer, PF_INET, timeout, error); // fallback to IPv4
+            pthread_mutex_lock(&ctx->lock);
+            ctx->socket = -1;
+            pthread_mutex_unlock(&ctx->lock);
+            close(sock);
+            return _btcPeerOpenSocket(peer, PF_INET); // fallback to IPv4
+        }
+        else if (! err) {
+            return _btcPeerDidOpenSocket(peer);
         }
-        else if (err) r = 0;
-
-        if (r) peer_log(peer, "socket connected");
-        fcntl(sock, F_SETFL, arg); // restore socket non-blocking status
     }
 
-    if (! r && err) peer_log(peer, "connect error: %s", strerror(err));
-    if (error && err) *error = err;
-    return r;
+    if (err) peer_log(peer, "connect error: %s", strerror(err));
+    return err;
 }
 
-static int _peerCheckAndGetSocket (BRBitcoinPeerContext *ctx, int *socket) {
-    int exists;
-
-    pthread_mutex_lock(&ctx->lock);
-    exists = ctx->socket >= 0;
-    if (NULL != socket) *socket = ctx->socket;
-    pthread_mutex_unlock(&ctx->lock);
-
-    return exists;
-}
+// accepts each complete message in the receive buffer; returns an errno.h code or 0
+static int _btcPeerAcceptBuffer(BRBitcoinPeer *peer, double time)
+{
+    BRBitcoinPeerContext *ctx = (BRBitcoinPeerContext *)peer;
+    uint8_t *buf;
+    size_t len;
+    int error = 0;
 
-static int _peerGetSocket (BRBitcoinPeerContext *ctx) {
-    int socket;
+    ctx->msgTimeout = DBL_MAX;
 
-    pthread_mutex_lock(&ctx->lock);
-    socket = ctx->socket;
-    pthread_mutex_unlock(&ctx->lock);
+    while (! error) {
+        buf = &ctx->buffer[ctx->bufferStart];
+        len = ctx->bufferEnd - ctx->bufferStart;
 
-    return socket;
-}
+        while (sizeof(uint32_t) <= len && UInt32GetLE(buf) != ctx->magicNumber) {
+            buf++, len--, ctx->bufferStart++; // consume one byte at a time until we find the magic number
+        }
 
-static double _peerGetDisconnectTime (BRBitcoinPeerContext *ctx) {
-    double value;
+        if (len < HEADER_LENGTH) break;
 
-    pthread_mutex_lock(&ctx->lock);
-    value = ctx->disconnectTime;
-    pthread_mutex_unlock(&ctx->lock);
+        if (buf[15] != 0) { // verify header type field is NULL terminated
+            peer_log(peer, "malformed message header: type not NULL terminated");
+            error = EPROTO;
+        }
+        else {
+            const char *type = (const char *)(&buf[4]);
+            uint32_t msgLen = UInt32GetLE(&buf[16]);
+            uint32_t checksum = UInt32GetLE(&buf[20]);
+            UInt256 hash;
 
-    return value;
-}
+            if (msgLen > MAX_MSG_LENGTH) { // check message length
+                peer_log(peer, "error reading %s, message length %"PRIu32" is too long", type, msgLen);
+                error = EPROTO;
+            }
+            else if (len < HEADER_LENGTH + msgLen) { // wait for the rest of the payload
+                if (ctx->bufferSize - ctx->bufferStart < HEADER_LENGTH + msgLen) {
+                    memmove(ctx->buffer, buf, len);
+                    ctx->bufferStart = 0;
+                    ctx->bufferEnd = len;
+
+                    if (ctx->bufferSize < HEADER_LENGTH + msgLen) {
+                        ctx->bufferSize = HEADER_LENGTH + msgLen;
+                        ctx->buffer = realloc(ctx->buffer, ctx->bufferSize);
+                        assert(ctx->buffer != NULL);
+                    }
+                }
 
-static double _peerGetMempoolTime (BRBitcoinPeerContext *ctx) {
-    double value;
+                ctx->msgTimeout = time + MESSAGE_TIMEOUT;
+                break;
+            }
+            else {
+                ctx->bufferStart += HEADER_LENGTH + msgLen;
+                BRSHA256_2(&hash, &buf[HEADER_LENGTH], msgLen);
 
-    pthread_mutex_lock(&ctx->lock);
-    value = ctx->mempoolTime;
-    pthread_mutex_unlock(&ctx->lock);
+                if (UInt32GetLE(&hash) != checksum) { // verify checksum
+                    peer_log(peer, "error reading %s, invalid checksum %x, expected %x, payload length:%"PRIu32
+                             ", SHA256_2:%s", type, UInt32GetLE(&hash), checksum, msgLen, u256hex(hash));
+                    error = EPROTO;
+                }
+                else if (! _btcPeerAcceptMessage(peer, &buf[HEADER_LENGTH], msgLen, type)) error = EPROTO;
+            }
+        }
+    }
 
-    return value;
+    return error;
 }
 
-
-static void *_peerThreadRoutine(void *arg)
+// reads what is available on the socket, accepting each complete message; returns an errno.h code or 0
+static int _btcPeerReadMessages(BRBitcoinPeer *peer, double time)
 {
-    BRBitcoinPeer *peer = arg;
-    BRBitcoinPeerContext *ctx = arg;
-    int socket, error = 0;
+    BRBitcoinPeerContext *ctx = (BRBitcoinPeerContext *)peer;
+    int socket = _peerGetSocket(ctx), error = 0;
+    size_t space;
+    ssize_t n;
+
+    if (NULL == ctx->buffer) {
+        ctx->bufferSize = PEER_REACTOR_BUFFER_SIZE;
+        ctx->buffer = malloc(ctx->bufferSize);
+        assert(ctx->buffer != NULL);
+    }
 
-    pthread_cleanup_push(ctx->threadCleanup, ctx->info);
+    for (int reads = 0; socket >= 0 && ! error && reads < PEER_REACTOR_READ_LIMIT; reads++) {
+        if (ctx->bufferStart > 0) {
+            memmove(ctx->buffer, &ctx->buffer[ctx->bufferStart], ctx->bufferEnd - ctx->bufferStart);
+            ctx->bufferEnd -= ctx->bufferStart;
+            ctx->bufferStart = 0;
+        }
 
-    char name[9 + 1 + INET6_ADDRSTRLEN + 1];
-    sprintf (name, "Core BTX, %s", ctx->host);
-    pthread_setname_brd (pthread_self(), name);
+        space = ctx->bufferSize - ctx->bufferEnd;
+        n = recv(socket, &ctx->buffer[ctx->bufferEnd], space, MSG_DONTWAIT);
 
-    if (_btcPeerOpenSocket(peer, PF_INET6, CONNECT_TIMEOUT, &error)) {
-        struct timeval tv;
-        double time = 0, msgTimeout;
-        uint8_t header[HEADER_LENGTH], *payload = malloc(0x1000);
-        size_t len = 0, payloadLen = 0x1000;
-        ssize_t n = 0;
+        if (n == 0) error = ECONNRESET;
+        else if (n < 0 && (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR)) break;
+        else if (n < 0) error = errno;
+        else {
+            ctx->bufferEnd += (size_t) n;
+            error = _btcPeerAcceptBuffer(peer, time);
+            if ((size_t) n < space) break; // the socket is drained
+        }
+    }
 
-        assert(payload != NULL);
-        gettimeofday(&tv, NULL);
-        ctx->startTime = tv.tv_sec + (double)tv.tv_usec/1000000;
-        btcPeerSendVersionMessage(peer);
+    return error;
+}
 
-        while (_peerCheckAndGetSocket(ctx, &socket) && ! error) {
-            len = 0;
-
-            while (socket >= 0 && ! error && len < HEADER_LENGTH) {
-                n = read(socket, &header[len], sizeof(header) - len);
-                if (n > 0) len += (size_t) n;
-                if (n == 0) error = ECONNRESET;
-                if (n < 0 && errno != EWOULDBLOCK) error = errno;
-                gettimeofday(&tv, NULL);
-                time = tv.tv_sec + (double)tv.tv_usec/1000000;
-                if (! error && time >= _peerGetDisconnectTime(ctx)) error = ETIMEDOUT;
-
-                if (! error && time >= _peerGetMempoolTime(ctx)) {
-                    peer_log(peer, "done waiting for mempool response");
-                    btcPeerSendPing(peer, ctx->mempoolInfo, ctx->mempoolCallback);
-                    ctx->mempoolCallback = NULL;
-
-                    pthread_mutex_lock(&ctx->lock);
-                    ctx->mempoolTime = DBL_MAX;
-                    pthread_mutex_unlock(&ctx->lock);
-                }
+// checks the peer's deadlines, sending a delayed mempool ping if due; returns an errno.h code or 0
+static int _btcPeerCheckTime(BRBitcoinPeer *peer, double time, double *deadline)
+{
+    BRBitcoinPeerContext *ctx = (BRBitcoinPeerContext *)peer;
+    double disconnectTime = _peerGetDisconnectTime(ctx), mempoolTime = _peerGetMempoolTime(ctx);
+    int error = 0;
 
-                while (sizeof(uint32_t) <= len && UInt32GetLE(header) != ctx->magicNumber) {
-                    memmove(header, &header[1], --len); // consume one byte at a time until we find the magic number
-                }
+    if (btcPeerConnectStatus(peer) == BRPeerStatusDisconnected) error = ECONNRESET; // btcPeerDisconnect()
+    else if (time >= disconnectTime) error = ETIMEDOUT;
+    else if (! ctx->connecting && time >= ctx->msgTimeout) error = ETIMEDOUT;
+    else if (! ctx->connecting && time >= mempoolTime) {
+        peer_log(peer, "done waiting for mempool response");
+        btcPeerSendPing(peer, ctx->mempoolInfo, ctx->mempoolCallback);
+        ctx->mempoolCallback = NULL;
 
-                socket = _peerGetSocket(ctx);
-            }
-            
-            if (error) {
-                peer_log(peer, "%s", strerror(error));
-            }
-            else if (header[15] != 0) { // verify header type field is NULL terminated
-                peer_log(peer, "malformed message header: type not NULL terminated");
-                error = EPROTO;
-            }
-            else if (len == HEADER_LENGTH) {
-                const char *type = (const char *)(&header[4]);
-                uint32_t msgLen = UInt32GetLE(&header[16]);
-                uint32_t checksum = UInt32GetLE(&header[20]);
-                UInt256 hash;
-                
-                if (msgLen > MAX_MSG_LENGTH) { // check message length
-                    peer_log(peer, "error reading %s, message length %"PRIu32" is too long", type, msgLen);
-                    error = EPROTO;
-                }
-                else {
-                    if (msgLen > payloadLen) payload = realloc(payload, (payloadLen = msgLen));
-                    assert(payload != NULL);
-                    len = 0;
-                    socket = _peerGetSocket(ctx);
-                    msgTimeout = time + MESSAGE_TIMEOUT;
-                    
-                    while (socket >= 0 && ! error && len < msgLen) {
-                        n = read(socket, &payload[len], msgLen - len);
-                        if (n > 0) len += (size_t) n;
-                        if (n == 0) error = ECONNRESET;
-                        if (n < 0 && errno != EWOULDBLOCK) error = errno;
-                        gettimeofday(&tv, NULL);
-                        time = tv.tv_sec + (double)tv.tv_usec/1000000;
-                        if (n > 0) msgTimeout = time + MESSAGE_TIMEOUT;
-                        if (! error && time >= msgTimeout) error = ETIMEDOUT;
-                        socket = _peerGetSocket(ctx);
-                    }
-                    
-                    if (error) {
-                        peer_log(peer, "%s", strerror(error));
-                    }
-                    else if (len == msgLen) {
-                        BRSHA256_2(&hash, payload, msgLen);
-                        
-                        if (UInt32GetLE(&hash) != checksum) { // verify checksum
-                            peer_log(peer, "error reading %s, invalid checksum %x, expected %x, payload length:%"PRIu32
-                                     ", SHA256_2:%s", type, UInt32GetLE(&hash), checksum, msgLen, u256hex(hash));
-                            error = EPROTO;
-                        }
-                        else if (! _btcPeerAcceptMessage(peer, payload, msgLen, type)) error = EPROTO;
-                    }
-                }
-            }
-        }
-        
-        free(payload);
+        pthread_mutex_lock(&ctx->lock);
+        ctx->mempoolTime = mempoolTime = DBL_MAX;
+        pthread_mutex_unlock(&ctx->lock);
     }
 
+    if (disconnectTime < *deadline) *deadline = disconnectTime;
+    if (! ctx->connecting && mempoolTime < *deadline) *deadline = mempoolTime;
+    if (! ctx->connecting && ctx->msgTimeout < *deadline) *deadline = ctx->msgTimeout;
+    return error;
+}
+
+static void _btcPeerDidDisconnect(BRBitcoinPeer *peer, int error)
+{
+    BRBitcoinPeerContext *ctx = (BRBitcoinPeerContext *)peer;
+    BRBitcoinPeerReactor *reactor;
+    void (*threadCleanup)(void *) = ctx->threadCleanup;
+    void *info = ctx->info;
+    int socket;
+
+    if (error) peer_log(peer, "%s", strerror(error));
+
     pthread_mutex_lock(&ctx->lock);
     socket = ctx->socket;
+    ctx->socket = -1;
     ctx->status = BRPeerStatusDisconnected;
+    reactor = ctx->reactor;
+    ctx->reactor = NULL;
     pthread_mutex_unlock(&ctx->lock);
 
     if (socket >= 0) close(socket);
     peer_log(peer, "disconnected");
-    
+
+    if (ctx->buffer) free(ctx->buffer);
+    ctx->buffer = NULL;
+    ctx->bufferSize = ctx->bufferStart = ctx->bufferEnd = 0;
+    ctx->msgTimeout = DBL_MAX;
+
+    pthread_mutex_lock(&reactor->lock);
+    reactor->peersCount--;
+    pthread_mutex_unlock(&reactor->lock);
+
     while (array_count(ctx->pongCallback) > 0) {
         void (*pongCallback)(void *, int) = ctx->pongCallback[0];
         void *pongInfo = ctx->pongInfo[0];
@@ -1100,9 +1328,136 @@ static void *_peerThreadRoutine(void *arg)
 
     if (ctx->mempoolCallback) ctx->mempoolCallback(ctx->mempoolInfo, 0);
     ctx->mempoolCallback = NULL;
-    if (ctx->disconnected) ctx->disconnected(ctx->info, error);
-    pthread_cleanup_pop(1);
-    return NULL; // detached threads don't need to return a value
+    if (ctx->disconnected) ctx->disconnected(ctx->info, error); // peer may be freed
+    threadCleanup(info);
+}
+
+static void *_peerReactorThreadRoutine(void *arg)
+{
+    BRBitcoinPeerReactor *reactor = arg;
+    BRBitcoinPeer **peers, **added;
+    struct pollfd *fds;
+    uint8_t drain[64];
+    double time, deadline;
+    int timeout, error;
+
+    pthread_setname_brd (pthread_self(), "Core BTX, reactor");
+
+    array_new(peers, 10);
+    array_new(added, 10);
+    array_new(fds, 11);
+
+    while (1) {
+        pthread_mutex_lock(&reactor->lock);
+        array_add_array(added, reactor->added, array_count(reactor->added));
+        array_clear(reactor->added);
+        pthread_mutex_unlock(&reactor->lock);
+
+        for (size_t i = 0; i < array_count(added); i++) {
+            error = _btcPeerOpenSocket(added[i], PF_INET6);
+            if (error) _btcPeerDidDisconnect(added[i], error);
+            else array_add(peers, added[i]);
+        }
+
+        array_clear(added);
+        time = _peerTime();
+        deadline = DBL_MAX;
+
+        for (size_t i = array_count(peers); i > 0; i--) {
+            error = _btcPeerCheckTime(peers[i - 1], time, &deadline);
+            if (! error) continue;
+            _btcPeerDidDisconnect(peers[i - 1], error);
+            array_rm(peers, i - 1);
+        }
+
+        array_clear(fds);
+        array_add(fds, ((struct pollfd) { reactor->wakeFds[0], POLLIN, 0 }));
+
+        for (size_t i = 0; i < array_count(peers); i++) {
+            BRBitcoinPeerContext *ctx = (BRBitcoinPeerContext *)peers[i];
+
+            array_add(fds, ((struct pollfd) { _peerGetSocket(ctx), (ctx->connecting) ? POLLOUT : POLLIN, 0 }));
+        }
+
+        if (array_count(peers) == 0) timeout = -1; // idle until a peer is added
+        else if (deadline - time >= PEER_REACTOR_POLL_MAX_MS/1000.0) timeout = PEER_REACTOR_POLL_MAX_MS;
+        else timeout = (deadline > time) ? (int)((deadline - time)*1000) + 1 : 0;
+
+        if (poll(fds, (nfds_t) array_count(fds), timeout) < 0) {
+            if (errno != EINTR) _peer_log("reactor poll error: %s\n", strerror(errno));
+            continue;
+        }
+
+        if (fds[0].revents) while (read(reactor->wakeFds[0], drain, sizeof(drain)) > 0);
+        time = _peerTime();
+
+        for (size_t i = array_count(peers); i > 0; i--) {
+            BRBitcoinPeerContext *ctx = (BRBitcoinPeerContext *)peers[i - 1];
+
+            if (fds[i].revents == 0) continue;
+            error = (ctx->connecting) ? _btcPeerDidOpenSocket(peers[i - 1]) : _btcPeerReadMessages(peers[i - 1], time);
+            if (! error) continue;
+            _btcPeerDidDisconnect(peers[i - 1], error);
+            array_rm(peers, i - 1);
+        }
+    }
+
+    return NULL; // reactors run for the life of the process
+}
+
+static void _peerReactorsCreate(void)
+{
+    for (size_t i = 0; i < PEER_REACTOR_COUNT; i++) {
+        BRBitcoinPeerReactor *reactor = &_peerReactors[i];
+        pthread_attr_t attr;
+        int r = 1;
+
+        reactor->thread = PTHREAD_NULL;
+        pthread_mutex_init(&reactor->lock, NULL);
+        array_new(reactor->added, 10);
+
+        if (pipe(reactor->wakeFds) < 0) r = 0;
+        for (size_t j = 0; r && j < 2; j++) {
+            int arg = fcntl(reactor->wakeFds[j], F_GETFL, NULL);
+            if (arg < 0 || fcntl(reactor->wakeFds[j], F_SETFL, arg | O_NONBLOCK) < 0) r = 0;
+        }
+
+        if (! r || pthread_attr_init(&attr) != 0) {
+            _peer_log("error creating reactor\n");
+        }
+        else {
+            if (pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) != 0 ||
+                pthread_attr_setstacksize(&attr, PTHREAD_STACK_SIZE) != 0 ||
+                pthread_create(&reactor->thread, &attr, _peerReactorThreadRoutine, reactor) != 0) {
+                _peer_log("error creating reactor thread\n");
+                reactor->thread = PTHREAD_NULL;
+            }
+
+            pthread_attr_destroy(&attr);
+        }
+    }
+}
+
+// returns the running reactor with the fewest peers, or NULL if none are running
+static BRBitcoinPeerReactor *_peerReactorSelect(void)
+{
+    BRBitcoinPeerReactor *reactor = NULL;
+    size_t peersCount = SIZE_MAX;
+
+    pthread_once(&_peerReactorsOnce, _peerReactorsCreate);
+
+    for (size_t i = 0; i < PEER_REACTOR_COUNT; i++) {
+        if (PTHREAD_NULL == _peerReactors[i].thread) continue;
+
+        pthread_mutex_lock(&_peerReactors[i].lock);
+        if (_peerReactors[i].peersCount < peersCount) {
+            reactor = &_peerReactors[i];
+            peersCount = reactor->peersCount;
+        }
+        pthread_mutex_unlock(&_peerReactors[i].lock);
+    }
+
+    return reactor;
 }
 
 static void _dummyThreadCleanup(void *info)
@@ -1126,6 +1481,7 @@ BRBitcoinPeer *btcPeerNew(uint32_t magicNumber)
     ctx->pingTime = DBL_MAX;
     ctx->mempoolTime = DBL_MAX;
     ctx->disconnectTime = DBL_MAX;
+    ctx->msgTimeout = DBL_MAX;
     ctx->socket = -1;
     ctx->threadCleanup = _dummyThreadCleanup;
 
@@ -1151,7 +1507,7 @@ BRBitcoinPeer *btcPeerNew(uint32_t magicNumber)
 // void notfound(void *, const UInt256[], size_t, const UInt256[], size_t) - called when "notfound" message is received
 // BRBitcoinTransaction *requestedTx(void *, UInt256) - called when "getdata" message with tx hash is received from peer
 // int networkIsReachable(void *) - must return true when networking is available, false otherwise
-// void threadCleanup(void *) - called before a thread terminates to faciliate any needed cleanup
+// void threadCleanup(void *) - called, on the network thread, after disconnected() to faciliate any needed cleanup
 void btcPeerSetCallbacks(BRBitcoinPeer *peer, void *info,
                         void (*connected)(void *info),
                         void (*disconnected)(void *info, int error),
@@ -1184,6 +1540,36 @@ void btcPeerSetCallbacks(BRBitcoinPeer *peer, void *info,
     ctx->threadCleanup = (threadCleanup) ? threadCleanup : _dummyThreadCleanup;
 }
 
+// setting these callbacks puts peer in compact filter mode: block headers are downloaded all the way to the chain tip,
+// announced blocks are requested as headers, and blocks are requested in full, rather than as merkleblocks
+// void relayedCFHeaders(void *, UInt256, UInt256, const UInt256[], size_t) - called when a "cfheaders" message is
+// received from peer, with the stop hash, the previous filter header, and the filter hashes up to the stop hash
+// void relayedCFilter(void *, UInt256, const uint8_t *, size_t) - called when a "cfilter" message is received from peer
+// void relayedFullBlock(void *, BRMerkleBlock *, BRBitcoinTransaction *[], size_t) - called when a "block" message is
+// received from peer, with the block header, its totalTx set, and the block's tx, all of which the callee owns
+void btcPeerSetCompactFilterCallbacks(BRBitcoinPeer *peer,
+                                      void (*relayedCFHeaders)(void *info, UInt256 stopHash, UInt256 prevHeader,
+                                                               const UInt256 filterHashes[], size_t filterCount),
+                                      void (*relayedCFilter)(void *info, UInt256 blockHash, const uint8_t *filter,
+                                                             size_t filterLen),
+                                      void (*relayedFullBlock)(void *info, BRBitcoinMerkleBlock *block,
+                                                               BRBitcoinTransaction *txs[], size_t txCount))
+{
+    BRBitcoinPeerContext *ctx = (BRBitcoinPeerContext *)peer;
+
+    ctx->relayedCFHeaders = relayedCFHeaders;
+    ctx->relayedCFilter = relayedCFilter;
+    ctx->relayedFullBlock = relayedFullBlock;
+}
+
+// in headers first mode, block headers are downloaded all the way to the chain tip, rather than switching to filtered
+// blocks after earliestKeyTime, so the filtered blocks can instead be requested by hash, from any peer; each batch of
+// headers is requested with btcPeerSendGetheaders(), so the caller can keep the headers from getting too far ahead
+void btcPeerSetHeadersFirst(BRBitcoinPeer *peer, int headersFirst)
+{
+    ((BRBitcoinPeerContext *)peer)->headersFirst = headersFirst;
+}
+
 // set earliestKeyTime to wallet creation time in order to speed up initial sync
 void btcPeerSetEarliestKeyTime(BRBitcoinPeer *peer, uint32_t earliestKeyTime)
 {
@@ -1213,8 +1599,7 @@ BRBitcoinPeerStatus btcPeerConnectStatus(BRBitcoinPeer *peer)
 void btcPeerConnect(BRBitcoinPeer *peer)
 {
     BRBitcoinPeerContext *ctx = (BRBitcoinPeerContext *)peer;
-    struct timeval tv;
-    pthread_attr_t attr;
+    BRBitcoinPeerReactor *reactor;
 
     pthread_mutex_lock(&ctx->lock);
     if (ctx->status == BRPeerStatusDisconnected || ctx->waitingForNetwork) {
@@ -1224,29 +1609,23 @@ void btcPeerConnect(BRBitcoinPeer *peer)
             if (! ctx->waitingForNetwork) peer_log(peer, "waiting for network reachability");
             ctx->waitingForNetwork = 1;
         }
+        else if (NULL == (reactor = _peerReactorSelect())) {
+            peer_log(peer, "error creating thread");
+            ctx->status = BRPeerStatusDisconnected;
+        }
         else {
             peer_log(peer, "connecting");
             ctx->waitingForNetwork = 0;
-            gettimeofday(&tv, NULL);
 
-            // No race - set before the thread starts.
-            ctx->disconnectTime = tv.tv_sec + (double)tv.tv_usec/1000000 + CONNECT_TIMEOUT;
+            // No race - set before the reactor owns the peer.
+            ctx->disconnectTime = _peerTime() + CONNECT_TIMEOUT;
+            ctx->reactor = reactor;
 
-            if (pthread_attr_init(&attr) != 0) {
-                // error = ENOMEM;
-                peer_log(peer, "error creating thread");
-                ctx->status = BRPeerStatusDisconnected;
-                //if (ctx->disconnected) ctx->disconnected(ctx->info, error);
-            }
-            else if (pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) != 0 ||
-                     pthread_attr_setstacksize(&attr, PTHREAD_STACK_SIZE) != 0 ||
-                     pthread_create(&ctx->thread, &attr, _peerThreadRoutine, peer) != 0) {
-                // error = EAGAIN;
-                peer_log(peer, "error creating thread");
-                pthread_attr_destroy(&attr);
-                ctx->status = BRPeerStatusDisconnected;
-                //if (ctx->disconnected) ctx->disconnected(ctx->info, error);
-            }
+            pthread_mutex_lock(&reactor->lock);
+            array_add(reactor->added, peer);
+            reactor->peersCount++;
+            pthread_mutex_unlock(&reactor->lock);
+            _peerReactorWake(reactor);
         }
     }
     pthread_mutex_unlock(&ctx->lock);
@@ -1256,16 +1635,16 @@ void btcPeerConnect(BRBitcoinPeer *peer)
 void btcPeerDisconnect(BRBitcoinPeer *peer)
 {
     BRBitcoinPeerContext *ctx = (BRBitcoinPeerContext *)peer;
-    int socket = -1;
 
-    if (_peerCheckAndGetSocket(ctx, &socket)) {
-        pthread_mutex_lock(&ctx->lock);
+    // the reactor closes the socket, and calls disconnected(), once it notices the status change; the socket
+    // can't be closed while ctx->lock is held
+    pthread_mutex_lock(&ctx->lock);
+    if (ctx->socket >= 0 && ctx->reactor) {
         ctx->status = BRPeerStatusDisconnected;
-        pthread_mutex_unlock(&ctx->lock);
-
-        if (shutdown(socket, SHUT_RDWR) < 0) peer_log(peer, "%s", strerror(errno));
-        close(socket);
+        if (! ctx->connecting && shutdown(ctx->socket, SHUT_RDWR) < 0) peer_log(peer, "%s", strerror(errno));
+        _peerReactorWake(ctx->reactor);
     }
+    pthread_mutex_unlock(&ctx->lock);
 }
 
 // call this to (re)schedule a disconnect in the given number of seconds, or < 0 to cancel (useful for sync timeout)
@@ -1353,7 +1732,7 @@ void btcPeerSendMessage(BRBitcoinPeer *peer, const uint8_t *msg, size_t msgLen,
         uint8_t buf[HEADER_LENGTH + msgLen], hash[32];
         size_t off = 0;
         ssize_t n = 0;
-        struct timeval tv;
+        double time, sendTimeout = _peerTime() + MESSAGE_TIMEOUT;
         int socket, error = 0;
         
         UInt32SetLE(&buf[off], ctx->magicNumber);
@@ -1375,8 +1754,10 @@ void btcPeerSendMessage(BRBitcoinPeer *peer, const uint8_t *msg, size_t msgLen,
             n = send(socket, &buf[msgLen], sizeof(buf) - msgLen, MSG_NOSIGNAL);
             if (n >= 0) msgLen += (size_t) n;
             if (n < 0 && errno != EWOULDBLOCK) error = errno;
-            gettimeofday(&tv, NULL);
-            if (! error && tv.tv_sec + (double)tv.tv_usec/1000000 >= _peerGetDisconnectTime(ctx)) error = ETIMEDOUT;
+            time = _peerTime();
+            if (n > 0) sendTimeout = time + MESSAGE_TIMEOUT;
+            if (! error && time >= _peerGetDisconnectTime(ctx)) error = ETIMEDOUT;
+            if (! error && time >= sendTimeout) error = ETIMEDOUT; // don't stall the reactor behind a stuck peer
             socket = _peerGetSocket(ctx);
         }
         
@@ -1573,8 +1954,8 @@ void btcPeerSendGetdata(BRBitcoinPeer *peer, const UInt256 txHashes[], size_t tx
             off += sizeof(UInt256);
         }
         
-        for (i = 0; i < blockCount; i++) {
-            UInt32SetLE(&msg[off], inv_filtered_block);
+        for (i = 0; i < blockCount; i++) { // in compact filter mode there's no bloom filter, so request full blocks
+            UInt32SetLE(&msg[off], (((BRBitcoinPeerContext *)peer)->relayedCFilter) ? inv_block | flag : inv_filtered_block);
             off += sizeof(uint32_t);
             UInt256Set(&msg[off], blockHashes[i]);
             off += sizeof(UInt256);
@@ -1605,6 +1986,30 @@ void btcPeerSendPing(BRBitcoinPeer *peer, void *info, void (*pongCallback)(void
     btcPeerSendMessage(peer, msg, sizeof(msg), MSG_PING);
 }
 
+// requests the filter hashes for blocks from startHeight through stopHash, at most 2000
+void btcPeerSendGetcfheaders(BRBitcoinPeer *peer, uint32_t startHeight, UInt256 stopHash)
+{
+    uint8_t msg[sizeof(uint8_t) + sizeof(uint32_t) + sizeof(UInt256)];
+
+    msg[0] = BIP158_FILTER_TYPE_BASIC;
+    UInt32SetLE(&msg[sizeof(uint8_t)], startHeight);
+    UInt256Set(&msg[sizeof(uint8_t) + sizeof(uint32_t)], stopHash);
+    peer_log(peer, "calling getcfheaders from height %"PRIu32" to: %s", startHeight, u256hex(stopHash));
+    btcPeerSendMessage(peer, msg, sizeof(msg), MSG_GETCFHEADERS);
+}
+
+// requests the filters for blocks from startHeight through stopHash, at most 1000
+void btcPeerSendGetcfilters(BRBitcoinPeer *peer, uint32_t startHeight, UInt256 stopHash)
+{
+    uint8_t msg[sizeof(uint8_t) + sizeof(uint32_t) + sizeof(UInt256)];
+
+    msg[0] = BIP158_FILTER_TYPE_BASIC;
+    UInt32SetLE(&msg[sizeof(uint8_t)], startHeight);
+    UInt256Set(&msg[sizeof(uint8_t) + sizeof(uint32_t)], stopHash);
+    peer_log(peer, "calling getcfilters from height %"PRIu32" to: %s", startHeight, u256hex(stopHash));
+    btcPeerSendMessage(peer, msg, sizeof(msg), MSG_GETCFILTERS);
+}
+
 // useful to get additional tx after a bloom filter update
 void btcPeerRerequestBlocks(BRBitcoinPeer *peer, UInt256 fromBlock)
 {
@@ -1631,6 +2036,7 @@ void btcPeerFree(BRBitcoinPeer *peer)
     if (ctx->knownTxHashSet) BRSetFree(ctx->knownTxHashSet);
     if (ctx->pongCallback) array_free(ctx->pongCallback);
     if (ctx->pongInfo) array_free(ctx->pongInfo);
+    if (ctx->buffer) free(ctx->buffer);
     
     pthread_mutex_destroy(&ctx->lock);
     free(ctx);
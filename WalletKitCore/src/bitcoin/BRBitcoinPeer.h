@@ -57,6 +57,7 @@ extern "C" {
 #define SERVICES_NODE_BLOOM   0x04 // BIP111: https://github.com/bitcoin/bips/blob/master/bip-0111.mediawiki
 #define SERVICES_NODE_WITNESS 0x08 // BIP144: https://github.com/bitcoin/bips/blob/master/bip-0144.mediawiki
 #define SERVICES_NODE_BCASH   0x20 // https://github.com/Bitcoin-UAHF/spec/blob/master/uahf-technical-spec.md
+#define SERVICES_NODE_COMPACT_FILTERS 0x40 // BIP157: https://github.com/bitcoin/bips/blob/master/bip-0157.mediawiki
     
 #define BR_VERSION "2.1"
 #define USER_AGENT "/bread:" BR_VERSION "/"
@@ -84,6 +85,10 @@ extern "C" {
 #define MSG_ALERT       "alert"
 #define MSG_REJECT      "reject"   // described in BIP61: https://github.com/bitcoin/bips/blob/master/bip-0061.mediawiki
 #define MSG_FEEFILTER   "feefilter"// described in BIP133 https://github.com/bitcoin/bips/blob/master/bip-0133.mediawiki
+#define MSG_GETCFILTERS  "getcfilters"  // described in BIP157 https://github.com/bitcoin/bips/blob/master/bip-0157.mediawiki
+#define MSG_CFILTER      "cfilter"
+#define MSG_GETCFHEADERS "getcfheaders"
+#define MSG_CFHEADERS    "cfheaders"
 
 #define REJECT_INVALID     0x10 // transaction is invalid for some reason (invalid signature, output value > input, etc)
 #define REJECT_SPENT       0x12 // an input is already spent
@@ -123,7 +128,7 @@ BRBitcoinPeer *btcPeerNew(uint32_t magicNumber);
 // void notfound(void *, const UInt256[], size_t, const UInt256[], size_t) - called when "notfound" message is received
 // BRBitcoinTransaction *requestedTx(void *, UInt256) - called when "getdata" message with a tx hash is received from peer
 // int networkIsReachable(void *) - must return true when networking is available, false otherwise
-// void threadCleanup(void *) - called before a thread terminates to faciliate any needed cleanup    
+// void threadCleanup(void *) - called, on the network thread, after disconnected() to faciliate any needed cleanup    
 void btcPeerSetCallbacks(BRBitcoinPeer *peer, void *info,
                         void (*connected)(void *info),
                         void (*disconnected)(void *info, int error),
@@ -139,6 +144,26 @@ void btcPeerSetCallbacks(BRBitcoinPeer *peer, void *info,
                         int (*networkIsReachable)(void *info),
                         void (*threadCleanup)(void *info));
 
+// setting these callbacks puts peer in compact filter mode: block headers are downloaded all the way to the chain tip,
+// announced blocks are requested as headers, and blocks are requested in full, rather than as merkleblocks
+// void relayedCFHeaders(void *, UInt256, UInt256, const UInt256[], size_t) - called when a "cfheaders" message is
+// received from peer, with the stop hash, the previous filter header, and the filter hashes up to the stop hash
+// void relayedCFilter(void *, UInt256, const uint8_t *, size_t) - called when a "cfilter" message is received from peer
+// void relayedFullBlock(void *, BRMerkleBlock *, BRBitcoinTransaction *[], size_t) - called when a "block" message is
+// received from peer, with the block header, its totalTx set, and the block's tx, all of which the callee owns
+void btcPeerSetCompactFilterCallbacks(BRBitcoinPeer *peer,
+                                      void (*relayedCFHeaders)(void *info, UInt256 stopHash, UInt256 prevHeader,
+                                                               const UInt256 filterHashes[], size_t filterCount),
+                                      void (*relayedCFilter)(void *info, UInt256 blockHash, const uint8_t *filter,
+                                                             size_t filterLen),
+                                      void (*relayedFullBlock)(void *info, BRBitcoinMerkleBlock *block,
+                                                               BRBitcoinTransaction *txs[], size_t txCount));
+
+// in headers first mode, block headers are downloaded all the way to the chain tip, rather than switching to filtered
+// blocks after earliestKeyTime, so the filtered blocks can instead be requested by hash, from any peer; each batch of
+// headers is requested with btcPeerSendGetheaders(), so the caller can keep the headers from getting too far ahead
+void btcPeerSetHeadersFirst(BRBitcoinPeer *peer, int headersFirst);
+
 // set earliestKeyTime to wallet creation time in order to speed up initial sync
 void btcPeerSetEarliestKeyTime(BRBitcoinPeer *peer, uint32_t earliestKeyTime);
 
@@ -190,6 +215,8 @@ void btcPeerSendGetdata(BRBitcoinPeer *peer, const UInt256 txHashes[], size_t tx
                         size_t blockCount);
 void btcPeerSendGetaddr(BRBitcoinPeer *peer);
 void btcPeerSendPing(BRBitcoinPeer *peer, void *info, void (*pongCallback)(void *info, int success));
+void btcPeerSendGetcfheaders(BRBitcoinPeer *peer, uint32_t startHeight, UInt256 stopHash);
+void btcPeerSendGetcfilters(BRBitcoinPeer *peer, uint32_t startHeight, UInt256 stopHash);
 
 // useful to get additional tx after a bloom filter update
 void btcPeerRerequestBlocks(BRBitcoinPeer *peer, UInt256 fromBlock);
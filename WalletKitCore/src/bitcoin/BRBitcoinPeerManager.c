@@ -24,6 +24,7 @@
 
 #include "BRBitcoinPeerManager.h"
 #include "BRBitcoinBloomFilter.h"
+#include "BRBitcoinCompactFilter.h"
 #include "support/BRSet.h"
 #include "support/BRArray.h"
 #include "support/BRInt.h"
@@ -43,6 +44,12 @@
 #define MAX_CONNECT_FAILURES  20 // notify user of network problems after this many connect failures in a row
 #define PEER_FLAG_SYNCED      0x01
 #define PEER_FLAG_NEEDSUPDATE 0x02
+#define PEER_FLAG_FILTERED    0x04 // the bloom filter has been loaded on the peer
+#define CF_BATCH_SIZE         1000 // most compact filters a peer serves per getcfilters request
+#define CF_SCRIPTS_SIZE       (25 + 22) // a pay-to-pubkey-hash plus a pay-to-witness-pubkey-hash output script
+#define MB_RANGE_SIZE         500 // most merkleblocks requested from a peer at a time during chain download
+#define MB_HEADERS_WINDOW     20000 // most block headers downloaded ahead of the merkleblocks during chain download
+#define MB_RANGE_TX_MAX       10000 // most unmatched tx kept for a merkleblock range before its peer is disconnected
 
 #define genesis_block_hash(params) UInt256Reverse((params)->checkpoints[0].hash)
 
@@ -69,6 +76,17 @@ typedef struct {
     BRBitcoinPeer *peers;
 } BRTxPeerList;
 
+typedef struct {
+    BRBitcoinPeer *peer; // NULL while waiting to be reassigned
+    const BRBitcoinPeer *stalledPeer; // the last peer that didn't send all of the range
+    uint32_t id, start, end;
+} BRBlockRange;
+
+typedef struct {
+    BRBitcoinTransaction *tx;
+    uint32_t height; // tx is in a block at or below height
+} BRUnmatchedTx;
+
 // true if peer is contained in the list of peers associated with txHash
 static int _BRTxPeerListHasPeer(const BRTxPeerList *list, UInt256 txHash, const BRBitcoinPeer *peer)
 {
@@ -175,8 +193,23 @@ struct BRBitcoinPeerManagerStruct {
     uint32_t earliestKeyTime, syncStartHeight, filterUpdateHeight, estimatedHeight;
     BRBitcoinBloomFilter *bloomFilter;
     double fpRate, averageTxPerBlock;
+    int compactFilters; // sync with BIP157 compact block filters instead of a bloom filter
+    uint32_t cfHeight, cfStartHeight, cfHeaderHeight; // filters are matched through cfHeight
+    UInt256 cfStopHash, cfHeader, *cfFilterHashes, *cfBlockRequests;
+    BRBitcoinPeer *cfCheckPeer; // a second peer asked for the cfheaders batch, see _btcPeerManagerCheckCFHeaders()
+    UInt256 cfCheckPrevHeader; // the previous filter header the download peer sent with the batch
+    int cfChecked; // the second peer's cfheaders matched, and the batch's filters are requested
+    uint8_t *cfScripts;
+    const uint8_t **cfItems;
+    size_t *cfItemLens, cfAddrsCount;
+    uint32_t mbHeight, mbNextHeight, mbRangeId; // merkleblocks are received through mbHeight, requested to mbNextHeight
+    uint32_t mbHeaderHeight; // block headers are requested through mbHeaderHeight, see _btcPeerManagerRequestHeaders()
+    BRBlockRange *mbRanges; // the merkleblock height ranges requested from each peer during chain download
+    BRUnmatchedTx *mbTxs; // tx relayed during chain download that may yet match the wallet, see _peerRelayedTx()
     BRSet *blocks, *orphans, *checkpoints;
     BRBitcoinMerkleBlock *lastBlock, *lastOrphan;
+    BRBitcoinMerkleBlock **chain; // main chain, indexed by height - chainHeight; see _btcPeerManagerChainUpdate()
+    uint32_t chainHeight;
     BRTxPeerList *txRelays, *txRequests;
     BRPublishedTx *publishedTx;
     UInt256 *publishedTxHashes;
@@ -238,6 +271,66 @@ static void _btcPeerManagerAddTxToPublishList(BRBitcoinPeerManager *manager, BRB
     }
 }
 
+// brings the main chain index up to date with lastBlock; the index holds, by height, every block reachable from
+// lastBlock through prevBlock, so looking up a main chain block by height needn't walk the chain
+static void _btcPeerManagerChainUpdate(BRBitcoinPeerManager *manager)
+{
+    BRBitcoinMerkleBlock *block = manager->lastBlock, **added;
+    size_t count = array_count(manager->chain);
+
+    if (! block || (count > 0 && manager->chain[count - 1] == block)) return;
+
+    if (count > 0 && block->height == manager->chainHeight + count &&
+        UInt256Eq(block->prevBlock, manager->chain[count - 1]->blockHash)) { // lastBlock extends the chain
+        array_add(manager->chain, block);
+        return;
+    }
+
+    // walk back from lastBlock to where it joins the indexed chain, as after a reorg or rescan
+    array_new(added, 10);
+
+    while (block && ! (block->height >= manager->chainHeight && block->height - manager->chainHeight < count &&
+                       manager->chain[block->height - manager->chainHeight] == block)) {
+        BRBitcoinMerkleBlock *prev = BRSetGet(manager->blocks, &block->prevBlock);
+
+        array_add(added, block);
+        block = (prev && prev->height + 1 == block->height) ? prev : NULL;
+    }
+
+    if (block) array_set_count(manager->chain, block->height - manager->chainHeight + 1);
+    else {
+        array_clear(manager->chain);
+        manager->chainHeight = added[array_count(added) - 1]->height;
+    }
+
+    for (size_t i = array_count(added); i > 0; i--) array_add(manager->chain, added[i - 1]);
+    array_free(added);
+}
+
+// returns the main chain block at height, or NULL if it's not held
+static BRBitcoinMerkleBlock *_btcPeerManagerChainBlock(BRBitcoinPeerManager *manager, uint32_t height)
+{
+    _btcPeerManagerChainUpdate(manager);
+
+    return (height >= manager->chainHeight && height - manager->chainHeight < array_count(manager->chain)) ?
+           manager->chain[height - manager->chainHeight] : NULL;
+}
+
+// call before freeing block; drops block, and every block below it, from the main chain index
+static void _btcPeerManagerChainRemove(BRBitcoinPeerManager *manager, const BRBitcoinMerkleBlock *block)
+{
+    size_t count = array_count(manager->chain);
+
+    if (block->height >= manager->chainHeight && block->height - manager->chainHeight < count &&
+        manager->chain[block->height - manager->chainHeight] == block) {
+        if (block->height - manager->chainHeight + 1 == count) array_clear(manager->chain);
+        else {
+            array_rm_range(manager->chain, 0, block->height - manager->chainHeight + 1);
+            manager->chainHeight = block->height + 1;
+        }
+    }
+}
+
 static size_t _btcPeerManagerBlockLocators(BRBitcoinPeerManager *manager, UInt256 locators[], size_t locatorsCount)
 {
     // append 10 most recent block hashes, decending, then continue appending, doubling the step back each time,
@@ -245,13 +338,13 @@ static size_t _btcPeerManagerBlockLocators(BRBitcoinPeerManager *manager, UInt25
     BRBitcoinMerkleBlock *block = manager->lastBlock;
     size_t step = 1, height = 0, i = 0, j;
     
+    _btcPeerManagerChainUpdate(manager);
+
     while (block) {
         if (locators && i < locatorsCount) locators[i] = block->blockHash, height = block->height;
         if (++i >= 10) step *= 2;
-        
-        for (j = 0; block && j < step; j++) {
-            block = BRSetGet(manager->blocks, &block->prevBlock);
-        }
+        block = (block->height >= manager->chainHeight + step) ?
+                manager->chain[block->height - manager->chainHeight - step] : NULL;
     }
     
     for (j = manager->params->checkpointsCount; j > 0; j--) { // add checkpoint hashes older than oldest saved block
@@ -338,29 +431,209 @@ static void _btcPeerManagerLoadBloomFilter(BRBitcoinPeerManager *manager, BRBitc
     size_t len = btcBloomFilterSerialize(filter, data, sizeof(data));
     
     btcPeerSendFilterload(peer, data, len);
+    peer->flags |= PEER_FLAG_FILTERED;
+}
+
+// true until the merkleblocks for all block headers up to the chain tip have been received; block headers are
+// downloaded first, from the download peer, and the merkleblocks then requested from every connected peer
+static int _btcPeerManagerIsDownloading(BRBitcoinPeerManager *manager)
+{
+    return (! manager->compactFilters &&
+            (manager->mbHeight < manager->lastBlock->height || manager->lastBlock->height < manager->estimatedHeight));
+}
+
+// returns the index of the merkleblock range requested from peer, or SIZE_MAX if there isn't one
+static size_t _btcPeerManagerBlockRange(BRBitcoinPeerManager *manager, const BRBitcoinPeer *peer)
+{
+    for (size_t i = array_count(manager->mbRanges); i > 0; i--) {
+        if (manager->mbRanges[i - 1].peer == peer) return i - 1;
+    }
+
+    return SIZE_MAX;
+}
+
+// true if the main chain block at height is a header that still has to be downloaded as a merkleblock, headers older
+// than one week before earliestKeyTime are all we need
+static int _btcPeerManagerNeedsMerkleBlock(BRBitcoinPeerManager *manager, uint32_t height)
+{
+    BRBitcoinMerkleBlock *b = _btcPeerManagerChainBlock(manager, height);
+
+    return (b && b->totalTx == 0 && b->timestamp + 7*24*60*60 - 2*60*60 > manager->earliestKeyTime);
+}
+
+// advances mbHeight past main chain blocks that don't need to be downloaded as merkleblocks, saving transition blocks
+// as it goes, and frees unmatched tx that can no longer match the wallet
+// returns true if this received all merkleblocks up to lastBlock
+static int _btcPeerManagerAdvanceMerkleBlocks(BRBitcoinPeerManager *manager)
+{
+    uint32_t height = manager->mbHeight;
+    BRBitcoinMerkleBlock *b;
+
+    while (manager->mbHeight < manager->lastBlock->height &&
+           ! _btcPeerManagerNeedsMerkleBlock(manager, manager->mbHeight + 1)) {
+        b = _btcPeerManagerChainBlock(manager, ++manager->mbHeight);
+
+        // save transition blocks once all the merkleblocks before them are received, so that a sync interrupted
+        // after saving one can resume from there
+        if (b && (b->height % BLOCK_DIFFICULTY_INTERVAL) == 0 && b->height + 100 < manager->estimatedHeight &&
+            manager->saveBlocks) manager->saveBlocks(manager->info, 0, &b, 1);
+    }
+
+    // a tx can only spend outputs of tx in blocks at or below its own
+    for (size_t i = array_count(manager->mbTxs); i > 0; i--) {
+        if (manager->mbTxs[i - 1].height > manager->mbHeight) continue;
+        btcTransactionFree(manager->mbTxs[i - 1].tx);
+        array_rm(manager->mbTxs, i - 1);
+    }
+
+    return (manager->mbHeight > height && manager->mbHeight == manager->lastBlock->height);
 }
 
-static void _updateFilterRerequestDone(void *info, int success)
+// registers any unmatched tx that now match the wallet, such as a tx spending outputs of a wallet tx from an earlier
+// block that was received after it
+static void _btcPeerManagerRegisterUnmatchedTx(BRBitcoinPeerManager *manager)
+{
+    BRBitcoinTransaction *tx;
+    size_t i = array_count(manager->mbTxs);
+
+    while (i > 0) {
+        tx = manager->mbTxs[--i].tx;
+        if (! btcWalletContainsTransaction(manager->wallet, tx)) continue;
+        array_rm(manager->mbTxs, i);
+
+        if (btcWalletTransactionForHash(manager->wallet, tx->txHash) ||
+            ! btcWalletRegisterTransaction(manager->wallet, tx)) btcTransactionFree(tx);
+
+        i = array_count(manager->mbTxs); // the newly registered tx may in turn match others
+    }
+}
+
+// true while the download peer has yet to send the block headers last requested from it
+static int _btcPeerManagerIsRequestingHeaders(BRBitcoinPeerManager *manager)
+{
+    return (manager->lastBlock->height < manager->estimatedHeight &&
+            manager->lastBlock->height < manager->mbHeaderHeight);
+}
+
+// during chain download, requests the next batch of block headers from the download peer once the last one has been
+// received, unless the headers are already MB_HEADERS_WINDOW ahead of mbHeight, so that headers and unmatched tx don't
+// pile up while the merkleblocks lag behind; called again as mbHeight advances
+static void _btcPeerManagerRequestHeaders(BRBitcoinPeerManager *manager)
+{
+    BRBitcoinPeer *peer = manager->downloadPeer;
+    uint32_t height = manager->lastBlock->height;
+
+    if (! peer || manager->compactFilters || height >= manager->estimatedHeight ||
+        _btcPeerManagerIsRequestingHeaders(manager) || height >= manager->mbHeight + MB_HEADERS_WINDOW) return;
+
+    size_t   count    = _btcPeerManagerBlockLocators(manager, NULL, 0);
+    UInt256 *locators = calloc (count, sizeof(UInt256)); // Okay if NULL
+
+    _btcPeerManagerBlockLocators (manager, locators, count);
+    btcPeerSendGetheaders(peer, locators, count, UINT256_ZERO);
+    manager->mbHeaderHeight = height + 2000; // a headers message has at most 2000 headers
+    btcPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT); // schedule sync timeout
+
+    if (locators) free (locators);
+}
+
+static void _btcPeerManagerRequestBlocks(BRBitcoinPeerManager *manager);
+
+static void _requestBlocksPingDone(void *info, int success)
 {
     BRBitcoinPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
     BRBitcoinPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
-    
+    uint32_t id = ((BRPeerCallbackInfo *)info)->hash.u32[0];
+    BRBlockRange *range;
+    size_t i;
+
     free(info);
-    
-    if (success) {
-        pthread_mutex_lock(&manager->lock);
+    if (! success) return; // the range is reassigned when the peer disconnects
+    pthread_mutex_lock(&manager->lock);
+    i = _btcPeerManagerBlockRange(manager, peer);
 
-        if ((peer->flags & PEER_FLAG_NEEDSUPDATE) == 0) {
-            size_t   count    = _btcPeerManagerBlockLocators(manager, NULL, 0);
-            UInt256 *locators = calloc (count, sizeof(UInt256));
-            _btcPeerManagerBlockLocators(manager, locators, count);
+    if (i != SIZE_MAX && manager->mbRanges[i].id == id) { // the peer has sent every merkleblock it's going to
+        range = &manager->mbRanges[i];
+        while (range->start <= range->end && ! _btcPeerManagerNeedsMerkleBlock(manager, range->start)) range->start++;
 
-            btcPeerSendGetblocks(peer, locators, count, UINT256_ZERO);
+        if (range->start <= range->end) {
+            peer_log(peer, "merkleblocks from height %"PRIu32" to %"PRIu32" not received, reassigning", range->start,
+                     range->end);
+            range->peer = NULL;
+            range->stalledPeer = peer;
+        }
+        else array_rm(manager->mbRanges, i);
 
-            if (NULL != locators) free (locators);
+        // cancel stall timeout, unless this is the download peer and it's still sending headers
+        if (peer != manager->downloadPeer || ! _btcPeerManagerIsRequestingHeaders(manager)) {
+            btcPeerScheduleDisconnect(peer, -1);
         }
 
-        pthread_mutex_unlock(&manager->lock);
+        _btcPeerManagerRequestBlocks(manager);
+    }
+
+    pthread_mutex_unlock(&manager->lock);
+}
+
+// during chain download, requests a range of merkleblocks from each connected peer that isn't downloading one yet,
+// first reassigning any range a disconnected or stalled peer didn't finish, followed by a ping to know when the peer has
+// sent all it will; the ranges are received out of order and reassembled in _peerRelayedBlock()
+static void _btcPeerManagerRequestBlocks(BRBitcoinPeerManager *manager)
+{
+    BRBitcoinPeer *peer;
+    BRBlockRange *range;
+    BRPeerCallbackInfo *info;
+    uint32_t height = manager->lastBlock->height, h;
+    size_t i, j, count;
+
+    if (manager->bloomFilter == NULL || ! _btcPeerManagerIsDownloading(manager)) return;
+    if (manager->mbNextHeight <= manager->mbHeight) manager->mbNextHeight = manager->mbHeight + 1;
+
+    for (i = array_count(manager->connectedPeers); i > 0; i--) {
+        peer = manager->connectedPeers[i - 1];
+        if (btcPeerConnectStatus(peer) != BRPeerStatusConnected || (peer->flags & PEER_FLAG_FILTERED) == 0 ||
+            (peer->flags & PEER_FLAG_NEEDSUPDATE) != 0 || _btcPeerManagerBlockRange(manager, peer) != SIZE_MAX) continue;
+
+        for (j = 0; j < array_count(manager->mbRanges); j++) { // give a stalled range to a different peer if we can
+            if (! manager->mbRanges[j].peer && (manager->mbRanges[j].stalledPeer != peer ||
+                                                array_count(manager->connectedPeers) == 1)) break;
+        }
+
+        if (j == array_count(manager->mbRanges)) {
+            while (manager->mbNextHeight <= height && ! _btcPeerManagerNeedsMerkleBlock(manager, manager->mbNextHeight)) {
+                manager->mbNextHeight++;
+            }
+
+            // wait for a full range of headers, unless we have the headers up to the chain tip
+            if (manager->mbNextHeight > height ||
+                (height - manager->mbNextHeight + 1 < MB_RANGE_SIZE && height < manager->estimatedHeight)) break;
+            h = (height - manager->mbNextHeight + 1 < MB_RANGE_SIZE) ? height : manager->mbNextHeight + MB_RANGE_SIZE - 1;
+            array_add(manager->mbRanges, ((const BRBlockRange) { NULL, NULL, 0, manager->mbNextHeight, h }));
+            manager->mbNextHeight = h + 1;
+        }
+
+        range = &manager->mbRanges[j];
+        range->peer = peer;
+        range->id = ++manager->mbRangeId;
+
+        UInt256 blockHashes[range->end - range->start + 1];
+
+        for (h = range->start, count = 0; h <= range->end; h++) {
+            if (_btcPeerManagerNeedsMerkleBlock(manager, h)) {
+                blockHashes[count++] = _btcPeerManagerChainBlock(manager, h)->blockHash;
+            }
+        }
+
+        peer_log(peer, "requesting %zu merkleblock(s) from height %"PRIu32" to %"PRIu32, count, range->start,
+                 range->end);
+        btcPeerSendGetdata(peer, NULL, 0, blockHashes, count);
+        info = calloc(1, sizeof(*info));
+        assert(info != NULL);
+        info->peer = peer;
+        info->manager = manager;
+        info->hash.u32[0] = range->id;
+        btcPeerSendPing(peer, info, _requestBlocksPingDone);
+        btcPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT); // schedule stall timeout
     }
 }
 
@@ -368,7 +641,6 @@ static void _updateFilterLoadDone(void *info, int success)
 {
     BRBitcoinPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
     BRBitcoinPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
-    BRPeerCallbackInfo *peerInfo;
 
     free(info);
     
@@ -377,15 +649,8 @@ static void _updateFilterLoadDone(void *info, int success)
         btcPeerSetNeedsFilterUpdate(peer, 0);
         peer->flags &= ~PEER_FLAG_NEEDSUPDATE;
         
-        if (manager->lastBlock->height < manager->estimatedHeight) { // if syncing, rerequest blocks
-            if (manager->downloadPeer) {
-                peerInfo = calloc(1, sizeof(*peerInfo));
-                assert(peerInfo != NULL);
-                peerInfo->peer = peer;
-                peerInfo->manager = manager;
-                btcPeerRerequestBlocks(manager->downloadPeer, manager->lastBlock->blockHash);
-                btcPeerSendPing(manager->downloadPeer, peerInfo, _updateFilterRerequestDone);
-            }
+        if (_btcPeerManagerIsDownloading(manager)) { // if syncing, request merkleblocks with the updated filter
+            _btcPeerManagerRequestBlocks(manager);
         }
         else btcPeerSendMempool(peer, NULL, 0, NULL, NULL); // if not syncing, request mempool
         
@@ -398,6 +663,7 @@ static void _updateFilterPingDone(void *info, int success)
     BRBitcoinPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
     BRBitcoinPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
     BRPeerCallbackInfo *peerInfo;
+    int isDownloading;
     
     if (success) {
         pthread_mutex_lock(&manager->lock);
@@ -405,25 +671,30 @@ static void _updateFilterPingDone(void *info, int success)
         if (manager->bloomFilter) btcBloomFilterFree(manager->bloomFilter);
         manager->bloomFilter = NULL;
 
-        if (manager->lastBlock->height < manager->estimatedHeight) { // if we're syncing, only update download peer
-            if (manager->downloadPeer) {
-                _btcPeerManagerLoadBloomFilter(manager, manager->downloadPeer);
-                btcPeerSendPing(manager->downloadPeer, info, _updateFilterLoadDone); // wait for pong so filter is loaded
-            }
-            else free(info);
+        free(info);
+        isDownloading = _btcPeerManagerIsDownloading(manager);
+
+        if (isDownloading) {
+            // merkleblocks already requested may have been filtered without the new addresses, so the ranges are
+            // requested again, from each peer once its filter is updated
+            array_clear(manager->mbRanges);
+            manager->mbNextHeight = manager->mbHeight + 1;
         }
-        else {
-            free(info);
-            
-            for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
-                if (btcPeerConnectStatus(manager->connectedPeers[i - 1]) != BRPeerStatusConnected) continue;
-                peerInfo = calloc(1, sizeof(*peerInfo));
-                assert(peerInfo != NULL);
-                peerInfo->peer = manager->connectedPeers[i - 1];
-                peerInfo->manager = manager;
-                _btcPeerManagerLoadBloomFilter(manager, peerInfo->peer);
-                btcPeerSendPing(peerInfo->peer, peerInfo, _updateFilterLoadDone); // wait for pong so filter is loaded
+
+        for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
+            if (btcPeerConnectStatus(manager->connectedPeers[i - 1]) != BRPeerStatusConnected) continue;
+            peerInfo = calloc(1, sizeof(*peerInfo));
+            assert(peerInfo != NULL);
+            peerInfo->peer = manager->connectedPeers[i - 1];
+            peerInfo->manager = manager;
+
+            if (isDownloading) {
+                btcPeerSetNeedsFilterUpdate(peerInfo->peer, 1);
+                peerInfo->peer->flags |= PEER_FLAG_NEEDSUPDATE;
             }
+
+            _btcPeerManagerLoadBloomFilter(manager, peerInfo->peer);
+            btcPeerSendPing(peerInfo->peer, peerInfo, _updateFilterLoadDone); // wait for pong so filter is loaded
         }
 
          pthread_mutex_unlock(&manager->lock);
@@ -618,6 +889,177 @@ static void _btcPeerManagerLoadMempools(BRBitcoinPeerManager *manager)
     }
 }
 
+// rebuilds the output scripts matched against compact filters if wallet addresses were added since the last rebuild;
+// like the bloom filter, spare addresses are generated first so the scripts aren't rebuilt for every wallet tx
+static void _btcPeerManagerLoadCompactFilterScripts(BRBitcoinPeerManager *manager)
+{
+    BRAddress *addrs;
+    UInt160 hash;
+    size_t i, count = 0, addrsCount;
+    uint8_t *s;
+
+    btcWalletUnusedAddrs(manager->wallet, NULL, SEQUENCE_GAP_LIMIT_EXTERNAL_EXTENDED, SEQUENCE_EXTERNAL_CHAIN);
+    btcWalletUnusedAddrs(manager->wallet, NULL, SEQUENCE_GAP_LIMIT_INTERNAL_EXTENDED, SEQUENCE_INTERNAL_CHAIN);
+    addrsCount = btcWalletAllAddrs(manager->wallet, NULL, 0);
+    if (addrsCount == manager->cfAddrsCount) return;
+
+    addrs = malloc(addrsCount*sizeof(*addrs));
+    assert(addrs != NULL || addrsCount == 0);
+    addrsCount = btcWalletAllAddrs(manager->wallet, addrs, addrsCount);
+    array_set_count(manager->cfScripts, addrsCount*CF_SCRIPTS_SIZE);
+    array_clear(manager->cfItems);
+    array_clear(manager->cfItemLens);
+
+    for (i = 0; i < addrsCount; i++) { // match both legacy and segwit outputs paying to each address's pubkey hash
+        if (! BRAddressHash160(&hash, manager->params->addrParams, addrs[i].s)) continue;
+        s = &manager->cfScripts[count++*CF_SCRIPTS_SIZE];
+        s[0] = OP_DUP, s[1] = OP_HASH160, s[2] = sizeof(hash);
+        UInt160Set(&s[3], hash);
+        s[23] = OP_EQUALVERIFY, s[24] = OP_CHECKSIG;
+        s[25] = OP_0, s[26] = sizeof(hash);
+        UInt160Set(&s[27], hash);
+    }
+
+    for (i = 0; i < count; i++) { // cfScripts is done growing, so it's now safe to point into it
+        array_add(manager->cfItems, &manager->cfScripts[i*CF_SCRIPTS_SIZE]);
+        array_add(manager->cfItemLens, 25);
+        array_add(manager->cfItems, &manager->cfScripts[i*CF_SCRIPTS_SIZE + 25]);
+        array_add(manager->cfItemLens, 22);
+    }
+
+    manager->cfAddrsCount = addrsCount;
+    if (addrs) free(addrs);
+}
+
+// requests filter hashes for the next batch of up to CF_BATCH_SIZE blocks after cfHeight, unless a batch is already
+// pending, or the chain download isn't complete and there aren't yet enough headers for a full batch
+static void _btcPeerManagerRequestCompactFilters(BRBitcoinPeerManager *manager)
+{
+    BRBitcoinPeer *peer = manager->downloadPeer;
+    BRBitcoinMerkleBlock *block;
+    uint32_t stopHeight;
+
+    if (! manager->compactFilters || ! peer || ! UInt256IsZero(manager->cfStopHash)) return;
+
+    // blocks older than one week before earliestKeyTime can't hold wallet tx, so skip their filters
+    while (manager->cfHeight < manager->lastBlock->height &&
+           (block = _btcPeerManagerChainBlock(manager, manager->cfHeight + 1)) != NULL &&
+           block->timestamp + 7*24*60*60 < manager->earliestKeyTime) manager->cfHeight++;
+
+    if (manager->cfHeight >= manager->lastBlock->height) return;
+    stopHeight = (manager->lastBlock->height - manager->cfHeight > CF_BATCH_SIZE) ?
+                 manager->cfHeight + CF_BATCH_SIZE : manager->lastBlock->height;
+    if (stopHeight - manager->cfHeight < CF_BATCH_SIZE && manager->lastBlock->height < manager->estimatedHeight) return;
+    block = _btcPeerManagerChainBlock(manager, stopHeight);
+    if (! block) return;
+
+    _btcPeerManagerLoadCompactFilterScripts(manager);
+    manager->cfStartHeight = manager->cfHeight + 1;
+    manager->cfStopHash = block->blockHash;
+    array_clear(manager->cfFilterHashes);
+    manager->cfCheckPeer = NULL;
+    manager->cfChecked = 0;
+    btcPeerSendGetcfheaders(peer, manager->cfStartHeight, manager->cfStopHash);
+}
+
+// a single peer could serve made up filters that hide wallet tx, so before requesting the filters, the download peer's
+// cfheaders for the batch are requested again from a second connected peer that serves compact filters, and compared
+// in _peerRelayedCFHeaders(); if no other such peer is connected yet, this is called again once one is
+static void _btcPeerManagerCheckCFHeaders(BRBitcoinPeerManager *manager)
+{
+    BRBitcoinPeer *peer;
+
+    if (! manager->compactFilters || ! manager->downloadPeer || UInt256IsZero(manager->cfStopHash) ||
+        array_count(manager->cfFilterHashes) == 0 || manager->cfChecked || manager->cfCheckPeer) return;
+
+    if (! UInt128IsZero(manager->fixedPeer.address) || manager->maxConnectCount < 2) {
+        manager->cfChecked = 1; // a fixed peer is trusted, and with one connection there's no second peer to ask
+        btcPeerSendGetcfilters(manager->downloadPeer, manager->cfStartHeight, manager->cfStopHash);
+        return;
+    }
+
+    for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
+        peer = manager->connectedPeers[i - 1];
+        if (peer == manager->downloadPeer || btcPeerConnectStatus(peer) != BRPeerStatusConnected ||
+            (peer->services & SERVICES_NODE_COMPACT_FILTERS) != SERVICES_NODE_COMPACT_FILTERS) continue;
+        manager->cfCheckPeer = peer;
+        btcPeerSendGetcfheaders(peer, manager->cfStartHeight, manager->cfStopHash);
+        btcPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT); // schedule check timeout
+        break;
+    }
+}
+
+// abandons any pending compact filter requests, such as when the download peer changes, and rewinds cfHeight so any
+// requested block that wasn't received has its filter matched again
+static void _btcPeerManagerResetCompactFilters(BRBitcoinPeerManager *manager)
+{
+    BRBitcoinMerkleBlock *b;
+
+    for (size_t i = array_count(manager->cfBlockRequests); i > 0; i--) {
+        b = BRSetGet(manager->blocks, &manager->cfBlockRequests[i - 1]);
+        if (b && b->height <= manager->cfHeight) manager->cfHeight = b->height - 1;
+    }
+
+    if (manager->cfHeight > manager->lastBlock->height) manager->cfHeight = manager->lastBlock->height;
+    array_clear(manager->cfBlockRequests);
+    array_clear(manager->cfFilterHashes);
+    manager->cfStopHash = UINT256_ZERO;
+    manager->cfHeader = UINT256_ZERO;
+    manager->cfCheckPeer = NULL;
+    manager->cfChecked = 0;
+}
+
+// blocks below this height are no longer needed for compact filter sync, and may be freed
+static uint32_t _btcPeerManagerCompactFiltersLowHeight(BRBitcoinPeerManager *manager)
+{
+    uint32_t height = manager->cfHeight;
+    BRBitcoinMerkleBlock *b;
+
+    for (size_t i = array_count(manager->cfBlockRequests); i > 0; i--) { // a requested block still needs its parent
+        b = BRSetGet(manager->blocks, &manager->cfBlockRequests[i - 1]);
+        if (b && b->height - 1 < height) height = b->height - 1;
+    }
+
+    return height;
+}
+
+// once filters are matched through a fully downloaded chain and all matched blocks are received, finishes the sync
+// returns true if the sync finished, in which case the caller must call syncStopped() after releasing the lock
+static int _btcPeerManagerCompactFiltersDone(BRBitcoinPeerManager *manager)
+{
+    BRBitcoinMerkleBlock *b = manager->lastBlock;
+    size_t i, j, saveCount = (b->height % BLOCK_DIFFICULTY_INTERVAL) + BLOCK_DIFFICULTY_INTERVAL + 1;
+
+    if (manager->syncStartHeight == 0 || ! manager->downloadPeer || manager->cfHeight < b->height ||
+        b->height < manager->estimatedHeight || array_count(manager->cfBlockRequests) > 0) return 0;
+
+    BRBitcoinMerkleBlock *saveBlocks[saveCount];
+
+    for (i = 0; b && i < saveCount; i++) {
+        saveBlocks[i] = b;
+        b = BRSetGet(manager->blocks, &b->prevBlock);
+    }
+
+    // make sure the set of blocks to be saved starts at a difficulty interval
+    j = (i > 0) ? saveBlocks[i - 1]->height % BLOCK_DIFFICULTY_INTERVAL : 0;
+    if (j > 0) i -= (i > BLOCK_DIFFICULTY_INTERVAL - j) ? BLOCK_DIFFICULTY_INTERVAL - j : i;
+    if (i > 0 && manager->saveBlocks) manager->saveBlocks(manager->info, (i > 1 ? 1 : 0), saveBlocks, i);
+    peer_log(manager->downloadPeer, "sync succeeded");
+    _btcPeerManagerSyncStopped(manager);
+
+    // without a bloom filter there's no mempool to load, but pending tx still need publishing
+    for (i = array_count(manager->connectedPeers); i > 0; i--) {
+        BRBitcoinPeer *peer = manager->connectedPeers[i - 1];
+
+        if (btcPeerConnectStatus(peer) != BRPeerStatusConnected) continue;
+        _btcPeerManagerPublishPendingTx(manager, peer);
+        _btcPeerManagerRequestUnrelayedTx(manager, peer);
+        btcPeerSendGetaddr(peer); // request a list of other bitcoin peers
+    }
+
+    return 1;
+}
+
 // returns a UINT128_ZERO terminated array of addresses for hostname that must be freed, or NULL if lookup failed
 static UInt128 *_addressLookup(const char *hostname)
 {
@@ -674,7 +1116,8 @@ static void *_findPeersThreadRoutine(void *arg)
 // DNS peer discovery
 static void _btcPeerManagerFindPeers(BRBitcoinPeerManager *manager)
 {
-    uint64_t services = SERVICES_NODE_NETWORK | SERVICES_NODE_BLOOM | manager->params->services;
+    uint64_t services = SERVICES_NODE_NETWORK | manager->params->services |
+                        (manager->compactFilters ? SERVICES_NODE_COMPACT_FILTERS : SERVICES_NODE_BLOOM);
     time_t now = time(NULL);
     struct timespec ts;
     pthread_t thread;
@@ -724,6 +1167,7 @@ static void _peerConnected(void *info)
     BRBitcoinPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
     BRPeerCallbackInfo *peerInfo;
     time_t now = time(NULL);
+    int syncFinished = 0;
     
     pthread_mutex_lock(&manager->lock);
     if (peer->timestamp > now + 2*60*60 || peer->timestamp < now - 2*60*60) peer->timestamp = (uint64_t) now; // sanity check
@@ -741,14 +1185,34 @@ static void _peerConnected(void *info)
         peer_log(peer, "node isn't synced");
         btcPeerDisconnect(peer);
     }
-    else if (btcPeerVersion(peer) >= 70011 && (peer->services & SERVICES_NODE_BLOOM) != SERVICES_NODE_BLOOM) {
+    else if (manager->compactFilters &&
+             (peer->services & SERVICES_NODE_COMPACT_FILTERS) != SERVICES_NODE_COMPACT_FILTERS) {
+        peer_log(peer, "node doesn't serve compact block filters");
+
+        for (size_t i = array_count(manager->peers); i > 0; i--) { // most nodes don't, so don't try this one again
+            if (btcPeerEq(&manager->peers[i - 1], peer)) array_rm(manager->peers, i - 1);
+        }
+
+        btcPeerDisconnect(peer);
+    }
+    else if (! manager->compactFilters && btcPeerVersion(peer) >= 70011 &&
+             (peer->services & SERVICES_NODE_BLOOM) != SERVICES_NODE_BLOOM) {
         peer_log(peer, "node doesn't support SPV mode");
         btcPeerDisconnect(peer);
     }
     else if (manager->downloadPeer && // check if we should stick with the existing download peer
              (btcPeerLastBlock(manager->downloadPeer) >= btcPeerLastBlock(peer) ||
               manager->lastBlock->height >= btcPeerLastBlock(peer))) {
-        if (manager->lastBlock->height >= btcPeerLastBlock(peer)) { // only load bloom filter if we're done syncing
+        if (_btcPeerManagerIsDownloading(manager)) { // help download merkleblocks
+            _btcPeerManagerLoadBloomFilter(manager, peer);
+            _btcPeerManagerRequestBlocks(manager);
+        }
+        else if (manager->lastBlock->height >= btcPeerLastBlock(peer) && manager->compactFilters) {
+            manager->connectFailureCount = 0; // there's no bloom filter or mempool to load in compact filter mode
+            _btcPeerManagerPublishPendingTx(manager, peer);
+            _btcPeerManagerRequestUnrelayedTx(manager, peer);
+        }
+        else if (manager->lastBlock->height >= btcPeerLastBlock(peer)) { // only load bloom filter if we're done syncing
             manager->connectFailureCount = 0; // also reset connect failure count if we're already synced
             _btcPeerManagerLoadBloomFilter(manager, peer);
             _btcPeerManagerPublishPendingTx(manager, peer);
@@ -779,26 +1243,39 @@ static void _peerConnected(void *info)
         manager->downloadPeer = peer;
         manager->isConnected = 1;
         manager->estimatedHeight = btcPeerLastBlock(peer);
-        _btcPeerManagerLoadBloomFilter(manager, peer);
+        if (manager->compactFilters) _btcPeerManagerResetCompactFilters(manager);
+        else _btcPeerManagerLoadBloomFilter(manager, peer);
         btcPeerSetCurrentBlockHeight(peer, manager->lastBlock->height);
         _btcPeerManagerPublishPendingTx(manager, peer);
             
         if (manager->lastBlock->height < btcPeerLastBlock(peer)) { // start blockchain sync
-            size_t   count    = _btcPeerManagerBlockLocators(manager, NULL, 0);
-            UInt256 *locators = calloc (count, sizeof(UInt256)); // Okay if NULL
-            
-            _btcPeerManagerBlockLocators (manager, locators, count);
-            
             btcPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT); // schedule sync timeout
 
-            // request just block headers up to a week before earliestKeyTime, and then merkleblocks after that
+            // request block headers up to the chain tip, and then the merkleblocks after one week before
+            // earliestKeyTime from every connected peer, or in compact filter mode, the filters as the headers arrive
             // we do not reset connect failure count yet incase this request times out
-            if (manager->lastBlock->timestamp + 7*24*60*60 >= manager->earliestKeyTime) {
-                btcPeerSendGetblocks(peer, locators, count, UINT256_ZERO);
-            }
-            else btcPeerSendGetheaders(peer, locators, count, UINT256_ZERO);
+            if (manager->compactFilters) {
+                size_t   count    = _btcPeerManagerBlockLocators(manager, NULL, 0);
+                UInt256 *locators = calloc (count, sizeof(UInt256)); // Okay if NULL
 
-            if (locators) free (locators);
+                _btcPeerManagerBlockLocators (manager, locators, count);
+                btcPeerSendGetheaders(peer, locators, count, UINT256_ZERO);
+                if (locators) free (locators);
+            }
+            else {
+                manager->mbHeaderHeight = 0; // the new download peer has yet to be asked for headers
+                _btcPeerManagerRequestHeaders(manager);
+                _btcPeerManagerRequestBlocks(manager); // resume any merkleblock download a previous download peer began
+            }
+        }
+        else if (manager->compactFilters) { // we're already synced, but may not have matched all the filters
+            manager->connectFailureCount = 0; // reset connect failure count
+            _btcPeerManagerRequestCompactFilters(manager);
+            syncFinished = _btcPeerManagerCompactFiltersDone(manager);
+        }
+        else if (_btcPeerManagerIsDownloading(manager)) { // we have the headers, but not all the merkleblocks
+            manager->connectFailureCount = 0; // reset connect failure count
+            _btcPeerManagerRequestBlocks(manager);
         }
         else { // we're already synced
             manager->connectFailureCount = 0; // reset connect failure count
@@ -806,7 +1283,10 @@ static void _peerConnected(void *info)
         }
     }
 
+    _btcPeerManagerCheckCFHeaders(manager); // a cfheaders batch may be waiting for a second peer to check it
     pthread_mutex_unlock(&manager->lock);
+    if (syncFinished && manager->txStatusUpdate) manager->txStatusUpdate(manager->info);
+    if (syncFinished && manager->syncStopped) manager->syncStopped(manager->info, 0);
 }
 
 static void _peerDisconnected(void *info, int error)
@@ -815,13 +1295,16 @@ static void _peerDisconnected(void *info, int error)
     BRBitcoinPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
     BRTxPeerList *peerList;
     int willSave = 0, willReconnect = 0, txError = 0;
-    size_t txCount = 0;
+    size_t txCount = 0, range;
     
     //free(info);
     pthread_mutex_lock(&manager->lock);
 
     BRPublishedTx pubTx[array_count(manager->publishedTx)];
     
+    range = _btcPeerManagerBlockRange(manager, peer);
+    if (range != SIZE_MAX) manager->mbRanges[range].peer = NULL; // reassign the range the peer was downloading
+    
     if (error == EPROTO) { // if it's protocol error, the peer isn't following standard policy
         _btcPeerManagerPeerMisbehavin(manager, peer);
     }
@@ -832,10 +1315,13 @@ static void _peerDisconnected(void *info, int error)
         
         manager->connectFailureCount++;
         
-        // if it's a timeout and there's pending tx publish callbacks, the tx publish timed out
+        // if it's a timeout and there's pending tx publish callbacks, the tx publish timed out, unless the peer was
+        // syncing or downloading merkleblocks
         // BUG: XXX what if it's a connect timeout and not a publish timeout?
-        if (error == ETIMEDOUT && (peer != manager->downloadPeer || manager->syncStartHeight == 0 ||
-                                   array_count(manager->connectedPeers) == 1)) txError = ETIMEDOUT;
+        if (error == ETIMEDOUT && ((peer != manager->downloadPeer && range == SIZE_MAX) ||
+                                   manager->syncStartHeight == 0 || array_count(manager->connectedPeers) == 1)) {
+            txError = ETIMEDOUT;
+        }
     }
     
     for (size_t i = array_count(manager->txRelays); i > 0; i--) {
@@ -847,10 +1333,15 @@ static void _peerDisconnected(void *info, int error)
     }
 
     if (peer == manager->downloadPeer) { // download peer disconnected
+        if (manager->compactFilters) _btcPeerManagerResetCompactFilters(manager);
         manager->isConnected = 0;
         manager->downloadPeer = NULL;
         if (manager->connectFailureCount > MAX_CONNECT_FAILURES) manager->connectFailureCount = MAX_CONNECT_FAILURES;
     }
+    else if (peer == manager->cfCheckPeer) { // ask another peer to check the download peer's cfheaders
+        manager->cfCheckPeer = NULL;
+        _btcPeerManagerCheckCFHeaders(manager);
+    }
 
     if (! manager->isConnected && manager->connectFailureCount == MAX_CONNECT_FAILURES) {
         _btcPeerManagerSyncStopped(manager);
@@ -879,6 +1370,7 @@ static void _peerDisconnected(void *info, int error)
         break;
     }
 
+    if (range != SIZE_MAX) _btcPeerManagerRequestBlocks(manager);
     btcPeerFree(peer);
     pthread_mutex_unlock(&manager->lock);
     
@@ -929,7 +1421,7 @@ static void _peerRelayedTx(void *info, BRBitcoinTransaction *tx)
     void *txInfo = NULL;
     void (*txCallback)(void *, int) = NULL;
     int isWalletTx = 0, hasPendingCallbacks = 0;
-    size_t relayCount = 0;
+    size_t relayCount = 0, range;
     
     pthread_mutex_lock(&manager->lock);
     peer_log(peer, "relayed tx: %s", u256hex(tx->txHash));
@@ -950,9 +1442,43 @@ static void _peerRelayedTx(void *info, BRBitcoinTransaction *tx)
         btcPeerScheduleDisconnect(peer, -1); // cancel publish tx timeout
     }
 
+    range = _btcPeerManagerBlockRange(manager, peer);
+
     if (manager->syncStartHeight == 0 || btcWalletContainsTransaction(manager->wallet, tx)) {
         isWalletTx = btcWalletRegisterTransaction(manager->wallet, tx);
         if (isWalletTx) tx = btcWalletTransactionForHash(manager->wallet, tx->txHash);
+        if (isWalletTx) _btcPeerManagerRegisterUnmatchedTx(manager);
+    }
+    else if (range != SIZE_MAX) {
+        // merkleblocks are downloaded out of order, so a tx may arrive before the wallet tx whose outputs it spends,
+        // keep it until the merkleblocks up to its own have all been received
+        uint32_t start = manager->mbRanges[range].start, end = manager->mbRanges[range].end;
+        size_t rangeTxCount = 0;
+
+        for (size_t i = array_count(manager->mbTxs); tx && i > 0; i--) {
+            if (manager->mbTxs[i - 1].height >= start && manager->mbTxs[i - 1].height <= end) rangeTxCount++;
+            if (! btcTransactionEq(manager->mbTxs[i - 1].tx, tx)) continue;
+            btcTransactionFree(tx);
+            tx = NULL;
+        }
+
+        if (tx && rangeTxCount >= MB_RANGE_TX_MAX) {
+            // far more than the bloom filter false positive rate allows, so rather than let the peer grow mbTxs without
+            // bound, drop the range's unmatched tx and disconnect it; the rest of the range is reassigned
+            peer_log(peer, "relayed over %d unmatched tx for merkleblocks from height %"PRIu32" to %"PRIu32
+                     ", disconnecting...", MB_RANGE_TX_MAX, start, end);
+
+            for (size_t i = array_count(manager->mbTxs); i > 0; i--) {
+                if (manager->mbTxs[i - 1].height < start || manager->mbTxs[i - 1].height > end) continue;
+                btcTransactionFree(manager->mbTxs[i - 1].tx);
+                array_rm(manager->mbTxs, i - 1);
+            }
+
+            btcTransactionFree(tx);
+            btcPeerDisconnect(peer);
+        }
+        else if (tx) array_add(manager->mbTxs, ((const BRUnmatchedTx) { tx, end }));
+        tx = NULL;
     }
     else {
         btcTransactionFree(tx);
@@ -1102,9 +1628,16 @@ static int _btcPeerManagerVerifyBlock(BRBitcoinPeerManager *manager, BRBitcoinMe
     if (r && (block->height % BLOCK_DIFFICULTY_INTERVAL) == 0) {
         BRBitcoinMerkleBlock *b = block;
         UInt256 prevBlock;
+        uint32_t lowHeight;
 
-        for (uint32_t i = 0; b && i < BLOCK_DIFFICULTY_INTERVAL; i++) {
-            b = BRSetGet(manager->blocks, &b->prevBlock);
+        if (_btcPeerManagerChainBlock(manager, prev->height) == prev) { // block extends the main chain
+            b = (block->height >= BLOCK_DIFFICULTY_INTERVAL) ?
+                _btcPeerManagerChainBlock(manager, block->height - BLOCK_DIFFICULTY_INTERVAL) : NULL;
+        }
+        else {
+            for (uint32_t i = 0; b && i < BLOCK_DIFFICULTY_INTERVAL; i++) {
+                b = BRSetGet(manager->blocks, &b->prevBlock);
+            }
         }
 
         if (! b) {
@@ -1113,11 +1646,16 @@ static int _btcPeerManagerVerifyBlock(BRBitcoinPeerManager *manager, BRBitcoinMe
         }
         else prevBlock = b->prevBlock;
 
+        // keep blocks whose filters still need matching in compact filter mode, or whose merkleblocks still need
+        // downloading otherwise
+        lowHeight = (manager->compactFilters) ? _btcPeerManagerCompactFiltersLowHeight(manager) : manager->mbHeight;
+
         while (b) { // free up some memory
             b = BRSetGet(manager->blocks, &prevBlock);
             if (b) prevBlock = b->prevBlock;
 
-            if (b && (b->height % BLOCK_DIFFICULTY_INTERVAL) != 0) {
+            if (b && (b->height % BLOCK_DIFFICULTY_INTERVAL) != 0 && b->height < lowHeight) {
+                _btcPeerManagerChainRemove(manager, b);
                 BRSetRemove(manager->blocks, b);
                 btcMerkleBlockFree(b);
             }
@@ -1164,7 +1702,7 @@ static void _peerRelayedBlock(void *info, BRBitcoinMerkleBlock *block)
     BRBitcoinPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
     BRBitcoinPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
     size_t i, j, fpCount = 0, saveCount = 0;
-    BRBitcoinMerkleBlock orphan, *b, *b2, *prev, *next = NULL;
+    BRBitcoinMerkleBlock orphan, *b, *b2, *prev, *next = NULL, *saveFrom = NULL;
     uint32_t txTime = 0;
 
     if (NULL == peer || NULL == manager) {
@@ -1175,8 +1713,7 @@ static void _peerRelayedBlock(void *info, BRBitcoinMerkleBlock *block)
     // Check manager - ensure anything dereferenced subsequently is valid
     if (NULL == manager->blocks ||
         NULL == manager->wallet ||
-        NULL == manager->lastBlock ||
-        NULL == manager->downloadPeer) {
+        NULL == manager->lastBlock) {
         _peerRelayedBlockFailed (block, peer, "missed 'manager' fields");
         return;
     }
@@ -1203,7 +1740,7 @@ static void _peerRelayedBlock(void *info, BRBitcoinMerkleBlock *block)
     }
     
     // track the observed bloom filter false positive rate using a low pass filter to smooth out variance
-    if (peer == manager->downloadPeer && block->totalTx > 0) {
+    if (peer == manager->downloadPeer && block->totalTx > 0 && ! manager->compactFilters) {
         for (i = 0; i < txCount; i++) { // wallet tx are not false-positives
             if (! btcWalletTransactionForHash(manager->wallet, txHashes[i])) fpCount++;
         }
@@ -1222,18 +1759,17 @@ static void _peerRelayedBlock(void *info, BRBitcoinMerkleBlock *block)
                      manager->fpRate, manager->lastBlock->height + 1 - manager->filterUpdateHeight);
             btcPeerDisconnect(peer);
         }
-        else if (manager->lastBlock->height + 500 < btcPeerLastBlock(peer) &&
+        else if (manager->mbHeight + 500 < btcPeerLastBlock(peer) &&
                  manager->fpRate > BLOOM_REDUCED_FALSEPOSITIVE_RATE*10.0) {
             _btcPeerManagerUpdateFilter(manager); // rebuild bloom filter when it starts to degrade
         }
     }
 
-    // ignore block headers that are newer than one week before earliestKeyTime (it's a header if it has 0 totalTx)
-    if (block->totalTx == 0 && block->timestamp + 7*24*60*60 - 2*60*60 > manager->earliestKeyTime) {
-        btcMerkleBlockFree(block);
-        block = NULL;
-    }
-    else if (manager->bloomFilter == NULL) { // ingore potentially incomplete blocks when a filter update is pending
+    // ingore potentially incomplete merkleblocks when a filter update is pending, but not block headers (it's a header
+    // if it has 0 totalTx), which are downloaded all the way to the chain tip before the merkleblocks
+    if (! manager->compactFilters && block->totalTx > 0 &&
+        (manager->bloomFilter == NULL ||
+         ((peer->flags & PEER_FLAG_NEEDSUPDATE) != 0 && _btcPeerManagerIsDownloading(manager)))) {
         btcMerkleBlockFree(block);
         block = NULL;
 
@@ -1259,8 +1795,9 @@ static void _peerRelayedBlock(void *info, BRBitcoinMerkleBlock *block)
                 UInt256 *locators      = calloc (locatorsCount, sizeof(UInt256));
                 _btcPeerManagerBlockLocators (manager, locators, locatorsCount);
 
-                peer_log(peer, "calling getblocks");
-                btcPeerSendGetblocks(peer, locators, locatorsCount, UINT256_ZERO);
+                peer_log(peer, "calling %s", (manager->compactFilters) ? "getheaders" : "getblocks");
+                if (manager->compactFilters) btcPeerSendGetheaders(peer, locators, locatorsCount, UINT256_ZERO);
+                else btcPeerSendGetblocks(peer, locators, locatorsCount, UINT256_ZERO);
 
                 if (NULL != locators) free (locators);
             }
@@ -1290,13 +1827,20 @@ static void _peerRelayedBlock(void *info, BRBitcoinMerkleBlock *block)
             manager->connectFailureCount = 0; // reset failure count once we know our initial request didn't timeout
         }
         
-        if ((block->height % BLOCK_DIFFICULTY_INTERVAL) == 0 && block->height + 100 < manager->estimatedHeight) {
-            saveCount = 1; // save transition blocks immediately
+        if (manager->compactFilters) { // blocks are saved once their filters are matched
+            _btcPeerManagerRequestCompactFilters(manager);
         }
-        
-        if (block->height == manager->estimatedHeight) { // chain download is complete
+        else if (_btcPeerManagerAdvanceMerkleBlocks(manager) && block->height == manager->estimatedHeight) {
             saveCount = (block->height % BLOCK_DIFFICULTY_INTERVAL) + BLOCK_DIFFICULTY_INTERVAL + 1;
-            _btcPeerManagerLoadMempools(manager);
+            _btcPeerManagerLoadMempools(manager); // chain download is complete
+        }
+        else {
+            _btcPeerManagerRequestHeaders(manager); // request the next batch of headers once this one is received
+            _btcPeerManagerRequestBlocks(manager); // request merkleblocks as their headers arrive
+
+            // with no headers requested, the download peer only times out while it has merkleblocks to send
+            if (peer == manager->downloadPeer && ! _btcPeerManagerIsRequestingHeaders(manager) &&
+                _btcPeerManagerBlockRange(manager, peer) == SIZE_MAX) btcPeerScheduleDisconnect(peer, -1);
         }
     }
     else if (BRSetContains(manager->blocks, block)) { // we already have the block (or at least the header)
@@ -1304,8 +1848,7 @@ static void _peerRelayedBlock(void *info, BRBitcoinMerkleBlock *block)
             peer_log(peer, "relayed existing block #%"PRIu32, block->height);
         }
         
-        b = manager->lastBlock;
-        while (b && b->height > block->height) b = BRSetGet(manager->blocks, &b->prevBlock); // is block in main chain?
+        b = _btcPeerManagerChainBlock(manager, block->height); // is block in main chain?
 
         if (b && btcMerkleBlockEq(b, block)) { // if it's not on a fork, set block heights for its transactions
             if (txCount > 0) btcWalletUpdateTransactions(manager->wallet, txHashes, txCount, block->height, txTime);
@@ -1315,10 +1858,39 @@ static void _peerRelayedBlock(void *info, BRBitcoinMerkleBlock *block)
         b = BRSetAdd(manager->blocks, block);
 
         if (b != block) {
+            if (b->height >= manager->chainHeight && b->height - manager->chainHeight < array_count(manager->chain) &&
+                manager->chain[b->height - manager->chainHeight] == b) {
+                manager->chain[b->height - manager->chainHeight] = block;
+            }
+
             if (BRSetGet(manager->orphans, b) == b) BRSetRemove(manager->orphans, b);
             if (manager->lastOrphan == b) manager->lastOrphan = NULL;
             btcMerkleBlockFree(b);
         }
+
+        // a merkleblock downloaded out of order takes the place of its header in the main chain
+        if (! manager->compactFilters && block->totalTx > 0 &&
+            _btcPeerManagerChainBlock(manager, block->height) == block) {
+            for (i = array_count(manager->mbTxs); i > 0; i--) { // set block heights for unmatched tx
+                for (j = 0; j < txCount && ! UInt256Eq(manager->mbTxs[i - 1].tx->txHash, txHashes[j]); j++);
+                if (j == txCount) continue;
+                manager->mbTxs[i - 1].tx->blockHeight = block->height;
+                manager->mbTxs[i - 1].tx->timestamp = txTime;
+                manager->mbTxs[i - 1].height = block->height;
+            }
+
+            if (_btcPeerManagerBlockRange(manager, peer) != SIZE_MAX) {
+                btcPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT); // reschedule stall timeout
+            }
+
+            if (_btcPeerManagerAdvanceMerkleBlocks(manager) &&
+                manager->lastBlock->height == manager->estimatedHeight) { // chain download is complete
+                saveCount = (manager->lastBlock->height % BLOCK_DIFFICULTY_INTERVAL) + BLOCK_DIFFICULTY_INTERVAL + 1;
+                saveFrom = manager->lastBlock;
+                _btcPeerManagerLoadMempools(manager);
+            }
+            else _btcPeerManagerRequestHeaders(manager); // mbHeight may have advanced enough to request more headers
+        }
     }
     else if (manager->lastBlock->height < btcPeerLastBlock(peer) &&
              block->height > manager->lastBlock->height + 1) { // special case, new block mined durring rescan
@@ -1373,9 +1945,26 @@ static void _peerRelayedBlock(void *info, BRBitcoinMerkleBlock *block)
         
             manager->lastBlock = block;
             
-            if (block->height == manager->estimatedHeight) { // chain download is complete
-                saveCount = (block->height % BLOCK_DIFFICULTY_INTERVAL) + BLOCK_DIFFICULTY_INTERVAL + 1;
-                _btcPeerManagerLoadMempools(manager);
+            if (manager->compactFilters) { // filters after the fork point are matched again
+                if (manager->cfHeight > b2->height) manager->cfHeight = b2->height;
+                manager->cfStopHash = UINT256_ZERO;
+                array_clear(manager->cfFilterHashes);
+                _btcPeerManagerRequestCompactFilters(manager);
+            }
+            else {
+                // merkleblocks after the fork point are downloaded, unless we already have them
+                if (manager->mbHeight > b2->height) manager->mbHeight = b2->height;
+                array_clear(manager->mbRanges);
+                manager->mbNextHeight = manager->mbHeight + 1;
+
+                if (_btcPeerManagerAdvanceMerkleBlocks(manager) && block->height == manager->estimatedHeight) {
+                    saveCount = (block->height % BLOCK_DIFFICULTY_INTERVAL) + BLOCK_DIFFICULTY_INTERVAL + 1;
+                    _btcPeerManagerLoadMempools(manager); // chain download is complete
+                }
+                else {
+                    _btcPeerManagerRequestHeaders(manager);
+                    _btcPeerManagerRequestBlocks(manager);
+                }
             }
         }
     }
@@ -1392,7 +1981,7 @@ static void _peerRelayedBlock(void *info, BRBitcoinMerkleBlock *block)
     
     BRBitcoinMerkleBlock *saveBlocks[saveCount];
     
-    for (i = 0, b = block; b && i < saveCount; i++) {
+    for (i = 0, b = (saveFrom) ? saveFrom : block; b && i < saveCount; i++) {
         if (b->height == BLOCK_UNKNOWN_HEIGHT) {
             _peerRelayedBlockFailed (NULL, peer, "In 'save' missed 'height'");
             return;
@@ -1419,6 +2008,196 @@ static void _peerRelayedBlock(void *info, BRBitcoinMerkleBlock *block)
     if (next) _peerRelayedBlock(info, next);
 }
 
+static void _peerRelayedCFHeaders(void *info, UInt256 stopHash, UInt256 prevHeader, const UInt256 filterHashes[],
+                                  size_t filterCount)
+{
+    BRBitcoinPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
+    BRBitcoinPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
+    BRBitcoinMerkleBlock *block = NULL;
+    UInt256 header = prevHeader;
+
+    pthread_mutex_lock(&manager->lock);
+
+    if (filterCount > 0 && filterCount <= CF_BATCH_SIZE) {
+        block = _btcPeerManagerChainBlock(manager, manager->cfStartHeight + (uint32_t)filterCount - 1);
+    }
+
+    if (peer == manager->cfCheckPeer && UInt256Eq(stopHash, manager->cfStopHash) && ! manager->cfChecked) {
+        for (size_t i = 0; i < filterCount; i++) header = btcCompactFilterHeader(filterHashes[i], header);
+        manager->cfCheckPeer = NULL;
+        btcPeerScheduleDisconnect(peer, -1); // cancel check timeout
+
+        if (filterCount != array_count(manager->cfFilterHashes) ||
+            ! UInt256Eq(prevHeader, manager->cfCheckPrevHeader) || ! UInt256Eq(header, manager->cfHeader)) {
+            // one of the two peers is lying, and there's no telling which, so both are dropped and the batch is
+            // requested again from a new download peer
+            peer_log(peer, "cfheaders to stopHash: %s differ from download peer's, filter header: %s",
+                     u256hex(stopHash), u256hex(manager->cfHeader));
+            _btcPeerManagerPeerMisbehavin(manager, manager->downloadPeer);
+            _btcPeerManagerPeerMisbehavin(manager, peer);
+        }
+        else {
+            manager->cfChecked = 1;
+            btcPeerSendGetcfilters(manager->downloadPeer, manager->cfStartHeight, stopHash);
+        }
+    }
+    else if (peer != manager->downloadPeer || ! UInt256Eq(stopHash, manager->cfStopHash) ||
+        array_count(manager->cfFilterHashes) > 0) {
+        peer_log(peer, "ignoring unrequested cfheaders, stopHash: %s", u256hex(stopHash));
+    }
+    else if (! block || ! UInt256Eq(block->blockHash, stopHash)) {
+        peer_log(peer, "cfheaders with %zu filter hashes doesn't end at stopHash: %s", filterCount, u256hex(stopHash));
+        _btcPeerManagerPeerMisbehavin(manager, peer);
+    }
+    else if (manager->cfHeaderHeight + 1 == manager->cfStartHeight && ! UInt256IsZero(manager->cfHeader) &&
+             ! UInt256Eq(prevHeader, manager->cfHeader)) {
+        peer_log(peer, "cfheaders doesn't connect to previous filter header: %s", u256hex(manager->cfHeader));
+        _btcPeerManagerPeerMisbehavin(manager, peer);
+    }
+    else {
+        for (size_t i = 0; i < filterCount; i++) header = btcCompactFilterHeader(filterHashes[i], header);
+        array_add_array(manager->cfFilterHashes, filterHashes, filterCount);
+        manager->cfHeader = header;
+        manager->cfHeaderHeight = manager->cfStartHeight + (uint32_t)filterCount - 1;
+        manager->cfCheckPrevHeader = prevHeader;
+        _btcPeerManagerCheckCFHeaders(manager); // the filters are requested once a second peer's cfheaders match
+    }
+
+    pthread_mutex_unlock(&manager->lock);
+}
+
+static void _peerRelayedCFilter(void *info, UInt256 blockHash, const uint8_t *filter, size_t filterLen)
+{
+    BRBitcoinPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
+    BRBitcoinPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
+    BRBitcoinMerkleBlock *block;
+    size_t i;
+    int syncFinished = 0;
+
+    pthread_mutex_lock(&manager->lock);
+    block = _btcPeerManagerChainBlock(manager, manager->cfHeight + 1);
+    i = manager->cfHeight + 1 - manager->cfStartHeight; // index of the expected filter in the current batch
+
+    // filters arrive in block order, any other filter is from a batch that was abandoned after a reorg or rescan
+    if (peer != manager->downloadPeer || manager->cfHeight + 1 < manager->cfStartHeight ||
+        i >= array_count(manager->cfFilterHashes) || ! block || ! UInt256Eq(block->blockHash, blockHash)) {
+        peer_log(peer, "ignoring unexpected cfilter for block: %s", u256hex(blockHash));
+    }
+    else if (! UInt256Eq(btcCompactFilterHash(filter, filterLen), manager->cfFilterHashes[i])) {
+        peer_log(peer, "cfilter doesn't match filter hash from cfheaders, block: %s", u256hex(blockHash));
+        _btcPeerManagerPeerMisbehavin(manager, peer);
+    }
+    else {
+        if (btcCompactFilterMatchAny(filter, filterLen, blockHash, manager->cfItems, manager->cfItemLens,
+                                     array_count(manager->cfItems))) {
+            peer_log(peer, "compact filter matched block #%"PRIu32", requesting block", block->height);
+            array_add(manager->cfBlockRequests, blockHash);
+            btcPeerSendGetdata(peer, NULL, 0, &blockHash, 1);
+        }
+
+        manager->cfHeight = block->height;
+        if (manager->syncStartHeight > 0) btcPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT); // reschedule sync timeout
+
+        // save transition blocks once their filters are matched, and any matched blocks are received
+        if ((block->height % BLOCK_DIFFICULTY_INTERVAL) == 0 && block->height + 100 < manager->estimatedHeight &&
+            array_count(manager->cfBlockRequests) == 0 && manager->saveBlocks) {
+            manager->saveBlocks(manager->info, 0, &block, 1);
+        }
+
+        if (i + 1 == array_count(manager->cfFilterHashes)) { // batch is complete
+            manager->cfStopHash = UINT256_ZERO;
+            array_clear(manager->cfFilterHashes);
+            _btcPeerManagerRequestCompactFilters(manager);
+        }
+
+        syncFinished = _btcPeerManagerCompactFiltersDone(manager);
+    }
+
+    pthread_mutex_unlock(&manager->lock);
+    if (syncFinished && manager->txStatusUpdate) manager->txStatusUpdate(manager->info);
+    if (syncFinished && manager->syncStopped) manager->syncStopped(manager->info, 0);
+}
+
+static void _peerRelayedFullBlock(void *info, BRBitcoinMerkleBlock *block, BRBitcoinTransaction *txs[], size_t txCount)
+{
+    BRBitcoinPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
+    BRBitcoinPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
+    UInt256 *txHashes = malloc(txCount*sizeof(*txHashes));
+    uint8_t *matches = calloc(txCount, sizeof(*matches));
+    BRBitcoinMerkleBlock *prev;
+    size_t i, addrsCount, requested = SIZE_MAX;
+    int syncFinished = 0;
+
+    assert(txHashes != NULL);
+    assert(matches != NULL);
+    for (i = 0; i < txCount; i++) txHashes[i] = txs[i]->txHash;
+    btcMerkleBlockSetTxMatches(block, txHashes, matches, txCount);
+    pthread_mutex_lock(&manager->lock);
+
+    for (i = array_count(manager->cfBlockRequests); i > 0; i--) {
+        if (UInt256Eq(manager->cfBlockRequests[i - 1], block->blockHash)) requested = i - 1;
+    }
+
+    if (requested == SIZE_MAX) {
+        peer_log(peer, "ignoring unrequested block: %s", u256hex(block->blockHash));
+        btcMerkleBlockFree(block);
+        block = NULL;
+    }
+    else if (! btcMerkleBlockIsValid(block, (uint32_t)time(NULL))) { // the tx don't hash to the block's merkle root
+        peer_log(peer, "relayed block with invalid tx: %s", u256hex(block->blockHash));
+        btcMerkleBlockFree(block);
+        block = NULL;
+        _btcPeerManagerPeerMisbehavin(manager, peer);
+    }
+    else {
+        array_rm(manager->cfBlockRequests, requested);
+
+        // registering a wallet tx can generate new wallet addresses, which later tx in the block may pay to
+        do {
+            addrsCount = btcWalletAllAddrs(manager->wallet, NULL, 0);
+
+            for (i = 0; i < txCount; i++) {
+                if (matches[i] || ! btcWalletContainsTransaction(manager->wallet, txs[i])) continue;
+                matches[i] = 1;
+
+                if (! btcWalletTransactionForHash(manager->wallet, txHashes[i]) &&
+                    btcWalletRegisterTransaction(manager->wallet, txs[i])) txs[i] = NULL; // the wallet owns tx now
+            }
+        } while (btcWalletAllAddrs(manager->wallet, NULL, 0) != addrsCount);
+
+        btcMerkleBlockSetTxMatches(block, txHashes, matches, txCount);
+        prev = BRSetGet(manager->blocks, &block->prevBlock);
+
+        if (addrsCount != manager->cfAddrsCount) { // the spare wallet addresses ran out, so add new ones
+            _btcPeerManagerLoadCompactFilterScripts(manager);
+
+            if (prev && manager->cfHeight > prev->height + 1) { // filters after this block must be matched again
+                peer_log(peer, "wallet addresses were added, matching compact filters again from block #%"PRIu32,
+                         prev->height + 2);
+                manager->cfHeight = prev->height + 1;
+                manager->cfStopHash = UINT256_ZERO;
+                array_clear(manager->cfFilterHashes);
+                _btcPeerManagerRequestCompactFilters(manager);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&manager->lock);
+
+    for (i = 0; i < txCount; i++) {
+        if (txs[i]) btcTransactionFree(txs[i]);
+    }
+
+    free(matches);
+    free(txHashes);
+    if (block) _peerRelayedBlock(info, block);
+    pthread_mutex_lock(&manager->lock);
+    syncFinished = _btcPeerManagerCompactFiltersDone(manager);
+    pthread_mutex_unlock(&manager->lock);
+    if (syncFinished && manager->txStatusUpdate) manager->txStatusUpdate(manager->info);
+    if (syncFinished && manager->syncStopped) manager->syncStopped(manager->info, 0);
+}
+
 static void _peerDataNotfound(void *info, const UInt256 txHashes[], size_t txCount,
                              const UInt256 blockHashes[], size_t blockCount)
 {
@@ -1536,6 +2315,7 @@ BRBitcoinPeerManager *btcPeerManagerNew(const BRBitcoinChainParams *params, BRBi
     manager->blocks = BRSetNew(btcMerkleBlockHash, btcMerkleBlockEq, blocksCount);
     manager->orphans = BRSetNew(_BRPrevBlockHash, _BRPrevBlockEq, blocksCount); // orphans are indexed by prevBlock
     manager->checkpoints = BRSetNew(_BRBlockHeightHash, _BRBlockHeightEq, 100); // checkpoints are indexed by height
+    array_new(manager->chain, blocksCount + BLOCK_DIFFICULTY_INTERVAL);
 
     for (size_t i = 0; i < manager->params->checkpointsCount; i++) {
         block = btcMerkleBlockNew();
@@ -1571,11 +2351,19 @@ BRBitcoinPeerManager *btcPeerManagerNew(const BRBitcoinChainParams *params, BRBi
     }
 
     _peer_log("BPM: initialized with %u last block height\n", manager->lastBlock->height);
+    manager->mbHeight = manager->lastBlock->height; // saved blocks were all received as merkleblocks, or headers
 
     array_new(manager->txRelays, 10);
     array_new(manager->txRequests, 10);
     array_new(manager->publishedTx, 10);
     array_new(manager->publishedTxHashes, 10);
+    array_new(manager->cfFilterHashes, CF_BATCH_SIZE);
+    array_new(manager->cfBlockRequests, 10);
+    array_new(manager->cfScripts, 0);
+    array_new(manager->cfItems, 0);
+    array_new(manager->cfItemLens, 0);
+    array_new(manager->mbRanges, PEER_MAX_CONNECTIONS);
+    array_new(manager->mbTxs, 10);
     pthread_mutex_init(&manager->lock, NULL);
     manager->threadCleanup = _dummyThreadCleanup;
     return manager;
@@ -1633,6 +2421,32 @@ void btcPeerManagerSetFixedPeer(BRBitcoinPeerManager *manager, UInt128 address,
     }
 }
 
+// sync with BIP157/158 compact block filters instead of a BIP37 bloom filter; peers then can't learn wallet addresses
+// from the filter, but unconfirmed tx paying to the wallet aren't seen until they confirm
+// changing this disconnects from the network, call btcPeerManagerConnect() afterwards to sync in the new mode
+void btcPeerManagerSetCompactFilters(BRBitcoinPeerManager *manager, int enabled)
+{
+    assert(manager != NULL);
+
+    pthread_mutex_lock(&manager->lock);
+    int sameMode = ((enabled != 0) == manager->compactFilters);
+    pthread_mutex_unlock(&manager->lock);
+
+    if (! sameMode) {
+        btcPeerManagerDisconnect(manager);
+        pthread_mutex_lock(&manager->lock);
+        manager->compactFilters = (enabled != 0);
+        // blocks synced in one mode needn't be synced again in the other, cfHeight is reset to at most lastBlock
+        if (manager->compactFilters) manager->cfHeight = manager->mbHeight;
+        else if (manager->cfHeight < manager->lastBlock->height) manager->mbHeight = manager->cfHeight;
+        else manager->mbHeight = manager->lastBlock->height;
+        array_clear(manager->mbRanges);
+        manager->cfAddrsCount = 0;
+        array_clear(manager->peers); // peers found for one mode may not serve the other
+        pthread_mutex_unlock(&manager->lock);
+    }
+}
+
 // current connect status
 BRBitcoinPeerStatus btcPeerManagerConnectStatus(BRBitcoinPeerManager *manager)
 {
@@ -1709,6 +2523,9 @@ void btcPeerManagerConnect(BRBitcoinPeerManager *manager)
                 btcPeerSetCallbacks(info->peer, info, _peerConnected, _peerDisconnected, _peerRelayedPeers,
                                    _peerRelayedTx, _peerHasTx, _peerRejectedTx, _peerRelayedBlock, _peerDataNotfound,
                                    _peerSetFeePerKb, _peerRequestedTx, _peerNetworkIsReachable, _peerThreadCleanup);
+                if (manager->compactFilters) btcPeerSetCompactFilterCallbacks(info->peer, _peerRelayedCFHeaders,
+                                                                              _peerRelayedCFilter, _peerRelayedFullBlock);
+                else btcPeerSetHeadersFirst(info->peer, 1);
                 btcPeerSetEarliestKeyTime(info->peer, manager->earliestKeyTime);
                 btcPeerConnect(info->peer);
 
@@ -1776,6 +2593,12 @@ static int _btcPeerManagerRescan(BRBitcoinPeerManager *manager, BRBitcoinMerkleB
 
     manager->lastBlock = newLastBlock;
     _peer_log("BPM: rescanning with %u last block height", manager->lastBlock->height);
+    manager->mbHeight = manager->lastBlock->height;
+    manager->mbNextHeight = 0;
+    manager->mbHeaderHeight = 0;
+    array_clear(manager->mbRanges);
+    for (size_t i = array_count(manager->mbTxs); i > 0; i--) btcTransactionFree(manager->mbTxs[i - 1].tx);
+    array_clear(manager->mbTxs);
 
     if (manager->downloadPeer) { // disconnect the current download peer so a new random one will be selected
         for (size_t i = array_count(manager->peers); i > 0; i--) {
@@ -1836,13 +2659,9 @@ void btcPeerManagerRescanFromLastHardcodedCheckpoint(BRBitcoinPeerManager *manag
 
 static BRBitcoinMerkleBlock *_btcPeerManagerLookupBlockFromBlockNumber(BRBitcoinPeerManager *manager, uint32_t blockNumber)
 {
-    BRBitcoinMerkleBlock *block = manager->lastBlock;
+    BRBitcoinMerkleBlock *block = _btcPeerManagerChainBlock(manager, blockNumber);
 
-    // walk the chain, looking for blockNumber
-    while (block) {
-        if (block->height == blockNumber) return block;
-        block = BRSetGet (manager->blocks, &block->prevBlock);
-    }
+    if (block) return block;
 
     // blockNumber not in the (abbreviated) chain - look through checkpoints
     for (int i = 0; i < manager->params->checkpointsCount; i++)
@@ -1924,17 +2743,22 @@ uint32_t btcPeerManagerLastBlockTimestamp(BRBitcoinPeerManager *manager)
 double btcPeerManagerSyncProgress(BRBitcoinPeerManager *manager, uint32_t startHeight)
 {
     double progress;
+    uint32_t height;
     
     assert(manager != NULL);
     pthread_mutex_lock(&manager->lock);
     if (startHeight == 0) startHeight = manager->syncStartHeight;
     
+    // blocks are synced once their filters are matched in compact filter mode, or their merkleblocks received
+    height = (manager->compactFilters) ? manager->cfHeight : manager->mbHeight;
+    if (height > manager->lastBlock->height) height = manager->lastBlock->height;
+    
     if (! manager->downloadPeer && manager->syncStartHeight == 0) {
         progress = 0.0;
     }
-    else if (! manager->downloadPeer || manager->lastBlock->height < manager->estimatedHeight) {
-        if (manager->lastBlock->height > startHeight && manager->estimatedHeight > startHeight) {
-            progress = 0.1 + 0.9*(manager->lastBlock->height - startHeight)/(manager->estimatedHeight - startHeight);
+    else if (! manager->downloadPeer || height < manager->estimatedHeight) {
+        if (height > startHeight && manager->estimatedHeight > startHeight) {
+            progress = 0.1 + 0.9*(height - startHeight)/(manager->estimatedHeight - startHeight);
         }
         else progress = 0.05;
     }
@@ -2082,6 +2906,7 @@ void btcPeerManagerFree(BRBitcoinPeerManager *manager)
     BRSetApply(manager->orphans, NULL, _setApplyFreeBlock);
     BRSetFree(manager->orphans);
     BRSetFree(manager->checkpoints);
+    array_free(manager->chain);
     for (size_t i = array_count(manager->txRelays); i > 0; i--) array_free(manager->txRelays[i - 1].peers);
     array_free(manager->txRelays);
     for (size_t i = array_count(manager->txRequests); i > 0; i--) array_free(manager->txRequests[i - 1].peers);
@@ -2096,6 +2921,14 @@ void btcPeerManagerFree(BRBitcoinPeerManager *manager)
 
     array_free(manager->publishedTx);
     array_free(manager->publishedTxHashes);
+    array_free(manager->cfFilterHashes);
+    array_free(manager->cfBlockRequests);
+    array_free(manager->cfScripts);
+    array_free(manager->cfItems);
+    array_free(manager->cfItemLens);
+    array_free(manager->mbRanges);
+    for (size_t i = array_count(manager->mbTxs); i > 0; i--) btcTransactionFree(manager->mbTxs[i - 1].tx);
+    array_free(manager->mbTxs);
     pthread_mutex_unlock(&manager->lock);
     pthread_mutex_destroy(&manager->lock);
     free(manager);
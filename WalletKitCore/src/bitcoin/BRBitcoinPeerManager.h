@@ -69,6 +69,13 @@ void btcPeerManagerSetCallbacks(BRBitcoinPeerManager *manager, void *info,
 // set address to UINT128_ZERO to revert to default behavior
 void btcPeerManagerSetFixedPeer(BRBitcoinPeerManager *manager, UInt128 address, uint16_t port);
 
+// sync with BIP157/158 compact block filters instead of a BIP37 bloom filter; peers then can't learn wallet addresses
+// from the filter, but unconfirmed tx paying to the wallet aren't seen until they confirm
+// each batch of filter headers is checked against a second peer, and both peers are dropped if they disagree, unless a
+// fixed peer is set or only one peer is connected to
+// changing this disconnects from the network, call btcPeerManagerConnect() afterwards to sync in the new mode
+void btcPeerManagerSetCompactFilters(BRBitcoinPeerManager *manager, int enabled);
+
 // current connect status
 BRBitcoinPeerStatus btcPeerManagerConnectStatus(BRBitcoinPeerManager *manager);
 
@@ -36,6 +36,14 @@
 #define SIGHASH_ANYONECANPAY 0x80 // let other people add inputs, I don't care where the rest of the bitcoins come from
 #define SIGHASH_FORKID       0x40 // use BIP143 digest method (for b-cash/b-gold signatures)
 
+// a packed tx is a single allocation holding the tx struct, then its inputs and outputs, and then the bytes their
+// scripts, signatures and witnesses point into; parsed and copied txs are packed, and are unpacked into separately
+// allocated arrays the first time inputs or outputs are added or signed
+typedef struct {
+    BRBitcoinTransaction tx;
+    int isPacked;
+} _BRTransaction;
+
 size_t btcTxInputAddress(const BRBitcoinTxInput *input, char *address, size_t addrLen, BRAddressParams params)
 {
     size_t r = BRAddressFromScriptPubKey(address, addrLen, params, input->script, input->scriptLen);
@@ -184,44 +192,70 @@ static size_t _btcTransactionOutputData(const BRBitcoinTransaction *tx, uint8_t
     return (! data || off <= dataLen) ? off : 0;
 }
 
+// BIP143 hashPrevouts, hashSequence and hashOutputs, which are the same for every input signed with a given hashType
+typedef struct {
+    UInt256 prevouts;
+    UInt256 sequence;
+    UInt256 outputs;
+} BRBitcoinTxWitnessHashes;
+
+// computes the BIP143 hashes for hashType once per tx, rather than once per input, so that signing n inputs is O(n)
+// https://github.com/bitcoin/bips/blob/master/bip-0143.mediawiki
+static void _btcTransactionWitnessHashes(const BRBitcoinTransaction *tx, int hashType, BRBitcoinTxWitnessHashes *hashes)
+{
+    int anyoneCanPay = (hashType & SIGHASH_ANYONECANPAY), sigHash = (hashType & 0x1f);
+    size_t i, bufLen = (sizeof(UInt256) + sizeof(uint32_t))*tx->inCount;
+    uint8_t _buf[0x1000], *buf;
+
+    hashes->prevouts = hashes->sequence = hashes->outputs = UINT256_ZERO;
+    if (! anyoneCanPay) {
+        buf = (bufLen <= sizeof(_buf)) ? _buf : malloc(bufLen);
+
+        for (i = 0; i < tx->inCount; i++) {
+            UInt256Set(&buf[(sizeof(UInt256) + sizeof(uint32_t))*i], tx->inputs[i].txHash);
+            UInt32SetLE(&buf[(sizeof(UInt256) + sizeof(uint32_t))*i + sizeof(UInt256)], tx->inputs[i].index);
+        }
+
+        BRSHA256_2(&hashes->prevouts, buf, bufLen); // inputs hash
+
+        if (sigHash != SIGHASH_SINGLE && sigHash != SIGHASH_NONE) { // buf is at least sizeof(uint32_t)*tx->inCount
+            for (i = 0; i < tx->inCount; i++) UInt32SetLE(&buf[sizeof(uint32_t)*i], tx->inputs[i].sequence);
+            BRSHA256_2(&hashes->sequence, buf, sizeof(uint32_t)*tx->inCount); // sequence hash
+        }
+
+        if (buf != _buf) free(buf);
+    }
+
+    if (sigHash != SIGHASH_SINGLE && sigHash != SIGHASH_NONE) {
+        bufLen = _btcTransactionOutputData(tx, NULL, 0, SIZE_MAX);
+        buf = (bufLen <= sizeof(_buf)) ? _buf : malloc(bufLen);
+        bufLen = _btcTransactionOutputData(tx, buf, bufLen, SIZE_MAX);
+        BRSHA256_2(&hashes->outputs, buf, bufLen); // SIGHASH_ALL outputs hash
+        if (buf != _buf) free(buf);
+    }
+}
+
 // writes the BIP143 witness program data that needs to be hashed and signed for the tx input at index
 // https://github.com/bitcoin/bips/blob/master/bip-0143.mediawiki
+// hashes, if not NULL, must be from _btcTransactionWitnessHashes() for the same tx and hashType
 // returns number of bytes written, or total len needed if data is NULL
 static size_t _btcTransactionWitnessData(const BRBitcoinTransaction *tx, uint8_t *data, size_t dataLen, size_t index,
-                                        int hashType)
+                                        int hashType, const BRBitcoinTxWitnessHashes *hashes)
 {
+    BRBitcoinTxWitnessHashes _hashes;
     BRBitcoinTxInput input;
-    int anyoneCanPay = (hashType & SIGHASH_ANYONECANPAY), sigHash = (hashType & 0x1f);
-    size_t i, off = 0;
+    int sigHash = (hashType & 0x1f);
+    size_t off = 0;
     uint8_t scriptCode[] = { OP_DUP, OP_HASH160, 20, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                              0, 0, 0, 0, 0, 0, 0, 0, 0, OP_EQUALVERIFY, OP_CHECKSIG };
 
     if (index >= tx->inCount) return 0;
+    if (data && ! hashes) _btcTransactionWitnessHashes(tx, hashType, &_hashes), hashes = &_hashes;
     if (data && off + sizeof(uint32_t) <= dataLen) UInt32SetLE(&data[off], tx->version); // tx version
     off += sizeof(uint32_t);
-    
-    if (! anyoneCanPay) {
-        uint8_t buf[(sizeof(UInt256) + sizeof(uint32_t))*tx->inCount];
-        
-        for (i = 0; i < tx->inCount; i++) {
-            UInt256Set(&buf[(sizeof(UInt256) + sizeof(uint32_t))*i], tx->inputs[i].txHash);
-            UInt32SetLE(&buf[(sizeof(UInt256) + sizeof(uint32_t))*i + sizeof(UInt256)], tx->inputs[i].index);
-        }
-        
-        if (data && off + sizeof(UInt256) <= dataLen) BRSHA256_2(&data[off], buf, sizeof(buf)); // inputs hash
-    }
-    else if (data && off + sizeof(UInt256) <= dataLen) UInt256Set(&data[off], UINT256_ZERO); // anyone-can-pay
-    
+    if (data && off + sizeof(UInt256) <= dataLen) UInt256Set(&data[off], hashes->prevouts); // inputs hash
     off += sizeof(UInt256);
-    
-    if (! anyoneCanPay && sigHash != SIGHASH_SINGLE && sigHash != SIGHASH_NONE) {
-        uint8_t buf[sizeof(uint32_t)*tx->inCount];
-        
-        for (i = 0; i < tx->inCount; i++) UInt32SetLE(&buf[sizeof(uint32_t)*i], tx->inputs[i].sequence);
-        if (data && off + sizeof(UInt256) <= dataLen) BRSHA256_2(&data[off], buf, sizeof(buf)); // sequence hash
-    }
-    else if (data && off + sizeof(UInt256) <= dataLen) UInt256Set(&data[off], UINT256_ZERO);
-    
+    if (data && off + sizeof(UInt256) <= dataLen) UInt256Set(&data[off], hashes->sequence); // sequence hash
     off += sizeof(UInt256);
     input = tx->inputs[index];
     input.signature = input.script; // TODO: handle OP_CODESEPARATOR
@@ -235,21 +269,13 @@ static size_t _btcTransactionWitnessData(const BRBitcoinTransaction *tx, uint8_t
 
     off += _btcTxInputData(&input, (data ? &data[off] : NULL), (off <= dataLen ? dataLen - off : 0));
     
-    if (sigHash != SIGHASH_SINGLE && sigHash != SIGHASH_NONE) {
-        size_t bufLen = _btcTransactionOutputData(tx, NULL, 0, SIZE_MAX);
-        uint8_t _buf[0x1000], *buf = (bufLen <= 0x1000) ? _buf : malloc(bufLen);
-        
-        bufLen = _btcTransactionOutputData(tx, buf, bufLen, SIZE_MAX);
-        if (data && off + sizeof(UInt256) <= dataLen) BRSHA256_2(&data[off], buf, bufLen); // SIGHASH_ALL outputs hash
-        if (buf != _buf) free(buf);
-    }
-    else if (sigHash == SIGHASH_SINGLE && index < tx->outCount) {
+    if (sigHash == SIGHASH_SINGLE && index < tx->outCount) {
         uint8_t buf[_btcTransactionOutputData(tx, NULL, 0, index)];
         size_t bufLen = _btcTransactionOutputData(tx, buf, sizeof(buf), index);
         
         if (data && off + sizeof(UInt256) <= dataLen) BRSHA256_2(&data[off], buf, bufLen); //SIGHASH_SINGLE outputs hash
     }
-    else if (data && off + sizeof(UInt256) <= dataLen) UInt256Set(&data[off], UINT256_ZERO); // SIGHASH_NONE
+    else if (data && off + sizeof(UInt256) <= dataLen) UInt256Set(&data[off], hashes->outputs); // ALL, or zero for NONE
     
     off += sizeof(UInt256);
     if (data && off + sizeof(uint32_t) <= dataLen) UInt32SetLE(&data[off], tx->lockTime); // locktime
@@ -268,7 +294,7 @@ static size_t _btcTransactionData(const BRBitcoinTransaction *tx, uint8_t *data,
     int anyoneCanPay = (hashType & SIGHASH_ANYONECANPAY), sigHash = (hashType & 0x1f), witnessFlag = 0;
     size_t i, count, len, woff, off = 0;
     
-    if (hashType & SIGHASH_FORKID) return _btcTransactionWitnessData(tx, data, dataLen, index, hashType);
+    if (hashType & SIGHASH_FORKID) return _btcTransactionWitnessData(tx, data, dataLen, index, hashType, NULL);
     if (anyoneCanPay && index >= tx->inCount) return 0;
     
     for (i = 0; index == SIZE_MAX && ! witnessFlag && i < tx->inCount; i++) {
@@ -354,7 +380,7 @@ static size_t _btcTransactionData(const BRBitcoinTransaction *tx, uint8_t *data,
 // returns a newly allocated empty transaction that must be freed by calling btcTransactionFree()
 BRBitcoinTransaction *btcTransactionNew(void)
 {
-    BRBitcoinTransaction *tx = calloc(1, sizeof(*tx));
+    BRBitcoinTransaction *tx = calloc(1, sizeof(_BRTransaction));
 
     assert(tx != NULL);
     tx->version = TX_VERSION;
@@ -365,128 +391,245 @@ BRBitcoinTransaction *btcTransactionNew(void)
     return tx;
 }
 
+// returns a packed tx with room for inCount inputs, outCount outputs and dataLen bytes of scripts, signatures and
+// witnesses, which are written to *data
+static BRBitcoinTransaction *_btcTransactionNewPacked(size_t inCount, size_t outCount, size_t dataLen, uint8_t **data)
+{
+    size_t len = sizeof(_BRTransaction) + inCount*sizeof(BRBitcoinTxInput) + outCount*sizeof(BRBitcoinTxOutput);
+    _BRTransaction *packed = calloc(1, len + dataLen);
+    BRBitcoinTransaction *tx = &packed->tx;
+
+    assert(packed != NULL);
+    packed->isPacked = 1;
+    tx->version = TX_VERSION;
+    tx->inputs = (BRBitcoinTxInput *)(packed + 1);
+    tx->inCount = inCount;
+    tx->outputs = (BRBitcoinTxOutput *)(tx->inputs + inCount);
+    tx->outCount = outCount;
+    tx->lockTime = TX_LOCKTIME;
+    tx->blockHeight = TX_UNCONFIRMED;
+    *data = (uint8_t *)packed + len;
+    return tx;
+}
+
+// moves the inputs and outputs of a packed tx into separately allocated arrays, so they can be added to or changed
+static void _btcTransactionUnpack(BRBitcoinTransaction *tx)
+{
+    BRBitcoinTxInput *inputs = tx->inputs;
+    BRBitcoinTxOutput *outputs = tx->outputs;
+    size_t inCount = tx->inCount, outCount = tx->outCount;
+
+    if (! ((_BRTransaction *)tx)->isPacked) return;
+    ((_BRTransaction *)tx)->isPacked = 0; // the packed inputs, outputs and data are freed along with tx
+    array_new(tx->inputs, inCount + 1);
+    array_new(tx->outputs, outCount + 1);
+    tx->inCount = tx->outCount = 0;
+
+    for (size_t i = 0; i < inCount; i++) {
+        btcTransactionAddInput(tx, inputs[i].txHash, inputs[i].index, inputs[i].amount,
+                               inputs[i].script, inputs[i].scriptLen, inputs[i].signature, inputs[i].sigLen,
+                               inputs[i].witness, inputs[i].witLen, inputs[i].sequence);
+    }
+
+    for (size_t i = 0; i < outCount; i++) {
+        btcTransactionAddOutput(tx, outputs[i].amount, outputs[i].script, outputs[i].scriptLen);
+    }
+}
+
+// copies len bytes of src to *data, advancing *data, or returns NULL if src is NULL
+inline static uint8_t *_btcTransactionPackBytes(uint8_t **data, const uint8_t *src, size_t len)
+{
+    uint8_t *dst = (src) ? *data : NULL;
+
+    if (src) memcpy(dst, src, len), *data += len;
+    return dst;
+}
+
 // returns a deep copy of tx and that must be freed by calling btcTransactionFree()
 BRBitcoinTransaction *btcTransactionCopy(const BRBitcoinTransaction *tx)
 {
-    BRBitcoinTransaction *cpy = btcTransactionNew();
+    size_t i, dataLen = 0;
+    uint8_t *data;
+
+    assert(tx != NULL);
+
+    for (i = 0; i < tx->inCount; i++) {
+        dataLen += tx->inputs[i].scriptLen + tx->inputs[i].sigLen + tx->inputs[i].witLen;
+    }
+
+    for (i = 0; i < tx->outCount; i++) dataLen += tx->outputs[i].scriptLen;
+
+    BRBitcoinTransaction *cpy = _btcTransactionNewPacked(tx->inCount, tx->outCount, dataLen, &data);
     BRBitcoinTxInput *inputs = cpy->inputs;
     BRBitcoinTxOutput *outputs = cpy->outputs;
-    
-    assert(tx != NULL);
+
     *cpy = *tx;
     cpy->inputs = inputs;
     cpy->outputs = outputs;
-    cpy->inCount = cpy->outCount = 0;
 
-    for (size_t i = 0; i < tx->inCount; i++) {
-        btcTransactionAddInput(cpy, tx->inputs[i].txHash, tx->inputs[i].index, tx->inputs[i].amount,
-                              tx->inputs[i].script, tx->inputs[i].scriptLen,
-                              tx->inputs[i].signature, tx->inputs[i].sigLen,
-                              tx->inputs[i].witness, tx->inputs[i].witLen, tx->inputs[i].sequence);
+    for (i = 0; i < tx->inCount; i++) {
+        inputs[i] = tx->inputs[i];
+        inputs[i].script = _btcTransactionPackBytes(&data, tx->inputs[i].script, tx->inputs[i].scriptLen);
+        inputs[i].signature = _btcTransactionPackBytes(&data, tx->inputs[i].signature, tx->inputs[i].sigLen);
+        inputs[i].witness = _btcTransactionPackBytes(&data, tx->inputs[i].witness, tx->inputs[i].witLen);
     }
-    
-    for (size_t i = 0; i < tx->outCount; i++) {
-        btcTransactionAddOutput(cpy, tx->outputs[i].amount, tx->outputs[i].script, tx->outputs[i].scriptLen);
+
+    for (i = 0; i < tx->outCount; i++) {
+        outputs[i] = tx->outputs[i];
+        outputs[i].script = _btcTransactionPackBytes(&data, tx->outputs[i].script, tx->outputs[i].scriptLen);
     }
 
     return cpy;
 }
 
+// the length of the serialized tx at the start of buf, and its input and output counts, or 0 if buf doesn't hold a
+// complete tx with at least one input and output; this walks buf exactly as btcTransactionParse() reads it
+static size_t _btcTransactionParseLen(const uint8_t *buf, size_t bufLen, size_t *inCount, size_t *outCount)
+{
+    int witnessFlag = 0;
+    size_t i, j, off = sizeof(uint32_t), sLen = 0, len = 0, count;
+
+    *inCount = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+    off += len;
+    if (*inCount == 0 && off + 1 <= bufLen) witnessFlag = buf[off++];
+
+    if (witnessFlag) {
+        *inCount = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+        off += len;
+    }
+
+    if (off + *inCount*(sizeof(UInt256) + sizeof(uint32_t)*2 + 1) > bufLen) *inCount = 0;
+
+    for (i = 0; off <= bufLen && i < *inCount; i++) {
+        off += sizeof(UInt256) + sizeof(uint32_t);
+        sLen = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+        off += len;
+        if (off + sLen <= bufLen && BRScriptPubKeyIsValid(&buf[off], sLen)) off += sizeof(uint64_t);
+        off += sLen + sizeof(uint32_t);
+    }
+
+    *outCount = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+    off += len;
+    if (off + *outCount*(sizeof(uint64_t) + 1) > bufLen) *outCount = 0;
+
+    for (i = 0; off <= bufLen && i < *outCount; i++) {
+        off += sizeof(uint64_t);
+        sLen = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+        off += len + sLen;
+    }
+
+    for (i = 0; witnessFlag && off <= bufLen && i < *inCount; i++) {
+        count = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+        off += len;
+
+        for (j = 0, sLen = 0; j < count && off + sLen <= bufLen; j++) { // stop at the end of buf for a bogus count
+            sLen += (size_t)BRVarInt(&buf[off + sLen], (off + sLen <= bufLen ? bufLen - (off + sLen) : 0), &len);
+            sLen += len;
+        }
+
+        off += sLen;
+    }
+
+    off += sizeof(uint32_t);
+    return (*inCount == 0 || *outCount == 0 || off > bufLen) ? 0 : off;
+}
+
 // buf must contain a serialized tx
 // retruns a transaction that must be freed by calling btcTransactionFree()
 BRBitcoinTransaction *btcTransactionParse(const uint8_t *buf, size_t bufLen)
 {
     assert(buf != NULL || bufLen == 0);
-    if (! buf) return NULL;
-    
+    if (! buf || bufLen < sizeof(uint32_t)) return NULL;
+
     int isSigned = 1, witnessFlag = 0;
-    uint8_t *sBuf;
-    size_t i, j, off = 0, witnessOff = 0, sLen = 0, len = 0, count;
-    BRBitcoinTransaction *tx = btcTransactionNew();
+    uint8_t _sBuf[0x1000], *sBuf, *data;
+    size_t i, j, off = 0, witnessOff = 0, sLen = 0, len = 0, count, inCount, outCount;
+
+    // the tx is packed with a copy of its serialization, which the scripts, signatures and witnesses point into
+    bufLen = _btcTransactionParseLen(buf, bufLen, &inCount, &outCount);
+    if (bufLen == 0) return NULL;
+
+    BRBitcoinTransaction *tx = _btcTransactionNewPacked(inCount, outCount, bufLen, &data);
     BRBitcoinTxInput *input;
     BRBitcoinTxOutput *output;
-    
-    tx->version = (off + sizeof(uint32_t) <= bufLen) ? UInt32GetLE(&buf[off]) : 0;
+
+    buf = memcpy(data, buf, bufLen);
+    tx->version = UInt32GetLE(&buf[off]);
     off += sizeof(uint32_t);
-    tx->inCount = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+    count = (size_t)BRVarInt(&buf[off], bufLen - off, &len);
     off += len;
-    if (tx->inCount == 0 && off + 1 <= bufLen) witnessFlag = buf[off++];
-    
+    if (count == 0) witnessFlag = buf[off++];
+
     if (witnessFlag) {
-        tx->inCount = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+        BRVarInt(&buf[off], bufLen - off, &len);
         off += len;
     }
 
-    if (off + tx->inCount*(sizeof(UInt256) + sizeof(uint32_t)*2 + 1) > bufLen) tx->inCount = 0;
-    array_set_count(tx->inputs, tx->inCount);
-    
-    for (i = 0; off <= bufLen && i < tx->inCount; i++) {
+    for (i = 0; i < tx->inCount; i++) {
         input = &tx->inputs[i];
-        input->txHash = (off + sizeof(UInt256) <= bufLen) ? UInt256Get(&buf[off]) : UINT256_ZERO;
+        input->txHash = UInt256Get(&buf[off]);
         off += sizeof(UInt256);
-        input->index = (off + sizeof(uint32_t) <= bufLen) ? UInt32GetLE(&buf[off]) : 0;
+        input->index = UInt32GetLE(&buf[off]);
         off += sizeof(uint32_t);
-        sLen = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+        sLen = (size_t)BRVarInt(&buf[off], bufLen - off, &len);
         off += len;
-        
-        if (off + sLen <= bufLen && BRScriptPubKeyIsValid(&buf[off], sLen)) {
-            btcTxInputSetScript(input, &buf[off], sLen);
-            input->amount = (off + sLen + sizeof(uint64_t) <= bufLen) ? UInt64GetLE(&buf[off + sLen]) : 0;
+
+        if (BRScriptPubKeyIsValid(&buf[off], sLen)) {
+            input->script = &data[off];
+            input->scriptLen = sLen;
+            input->amount = UInt64GetLE(&buf[off + sLen]);
             off += sizeof(uint64_t);
             isSigned = 0;
         }
-        else if (off + sLen <= bufLen) btcTxInputSetSignature(input, &buf[off], sLen);
-        
+        else input->signature = &data[off], input->sigLen = sLen;
+
         off += sLen;
-        if (! witnessFlag) btcTxInputSetWitness(input, &buf[off], 0); // set witness to empty byte array
-        input->sequence = (off + sizeof(uint32_t) <= bufLen) ? UInt32GetLE(&buf[off]) : 0;
+        if (! witnessFlag) input->witness = &data[off]; // set witness to empty byte array
+        input->sequence = UInt32GetLE(&buf[off]);
         off += sizeof(uint32_t);
     }
-    
-    tx->outCount = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+
+    BRVarInt(&buf[off], bufLen - off, &len);
     off += len;
-    if (off + tx->outCount*(sizeof(uint64_t) + 1) > bufLen) tx->outCount = 0;
-    array_set_count(tx->outputs, tx->outCount);
-    
-    for (i = 0; off <= bufLen && i < tx->outCount; i++) {
+
+    for (i = 0; i < tx->outCount; i++) {
         output = &tx->outputs[i];
-        output->amount = (off + sizeof(uint64_t) <= bufLen) ? UInt64GetLE(&buf[off]) : 0;
+        output->amount = UInt64GetLE(&buf[off]);
         off += sizeof(uint64_t);
-        sLen = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+        sLen = (size_t)BRVarInt(&buf[off], bufLen - off, &len);
         off += len;
-        if (off + sLen <= bufLen) btcTxOutputSetScript(output, &buf[off], sLen);
+        output->script = &data[off];
+        output->scriptLen = sLen;
         off += sLen;
     }
-    
-    for (i = 0, witnessOff = off; witnessFlag && off <= bufLen && i < tx->inCount; i++) {
+
+    for (i = 0, witnessOff = off; witnessFlag && i < tx->inCount; i++) {
         input = &tx->inputs[i];
-        count = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+        count = (size_t)BRVarInt(&buf[off], bufLen - off, &len);
         off += len;
-        
+
         for (j = 0, sLen = 0; j < count; j++) {
-            sLen += (size_t)BRVarInt(&buf[off + sLen], (off + sLen <= bufLen ? bufLen - (off + sLen) : 0), &len);
+            sLen += (size_t)BRVarInt(&buf[off + sLen], bufLen - (off + sLen), &len);
             sLen += len;
         }
-        
-        if (off + sLen <= bufLen) btcTxInputSetWitness(input, &buf[off], sLen);
+
+        input->witness = &data[off];
+        input->witLen = sLen;
         off += sLen;
     }
-    
-    tx->lockTime = (off + sizeof(uint32_t) <= bufLen) ? UInt32GetLE(&buf[off]) : 0;
+
+    tx->lockTime = UInt32GetLE(&buf[off]);
     off += sizeof(uint32_t);
-    
-    if (tx->inCount == 0 || tx->outCount == 0 || off > bufLen) {
-        btcTransactionFree(tx);
-        tx = NULL;
-    }
-    else if (isSigned && witnessFlag) {
+
+    if (isSigned && witnessFlag) {
         BRSHA256_2(&tx->wtxHash, buf, off);
-        sBuf = malloc((witnessOff - 2) + sizeof(uint32_t));
+        sBuf = ((witnessOff - 2) + sizeof(uint32_t) <= sizeof(_sBuf)) ? _sBuf :
+               malloc((witnessOff - 2) + sizeof(uint32_t));
         UInt32SetLE(sBuf, tx->version);
         memcpy(&sBuf[sizeof(uint32_t)], &buf[sizeof(uint32_t) + 2], witnessOff - (sizeof(uint32_t) + 2));
         UInt32SetLE(&sBuf[witnessOff - 2], tx->lockTime);
         BRSHA256_2(&tx->txHash, sBuf, (witnessOff - 2) + sizeof(uint32_t));
-        free(sBuf);
+        if (sBuf != _sBuf) free(sBuf);
     }
     else if (isSigned) {
         BRSHA256_2(&tx->txHash, buf, off);
@@ -517,6 +660,7 @@ void btcTransactionAddInput(BRBitcoinTransaction *tx, UInt256 txHash, uint32_t i
     assert(witness != NULL || witLen == 0);
     
     if (tx) {
+        _btcTransactionUnpack(tx);
         if (script) btcTxInputSetScript(&input, script, scriptLen);
         if (signature) btcTxInputSetSignature(&input, signature, sigLen);
         if (witness) btcTxInputSetWitness(&input, witness, witLen);
@@ -534,6 +678,7 @@ void btcTransactionAddOutput(BRBitcoinTransaction *tx, uint64_t amount, const ui
     assert(script != NULL || scriptLen == 0);
     
     if (tx) {
+        _btcTransactionUnpack(tx);
         btcTxOutputSetScript(&output, script, scriptLen);
         array_add(tx->outputs, output);
         tx->outCount = array_count(tx->outputs);
@@ -638,17 +783,53 @@ int btcTransactionIsSigned(const BRBitcoinTransaction *tx)
     return (tx) ? 1 : 0;
 }
 
+// returns the hash to sign for the tx input at index, given hashes from _btcTransactionWitnessHashes() for witness and
+// forkId inputs; the legacy pre-image, which includes every input, is written to *buf, which is grown (by realloc) to
+// *bufLen as needed and so can be reused across inputs
+static UInt256 _btcTransactionSigHash(const BRBitcoinTransaction *tx, size_t index, int hashType, int isWitness,
+                                      const BRBitcoinTxWitnessHashes *hashes, uint8_t **buf, size_t *bufLen)
+{
+    UInt256 md = UINT256_ZERO;
+    size_t len;
+
+    if (isWitness || (hashType & SIGHASH_FORKID)) {
+        uint8_t data[_btcTransactionWitnessData(tx, NULL, 0, index, hashType, hashes)];
+        
+        len = _btcTransactionWitnessData(tx, data, sizeof(data), index, hashType, hashes);
+        BRSHA256_2(&md, data, len);
+    }
+    else {
+        len = (*buf) ? _btcTransactionData(tx, *buf, *bufLen, index, hashType) : 0;
+
+        if (len == 0) {
+            *bufLen = _btcTransactionData(tx, NULL, 0, index, hashType);
+            *buf = realloc(*buf, *bufLen);
+            assert(*buf != NULL);
+            len = _btcTransactionData(tx, *buf, *bufLen, index, hashType);
+        }
+
+        BRSHA256_2(&md, *buf, len);
+    }
+
+    return md;
+}
+
 // adds signatures to any inputs with NULL signatures that can be signed with any keys
 // forkId is 0 for bitcoin, 0x40 for b-cash, 0x4f for b-gold
 // returns true if tx is signed
 int btcTransactionSign(BRBitcoinTransaction *tx, int forkId, BRKey keys[], size_t keysCount)
 {
     UInt160 pkh[keysCount];
-    size_t i, j;
+    BRBitcoinTxWitnessHashes hashes;
+    int hasHashes = 0;
+    uint8_t *buf = NULL;
+    size_t i, j, bufLen = 0;
     
     assert(tx != NULL);
     assert(keys != NULL || keysCount == 0);
     
+    if (tx) _btcTransactionUnpack(tx);
+
     for (i = 0; tx && i < keysCount; i++) {
         pkh[i] = BRKeyHash160(&keys[i]);
     }
@@ -667,13 +848,17 @@ int btcTransactionSign(BRBitcoinTransaction *tx, int forkId, BRKey keys[], size_
         size_t pkLen = BRKeyPubKey(&keys[j], pubKey, sizeof(pubKey));
         uint8_t sig[73], script[1 + sizeof(sig) + 1 + sizeof(pubKey)];
         size_t sigLen, scriptLen;
-        UInt256 md = UINT256_ZERO;
+        int isWitness = (elemsCount == 2 && *elems[0] == OP_0 && *elems[1] == 20);
+        UInt256 md;
         
-        if (elemsCount == 2 && *elems[0] == OP_0 && *elems[1] == 20) { // pay-to-witness-pubkey-hash
-            uint8_t data[_btcTransactionWitnessData(tx, NULL, 0, i, forkId | SIGHASH_ALL)];
-            size_t dataLen = _btcTransactionWitnessData(tx, data, sizeof(data), i, forkId | SIGHASH_ALL);
-            
-            BRSHA256_2(&md, data, dataLen);
+        if (! hasHashes && (isWitness || (forkId & SIGHASH_FORKID))) {
+            _btcTransactionWitnessHashes(tx, forkId | SIGHASH_ALL, &hashes);
+            hasHashes = 1;
+        }
+
+        md = _btcTransactionSigHash(tx, i, forkId | SIGHASH_ALL, isWitness, &hashes, &buf, &bufLen);
+        
+        if (isWitness) { // pay-to-witness-pubkey-hash
             sigLen = BRKeySign(&keys[j], sig, sizeof(sig) - 1, md);
             sig[sigLen++] = forkId | SIGHASH_ALL;
             scriptLen = BRScriptPushData(script, sizeof(script), sig, sigLen);
@@ -682,10 +867,6 @@ int btcTransactionSign(BRBitcoinTransaction *tx, int forkId, BRKey keys[], size_
             btcTxInputSetWitness(input, script, scriptLen);
         }
         else if (elemsCount >= 2 && *elems[elemsCount - 2] == OP_EQUALVERIFY) { // pay-to-pubkey-hash
-            uint8_t data[_btcTransactionData(tx, NULL, 0, i, forkId | SIGHASH_ALL)];
-            size_t dataLen = _btcTransactionData(tx, data, sizeof(data), i, forkId | SIGHASH_ALL);
-            
-            BRSHA256_2(&md, data, dataLen);
             sigLen = BRKeySign(&keys[j], sig, sizeof(sig) - 1, md);
             sig[sigLen++] = forkId | SIGHASH_ALL;
             scriptLen = BRScriptPushData(script, sizeof(script), sig, sigLen);
@@ -694,10 +875,6 @@ int btcTransactionSign(BRBitcoinTransaction *tx, int forkId, BRKey keys[], size_
             btcTxInputSetWitness(input, script, 0);
         }
         else { // pay-to-pubkey
-            uint8_t data[_btcTransactionData(tx, NULL, 0, i, forkId | SIGHASH_ALL)];
-            size_t dataLen = _btcTransactionData(tx, data, sizeof(data), i, forkId | SIGHASH_ALL);
-
-            BRSHA256_2(&md, data, dataLen);
             sigLen = BRKeySign(&keys[j], sig, sizeof(sig) - 1, md);
             sig[sigLen++] = forkId | SIGHASH_ALL;
             scriptLen = BRScriptPushData(script, sizeof(script), sig, sigLen);
@@ -706,6 +883,8 @@ int btcTransactionSign(BRBitcoinTransaction *tx, int forkId, BRKey keys[], size_
         }
     }
     
+    if (buf) free(buf);
+    
     if (tx && btcTransactionIsSigned(tx)) {
         uint8_t data[btcTransactionSerialize(tx, NULL, 0)];
         size_t len = btcTransactionSerialize(tx, data, sizeof(data));
@@ -733,7 +912,8 @@ void btcTransactionFree(BRBitcoinTransaction *tx)
 {
     assert(tx != NULL);
     
-    if (tx) {
+    if (tx && ((_BRTransaction *)tx)->isPacked) free(tx); // scripts, signatures and witnesses are all inline
+    else if (tx) {
         for (size_t i = 0; i < tx->inCount; i++) {
             btcTxInputSetScript(&tx->inputs[i], NULL, 0);
             btcTxInputSetSignature(&tx->inputs[i], NULL, 0);
@@ -101,6 +101,9 @@ BRBitcoinTransaction *btcTransactionCopy(const BRBitcoinTransaction *tx);
 
 // buf must contain a serialized tx
 // retruns a transaction that must be freed by calling btcTransactionFree()
+// NOTE: parsed and copied transactions are held in a single allocation, so the btcTxInputSet and btcTxOutputSet
+// functions must not be called on their inputs and outputs; use btcTransactionAddInput(), btcTransactionAddOutput() or
+// btcTransactionSign() instead
 BRBitcoinTransaction *btcTransactionParse(const uint8_t *buf, size_t bufLen);
 
 // returns number of bytes written to buf, or total bufLen needed if buf is NULL
@@ -23,9 +23,12 @@
 //  THE SOFTWARE.
 
 #include "BRBitcoinWallet.h"
+#include "BRBitcoinBloomFilter.h"
 #include "support/BRSet.h"
 #include "support/BRAddress.h"
 #include "support/BRArray.h"
+#include "support/BRCrypto.h"
+#include "support/BROSCompat.h"
 #include <stdlib.h>
 #include <inttypes.h>
 #include <limits.h>
@@ -66,6 +69,68 @@ inline static size_t _txChainIndex(const BRBitcoinTransaction *tx, const UInt160
     return (size_t) -1;
 }
 
+#define WALLET_DERIVE_PARALLEL_MIN 512 // fewer pkhs than this are derived on the calling thread
+#define WALLET_DERIVE_MAX_WORKERS  8
+#define WALLET_DERIVE_BATCH        256 // pubKeys per BRBIP32PubKeyRange() call
+
+typedef struct {
+    BRMasterPubKey mpk;
+    uint32_t chain;
+    uint32_t index;
+    size_t count;
+    size_t derived;
+    UInt160 *pkhs;
+} BRBitcoinWalletDeriveJob;
+
+// writes the pkhs for paths N(mpk/chain/index) through N(mpk/chain/index + count - 1) to job->pkhs
+static void *_btcWalletDeriveRoutine(void *info)
+{
+    BRBitcoinWalletDeriveJob *job = info;
+    uint8_t (*pubKeys)[33] = malloc(WALLET_DERIVE_BATCH*sizeof(*pubKeys));
+    size_t i, n, len;
+
+    assert(pubKeys != NULL);
+
+    for (job->derived = 0; job->derived < job->count; job->derived += n) {
+        len = (job->count - job->derived < WALLET_DERIVE_BATCH) ? job->count - job->derived : WALLET_DERIVE_BATCH;
+        n = BRBIP32PubKeyRange(pubKeys, job->mpk, job->chain, (uint32_t)(job->index + job->derived), len);
+        for (i = 0; i < n; i++) BRHash160(&job->pkhs[job->derived + i], pubKeys[i], sizeof(pubKeys[i]));
+        if (n < len) { job->derived += n; break; } // invalid key
+    }
+
+    free(pubKeys);
+    return NULL;
+}
+
+// writes the pkhs for count consecutive keys of chain, starting at index, to pkhs, splitting large ranges across worker
+// threads; returns the number of leading pkhs written, which is less than count only if a key would be invalid
+static size_t _btcWalletDerivePKHs(BRMasterPubKey mpk, uint32_t chain, uint32_t index, size_t count, UInt160 pkhs[])
+{
+    BRBitcoinWalletDeriveJob jobs[WALLET_DERIVE_MAX_WORKERS];
+    size_t i, workers = (count < WALLET_DERIVE_PARALLEL_MIN) ? 1 :
+                        pthread_workers_count_brd(count, WALLET_DERIVE_MAX_WORKERS),
+           offset = 0, derived = 0;
+
+    for (i = 0; i < workers; i++) {
+        jobs[i].mpk = mpk;
+        jobs[i].chain = chain;
+        jobs[i].index = (uint32_t)(index + offset);
+        jobs[i].count = count/workers + (i < count % workers);
+        jobs[i].derived = 0;
+        jobs[i].pkhs = &pkhs[offset];
+        offset += jobs[i].count;
+    }
+
+    pthread_run_jobs_brd(_btcWalletDeriveRoutine, jobs, sizeof(*jobs), workers);
+
+    for (i = 0; i < workers; i++) {
+        derived += jobs[i].derived;
+        if (jobs[i].derived < jobs[i].count) break;
+    }
+
+    return derived;
+}
+
 struct BRBitcoinWalletStruct {
     uint64_t balance, totalSent, totalReceived, feePerKb, *balanceHist;
     uint32_t blockHeight;
@@ -74,7 +139,9 @@ struct BRBitcoinWalletStruct {
     BRMasterPubKey masterPubKey;
     BRAddressParams addrParams;
     UInt160 *internalChain, *externalChain;
+    UInt160 *internalDerived, *externalDerived; // every pkh derived so far, of which each chain is a prefix
     BRSet *allTx, *invalidTx, *pendingTx, *spentOutputs, *usedPKH, *allPKH;
+    BRBitcoinBlockedBloomFilter *pkhFilter; // allPKH, for ruling out most non-wallet pkhs without a set lookup
     void *callbackInfo;
     void (*balanceChanged)(void *info, uint64_t balance);
     void (*txAdded)(void *info, BRBitcoinTransaction *tx);
@@ -83,6 +150,36 @@ struct BRBitcoinWalletStruct {
     pthread_mutex_t lock;
 };
 
+#define WALLET_PKH_FILTER_FP_RATE 0.0005 // a false positive only costs an allPKH lookup
+
+// rebuilds pkhFilter from allPKH, with room for the address chains to double in length
+static void _btcWalletRebuildPKHFilter(BRBitcoinWallet *wallet)
+{
+    if (wallet->pkhFilter) btcBlockedBloomFilterFree(wallet->pkhFilter);
+    wallet->pkhFilter = btcBlockedBloomFilterNew(WALLET_PKH_FILTER_FP_RATE, 2*BRSetCount(wallet->allPKH) + 100, 0);
+
+    FOR_SET(const UInt160 *, pkh, wallet->allPKH) {
+        btcBlockedBloomFilterInsertData(wallet->pkhFilter, pkh->u8, sizeof(*pkh));
+    }
+}
+
+inline static void _btcWalletAddPKH(BRBitcoinWallet *wallet, UInt160 *pkh)
+{
+    BRSetAdd(wallet->allPKH, pkh);
+
+    if (wallet->pkhFilter->elemCount < wallet->pkhFilter->capacity) {
+        btcBlockedBloomFilterInsertData(wallet->pkhFilter, pkh->u8, sizeof(*pkh));
+    }
+    else _btcWalletRebuildPKHFilter(wallet);
+}
+
+// true if pkh is one of the wallet's addresses
+inline static int _btcWalletContainsPKH(BRBitcoinWallet *wallet, const void *pkh)
+{
+    return (btcBlockedBloomFilterContainsData(wallet->pkhFilter, pkh, sizeof(UInt160)) &&
+            BRSetContains(wallet->allPKH, pkh));
+}
+
 inline static int _btcWalletTxIsAscending(BRBitcoinWallet *wallet, const BRBitcoinTransaction *tx1,
                                           const BRBitcoinTransaction *tx2)
 {
@@ -142,7 +239,7 @@ static int _btcWalletContainsTx(BRBitcoinWallet *wallet, const BRBitcoinTransact
     
     for (size_t i = 0; ! r && i < tx->outCount; i++) {
         pkh = BRScriptPKH(tx->outputs[i].script, tx->outputs[i].scriptLen);
-        if (pkh && BRSetContains(wallet->allPKH, pkh)) r = 1;
+        if (pkh && _btcWalletContainsPKH(wallet, pkh)) r = 1;
     }
     
     for (size_t i = 0; ! r && i < tx->inCount; i++) {
@@ -150,27 +247,109 @@ static int _btcWalletContainsTx(BRBitcoinWallet *wallet, const BRBitcoinTransact
         uint32_t n = tx->inputs[i].index;
         
         pkh = (t && n < t->outCount) ? BRScriptPKH(t->outputs[n].script, t->outputs[n].scriptLen) : NULL;
-        if (pkh && BRSetContains(wallet->allPKH, pkh)) r = 1;
+        if (pkh && _btcWalletContainsPKH(wallet, pkh)) r = 1;
     }
     
     for (size_t i = 0; ! r && i < tx->inCount; i++) {
         size_t l = (tx->inputs[i].witLen > 0) ? BRWitnessPKH(hash.u8, tx->inputs[i].witness, tx->inputs[i].witLen)
                                               : BRSignaturePKH(hash.u8, tx->inputs[i].signature, tx->inputs[i].sigLen);
 
-        if (l > 0 && BRSetContains(wallet->allPKH, &hash)) r = 1;
+        if (l > 0 && _btcWalletContainsPKH(wallet, &hash)) r = 1;
     }
 
     return r;
 }
 
+// applies tx, which must follow every transaction already applied in wallet->transactions order, to the balance,
+// balance history, UTXOs and the spent output, invalid, pending and used sets
+static void _btcWalletApplyTx(BRBitcoinWallet *wallet, BRBitcoinTransaction *tx, time_t now)
+{
+    int isInvalid, isPending, isSpending = (BRSetCount(wallet->pendingTx) > 0); // pending tx inputs aren't yet removed
+    uint64_t balance = wallet->balance, prevBalance = wallet->balance;
+    size_t j;
+    BRBitcoinTransaction *t;
+    const uint8_t *pkh;
+
+    // check if any inputs are invalid or already spent
+    if (tx->blockHeight == TX_UNCONFIRMED) {
+        for (j = 0, isInvalid = 0; ! isInvalid && j < tx->inCount; j++) {
+            if (BRSetContains(wallet->spentOutputs, &tx->inputs[j]) ||
+                BRSetContains(wallet->invalidTx, &tx->inputs[j].txHash)) isInvalid = 1;
+        }
+    
+        if (isInvalid) {
+            BRSetAdd(wallet->invalidTx, tx);
+            array_add(wallet->balanceHist, balance);
+            return;
+        }
+    }
+
+    // add inputs to spent output set
+    for (j = 0; j < tx->inCount; j++) {
+        BRSetAdd(wallet->spentOutputs, &tx->inputs[j]);
+        if (BRSetContains(wallet->allTx, &tx->inputs[j].txHash)) isSpending = 1; // may spend a wallet UTXO
+    }
+
+    // check if tx is pending
+    if (tx->blockHeight == TX_UNCONFIRMED) {
+        isPending = (btcTransactionVSize(tx) > TX_MAX_SIZE) ? 1 : 0; // check tx size is under TX_MAX_SIZE
+        
+        for (j = 0; ! isPending && j < tx->outCount; j++) {
+            if (tx->outputs[j].amount < TX_MIN_OUTPUT_AMOUNT) isPending = 1; // check that no outputs are dust
+        }
+
+        for (j = 0; ! isPending && j < tx->inCount; j++) {
+            if (tx->inputs[j].sequence < UINT32_MAX - 1) isPending = 1; // check for replace-by-fee
+            if (tx->inputs[j].sequence < UINT32_MAX && tx->lockTime < TX_MAX_LOCK_HEIGHT &&
+                tx->lockTime > wallet->blockHeight + 1) isPending = 1; // future lockTime
+            if (tx->inputs[j].sequence < UINT32_MAX && tx->lockTime > now) isPending = 1; // future lockTime
+            if (BRSetContains(wallet->pendingTx, &tx->inputs[j].txHash)) isPending = 1; // check for pending inputs
+            // TODO: XXX handle BIP68 check lock time verify rules
+        }
+        
+        if (isPending) {
+            BRSetAdd(wallet->pendingTx, tx);
+            array_add(wallet->balanceHist, balance);
+            return;
+        }
+    }
+
+    // add outputs to UTXO set
+    // TODO: don't add outputs below TX_MIN_OUTPUT_AMOUNT
+    // TODO: don't add coin generation outputs < 100 blocks deep
+    // NOTE: balance/UTXOs will then need to be recalculated when last block changes
+    for (j = 0; j < tx->outCount; j++) {
+        pkh = BRScriptPKH(tx->outputs[j].script, tx->outputs[j].scriptLen);
+
+        if (pkh && _btcWalletContainsPKH(wallet, pkh)) {
+            BRSetAdd(wallet->usedPKH, (void *)pkh);
+            array_add(wallet->utxos, ((const BRBitcoinUTXO) { tx->txHash, (uint32_t)j }));
+            balance += tx->outputs[j].amount;
+            if (BRSetContains(wallet->spentOutputs, &wallet->utxos[array_count(wallet->utxos) - 1])) isSpending = 1;
+        }
+    }
+
+    // transaction ordering is not guaranteed, so check the entire UTXO set against the entire spent output set; unless
+    // a pending tx spent some, the UTXO set held no spent outputs before tx, so this is only needed if tx spends a
+    // wallet output or if tx's own outputs were spent by an earlier transaction
+    for (j = array_count(wallet->utxos); isSpending && j > 0; j--) {
+        if (! BRSetContains(wallet->spentOutputs, &wallet->utxos[j - 1])) continue;
+        t = BRSetGet(wallet->allTx, &wallet->utxos[j - 1].hash);
+        balance -= t->outputs[wallet->utxos[j - 1].n].amount;
+        array_rm(wallet->utxos, j - 1);
+    }
+    
+    if (prevBalance < balance) wallet->totalReceived += balance - prevBalance;
+    if (balance < prevBalance) wallet->totalSent += prevBalance - balance;
+    array_add(wallet->balanceHist, balance);
+    wallet->balance = balance;
+}
+
+// rebuilds the balance, balance history, UTXOs and the spent output, invalid, pending and used sets by applying every
+// transaction, in order
 static void _btcWalletUpdateBalance(BRBitcoinWallet *wallet)
 {
-    int isInvalid, isPending;
-    uint64_t balance = 0, prevBalance = 0;
     time_t now = time(NULL);
-    size_t i, j;
-    BRBitcoinTransaction *tx, *t;
-    const uint8_t *pkh;
     
     array_clear(wallet->utxos);
     array_clear(wallet->balanceHist);
@@ -178,96 +357,213 @@ static void _btcWalletUpdateBalance(BRBitcoinWallet *wallet)
     BRSetClear(wallet->invalidTx);
     BRSetClear(wallet->pendingTx);
     BRSetClear(wallet->usedPKH);
+    wallet->balance = 0;
     wallet->totalSent = 0;
     wallet->totalReceived = 0;
 
-    for (i = 0; i < array_count(wallet->transactions); i++) {
-        tx = wallet->transactions[i];
+    for (size_t i = 0; i < array_count(wallet->transactions); i++) {
+        _btcWalletApplyTx(wallet, wallet->transactions[i], now);
+    }
 
-        // check if any inputs are invalid or already spent
-        if (tx->blockHeight == TX_UNCONFIRMED) {
-            for (j = 0, isInvalid = 0; ! isInvalid && j < tx->inCount; j++) {
-                if (BRSetContains(wallet->spentOutputs, &tx->inputs[j]) ||
-                    BRSetContains(wallet->invalidTx, &tx->inputs[j].txHash)) isInvalid = 1;
-            }
-        
-            if (isInvalid) {
-                BRSetAdd(wallet->invalidTx, tx);
-                array_add(wallet->balanceHist, balance);
-                continue;
-            }
-        }
+    assert(array_count(wallet->balanceHist) == array_count(wallet->transactions));
+}
+
+// applies tx, just inserted into wallet->transactions, as a delta if that gives the same result as a full update;
+// it does when tx sorts last and no earlier transaction is pending (whose pending status may since have changed)
+static void _btcWalletUpdateBalanceWithTx(BRBitcoinWallet *wallet, BRBitcoinTransaction *tx)
+{
+    size_t count = array_count(wallet->transactions);
+
+    if (BRSetCount(wallet->pendingTx) == 0 &&
+        count > 0 && wallet->transactions[count - 1] == tx && array_count(wallet->balanceHist) + 1 == count) {
+        _btcWalletApplyTx(wallet, tx, time(NULL));
+    }
+    else _btcWalletUpdateBalance(wallet);
+}
+
+// allocates and populates a BRBitcoinWallet struct which must be freed by calling btcWalletFree()
+BRBitcoinWallet *btcWalletNew(BRAddressParams addrParams, BRBitcoinTransaction *transactions[], size_t txCount,
+                              BRMasterPubKey mpk)
+{
+    return btcWalletNewWithSnapshot(addrParams, transactions, txCount, mpk, NULL, 0, NULL, 0, NULL, 0);
+}
+
+// true if the first and last of pkhs are those of chain, as a check that pkhs were derived from mpk
+static int _btcWalletAddrChainIsValid(BRMasterPubKey mpk, uint32_t chain, const UInt160 pkhs[], size_t pkhsCount)
+{
+    UInt160 pkh;
+
+    return (pkhsCount > 0 && _btcWalletDerivePKHs(mpk, chain, 0, 1, &pkh) == 1 && UInt160Eq(pkh, pkhs[0]) &&
+            _btcWalletDerivePKHs(mpk, chain, (uint32_t)(pkhsCount - 1), 1, &pkh) == 1 &&
+            UInt160Eq(pkh, pkhs[pkhsCount - 1]));
+}
+
+// as btcWalletNew(), but with the external and internal chain pkhs, from btcWalletAddrChain() of an earlier wallet with
+// the same mpk, to use rather than derive again; a chain whose first or last pkh doesn't match mpk is ignored, and the
+// rest are trusted, so persisted chains must be checked for corruption (e.g. against a digest) before being passed in
+BRBitcoinWallet *btcWalletNewWithAddrChains(BRAddressParams addrParams, BRBitcoinTransaction *transactions[],
+                                            size_t txCount, BRMasterPubKey mpk,
+                                            const UInt160 externalPKHs[], size_t externalCount,
+                                            const UInt160 internalPKHs[], size_t internalCount)
+{
+    return btcWalletNewWithSnapshot(addrParams, transactions, txCount, mpk, externalPKHs, externalCount,
+                                    internalPKHs, internalCount, NULL, 0);
+}
 
-        // add inputs to spent output set
-        for (j = 0; j < tx->inCount; j++) {
-            BRSetAdd(wallet->spentOutputs, &tx->inputs[j]);
+#define WALLET_SNAPSHOT_VERSION 1
+#define WALLET_SNAPSHOT_TX_SIZE (sizeof(UInt256) + sizeof(uint32_t) + sizeof(uint64_t)) // txHash, blockHeight, balance
+#define WALLET_SNAPSHOT_UTXO_SIZE (sizeof(UInt256) + sizeof(uint32_t))
+
+// the transactions of a snapshot from btcWalletSnapshot(), in wallet order, with their balance history and the UTXOs
+typedef struct {
+    BRBitcoinTransaction **transactions;
+    uint64_t *balanceHist;
+    BRBitcoinUTXO *utxos;
+    BRSet *allTx;
+} BRBitcoinWalletSnapshot;
+
+static void _btcWalletSnapshotFree(BRBitcoinWalletSnapshot *s)
+{
+    if (s->transactions) array_free(s->transactions);
+    if (s->balanceHist) array_free(s->balanceHist);
+    if (s->utxos) array_free(s->utxos);
+    if (s->allTx) BRSetFree(s->allTx);
+    memset(s, 0, sizeof(*s));
+}
+
+// reads snapshot into s, checking that it's intact and not stale: each of its transactions must be among transactions,
+// at the same block height, and each of the rest must be at a greater height, so it sorts after all of the snapshot's
+// returns true if s can be restored in place of sorting and replaying the snapshot's transactions
+static int _btcWalletSnapshotRead(BRBitcoinWalletSnapshot *s, const uint8_t *snapshot, size_t snapshotLen,
+                                  BRBitcoinTransaction *transactions[], size_t txCount)
+{
+    BRSet *txSet;
+    BRBitcoinTransaction *tx;
+    BRBitcoinUTXO utxo;
+    UInt256 md, txHash;
+    uint32_t blockHeight, maxHeight = 0;
+    size_t i, count = 0, off = sizeof(uint32_t), len = 0;
+    int r = (snapshot && snapshotLen >= sizeof(uint32_t)*2);
+
+    memset(s, 0, sizeof(*s));
+    if (r) snapshotLen -= sizeof(uint32_t), BRSHA256_2(&md, snapshot, snapshotLen); // checksum is the last 4 bytes
+    if (r && (UInt32GetLE(snapshot) != WALLET_SNAPSHOT_VERSION || memcmp(md.u8, &snapshot[snapshotLen], 4) != 0)) r = 0;
+    if (r) count = (size_t)BRVarInt(&snapshot[off], snapshotLen - off, &len);
+    off += len;
+    if (! r || len == 0 || off + count*WALLET_SNAPSHOT_TX_SIZE > snapshotLen) return 0;
+
+    txSet = BRSetNew(btcTransactionHash, btcTransactionEq, txCount + 1);
+    s->allTx = BRSetNew(btcTransactionHash, btcTransactionEq, count + 1);
+    array_new(s->transactions, count);
+    array_new(s->balanceHist, count);
+
+    for (i = 0; transactions && i < txCount; i++) { // as btcWalletNew() does, skip unsigned and duplicate txs
+        if (btcTransactionIsSigned(transactions[i]) && ! BRSetContains(txSet, transactions[i])) {
+            BRSetAdd(txSet, transactions[i]);
         }
+    }
 
-        // check if tx is pending
-        if (tx->blockHeight == TX_UNCONFIRMED) {
-            isPending = (btcTransactionVSize(tx) > TX_MAX_SIZE) ? 1 : 0; // check tx size is under TX_MAX_SIZE
-            
-            for (j = 0; ! isPending && j < tx->outCount; j++) {
-                if (tx->outputs[j].amount < TX_MIN_OUTPUT_AMOUNT) isPending = 1; // check that no outputs are dust
-            }
+    for (i = 0; r && i < count; i++, off += WALLET_SNAPSHOT_TX_SIZE) {
+        txHash = UInt256Get(&snapshot[off]);
+        blockHeight = UInt32GetLE(&snapshot[off + sizeof(UInt256)]);
+        tx = BRSetGet(txSet, &txHash);
 
-            for (j = 0; ! isPending && j < tx->inCount; j++) {
-                if (tx->inputs[j].sequence < UINT32_MAX - 1) isPending = 1; // check for replace-by-fee
-                if (tx->inputs[j].sequence < UINT32_MAX && tx->lockTime < TX_MAX_LOCK_HEIGHT &&
-                    tx->lockTime > wallet->blockHeight + 1) isPending = 1; // future lockTime
-                if (tx->inputs[j].sequence < UINT32_MAX && tx->lockTime > now) isPending = 1; // future lockTime
-                if (BRSetContains(wallet->pendingTx, &tx->inputs[j].txHash)) isPending = 1; // check for pending inputs
-                // TODO: XXX handle BIP68 check lock time verify rules
-            }
-            
-            if (isPending) {
-                BRSetAdd(wallet->pendingTx, tx);
-                array_add(wallet->balanceHist, balance);
-                continue;
-            }
+        if (! tx || tx->blockHeight != blockHeight || blockHeight == TX_UNCONFIRMED || BRSetContains(s->allTx, tx)) {
+            r = 0;
+        }
+        else {
+            BRSetAdd(s->allTx, tx);
+            array_add(s->transactions, tx);
+            array_add(s->balanceHist, UInt64GetLE(&snapshot[off + sizeof(UInt256) + sizeof(uint32_t)]));
+            if (blockHeight > maxHeight) maxHeight = blockHeight;
         }
+    }
+
+    count = (r) ? (size_t)BRVarInt(&snapshot[off], snapshotLen - off, &len) : 0;
+    off += len;
+    if (r && (len == 0 || off + count*WALLET_SNAPSHOT_UTXO_SIZE != snapshotLen)) r = 0;
+    if (r) array_new(s->utxos, count);
+
+    for (i = 0; r && i < count; i++, off += WALLET_SNAPSHOT_UTXO_SIZE) {
+        utxo.hash = UInt256Get(&snapshot[off]);
+        utxo.n = UInt32GetLE(&snapshot[off + sizeof(UInt256)]);
+        tx = BRSetGet(s->allTx, &utxo.hash);
+        if (tx && utxo.n < tx->outCount) array_add(s->utxos, utxo);
+        else r = 0;
+    }
+
+    FOR_SET(BRBitcoinTransaction *, t, txSet) {
+        if (r && t->blockHeight <= maxHeight && ! BRSetContains(s->allTx, t)) r = 0;
+    }
+
+    BRSetFree(txSet);
+    if (! r) _btcWalletSnapshotFree(s);
+    return r;
+}
+
+// restores the balance, balance history, UTXOs and the spent output and used sets from snapshot s, and then applies
+// the wallet transactions that aren't in s, all of which sort after those that are, as _btcWalletUpdateBalance() would
+static void _btcWalletSnapshotRestore(BRBitcoinWallet *wallet, const BRBitcoinWalletSnapshot *s)
+{
+    time_t now = time(NULL);
+    size_t i, j, count = array_count(s->transactions);
+    BRBitcoinTransaction *tx;
+    const uint8_t *pkh;
+
+    array_insert_array(wallet->transactions, 0, s->transactions, count);
+    array_clear(wallet->balanceHist);
+    array_add_array(wallet->balanceHist, s->balanceHist, count);
+    array_clear(wallet->utxos);
+    array_add_array(wallet->utxos, s->utxos, array_count(s->utxos));
+    BRSetClear(wallet->spentOutputs);
+    BRSetClear(wallet->invalidTx);
+    BRSetClear(wallet->pendingTx);
+    BRSetClear(wallet->usedPKH);
+    wallet->balance = 0;
+    wallet->totalSent = 0;
+    wallet->totalReceived = 0;
+
+    // the snapshot's transactions are all confirmed, so none are invalid or pending
+    for (i = 0; i < count; i++) {
+        tx = wallet->transactions[i];
+        for (j = 0; j < tx->inCount; j++) BRSetAdd(wallet->spentOutputs, &tx->inputs[j]);
 
-        // add outputs to UTXO set
-        // TODO: don't add outputs below TX_MIN_OUTPUT_AMOUNT
-        // TODO: don't add coin generation outputs < 100 blocks deep
-        // NOTE: balance/UTXOs will then need to be recalculated when last block changes
         for (j = 0; j < tx->outCount; j++) {
             pkh = BRScriptPKH(tx->outputs[j].script, tx->outputs[j].scriptLen);
-
-            if (pkh && BRSetContains(wallet->allPKH, pkh)) {
-                BRSetAdd(wallet->usedPKH, (void *)pkh);
-                array_add(wallet->utxos, ((const BRBitcoinUTXO) { tx->txHash, (uint32_t)j }));
-                balance += tx->outputs[j].amount;
-            }
+            if (pkh && _btcWalletContainsPKH(wallet, pkh)) BRSetAdd(wallet->usedPKH, (void *)pkh);
         }
 
-        // transaction ordering is not guaranteed, so check the entire UTXO set against the entire spent output set
-        for (j = array_count(wallet->utxos); j > 0; j--) {
-            if (! BRSetContains(wallet->spentOutputs, &wallet->utxos[j - 1])) continue;
-            t = BRSetGet(wallet->allTx, &wallet->utxos[j - 1].hash);
-            balance -= t->outputs[wallet->utxos[j - 1].n].amount;
-            array_rm(wallet->utxos, j - 1);
-        }
-        
-        if (prevBalance < balance) wallet->totalReceived += balance - prevBalance;
-        if (balance < prevBalance) wallet->totalSent += prevBalance - balance;
-        array_add(wallet->balanceHist, balance);
-        prevBalance = balance;
+        if (wallet->balance < wallet->balanceHist[i]) wallet->totalReceived += wallet->balanceHist[i] - wallet->balance;
+        if (wallet->balanceHist[i] < wallet->balance) wallet->totalSent += wallet->balance - wallet->balanceHist[i];
+        wallet->balance = wallet->balanceHist[i];
+    }
+
+    for (i = count; i < array_count(wallet->transactions); i++) {
+        _btcWalletApplyTx(wallet, wallet->transactions[i], now);
     }
 
     assert(array_count(wallet->balanceHist) == array_count(wallet->transactions));
-    wallet->balance = balance;
 }
 
-// allocates and populates a BRBitcoinWallet struct which must be freed by calling btcWalletFree()
-BRBitcoinWallet *btcWalletNew(BRAddressParams addrParams, BRBitcoinTransaction *transactions[], size_t txCount,
-                              BRMasterPubKey mpk)
+// as btcWalletNewWithAddrChains(), but with a snapshot from btcWalletSnapshot() of an earlier wallet with the same mpk,
+// to restore rather than sort and replay the transactions it holds; a snapshot that is stale or corrupt is ignored
+BRBitcoinWallet *btcWalletNewWithSnapshot(BRAddressParams addrParams, BRBitcoinTransaction *transactions[],
+                                          size_t txCount, BRMasterPubKey mpk,
+                                          const UInt160 externalPKHs[], size_t externalCount,
+                                          const UInt160 internalPKHs[], size_t internalCount,
+                                          const uint8_t *snapshot, size_t snapshotLen)
 {
     BRBitcoinWallet *wallet = NULL;
     BRBitcoinTransaction *tx;
+    BRBitcoinWalletSnapshot s;
     const uint8_t *pkh;
+    int hasSnapshot;
 
     assert(transactions != NULL || txCount == 0);
+    assert(externalPKHs != NULL || externalCount == 0);
+    assert(internalPKHs != NULL || internalCount == 0);
+    assert(snapshot != NULL || snapshotLen == 0);
+    hasSnapshot = _btcWalletSnapshotRead(&s, snapshot, snapshotLen, transactions, txCount);
     wallet = calloc(1, sizeof(*wallet));
     assert(wallet != NULL);
     array_new(wallet->utxos, 100);
@@ -277,6 +573,14 @@ BRBitcoinWallet *btcWalletNew(BRAddressParams addrParams, BRBitcoinTransaction *
     wallet->addrParams = addrParams;
     array_new(wallet->internalChain, 100);
     array_new(wallet->externalChain, 100);
+    array_new(wallet->internalDerived, 100);
+    array_new(wallet->externalDerived, 100);
+
+    if (_btcWalletAddrChainIsValid(mpk, SEQUENCE_EXTERNAL_CHAIN, externalPKHs, externalCount))
+        array_add_array(wallet->externalDerived, externalPKHs, externalCount);
+    if (_btcWalletAddrChainIsValid(mpk, SEQUENCE_INTERNAL_CHAIN, internalPKHs, internalCount))
+        array_add_array(wallet->internalDerived, internalPKHs, internalCount);
+
     array_new(wallet->balanceHist, txCount + 100);
     wallet->allTx = BRSetNew(btcTransactionHash, btcTransactionEq, txCount + 100);
     wallet->invalidTx = BRSetNew(btcTransactionHash, btcTransactionEq, 10);
@@ -284,13 +588,14 @@ BRBitcoinWallet *btcWalletNew(BRAddressParams addrParams, BRBitcoinTransaction *
     wallet->spentOutputs = BRSetNew(btcUTXOHash, btcUTXOEq, txCount + 100);
     wallet->usedPKH = BRSetNew(_pkhHash, _pkhEq, txCount + 100);
     wallet->allPKH = BRSetNew(_pkhHash, _pkhEq, txCount + 100);
+    _btcWalletRebuildPKHFilter(wallet);
     pthread_mutex_init(&wallet->lock, NULL);
 
     for (size_t i = 0; transactions && i < txCount; i++) {
         tx = transactions[i];
         if (! btcTransactionIsSigned(tx) || BRSetContains(wallet->allTx, tx)) continue;
         BRSetAdd(wallet->allTx, tx);
-        _btcWalletInsertTx(wallet, tx);
+        if (! hasSnapshot || ! BRSetContains(s.allTx, tx)) _btcWalletInsertTx(wallet, tx); // snapshot txs are in order
 
         for (size_t j = 0; j < tx->outCount; j++) {
             pkh = BRScriptPKH(tx->outputs[j].script, tx->outputs[j].scriptLen);
@@ -301,7 +606,8 @@ BRBitcoinWallet *btcWalletNew(BRAddressParams addrParams, BRBitcoinTransaction *
     btcWalletUnusedAddrs(wallet, NULL, SEQUENCE_GAP_LIMIT_EXTERNAL_EXTENDED, SEQUENCE_EXTERNAL_CHAIN);
     btcWalletUnusedAddrs(wallet, NULL, SEQUENCE_GAP_LIMIT_INTERNAL_EXTENDED, SEQUENCE_INTERNAL_CHAIN);
 
-    _btcWalletUpdateBalance(wallet);
+    if (hasSnapshot) _btcWalletSnapshotRestore(wallet, &s), _btcWalletSnapshotFree(&s);
+    else _btcWalletUpdateBalance(wallet);
 
     if (txCount > 0 && ! _btcWalletContainsTx(wallet, transactions[0])) { // verify transactions match master pubKey
         btcWalletFree(wallet);
@@ -311,6 +617,52 @@ BRBitcoinWallet *btcWalletNew(BRAddressParams addrParams, BRBitcoinTransaction *
     return wallet;
 }
 
+// writes a snapshot of the wallet's transaction order, balance history and UTXOs to buf, for persisting and passing to
+// btcWalletNewWithSnapshot(); only a wallet whose transactions are all confirmed has one, since whether an unconfirmed
+// tx is pending or invalid depends on the time and the chain tip when it's applied
+// returns number of bytes written to buf, or total bufLen needed if buf is NULL, or 0 if there is no snapshot
+size_t btcWalletSnapshot(BRBitcoinWallet *wallet, uint8_t *buf, size_t bufLen)
+{
+    BRBitcoinTransaction *tx;
+    UInt256 md;
+    size_t i, count, utxosCount, len, off = 0;
+
+    assert(wallet != NULL);
+    pthread_mutex_lock(&wallet->lock);
+    count = array_count(wallet->transactions);
+    utxosCount = array_count(wallet->utxos);
+    len = sizeof(uint32_t) + BRVarIntSize(count) + count*WALLET_SNAPSHOT_TX_SIZE + BRVarIntSize(utxosCount) +
+          utxosCount*WALLET_SNAPSHOT_UTXO_SIZE + sizeof(uint32_t);
+    if (count > 0 && wallet->transactions[count - 1]->blockHeight == TX_UNCONFIRMED) len = 0; // unconfirmed sort last
+
+    if (buf && len > 0 && len <= bufLen) {
+        UInt32SetLE(&buf[off], WALLET_SNAPSHOT_VERSION);
+        off += sizeof(uint32_t);
+        off += BRVarIntSet(&buf[off], bufLen - off, count);
+
+        for (i = 0; i < count; i++, off += WALLET_SNAPSHOT_TX_SIZE) {
+            tx = wallet->transactions[i];
+            UInt256Set(&buf[off], tx->txHash);
+            UInt32SetLE(&buf[off + sizeof(UInt256)], tx->blockHeight);
+            UInt64SetLE(&buf[off + sizeof(UInt256) + sizeof(uint32_t)], wallet->balanceHist[i]);
+        }
+
+        off += BRVarIntSet(&buf[off], bufLen - off, utxosCount);
+
+        for (i = 0; i < utxosCount; i++, off += WALLET_SNAPSHOT_UTXO_SIZE) {
+            UInt256Set(&buf[off], wallet->utxos[i].hash);
+            UInt32SetLE(&buf[off + sizeof(UInt256)], wallet->utxos[i].n);
+        }
+
+        BRSHA256_2(&md, buf, off);
+        memcpy(&buf[off], md.u8, sizeof(uint32_t));
+        off += sizeof(uint32_t);
+    }
+
+    pthread_mutex_unlock(&wallet->lock);
+    return (! buf || off == len) ? len : 0;
+}
+
 // not thread-safe, set callbacks once after btcWalletNew(), before calling other BRBitcoinWallet functions
 // info is a void pointer that will be passed along with each callback call
 // void balanceChanged(void *, uint64_t) - called when the wallet balance changes
@@ -342,15 +694,15 @@ void btcWalletSetCallbacks(BRBitcoinWallet *wallet, void *info,
 // returns the number addresses written to addrs
 size_t btcWalletUnusedAddrs(BRBitcoinWallet *wallet, BRAddress addrs[], uint32_t gapLimit, uint32_t internal)
 {
-    UInt160 *chain = NULL, *origChain;
-    size_t i, j = 0, count, startCount;
+    UInt160 *chain = NULL, *origChain, **derived = NULL;
+    size_t i, j = 0, n, k, count, startCount;
 
     assert(wallet != NULL);
     assert(gapLimit > 0);
     pthread_mutex_lock(&wallet->lock);
-    if (internal == SEQUENCE_EXTERNAL_CHAIN) chain = wallet->externalChain;
-    if (internal == SEQUENCE_INTERNAL_CHAIN) chain = wallet->internalChain;
-    assert(chain != NULL);
+    if (internal == SEQUENCE_EXTERNAL_CHAIN) chain = wallet->externalChain, derived = &wallet->externalDerived;
+    if (internal == SEQUENCE_INTERNAL_CHAIN) chain = wallet->internalChain, derived = &wallet->internalDerived;
+    assert(chain != NULL && derived != NULL);
     origChain = chain;
     i = count = startCount = array_count(chain);
     
@@ -358,14 +710,24 @@ size_t btcWalletUnusedAddrs(BRBitcoinWallet *wallet, BRAddress addrs[], uint32_t
     while (i > 0 && ! BRSetContains(wallet->usedPKH, &chain[i - 1])) i--;
     
     while (i + gapLimit > count) { // generate new addresses up to gapLimit
-        BRKey key;
-        uint8_t pubKey[33];
-        size_t len = BRBIP32PubKey(pubKey, wallet->masterPubKey, internal, (uint32_t)count);
-        
-        if (! BRKeySetPubKey(&key, pubKey, len)) break;
-        array_add(chain, BRKeyHash160(&key));
-        count++;
-        if (BRSetContains(wallet->usedPKH, &chain[array_count(chain) - 1])) i = count;
+        n = i + gapLimit - count;
+
+        // once used addresses are found past the gap, as when a wallet is first loaded, there are likely many more, so
+        // derive ahead, doubling the number derived in each pass
+        if (i > startCount && n < count - startCount) n = count - startCount;
+
+        if (count + n > array_count(*derived)) {
+            k = array_count(*derived);
+            array_set_count(*derived, count + n);
+            array_set_count(*derived, k + _btcWalletDerivePKHs(wallet->masterPubKey, internal, (uint32_t)k, count + n - k,
+                                                               &(*derived)[k]));
+            if (count == array_count(*derived)) break; // invalid key
+        }
+
+        for (; i + gapLimit > count && count < array_count(*derived); count++) {
+            array_add(chain, (*derived)[count]);
+            if (BRSetContains(wallet->usedPKH, &chain[count])) i = count + 1;
+        }
     }
 
     if (addrs && i + gapLimit <= count) {
@@ -377,7 +739,7 @@ size_t btcWalletUnusedAddrs(BRBitcoinWallet *wallet, BRAddress addrs[], uint32_t
     // was chain moved to a new memory location?
     if (chain == origChain) {
         for (i = startCount; i < count; i++) {
-            BRSetAdd(wallet->allPKH, &chain[i]);
+            _btcWalletAddPKH(wallet, &chain[i]);
         }
     }
     else {
@@ -393,6 +755,8 @@ size_t btcWalletUnusedAddrs(BRBitcoinWallet *wallet, BRAddress addrs[], uint32_t
         for (i = array_count(wallet->externalChain); i > 0; i--) {
             BRSetAdd(wallet->allPKH, &wallet->externalChain[i - 1]);
         }
+
+        _btcWalletRebuildPKHFilter(wallet);
     }
 
     pthread_mutex_unlock(&wallet->lock);
@@ -574,6 +938,26 @@ size_t btcWalletAllAddrs(BRBitcoinWallet *wallet, BRAddress addrs[], size_t addr
     return internalCount + externalCount;
 }
 
+// writes the pkhs of every address of the given chain derived so far, which includes those generated by
+// btcWalletUnusedAddrs() and may include more, to pkhs for persisting and passing to btcWalletNewWithAddrChains()
+// returns the number of pkhs written, or total number available if pkhs is NULL
+size_t btcWalletAddrChain(BRBitcoinWallet *wallet, uint32_t internal, UInt160 pkhs[], size_t pkhsCount)
+{
+    UInt160 *derived = NULL;
+    size_t count;
+
+    assert(wallet != NULL);
+    pthread_mutex_lock(&wallet->lock);
+    if (internal == SEQUENCE_EXTERNAL_CHAIN) derived = wallet->externalDerived;
+    if (internal == SEQUENCE_INTERNAL_CHAIN) derived = wallet->internalDerived;
+    assert(derived != NULL);
+    count = array_count(derived);
+    if (pkhs && count > pkhsCount) count = pkhsCount;
+    if (pkhs) memcpy(pkhs, derived, count*sizeof(*pkhs));
+    pthread_mutex_unlock(&wallet->lock);
+    return count;
+}
+
 // true if the address was previously generated by btcWalletUnusedAddrs() (even if it's now used)
 int btcWalletContainsAddress(BRBitcoinWallet *wallet, const char *addr)
 {
@@ -584,7 +968,7 @@ int btcWalletContainsAddress(BRBitcoinWallet *wallet, const char *addr)
     assert(addr != NULL);
     pthread_mutex_lock(&wallet->lock);
     if (addr) BRAddressHash160(&pkh, wallet->addrParams, addr);
-    r = BRSetContains(wallet->allPKH, &pkh);
+    r = _btcWalletContainsPKH(wallet, &pkh);
     pthread_mutex_unlock(&wallet->lock);
     return r;
 }
@@ -640,12 +1024,43 @@ BRBitcoinTransaction *btcWalletCreateTxForOutputs(BRBitcoinWallet *wallet, const
 // use feePerKb UINT64_MAX to indicate that the wallet feePerKb should be used
 BRBitcoinTransaction *btcWalletCreateTxForOutputsWithFeePerKb(BRBitcoinWallet *wallet, uint64_t feePerKb,
                                                               const BRBitcoinTxOutput outputs[], size_t outCount)
+{
+    return btcWalletCreateTxForOutputsWithCoinSelection(wallet, feePerKb, outputs, outCount,
+                                                        BITCOIN_COIN_SELECTION_WALLET_ORDER);
+}
+
+typedef struct {
+    uint64_t feePerKb;
+    uint64_t amount;
+    uint64_t balance;
+} BRBitcoinWalletFeeInfo;
+
+// fee for a tx of vsize bytes, increased to round off the remaining wallet balance to the nearest 100 satoshi
+static uint64_t _btcWalletCoinSelectionFee(void *info, size_t vsize)
+{
+    BRBitcoinWalletFeeInfo *feeInfo = info;
+    uint64_t fee = _txFee(feeInfo->feePerKb, vsize);
+    
+    if (feeInfo->balance > feeInfo->amount + fee) fee += (feeInfo->balance - (feeInfo->amount + fee)) % 100;
+    return fee;
+}
+
+// returns an unsigned transaction that satisifes the given transaction outputs, spending UTXOs chosen by selection
+// result must be freed using btcTransactionFree()
+// use feePerKb UINT64_MAX to indicate that the wallet feePerKb should be used
+BRBitcoinTransaction *btcWalletCreateTxForOutputsWithCoinSelection(BRBitcoinWallet *wallet, uint64_t feePerKb,
+                                                                   const BRBitcoinTxOutput outputs[], size_t outCount,
+                                                                   BRBitcoinCoinSelection selection)
 {
     BRBitcoinTransaction *tx, *transaction = btcTransactionNew();
-    uint64_t feeAmount, amount = 0, balance = 0, minAmount;
-    size_t i, cpfpSize = 0;
-    BRBitcoinUTXO *o;
+    BRBitcoinCoinSelectionResult result = { 0, 0, 0, 0 };
+    BRBitcoinWalletFeeInfo feeInfo;
+    BRBitcoinCoin *coins;
+    BRBitcoinUTXO *utxos;
+    uint64_t amount = 0, minAmount;
+    size_t i, coinsCount = 0, *selected;
     BRAddress addr = BR_ADDRESS_NONE;
+    int isFunded;
     
     assert(wallet != NULL);
     assert(outputs != NULL && outCount > 0);
@@ -659,46 +1074,62 @@ BRBitcoinTransaction *btcWalletCreateTxForOutputsWithFeePerKb(BRBitcoinWallet *w
     minAmount = btcWalletMinOutputAmountWithFeePerKb(wallet, feePerKb);
     pthread_mutex_lock(&wallet->lock);
     feePerKb = UINT64_MAX == feePerKb ? wallet->feePerKb : feePerKb;
-    feeAmount = _txFee(feePerKb, btcTransactionVSize(transaction) + TX_OUTPUT_SIZE);
-    
+    feeInfo = (BRBitcoinWalletFeeInfo) { feePerKb, amount, wallet->balance };
+
+    coins = malloc(array_count(wallet->utxos)*sizeof(*coins) + 1);
+    utxos = malloc(array_count(wallet->utxos)*sizeof(*utxos) + 1);
+    selected = malloc(array_count(wallet->utxos)*sizeof(*selected) + 1);
+    assert(coins != NULL && utxos != NULL && selected != NULL);
+
     // TODO: use up all UTXOs for all used addresses to avoid leaving funds in addresses whose public key is revealed
     // TODO: avoid combining addresses in a single transaction when possible to reduce information leakage
     // TODO: use up UTXOs received from any of the output scripts that this transaction sends funds to, to mitigate an
     //       attacker double spending and requesting a refund
     for (i = 0; i < array_count(wallet->utxos); i++) {
-        o = &wallet->utxos[i];
-        tx = BRSetGet(wallet->allTx, o);
-        if (! tx || o->n >= tx->outCount) continue;
-        btcTransactionAddInput(transaction, tx->txHash, o->n, tx->outputs[o->n].amount,
-                              tx->outputs[o->n].script, tx->outputs[o->n].scriptLen, NULL, 0, NULL, 0, TXIN_SEQUENCE);
-        balance += tx->outputs[o->n].amount;
+        BRBitcoinTxOutput *output;
         
-//        // size of unconfirmed, non-change inputs for child-pays-for-parent fee
-//        // don't include parent tx with more than 10 inputs or 10 outputs
-//        if (tx->blockHeight == TX_UNCONFIRMED && tx->inCount <= 10 && tx->outCount <= 10 &&
-//            ! _btcWalletTxIsSend(wallet, tx)) cpfpSize += btcTransactionVSize(tx);
-
-        // fee amount after adding a change output
-        feeAmount = _txFee(feePerKb, btcTransactionVSize(transaction) + TX_OUTPUT_SIZE + cpfpSize);
-
-        // increase fee to round off remaining wallet balance to nearest 100 satoshi
-        if (wallet->balance > amount + feeAmount) feeAmount += (wallet->balance - (amount + feeAmount)) % 100;
+        tx = BRSetGet(wallet->allTx, &wallet->utxos[i]);
+        if (! tx || wallet->utxos[i].n >= tx->outCount) continue;
+        output = &tx->outputs[wallet->utxos[i].n];
+        utxos[coinsCount] = wallet->utxos[i];
+        coins[coinsCount].amount = output->amount;
         
-        if (balance == amount + feeAmount || balance >= amount + feeAmount + minAmount) break;
+        if (output->scriptLen > 0 && output->script[0] == OP_0) { // estimated P2WPKH input size, as btcTransactionVSize()
+            coins[coinsCount].size = sizeof(UInt256) + sizeof(uint32_t) + BRVarIntSize(0) + sizeof(uint32_t);
+            coins[coinsCount].witSize = TX_INPUT_SIZE - coins[coinsCount].size;
+        }
+        else coins[coinsCount].size = TX_INPUT_SIZE, coins[coinsCount].witSize = 0; // estimated P2PKH input size
+        
+        coinsCount++;
+    }
+    
+    isFunded = btcCoinSelect(selection, coins, coinsCount, &((BRBitcoinCoinSelectionParams) {
+        amount, feePerKb, minAmount, btcTransactionSize(transaction) - BRVarIntSize(0), TX_OUTPUT_SIZE, TX_MAX_SIZE,
+        &feeInfo, _btcWalletCoinSelectionFee
+    }), selected, &result);
+
+    for (i = 0; i < result.count; i++) {
+        tx = BRSetGet(wallet->allTx, &utxos[selected[i]]);
+        btcTransactionAddInput(transaction, tx->txHash, utxos[selected[i]].n, tx->outputs[utxos[selected[i]].n].amount,
+                               tx->outputs[utxos[selected[i]].n].script, tx->outputs[utxos[selected[i]].n].scriptLen,
+                               NULL, 0, NULL, 0, TXIN_SEQUENCE);
     }
     
     pthread_mutex_unlock(&wallet->lock);
+    free(selected);
+    free(utxos);
+    free(coins);
     
-    if (transaction && balance > amount + feeAmount + minAmount) { // add change output
+    if (transaction && result.change > 0) { // add change output
         btcWalletUnusedAddrs(wallet, &addr, 1, 1);
         uint8_t script[BRAddressScriptPubKey(NULL, 0, wallet->addrParams, addr.s)];
         size_t scriptLen = BRAddressScriptPubKey(script, sizeof(script), wallet->addrParams, addr.s);
     
-        btcTransactionAddOutput(transaction, balance - (amount + feeAmount), script, scriptLen);
+        btcTransactionAddOutput(transaction, result.change, script, scriptLen);
         btcTransactionShuffleOutputs(transaction);
     }
 
-    if (transaction && (outCount < 1 || balance < amount + feeAmount ||
+    if (transaction && (outCount < 1 || ! isFunded ||
                         btcTransactionVSize(transaction) > TX_MAX_SIZE)) { // no outputs/insufficient funds/too large
         btcTransactionFree(transaction);
         transaction = NULL;
@@ -783,7 +1214,7 @@ int btcWalletRegisterTransaction(BRBitcoinWallet *wallet, BRBitcoinTransaction *
                 //       (for now, replacements appear invalid until confirmation)
                 BRSetAdd(wallet->allTx, tx);
                 _btcWalletInsertTx(wallet, tx);
-                _btcWalletUpdateBalance(wallet);
+                _btcWalletUpdateBalanceWithTx(wallet, tx);
                 wasAdded = 1;
             }
             else { // keep track of unconfirmed non-wallet tx for invalid tx checks and child-pays-for-parent fees
@@ -1004,13 +1435,13 @@ static int _btcWalletContainsTxInput(BRBitcoinWallet *wallet, const BRBitcoinTra
     uint32_t n = txInput->index;
 
     pkh = (t && n < t->outCount) ? BRScriptPKH(t->outputs[n].script, t->outputs[n].scriptLen) : NULL;
-    if (pkh && BRSetContains(wallet->allPKH, pkh)) return 1;
+    if (pkh && _btcWalletContainsPKH(wallet, pkh)) return 1;
 
     size_t l = ((txInput->witLen > 0)
                 ? BRWitnessPKH(hash.u8, txInput->witness, txInput->witLen)
                 : BRSignaturePKH(hash.u8, txInput->signature, txInput->sigLen));
 
-    if (l > 0 && BRSetContains(wallet->allPKH, &hash)) return 1;
+    if (l > 0 && _btcWalletContainsPKH(wallet, &hash)) return 1;
 
     return 0;
 }
@@ -1066,6 +1497,7 @@ void btcWalletUpdateTransactions(BRBitcoinWallet *wallet, const UInt256 txHashes
                 if (! btcTransactionEq(wallet->transactions[k - 1], tx)) continue;
                 array_rm(wallet->transactions, k - 1);
                 _btcWalletInsertTx(wallet, tx);
+                if (wallet->transactions[k - 1] != tx) needsUpdate = 1; // tx moved; balanceHist is out of order
                 break;
             }
             
@@ -1123,7 +1555,7 @@ uint64_t btcWalletAmountReceivedFromTx(BRBitcoinWallet *wallet, const BRBitcoinT
     // TODO: don't include outputs below TX_MIN_OUTPUT_AMOUNT
     for (size_t i = 0; tx && i < tx->outCount; i++) {
         pkh = BRScriptPKH(tx->outputs[i].script, tx->outputs[i].scriptLen);
-        if (pkh && BRSetContains(wallet->allPKH, pkh)) amount += tx->outputs[i].amount;
+        if (pkh && _btcWalletContainsPKH(wallet, pkh)) amount += tx->outputs[i].amount;
     }
     
     pthread_mutex_unlock(&wallet->lock);
@@ -1146,7 +1578,7 @@ uint64_t btcWalletAmountSentByTx(BRBitcoinWallet *wallet, const BRBitcoinTransac
 
         if (t && n < t->outCount) {
             pkh = BRScriptPKH(t->outputs[n].script, t->outputs[n].scriptLen);
-            if (pkh && BRSetContains(wallet->allPKH, pkh)) amount += t->outputs[n].amount;
+            if (pkh && _btcWalletContainsPKH(wallet, pkh)) amount += t->outputs[n].amount;
         }
     }
     
@@ -1223,6 +1655,14 @@ uint64_t btcWalletFeeForTxAmount(BRBitcoinWallet *wallet, uint64_t amount)
 // fee that will be added for a transaction of the given amount
 // use feePerKb UINT64_MAX to indicate that the wallet feePerKb should be used
 uint64_t btcWalletFeeForTxAmountWithFeePerKb(BRBitcoinWallet *wallet, uint64_t feePerKb, uint64_t amount)
+{
+    return btcWalletFeeForTxAmountWithCoinSelection(wallet, feePerKb, amount, BITCOIN_COIN_SELECTION_WALLET_ORDER);
+}
+
+// fee that will be added for a transaction of the given amount, spending UTXOs chosen by selection
+// use feePerKb UINT64_MAX to indicate that the wallet feePerKb should be used
+uint64_t btcWalletFeeForTxAmountWithCoinSelection(BRBitcoinWallet *wallet, uint64_t feePerKb, uint64_t amount,
+                                                  BRBitcoinCoinSelection selection)
 {
     static const uint8_t dummyScript[] = { OP_DUP, OP_HASH160, 20, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
                                            0, 0, 0, 0, 0, 0, 0, 0, 0, OP_EQUALVERIFY, OP_CHECKSIG };
@@ -1235,7 +1675,7 @@ uint64_t btcWalletFeeForTxAmountWithFeePerKb(BRBitcoinWallet *wallet, uint64_t f
     maxAmount = btcWalletMaxOutputAmountWithFeePerKb(wallet, feePerKb);
     o.amount = (amount < maxAmount) ? amount : maxAmount;
     btcTxOutputSetScript(&o, dummyScript, sizeof(dummyScript)); // unspendable dummy scriptPubKey
-    tx = btcWalletCreateTxForOutputsWithFeePerKb(wallet, feePerKb, &o, 1);
+    tx = btcWalletCreateTxForOutputsWithCoinSelection(wallet, feePerKb, &o, 1, selection);
     btcTxOutputSetScript(&o, NULL, 0);
 
     if (tx) {
@@ -1316,6 +1756,53 @@ uint64_t btcWalletMaxOutputAmountWithFeePerKb(BRBitcoinWallet *wallet, uint64_t
     return (amount > fee) ? amount - fee : 0;
 }
 
+// compares the incrementally maintained balance, balance history and UTXOs with those of a full update; returns true if
+// they match.  Not for production use: it leaves the wallet fully updated.
+int btcWalletBalanceIsConsistentTest(BRBitcoinWallet *wallet)
+{
+    uint64_t balance, totalSent, totalReceived;
+    size_t utxosCount, histCount, spentCount, invalidCount, pendingCount, usedCount;
+    int r = 1;
+
+    assert(wallet != NULL);
+    pthread_mutex_lock(&wallet->lock);
+    balance = wallet->balance;
+    totalSent = wallet->totalSent;
+    totalReceived = wallet->totalReceived;
+    utxosCount = array_count(wallet->utxos);
+    histCount = array_count(wallet->balanceHist);
+    spentCount = BRSetCount(wallet->spentOutputs);
+    invalidCount = BRSetCount(wallet->invalidTx);
+    pendingCount = BRSetCount(wallet->pendingTx);
+    usedCount = BRSetCount(wallet->usedPKH);
+
+    BRBitcoinUTXO *utxos = malloc((utxosCount + 1)*sizeof(*utxos));
+    uint64_t *hist = malloc((histCount + 1)*sizeof(*hist));
+
+    assert(utxos != NULL && hist != NULL);
+    memcpy(utxos, wallet->utxos, utxosCount*sizeof(*utxos));
+    memcpy(hist, wallet->balanceHist, histCount*sizeof(*hist));
+    _btcWalletUpdateBalance(wallet);
+
+    if (balance != wallet->balance || totalSent != wallet->totalSent || totalReceived != wallet->totalReceived) r = 0;
+    if (utxosCount != array_count(wallet->utxos) || histCount != array_count(wallet->balanceHist)) r = 0;
+    if (spentCount != BRSetCount(wallet->spentOutputs) || invalidCount != BRSetCount(wallet->invalidTx) ||
+        pendingCount != BRSetCount(wallet->pendingTx) || usedCount != BRSetCount(wallet->usedPKH)) r = 0;
+
+    for (size_t i = 0; r && i < utxosCount; i++) {
+        if (! btcUTXOEq(&utxos[i], &wallet->utxos[i])) r = 0;
+    }
+
+    for (size_t i = 0; r && i < histCount; i++) {
+        if (hist[i] != wallet->balanceHist[i]) r = 0;
+    }
+
+    free(hist);
+    free(utxos);
+    pthread_mutex_unlock(&wallet->lock);
+    return r;
+}
+
 static void _setApplyFreeTx(void *info, void *tx)
 {
     btcTransactionFree(tx);
@@ -1327,6 +1814,7 @@ void btcWalletFree(BRBitcoinWallet *wallet)
     assert(wallet != NULL);
     pthread_mutex_lock(&wallet->lock);
     BRSetFree(wallet->allPKH);
+    btcBlockedBloomFilterFree(wallet->pkhFilter);
     BRSetFree(wallet->usedPKH);
     BRSetFree(wallet->invalidTx);
     BRSetFree(wallet->pendingTx);
@@ -1335,6 +1823,8 @@ void btcWalletFree(BRBitcoinWallet *wallet)
     BRSetFree(wallet->spentOutputs);
     array_free(wallet->internalChain);
     array_free(wallet->externalChain);
+    array_free(wallet->internalDerived);
+    array_free(wallet->externalDerived);
     array_free(wallet->balanceHist);
     array_free(wallet->transactions);
     array_free(wallet->utxos);
@@ -26,6 +26,7 @@
 #define BRWallet_h
 
 #include "BRBitcoinTransaction.h"
+#include "BRBitcoinCoinSelection.h"
 #include "support/BRAddress.h"
 #include "support/BRBIP32Sequence.h"
 #include "support/BRInt.h"
@@ -63,6 +64,27 @@ typedef struct BRBitcoinWalletStruct BRBitcoinWallet;
 BRBitcoinWallet *btcWalletNew(BRAddressParams addrParams, BRBitcoinTransaction *transactions[], size_t txCount,
                               BRMasterPubKey mpk);
 
+// as btcWalletNew(), but with the external and internal chain pkhs, from btcWalletAddrChain() of an earlier wallet with
+// the same mpk, to use rather than derive again; a chain whose first or last pkh doesn't match mpk is ignored, and the
+// rest are trusted, so persisted chains must be checked for corruption (e.g. against a digest) before being passed in
+BRBitcoinWallet *btcWalletNewWithAddrChains(BRAddressParams addrParams, BRBitcoinTransaction *transactions[],
+                                            size_t txCount, BRMasterPubKey mpk,
+                                            const UInt160 externalPKHs[], size_t externalCount,
+                                            const UInt160 internalPKHs[], size_t internalCount);
+
+// as btcWalletNewWithAddrChains(), but with a snapshot from btcWalletSnapshot() of an earlier wallet with the same mpk,
+// to restore rather than sort and replay the transactions it holds; a snapshot that is stale or corrupt is ignored
+BRBitcoinWallet *btcWalletNewWithSnapshot(BRAddressParams addrParams, BRBitcoinTransaction *transactions[],
+                                          size_t txCount, BRMasterPubKey mpk,
+                                          const UInt160 externalPKHs[], size_t externalCount,
+                                          const UInt160 internalPKHs[], size_t internalCount,
+                                          const uint8_t *snapshot, size_t snapshotLen);
+
+// writes a snapshot of the wallet's transaction order, balance history and UTXOs to buf, for persisting and passing to
+// btcWalletNewWithSnapshot(); only a wallet whose transactions are all confirmed has one
+// returns number of bytes written to buf, or total bufLen needed if buf is NULL, or 0 if there is no snapshot
+size_t btcWalletSnapshot(BRBitcoinWallet *wallet, uint8_t *buf, size_t bufLen);
+
 // not thread-safe, set callbacks once after btcWalletNew(), before calling other BRBitcoinWallet functions
 // info is a void pointer that will be passed along with each callback call
 // void balanceChanged(void *, uint64_t) - called when the wallet balance changes
@@ -100,6 +122,11 @@ BRAddress btcWalletAddressToLegacy (BRBitcoinWallet *wallet, BRAddress *addr);
 // returns the number addresses written, or total number available if addrs is NULL
 size_t btcWalletAllAddrs(BRBitcoinWallet *wallet, BRAddress addrs[], size_t addrsCount);
 
+// writes the pkhs of every address of the given chain derived so far, which includes those generated by
+// btcWalletUnusedAddrs() and may include more, to pkhs for persisting and passing to btcWalletNewWithAddrChains()
+// returns the number of pkhs written, or total number available if pkhs is NULL
+size_t btcWalletAddrChain(BRBitcoinWallet *wallet, uint32_t internal, UInt160 pkhs[], size_t pkhsCount);
+
 // true if the address was previously generated by btcWalletUnusedAddrs() (even if it's now used)
 int btcWalletContainsAddress(BRBitcoinWallet *wallet, const char *addr);
 
@@ -158,6 +185,13 @@ BRBitcoinTransaction *btcWalletCreateTxForOutputs(BRBitcoinWallet *wallet, const
 BRBitcoinTransaction *btcWalletCreateTxForOutputsWithFeePerKb(BRBitcoinWallet *wallet, uint64_t feePerKb,
                                                               const BRBitcoinTxOutput outputs[], size_t outCount);
 
+// returns an unsigned transaction that satisifes the given transaction outputs, spending UTXOs chosen by selection
+// result must be freed using btcTransactionFree()
+// use feePerKb UINT64_MAX to indicate that the wallet feePerKb should be used
+BRBitcoinTransaction *btcWalletCreateTxForOutputsWithCoinSelection(BRBitcoinWallet *wallet, uint64_t feePerKb,
+                                                                   const BRBitcoinTxOutput outputs[], size_t outCount,
+                                                                   BRBitcoinCoinSelection selection);
+
 // signs any inputs in tx that can be signed using private keys from the wallet
 // forkId is 0 for bitcoin, 0x40 for b-cash
 // seed is the master private key (wallet seed) corresponding to the master public key given when the wallet was created
@@ -222,6 +256,11 @@ uint64_t btcWalletFeeForTxAmount(BRBitcoinWallet *wallet, uint64_t amount);
 // use feePerKb UINT64_MAX to indicate that the wallet feePerKb should be used
 uint64_t btcWalletFeeForTxAmountWithFeePerKb(BRBitcoinWallet *wallet, uint64_t feePerKb, uint64_t amount);
 
+// fee that will be added for a transaction of the given amount, spending UTXOs chosen by selection
+// use feePerKb UINT64_MAX to indicate that the wallet feePerKb should be used
+uint64_t btcWalletFeeForTxAmountWithCoinSelection(BRBitcoinWallet *wallet, uint64_t feePerKb, uint64_t amount,
+                                                  BRBitcoinCoinSelection selection);
+
 // outputs below this amount are uneconomical due to fees (TX_MIN_OUTPUT_AMOUNT is the absolute minimum output amount)
 uint64_t btcWalletMinOutputAmount(BRBitcoinWallet *wallet);
 
@@ -25,13 +25,17 @@
 #include "BRBIP32Sequence.h"
 #include "BRCrypto.h"
 #include "BRBase58.h"
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
 #define BIP32_SEED_KEY "Bitcoin seed"
 #define BIP32_XPRV     "\x04\x88\xAD\xE4"
 #define BIP32_XPUB     "\x04\x88\xB2\x1E"
 
+#define BIP32_CHAIN_CACHE_SIZE 8
+
 // BIP32 is a scheme for deriving chains of addresses from a seed value
 // https://github.com/bitcoin/bips/blob/master/bip-0032.mediawiki
 
@@ -104,6 +108,57 @@ static void _CKDpub(BRECPoint *K, UInt256 *c, uint32_t i)
     }
 }
 
+// every key in a chain is derived from N(mpk/chain), so the most recently used ones are kept along with their chain
+// codes; the cache is small since a wallet uses just a few chains
+static struct {
+    uint32_t fingerPrint;
+    UInt256 chainCode;
+    uint8_t pubKey[33];
+    uint32_t chain;
+    BRECPoint K;
+    UInt256 c;
+} _chainCache[BIP32_CHAIN_CACHE_SIZE];
+
+static size_t _chainCacheCount = 0, _chainCacheNext = 0;
+static pthread_mutex_t _chainCacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+// sets K and c to the public key and chain code for path N(mpk/chain)
+static void _CKDpubChain(BRECPoint *K, UInt256 *c, BRMasterPubKey mpk, uint32_t chain)
+{
+    size_t i;
+
+    pthread_mutex_lock(&_chainCacheLock);
+
+    for (i = 0; i < _chainCacheCount; i++) {
+        if (_chainCache[i].chain == chain && _chainCache[i].fingerPrint == mpk.fingerPrint &&
+            UInt256Eq(_chainCache[i].chainCode, mpk.chainCode) &&
+            memcmp(_chainCache[i].pubKey, mpk.pubKey, sizeof(mpk.pubKey)) == 0) break;
+    }
+
+    if (i < _chainCacheCount) {
+        *K = _chainCache[i].K;
+        *c = _chainCache[i].c;
+        pthread_mutex_unlock(&_chainCacheLock);
+        return;
+    }
+
+    pthread_mutex_unlock(&_chainCacheLock);
+    *K = *(BRECPoint *)mpk.pubKey;
+    *c = mpk.chainCode;
+    _CKDpub(K, c, chain); // path N(mpk/chain)
+    pthread_mutex_lock(&_chainCacheLock);
+    i = _chainCacheNext;
+    _chainCacheNext = (_chainCacheNext + 1) % BIP32_CHAIN_CACHE_SIZE;
+    if (_chainCacheCount < BIP32_CHAIN_CACHE_SIZE) _chainCacheCount++;
+    _chainCache[i].fingerPrint = mpk.fingerPrint;
+    _chainCache[i].chainCode = mpk.chainCode;
+    memcpy(_chainCache[i].pubKey, mpk.pubKey, sizeof(mpk.pubKey));
+    _chainCache[i].chain = chain;
+    _chainCache[i].K = *K;
+    _chainCache[i].c = *c;
+    pthread_mutex_unlock(&_chainCacheLock);
+}
+
 // returns the master public key for the default BIP32 wallet layout - derivation path N(m/0H)
 BRMasterPubKey BRBIP32MasterPubKey(const void *seed, size_t seedLen)
 {
@@ -178,9 +233,7 @@ size_t BRBIP32PubKey(uint8_t pubKey[33], BRMasterPubKey mpk, uint32_t chain, uin
     assert(memcmp(&mpk, &BR_MASTER_PUBKEY_NONE, sizeof(mpk)) != 0);
     
     if (pubKey) {
-        *(BRECPoint *)pubKey = *(BRECPoint *)mpk.pubKey;
-
-        _CKDpub((BRECPoint *)pubKey, &chainCode, chain); // path N(mpk/chain)
+        _CKDpubChain((BRECPoint *)pubKey, &chainCode, mpk, chain); // path N(mpk/chain)
         _CKDpub((BRECPoint *)pubKey, &chainCode, index); // index'th key in chain
         var_clean(&chainCode);
     }
@@ -188,6 +241,38 @@ size_t BRBIP32PubKey(uint8_t pubKey[33], BRMasterPubKey mpk, uint32_t chain, uin
     return sizeof(BRECPoint);
 }
 
+// writes the public keys for paths N(mpk/chain/index) through N(mpk/chain/index + count - 1) to pubKeys
+// returns the number of keys written, which is less than count only if a key would be invalid or hardened
+size_t BRBIP32PubKeyRange(uint8_t pubKeys[][33], BRMasterPubKey mpk, uint32_t chain, uint32_t index, size_t count)
+{
+    BRECPoint K;
+    UInt256 chainCode, *IL = (count > 0) ? malloc(count*sizeof(*IL)) : NULL;
+    uint8_t buf[sizeof(K) + sizeof(index)];
+    UInt512 I;
+    size_t i;
+
+    assert(memcmp(&mpk, &BR_MASTER_PUBKEY_NONE, sizeof(mpk)) != 0);
+    assert(pubKeys != NULL || count == 0);
+    assert(IL != NULL || count == 0);
+    
+    if (count == 0) return 0;
+    _CKDpubChain(&K, &chainCode, mpk, chain); // path N(mpk/chain)
+    *(BRECPoint *)buf = K;
+
+    for (i = 0; i < count && ((index + i) & BIP32_HARD) != BIP32_HARD; i++) { // the HMAC part of CKDpub for each key
+        UInt32SetBE(&buf[sizeof(K)], (uint32_t)(index + i));
+        BRHMAC(&I, BRSHA512, sizeof(UInt512), &chainCode, sizeof(chainCode), buf, sizeof(buf));
+        IL[i] = *(UInt256 *)&I; // the child chain codes, IR, aren't needed
+    }
+
+    count = BRSecp256k1PointAddList((BRECPoint *)pubKeys, &K, IL, i); // P(IL) + K for each key
+    mem_clean(IL, i*sizeof(*IL));
+    free(IL);
+    var_clean(&I, &chainCode);
+    mem_clean(buf, sizeof(buf));
+    return count;
+}
+
 // sets the private key for path m/0H/chain/index to key
 void BRBIP32PrivKey(BRKey *key, const void *seed, size_t seedLen, uint32_t chain, uint32_t index)
 {
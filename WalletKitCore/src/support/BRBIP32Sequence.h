@@ -85,6 +85,10 @@ BRMasterPubKey BRBIP32MasterPubKeyPath(const void *seed, size_t seedLen, int dep
 // returns number of bytes written, maximum is 33
 size_t BRBIP32PubKey(uint8_t pubKey[33], BRMasterPubKey mpk, uint32_t chain, uint32_t index);
 
+// writes the public keys for paths N(mpk/chain/index) through N(mpk/chain/index + count - 1) to pubKeys
+// returns the number of keys written, which is less than count only if a key would be invalid or hardened
+size_t BRBIP32PubKeyRange(uint8_t pubKeys[][33], BRMasterPubKey mpk, uint32_t chain, uint32_t index, size_t count);
+
 // sets the private key for path m/0H/chain/index to key
 void BRBIP32PrivKey(BRKey *key, const void *seed, size_t seedLen, uint32_t chain, uint32_t index);
 
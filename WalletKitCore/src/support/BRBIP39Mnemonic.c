@@ -25,9 +25,12 @@
 #include "BRBIP39Mnemonic.h"
 #include "BRCrypto.h"
 #include "BRInt.h"
+#include "BROSCompat.h"
 #include <string.h>
 #include <assert.h>
 
+#define BIP39_DERIVE_MAX_WORKERS 8
+
 // returns number of bytes written to phrase including NULL terminator, or phraseLen needed if phrase is NULL
 size_t BRBIP39Encode(char *phrase, size_t phraseLen, const char *wordList[], const uint8_t *data, size_t dataLen)
 {
@@ -131,7 +134,44 @@ void BRBIP39DeriveKey(void *key64, const char *phrase, const char *passphrase)
     if (phrase) {
         strcpy(salt, "mnemonic");
         if (passphrase) strcpy(salt + strlen("mnemonic"), passphrase);
-        BRPBKDF2(key64, 64, BRSHA512, 512/8, phrase, strlen(phrase), salt, strlen(salt), 2048);
+        BRPBKDF2SHA512(key64, 64, phrase, strlen(phrase), salt, strlen(salt), 2048);
         mem_clean(salt, sizeof(salt));
     }
 }
+
+typedef struct {
+    uint8_t *keys;
+    const char **phrases, **passphrases;
+    size_t count;
+} BRBIP39DeriveJob;
+
+static void *_BRBIP39DeriveRoutine(void *info)
+{
+    BRBIP39DeriveJob *job = info;
+
+    for (size_t i = 0; i < job->count; i++) {
+        BRBIP39DeriveKey(&job->keys[i*64], job->phrases[i], (job->passphrases) ? job->passphrases[i] : NULL);
+    }
+
+    return NULL;
+}
+
+// derives the keys for count phrases, split across worker threads, up to one per cpu
+// keys64 must hold count*64 bytes, and passphrases may be NULL, or hold NULL entries, for phrases without one
+void BRBIP39DeriveKeys(void *keys64, const char *phrases[], const char *passphrases[], size_t count)
+{
+    BRBIP39DeriveJob jobs[BIP39_DERIVE_MAX_WORKERS];
+    size_t i, offset = 0, workers = pthread_workers_count_brd(count, BIP39_DERIVE_MAX_WORKERS);
+
+    assert(keys64 != NULL || count == 0);
+    assert(phrases != NULL || count == 0);
+
+    for (i = 0; i < workers; i++) {
+        jobs[i] = (BRBIP39DeriveJob) { (uint8_t *)keys64 + offset*64, &phrases[offset],
+                                       (passphrases) ? &passphrases[offset] : NULL,
+                                       count/workers + (i < count % workers ? 1 : 0) };
+        offset += jobs[i].count;
+    }
+
+    pthread_run_jobs_brd(_BRBIP39DeriveRoutine, jobs, sizeof(*jobs), workers);
+}
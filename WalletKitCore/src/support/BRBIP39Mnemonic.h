@@ -52,6 +52,10 @@ int BRBIP39PhraseIsValid(const char *wordList[], const char *phrase);
 // BUG: does not currently support passphrases containing NULL characters
 void BRBIP39DeriveKey(void *key64, const char *phrase, const char *passphrase);
 
+// derives the keys for count phrases, split across worker threads, up to one per cpu
+// keys64 must hold count*64 bytes, and passphrases may be NULL, or hold NULL entries, for phrases without one
+void BRBIP39DeriveKeys(void *keys64, const char *phrases[], const char *passphrases[], size_t count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -27,6 +27,8 @@
 #include <string.h>
 #include <assert.h>
 
+#define AES_PARALLEL_BLOCKS 8 // ctr keystream blocks encrypted per pass
+
 // endian swapping
 #if __BIG_ENDIAN__ || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
 #define be32(x) (x)
@@ -110,19 +112,20 @@ void BRSHA1(void *md20, const void *data, size_t dataLen)
 #define s2(x) (ror32((x), 7) ^ ror32((x), 18) ^ ((x) >> 3))
 #define s3(x) (ror32((x), 17) ^ ror32((x), 19) ^ ((x) >> 10))
 
+static const uint32_t _BRSHA256K[] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
 static void _BRSHA256Compress(uint32_t *r, const uint32_t *x)
 {
-    static const uint32_t k[] = {
-        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
-    };
-    
+    const uint32_t *k = _BRSHA256K;
     int i;
     uint32_t a = r[0], b = r[1], c = r[2], d = r[3], e = r[4], f = r[5], g = r[6], h = r[7], t1, t2, w[64];
     
@@ -140,25 +143,218 @@ static void _BRSHA256Compress(uint32_t *r, const uint32_t *x)
     mem_clean(w, sizeof(w));
 }
 
+static void _BRSHA256CompressPortable(uint32_t *r, const void *blocks, size_t count)
+{
+    uint32_t x[16];
+
+    for (size_t i = 0; i < count; i++) {
+        memcpy(x, (const uint8_t *)blocks + i*64, 64);
+        _BRSHA256Compress(r, x);
+    }
+
+    mem_clean(x, sizeof(x));
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BR_SHA256_X86 1
+#include <immintrin.h>
+#include <cpuid.h>
+
+// four rounds with message words w, for the sha extension's ABEF/CDGH state layout
+#define sha256ni_rounds(i, w) (t = _mm_add_epi32((w), _mm_loadu_si128((const __m128i *)&_BRSHA256K[(i)*4])),\
+    s1 = _mm_sha256rnds2_epu32(s1, s0, t), s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(t, 0x0e)))
+
+// replaces w0 = W[i - 4] with W[i], given w1 = W[i - 3], w2 = W[i - 2], w3 = W[i - 1], four words each
+#define sha256ni_schedule(w0, w1, w2, w3) ((w0) = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32((w0), (w1)),\
+    _mm_alignr_epi8((w3), (w2), 4)), (w3)))
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void _BRSHA256CompressSHANI(uint32_t *r, const void *blocks, size_t count)
+{
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL); // big endian words
+    const uint8_t *p = blocks;
+    __m128i s0, s1, abef, cdgh, t, w0, w1, w2, w3;
+
+    t = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&r[0]), 0xb1); // CDAB
+    s1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&r[4]), 0x1b); // EFGH
+    s0 = _mm_alignr_epi8(t, s1, 8); // ABEF
+    s1 = _mm_blend_epi16(s1, t, 0xf0); // CDGH
+
+    for (size_t i = 0; i < count; i++, p += 64) {
+        abef = s0, cdgh = s1;
+        w0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&p[0]), mask);
+        w1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&p[16]), mask);
+        w2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&p[32]), mask);
+        w3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&p[48]), mask);
+        sha256ni_rounds(0, w0), sha256ni_rounds(1, w1), sha256ni_rounds(2, w2), sha256ni_rounds(3, w3);
+
+        for (int j = 4; j < 16; j += 4) {
+            sha256ni_schedule(w0, w1, w2, w3), sha256ni_rounds(j, w0);
+            sha256ni_schedule(w1, w2, w3, w0), sha256ni_rounds(j + 1, w1);
+            sha256ni_schedule(w2, w3, w0, w1), sha256ni_rounds(j + 2, w2);
+            sha256ni_schedule(w3, w0, w1, w2), sha256ni_rounds(j + 3, w3);
+        }
+
+        s0 = _mm_add_epi32(s0, abef), s1 = _mm_add_epi32(s1, cdgh);
+    }
+
+    t = _mm_shuffle_epi32(s0, 0x1b); // FEBA
+    s1 = _mm_shuffle_epi32(s1, 0xb1); // DCHG
+    _mm_storeu_si128((__m128i *)&r[0], _mm_blend_epi16(t, s1, 0xf0)); // DCBA
+    _mm_storeu_si128((__m128i *)&r[4], _mm_alignr_epi8(s1, t, 8)); // HGFE
+}
+
+#define ror32x8(x, n) _mm256_or_si256(_mm256_srli_epi32((x), (n)), _mm256_slli_epi32((x), 32 - (n)))
+#define s0x8(x) _mm256_xor_si256(_mm256_xor_si256(ror32x8((x), 2), ror32x8((x), 13)), ror32x8((x), 22))
+#define s1x8(x) _mm256_xor_si256(_mm256_xor_si256(ror32x8((x), 6), ror32x8((x), 11)), ror32x8((x), 25))
+#define s2x8(x) _mm256_xor_si256(_mm256_xor_si256(ror32x8((x), 7), ror32x8((x), 18)), _mm256_srli_epi32((x), 3))
+#define s3x8(x) _mm256_xor_si256(_mm256_xor_si256(ror32x8((x), 17), ror32x8((x), 19)), _mm256_srli_epi32((x), 10))
+#define chx8(x, y, z) _mm256_xor_si256(_mm256_and_si256((x), _mm256_xor_si256((y), (z))), (z))
+#define majx8(x, y, z) _mm256_or_si256(_mm256_and_si256((x), (y)), _mm256_and_si256(_mm256_or_si256((x), (y)), (z)))
+
+// compresses one block for each of 8 messages, the block for lane l at blocks + l*stride, with r holding the 8 states
+// one word per lane, r[0] the a words, r[1] the b words, etc.
+__attribute__((target("avx2")))
+static void _BRSHA256CompressAVX2x8(__m256i *r, const uint8_t *blocks, size_t stride)
+{
+    const __m256i mask = _mm256_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL,
+                                           0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL),
+                  lanes = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32((int)stride));
+    __m256i a = r[0], b = r[1], c = r[2], d = r[3], e = r[4], f = r[5], g = r[6], h = r[7], t1, t2, w[16];
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        w[i] = _mm256_shuffle_epi8(_mm256_i32gather_epi32((const int *)&blocks[i*4], lanes, 1), mask);
+    }
+
+    for (i = 0; i < 64; i++) {
+        if (i >= 16) {
+            w[i & 15] = _mm256_add_epi32(_mm256_add_epi32(s3x8(w[(i - 2) & 15]), w[(i - 7) & 15]),
+                                         _mm256_add_epi32(s2x8(w[(i - 15) & 15]), w[i & 15]));
+        }
+
+        t1 = _mm256_add_epi32(_mm256_add_epi32(h, s1x8(e)), _mm256_add_epi32(chx8(e, f, g),
+                              _mm256_add_epi32(_mm256_set1_epi32((int)_BRSHA256K[i]), w[i & 15])));
+        t2 = _mm256_add_epi32(s0x8(a), majx8(a, b, c));
+        h = g, g = f, f = e, e = _mm256_add_epi32(d, t1), d = c, c = b, b = a, a = _mm256_add_epi32(t1, t2);
+    }
+
+    r[0] = _mm256_add_epi32(r[0], a), r[1] = _mm256_add_epi32(r[1], b), r[2] = _mm256_add_epi32(r[2], c);
+    r[3] = _mm256_add_epi32(r[3], d), r[4] = _mm256_add_epi32(r[4], e), r[5] = _mm256_add_epi32(r[5], f);
+    r[6] = _mm256_add_epi32(r[6], g), r[7] = _mm256_add_epi32(r[7], h);
+}
+
+// sha-256 of 8 messages of dataLen bytes each, stored one after another at data, written one after another to md32s
+__attribute__((target("avx2")))
+static void _BRSHA256AVX2x8(uint8_t *md32s, const uint8_t *data, size_t dataLen)
+{
+    static const uint32_t iv[] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                   0x1f83d9ab, 0x5be0cd19 };
+    size_t i, l, tailLen = dataLen % 64, tailCount = (tailLen >= 56) ? 2 : 1;
+    uint32_t tail[8][32], buf[8][8], md[8];
+    __m256i r[8];
+
+    for (i = 0; i < 8; i++) r[i] = _mm256_set1_epi32((int)iv[i]);
+    for (i = 0; i + 64 <= dataLen; i += 64) _BRSHA256CompressAVX2x8(r, &data[i], dataLen);
+
+    for (l = 0; l < 8; l++) { // padding and length, in one or two blocks per lane
+        memset(tail[l], 0, sizeof(tail[l]));
+        memcpy(tail[l], &data[l*dataLen + i], tailLen);
+        ((uint8_t *)tail[l])[tailLen] = 0x80;
+        tail[l][tailCount*16 - 2] = be32((uint32_t)(dataLen >> 29));
+        tail[l][tailCount*16 - 1] = be32((uint32_t)(dataLen << 3));
+    }
+
+    for (i = 0; i < tailCount; i++) _BRSHA256CompressAVX2x8(r, (const uint8_t *)&tail[0][i*16], sizeof(tail[0]));
+    for (i = 0; i < 8; i++) _mm256_storeu_si256((__m256i *)buf[i], r[i]);
+
+    for (l = 0; l < 8; l++) {
+        for (i = 0; i < 8; i++) md[i] = be32(buf[i][l]);
+        memcpy(&md32s[l*32], md, sizeof(md));
+    }
+
+    mem_clean(tail, sizeof(tail));
+    mem_clean(buf, sizeof(buf));
+    mem_clean(md, sizeof(md));
+}
+
+static int _BRSHA256BackendIsSupported(BRSHA256Backend backend)
+{
+    unsigned int eax, ebx, ecx, edx, xcr0 = 0, ebx7 = 0;
+    int sse4 = 0, avx = 0;
+
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        sse4 = ((ecx & bit_SSSE3) && (ecx & bit_SSE4_1));
+        avx = ((ecx & bit_AVX) && (ecx & bit_OSXSAVE));
+    }
+
+    if (avx) __asm__ ("xgetbv" : "=a" (xcr0) : "c" (0) : "edx"); // the os saves the ymm registers
+    if (! __get_cpuid_count(7, 0, &eax, &ebx7, &ecx, &edx)) ebx7 = 0;
+
+    switch (backend) {
+        case BR_SHA256_BACKEND_PORTABLE: return 1;
+        case BR_SHA256_BACKEND_AVX2: return (avx && (xcr0 & 0x06) == 0x06 && (ebx7 & bit_AVX2));
+        case BR_SHA256_BACKEND_SHA_NI: return (sse4 && (ebx7 & (1 << 29))); // cpuid leaf 7 ebx bit 29: sha
+    }
+
+    return 0;
+}
+#else
+static int _BRSHA256BackendIsSupported(BRSHA256Backend backend)
+{
+    return (backend == BR_SHA256_BACKEND_PORTABLE);
+}
+#endif // BR_SHA256_X86
+
+static void _BRSHA256CompressDetect(uint32_t *r, const void *blocks, size_t count);
+
+// the compression function for the selected backend, set on first use; racing threads all set the same value
+static void (*_BRSHA256CompressBlocks)(uint32_t *r, const void *blocks, size_t count) = _BRSHA256CompressDetect;
+static BRSHA256Backend _BRSHA256Backend = BR_SHA256_BACKEND_PORTABLE;
+
+int BRSHA256SetBackend(BRSHA256Backend backend)
+{
+    if (! _BRSHA256BackendIsSupported(backend)) return 0;
+    _BRSHA256Backend = backend;
+#if BR_SHA256_X86
+    if (backend == BR_SHA256_BACKEND_SHA_NI) _BRSHA256CompressBlocks = _BRSHA256CompressSHANI;
+    else _BRSHA256CompressBlocks = _BRSHA256CompressPortable;
+#else
+    _BRSHA256CompressBlocks = _BRSHA256CompressPortable;
+#endif
+    return 1;
+}
+
+BRSHA256Backend BRSHA256GetBackend(void)
+{
+    if (_BRSHA256CompressBlocks == _BRSHA256CompressDetect) _BRSHA256CompressDetect(NULL, NULL, 0);
+    return _BRSHA256Backend;
+}
+
+static void _BRSHA256CompressDetect(uint32_t *r, const void *blocks, size_t count)
+{
+    if (! BRSHA256SetBackend(BR_SHA256_BACKEND_SHA_NI) && ! BRSHA256SetBackend(BR_SHA256_BACKEND_AVX2)) {
+        BRSHA256SetBackend(BR_SHA256_BACKEND_PORTABLE);
+    }
+
+    if (count > 0) _BRSHA256CompressBlocks(r, blocks, count);
+}
+
 void BRSHA224(void *md28, const void *data, size_t dataLen) {
-    size_t i;
+    size_t i = dataLen & ~(size_t)63;
     uint32_t x[16], buf[] = { 0xc1059ed8, 0x367cd507, 0x3070dd17, 0xf70e5939, 0xffc00b31, 0x68581511,
                               0x64f98fa7, 0xbefa4fa4 }; // initial buffer values
 
     assert(md28 != NULL);
     assert(data != NULL || dataLen == 0);
 
-    for (i = 0; i < dataLen; i += 64) { // process data in 64 byte blocks
-        memcpy(x, (const uint8_t *)data + i, (i + 64 < dataLen) ? 64 : dataLen - i);
-        if (i + 64 > dataLen) break;
-        _BRSHA256Compress(buf, x);
-    }
-
+    if (i > 0) _BRSHA256CompressBlocks(buf, data, i/64); // process data in 64 byte blocks
+    memcpy(x, (const uint8_t *)data + i, dataLen - i);
     memset((uint8_t *)x + (dataLen - i), 0, 64 - (dataLen - i)); // clear remainder of x
     ((uint8_t *)x)[dataLen - i] = 0x80; // append padding
-    if (dataLen - i >= 56) _BRSHA256Compress(buf, x), memset(x, 0, 64); // length goes to next block
+    if (dataLen - i >= 56) _BRSHA256CompressBlocks(buf, x, 1), memset(x, 0, 64); // length goes to next block
     x[14] = be32((uint32_t)(dataLen >> 29)), x[15] = be32((uint32_t)(dataLen << 3)); // append length in bits
-    _BRSHA256Compress(buf, x); // finalize
+    _BRSHA256CompressBlocks(buf, x, 1); // finalize
     for (i = 0; i < 7; i++) buf[i] = be32(buf[i]); // endian swap
     memcpy(md28, buf, 28); // write to md
     mem_clean(x, sizeof(x));
@@ -167,24 +363,20 @@ void BRSHA224(void *md28, const void *data, size_t dataLen) {
 
 void BRSHA256(void *md32, const void *data, size_t dataLen)
 {
-    size_t i;
+    size_t i = dataLen & ~(size_t)63;
     uint32_t x[16], buf[] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c,
                               0x1f83d9ab, 0x5be0cd19 }; // initial buffer values
     
     assert(md32 != NULL);
     assert(data != NULL || dataLen == 0);
 
-    for (i = 0; i < dataLen; i += 64) { // process data in 64 byte blocks
-        memcpy(x, (const uint8_t *)data + i, (i + 64 < dataLen) ? 64 : dataLen - i);
-        if (i + 64 > dataLen) break;
-        _BRSHA256Compress(buf, x);
-    }
-    
+    if (i > 0) _BRSHA256CompressBlocks(buf, data, i/64); // process data in 64 byte blocks
+    memcpy(x, (const uint8_t *)data + i, dataLen - i);
     memset((uint8_t *)x + (dataLen - i), 0, 64 - (dataLen - i)); // clear remainder of x
     ((uint8_t *)x)[dataLen - i] = 0x80; // append padding
-    if (dataLen - i >= 56) _BRSHA256Compress(buf, x), memset(x, 0, 64); // length goes to next block
+    if (dataLen - i >= 56) _BRSHA256CompressBlocks(buf, x, 1), memset(x, 0, 64); // length goes to next block
     x[14] = be32((uint32_t)(dataLen >> 29)), x[15] = be32((uint32_t)(dataLen << 3)); // append length in bits
-    _BRSHA256Compress(buf, x); // finalize
+    _BRSHA256CompressBlocks(buf, x, 1); // finalize
     for (i = 0; i < 8; i++) buf[i] = be32(buf[i]); // endian swap
     memcpy(md32, buf, 32); // write to md
     mem_clean(x, sizeof(x));
@@ -202,6 +394,34 @@ void BRSHA256_2(void *md32, const void *data, size_t dataLen)
     BRSHA256(md32, t, sizeof(t));
 }
 
+// sha-256 of count messages, each dataLen bytes and stored one after another at data, written 32 bytes apart to md32s
+void BRSHA256Batch(void *md32s, const void *data, size_t dataLen, size_t count)
+{
+    size_t i = 0;
+
+    assert(md32s != NULL || count == 0);
+    assert(data != NULL || dataLen == 0 || count == 0);
+    if (_BRSHA256CompressBlocks == _BRSHA256CompressDetect) _BRSHA256CompressDetect(NULL, NULL, 0);
+
+#if BR_SHA256_X86
+    // the lanes are gathered with 32 bit offsets, so longer messages are hashed one at a time
+    if (_BRSHA256Backend == BR_SHA256_BACKEND_AVX2 && dataLen <= INT32_MAX/8) {
+        for (; i + 8 <= count; i += 8) {
+            _BRSHA256AVX2x8((uint8_t *)md32s + i*32, (const uint8_t *)data + i*dataLen, dataLen);
+        }
+    }
+#endif
+
+    for (; i < count; i++) BRSHA256((uint8_t *)md32s + i*32, (const uint8_t *)data + i*dataLen, dataLen);
+}
+
+// double-sha-256 of count messages, laid out as for BRSHA256Batch(), e.g. the nodes of a merkle tree level
+void BRSHA256_2Batch(void *md32s, const void *data, size_t dataLen, size_t count)
+{
+    BRSHA256Batch(md32s, data, dataLen, count);
+    BRSHA256Batch(md32s, md32s, 32, count); // each message is read in full before its own digest is written
+}
+
 // bitwise right rotation
 #define ror64(a, b) (((a) >> (b)) | ((a) << (64 - (b))))
 
@@ -398,54 +618,62 @@ void BRHash160(void *md20, const void *data, size_t datalen)
 
 // bitwise left rotation
 #define rol64(a, b) ((a) << (b) ^ ((a) >> (64 - (b))))
+#define xor64(a, b) ((a) ^ (b))
+#define andn64(a, b) (~(a) & (b))
+
+static const uint64_t _BRKeccakRC[] = { // keccak round constants
+    0x0000000000000001, 0x0000000000008082, 0x800000000000808a, 0x8000000080008000, 0x000000000000808b,
+    0x0000000080000001, 0x8000000080008081, 0x8000000000008009, 0x000000000000008a, 0x0000000000000088,
+    0x0000000080008009, 0x000000008000000a, 0x000000008000808b, 0x800000000000008b, 0x8000000000008089,
+    0x8000000000008003, 0x8000000000008002, 0x8000000000000080, 0x000000000000800a, 0x800000008000000a,
+    0x8000000080008081, 0x8000000000008080, 0x0000000080000001, 0x8000000080008008
+};
+
+// chi on the five lanes of row j, from the rotated and permuted lanes b
+#define keccak_chi(s, b, j, XOR, ANDN) (\
+    s[(j) + 0] = XOR(b[(j) + 0], ANDN(b[(j) + 1], b[(j) + 2])), s[(j) + 1] = XOR(b[(j) + 1], ANDN(b[(j) + 2], b[(j) + 3])),\
+    s[(j) + 2] = XOR(b[(j) + 2], ANDN(b[(j) + 3], b[(j) + 4])), s[(j) + 3] = XOR(b[(j) + 3], ANDN(b[(j) + 4], b[(j) + 0])),\
+    s[(j) + 4] = XOR(b[(j) + 4], ANDN(b[(j) + 0], b[(j) + 1])))
+
+// one unrolled keccak-f[1600] round on the 25 lanes s, written in terms of the lane operations XOR, ANDN (~a & b) and
+// ROL, so that the same round permutes one state held in uint64_t lanes, or several states side by side in vector lanes
+#define keccak_round(s, b, c, d, XOR, ANDN, ROL, rc) (\
+    /* theta */\
+    c[0] = XOR(XOR(XOR(s[0], s[5]), XOR(s[10], s[15])), s[20]), c[1] = XOR(XOR(XOR(s[1], s[6]), XOR(s[11], s[16])), s[21]),\
+    c[2] = XOR(XOR(XOR(s[2], s[7]), XOR(s[12], s[17])), s[22]), c[3] = XOR(XOR(XOR(s[3], s[8]), XOR(s[13], s[18])), s[23]),\
+    c[4] = XOR(XOR(XOR(s[4], s[9]), XOR(s[14], s[19])), s[24]),\
+    d[0] = XOR(c[4], ROL(c[1], 1)), d[1] = XOR(c[0], ROL(c[2], 1)), d[2] = XOR(c[1], ROL(c[3], 1)),\
+    d[3] = XOR(c[2], ROL(c[4], 1)), d[4] = XOR(c[3], ROL(c[0], 1)),\
+    /* rho and pi, lane x + 5y moves to y + 5((2x + 3y) mod 5) */\
+    b[0] = XOR(s[0], d[0]), b[10] = ROL(XOR(s[1], d[1]), 1), b[20] = ROL(XOR(s[2], d[2]), 62),\
+    b[5] = ROL(XOR(s[3], d[3]), 28), b[15] = ROL(XOR(s[4], d[4]), 27), b[16] = ROL(XOR(s[5], d[0]), 36),\
+    b[1] = ROL(XOR(s[6], d[1]), 44), b[11] = ROL(XOR(s[7], d[2]), 6), b[21] = ROL(XOR(s[8], d[3]), 55),\
+    b[6] = ROL(XOR(s[9], d[4]), 20), b[7] = ROL(XOR(s[10], d[0]), 3), b[17] = ROL(XOR(s[11], d[1]), 10),\
+    b[2] = ROL(XOR(s[12], d[2]), 43), b[12] = ROL(XOR(s[13], d[3]), 25), b[22] = ROL(XOR(s[14], d[4]), 39),\
+    b[23] = ROL(XOR(s[15], d[0]), 41), b[8] = ROL(XOR(s[16], d[1]), 45), b[18] = ROL(XOR(s[17], d[2]), 15),\
+    b[3] = ROL(XOR(s[18], d[3]), 21), b[13] = ROL(XOR(s[19], d[4]), 8), b[14] = ROL(XOR(s[20], d[0]), 18),\
+    b[24] = ROL(XOR(s[21], d[1]), 2), b[9] = ROL(XOR(s[22], d[2]), 61), b[19] = ROL(XOR(s[23], d[3]), 56),\
+    b[4] = ROL(XOR(s[24], d[4]), 14),\
+    /* chi */\
+    keccak_chi(s, b, 0, XOR, ANDN), keccak_chi(s, b, 5, XOR, ANDN), keccak_chi(s, b, 10, XOR, ANDN),\
+    keccak_chi(s, b, 15, XOR, ANDN), keccak_chi(s, b, 20, XOR, ANDN),\
+    /* iota */\
+    s[0] = XOR(s[0], (rc)))
+
+// keccak-f[1600] permutation of the 25 lane state s
+void BRKeccakF1600(uint64_t s[25])
+{
+    uint64_t b[25], c[5], d[5];
+    int i;
+
+    assert(s != NULL);
+    for (i = 0; i < 24; i++) keccak_round(s, b, c, d, xor64, andn64, rol64, _BRKeccakRC[i]);
+}
 
 static void _BRSHA3Compress(uint64_t *r, const uint64_t *x, size_t blockSize)
 {
-    static const uint64_t k[] = { // keccak round constants
-        0x0000000000000001, 0x0000000000008082, 0x800000000000808a, 0x8000000080008000, 0x000000000000808b,
-        0x0000000080000001, 0x8000000080008081, 0x8000000000008009, 0x000000000000008a, 0x0000000000000088,
-        0x0000000080008009, 0x000000008000000a, 0x000000008000808b, 0x800000000000008b, 0x8000000000008089,
-        0x8000000000008003, 0x8000000000008002, 0x8000000000000080, 0x000000000000800a, 0x800000008000000a,
-        0x8000000080008081, 0x8000000000008080, 0x0000000080000001, 0x8000000080008008
-    };
-    
-    size_t i, j;
-    uint64_t a[5], b[5], r0, r1;
-    
-    for (i = 0; i < blockSize/sizeof(uint64_t); i++) r[i] ^= le64(x[i]);
-    
-    for (i = 0; i < 24; i++) { // permute r
-        // theta(r)
-        for (j = 0; j < 5; j++) a[j] = r[j] ^ r[j + 5] ^ r[j + 10] ^ r[j + 15] ^ r[j + 20];
-        b[0] = rol64(a[1], 1) ^ a[4], b[1] = rol64(a[2], 1) ^ a[0], b[2] = rol64(a[3], 1) ^ a[1];
-        b[3] = rol64(a[4], 1) ^ a[2], b[4] = rol64(a[0], 1) ^ a[3];
-        for (j = 0; j < 5; j++) r[j] ^= b[j], r[j + 5] ^= b[j], r[j + 10] ^= b[j], r[j + 15] ^= b[j], r[j + 20] ^= b[j];
-        
-        // rho(r)
-        r[1] = rol64(r[1], 1), r[2] = rol64(r[2], 62), r[3] = rol64(r[3], 28), r[4] = rol64(r[4], 27);
-        r[5] = rol64(r[5], 36), r[6] = rol64(r[6], 44), r[7] = rol64(r[7], 6), r[8] = rol64(r[8], 55);
-        r[9] = rol64(r[9], 20), r[10] = rol64(r[10], 3), r[11] = rol64(r[11], 10), r[12] = rol64(r[12], 43);
-        r[13] = rol64(r[13], 25), r[14] = rol64(r[14], 39), r[15] = rol64(r[15], 41), r[16] = rol64(r[16], 45);
-        r[17] = rol64(r[17], 15), r[18] = rol64(r[18], 21), r[19] = rol64(r[19], 8), r[20] = rol64(r[20], 18);
-        r[21] = rol64(r[21], 2), r[22] = rol64(r[22], 61), r[23] = rol64(r[23], 56), r[24] = rol64(r[24], 14);
-        
-        // pi(r)
-        r1 = r[1], r[1] = r[6], r[6] = r[9], r[9] = r[22], r[22] = r[14], r[14] = r[20], r[20] = r[2], r[2] = r[12],
-        r[12] = r[13], r[13] = r[19], r[19] = r[23], r[23] = r[15], r[15] = r[4], r[4] = r[24], r[24] = r[21];
-        r[21] = r[8], r[8] = r[16], r[16] = r[5], r[5] = r[3], r[3] = r[18], r[18] = r[17], r[17] = r[11], r[11] = r[7];
-        r[7] = r[10], r[10] = r1; // r[0] left as is
-        
-        for (j = 0; j < 25; j += 5) { // chi(r)
-            r0 = r[0 + j], r1 = r[1 + j], r[0 + j] ^= ~r1 & r[2 + j], r[1 + j] ^= ~r[2 + j] & r[3 + j];
-            r[2 + j] ^= ~r[3 + j] & r[4 + j], r[3 + j] ^= ~r[4 + j] & r0, r[4 + j] ^= ~r0 & r1;
-        }
-        
-        *r ^= k[i]; // iota(r, i)
-    }
-    
-    mem_clean(a, sizeof(a));
-    mem_clean(b, sizeof(b));
-    var_clean(&r0, &r1);
+    for (size_t i = 0; i < blockSize/sizeof(uint64_t); i++) r[i] ^= le64(x[i]);
+    BRKeccakF1600(r);
 }
 
 // sha3-256: http://nvlpubs.nist.gov/nistpubs/FIPS/NIST.FIPS.202.pdf
@@ -498,6 +726,154 @@ void BRKeccak256(void *md32, const void *data, size_t dataLen)
     mem_clean(buf, sizeof(buf));
 }
 
+#if BR_SHA256_X86
+#define xor64x2(a, b) _mm_xor_si128((a), (b))
+#define andn64x2(a, b) _mm_andnot_si128((a), (b))
+#define rol64x2(a, b) _mm_or_si128(_mm_slli_epi64((a), (b)), _mm_srli_epi64((a), 64 - (b)))
+#define xor64x4(a, b) _mm256_xor_si256((a), (b))
+#define andn64x4(a, b) _mm256_andnot_si256((a), (b))
+#define rol64x4(a, b) _mm256_or_si256(_mm256_slli_epi64((a), (b)), _mm256_srli_epi64((a), 64 - (b)))
+
+// writes the n-th 136 byte block of the padded keccak-256 message data to x
+static void _BRKeccak256Block(uint64_t x[17], const uint8_t *data, size_t dataLen, size_t n)
+{
+    size_t i = n*136, len = (i + 136 <= dataLen) ? 136 : dataLen - i;
+
+    memcpy(x, &data[i], len);
+
+    if (len < 136) { // final block
+        memset((uint8_t *)x + len, 0, 136 - len);
+        ((uint8_t *)x)[len] |= 0x01; // append padding
+        ((uint8_t *)x)[135] |= 0x80;
+    }
+}
+
+// keccak-256 of 2 messages of dataLen bytes each, stored one after another at data, written one after another to md32s
+static void _BRKeccak256SSE2x2(uint8_t *md32s, const uint8_t *data, size_t dataLen)
+{
+    uint64_t x[2][17], md[2][4];
+    __m128i s[25], b[25], c[5], d[5];
+    size_t i, j;
+
+    for (i = 0; i < 25; i++) s[i] = _mm_setzero_si128();
+
+    for (i = 0; i <= dataLen/136; i++) { // the last block holds the padding
+        _BRKeccak256Block(x[0], data, dataLen, i);
+        _BRKeccak256Block(x[1], &data[dataLen], dataLen, i);
+        for (j = 0; j < 17; j++) s[j] = _mm_xor_si128(s[j], _mm_set_epi64x((long long)x[1][j], (long long)x[0][j]));
+
+        for (j = 0; j < 24; j++) {
+            keccak_round(s, b, c, d, xor64x2, andn64x2, rol64x2, _mm_set1_epi64x((long long)_BRKeccakRC[j]));
+        }
+    }
+
+    for (i = 0; i < 4; i++) {
+        md[0][i] = (uint64_t)_mm_cvtsi128_si64(s[i]), md[1][i] = (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(s[i], s[i]));
+    }
+
+    memcpy(md32s, md, sizeof(md));
+    mem_clean(x, sizeof(x));
+    mem_clean(md, sizeof(md));
+}
+
+// keccak-256 of 4 messages of dataLen bytes each, stored one after another at data, written one after another to md32s
+__attribute__((target("avx2")))
+static void _BRKeccak256AVX2x4(uint8_t *md32s, const uint8_t *data, size_t dataLen)
+{
+    uint64_t x[4][17], md[4][4], t[4];
+    __m256i s[25], b[25], c[5], d[5];
+    size_t i, j;
+
+    for (i = 0; i < 25; i++) s[i] = _mm256_setzero_si256();
+
+    for (i = 0; i <= dataLen/136; i++) { // the last block holds the padding
+        for (j = 0; j < 4; j++) _BRKeccak256Block(x[j], &data[j*dataLen], dataLen, i);
+
+        for (j = 0; j < 17; j++) {
+            s[j] = _mm256_xor_si256(s[j], _mm256_set_epi64x((long long)x[3][j], (long long)x[2][j], (long long)x[1][j],
+                                                            (long long)x[0][j]));
+        }
+
+        for (j = 0; j < 24; j++) {
+            keccak_round(s, b, c, d, xor64x4, andn64x4, rol64x4, _mm256_set1_epi64x((long long)_BRKeccakRC[j]));
+        }
+    }
+
+    for (i = 0; i < 4; i++) {
+        _mm256_storeu_si256((__m256i *)t, s[i]);
+        for (j = 0; j < 4; j++) md[j][i] = t[j];
+    }
+
+    memcpy(md32s, md, sizeof(md));
+    mem_clean(x, sizeof(x));
+    mem_clean(md, sizeof(md));
+    mem_clean(t, sizeof(t));
+}
+
+static int _BRKeccakBackendIsSupported(BRKeccakBackend backend)
+{
+    switch (backend) {
+        case BR_KECCAK_BACKEND_PORTABLE: return 1;
+        case BR_KECCAK_BACKEND_SSE2: return 1; // part of x86-64
+        case BR_KECCAK_BACKEND_AVX2: return _BRSHA256BackendIsSupported(BR_SHA256_BACKEND_AVX2);
+    }
+
+    return 0;
+}
+#else
+static int _BRKeccakBackendIsSupported(BRKeccakBackend backend)
+{
+    return (backend == BR_KECCAK_BACKEND_PORTABLE);
+}
+#endif // BR_SHA256_X86
+
+static BRKeccakBackend _BRKeccakBackend = BR_KECCAK_BACKEND_PORTABLE;
+static int _BRKeccakBackendIsSet = 0;
+
+int BRKeccakSetBackend(BRKeccakBackend backend)
+{
+    if (! _BRKeccakBackendIsSupported(backend)) return 0;
+    _BRKeccakBackend = backend;
+    _BRKeccakBackendIsSet = 1;
+    return 1;
+}
+
+BRKeccakBackend BRKeccakGetBackend(void)
+{
+    if (! _BRKeccakBackendIsSet && ! BRKeccakSetBackend(BR_KECCAK_BACKEND_AVX2) &&
+        ! BRKeccakSetBackend(BR_KECCAK_BACKEND_SSE2)) BRKeccakSetBackend(BR_KECCAK_BACKEND_PORTABLE);
+    return _BRKeccakBackend;
+}
+
+// keccak-256 of count messages, each dataLen bytes and stored one after another at data, written 32 bytes apart to
+// md32s, e.g. addresses or log topics
+void BRKeccak256Batch(void *md32s, const void *data, size_t dataLen, size_t count)
+{
+    BRKeccakBackend backend = BRKeccakGetBackend();
+    size_t i = 0;
+
+    assert(md32s != NULL || count == 0);
+    assert(data != NULL || dataLen == 0 || count == 0);
+
+#if BR_SHA256_X86
+    if (backend == BR_KECCAK_BACKEND_AVX2) {
+        for (; i + 4 <= count; i += 4) {
+            _BRKeccak256AVX2x4((uint8_t *)md32s + i*32, (const uint8_t *)data + i*dataLen, dataLen);
+        }
+    }
+
+    if (backend != BR_KECCAK_BACKEND_PORTABLE) {
+        for (; i + 2 <= count; i += 2) {
+            _BRKeccak256SSE2x2((uint8_t *)md32s + i*32, (const uint8_t *)data + i*dataLen, dataLen);
+        }
+    }
+#else
+    (void)backend;
+#endif
+
+    for (; i < count; i++) BRKeccak256((uint8_t *)md32s + i*32, (const uint8_t *)data + i*dataLen, dataLen);
+}
+
 // basic md5 functions
 #define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
 #define G(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
@@ -660,6 +1036,66 @@ void BRHMAC(void *mac, void (*hash)(void *, const void *, size_t), size_t hashLe
     mem_clean(kopad, blockLen);
 }
 
+// sets the context to the sha512 states after the key's inner and outer pad blocks
+void BRHMACSHA512Init(BRHMACSHA512Context *ctx, const void *key, size_t keyLen)
+{
+    static const uint64_t iv[] = { 0x6a09e667f3bcc908, 0xbb67ae8584caa73b, 0x3c6ef372fe94f82b, 0xa54ff53a5f1d36f1,
+                                   0x510e527fade682d1, 0x9b05688c2b3e6c1f, 0x1f83d9abfb41bd6b, 0x5be0cd19137e2179 };
+    uint64_t k[16], pad[16];
+    size_t i;
+
+    assert(ctx != NULL);
+    assert(key != NULL || keyLen == 0);
+
+    memset(k, 0, sizeof(k));
+    if (keyLen > sizeof(k)) BRSHA512(k, key, keyLen);
+    else if (keyLen > 0) memcpy(k, key, keyLen);
+    memcpy(ctx->inner, iv, sizeof(iv));
+    for (i = 0; i < 16; i++) pad[i] = k[i] ^ 0x3636363636363636;
+    _BRSHA512Compress(ctx->inner, pad);
+    memcpy(ctx->outer, iv, sizeof(iv));
+    for (i = 0; i < 16; i++) pad[i] = k[i] ^ 0x5c5c5c5c5c5c5c5c;
+    _BRSHA512Compress(ctx->outer, pad);
+    mem_clean(k, sizeof(k));
+    mem_clean(pad, sizeof(pad));
+}
+
+// HMAC-SHA512(key, data), continuing from the precomputed pad block states of the key
+void BRHMACSHA512(void *mac64, const BRHMACSHA512Context *ctx, const void *data, size_t dataLen)
+{
+    size_t i;
+    uint64_t x[16], buf[8];
+
+    assert(mac64 != NULL);
+    assert(ctx != NULL);
+    assert(data != NULL || dataLen == 0);
+
+    memcpy(buf, ctx->inner, sizeof(buf));
+
+    for (i = 0; i < dataLen; i += 128) { // process data in 128 byte blocks
+        memcpy(x, (const uint8_t *)data + i, (i + 128 < dataLen) ? 128 : dataLen - i);
+        if (i + 128 > dataLen) break;
+        _BRSHA512Compress(buf, x);
+    }
+
+    memset((uint8_t *)x + (dataLen - i), 0, 128 - (dataLen - i)); // clear remainder of x
+    ((uint8_t *)x)[dataLen - i] = 0x80; // append padding
+    if (dataLen - i >= 112) _BRSHA512Compress(buf, x), memset(x, 0, 128); // length goes to next block
+    x[14] = 0, x[15] = be64((uint64_t)(128 + dataLen)*8); // append length in bits, after the inner pad block
+    _BRSHA512Compress(buf, x); // finalize inner hash
+
+    for (i = 0; i < 8; i++) x[i] = be64(buf[i]); // the inner hash is the whole outer message after the pad block
+    memset(&x[8], 0, 64);
+    ((uint8_t *)x)[64] = 0x80;
+    x[15] = be64((uint64_t)(128 + 64)*8);
+    memcpy(buf, ctx->outer, sizeof(buf));
+    _BRSHA512Compress(buf, x);
+    for (i = 0; i < 8; i++) buf[i] = be64(buf[i]); // endian swap
+    memcpy(mac64, buf, 64);
+    mem_clean(x, sizeof(x));
+    mem_clean(buf, sizeof(buf));
+}
+
 // hmac-drbg with no prediction resistance or additional input
 // K and V must point to buffers of size hashLen, and ps (personalization string) may be NULL
 // to generate additional drbg output, use K and V from the previous call, and set seed, nonce and ps to NULL
@@ -906,197 +1342,441 @@ size_t BRChacha20Poly1305AEADDecrypt(void *out, size_t outLen, const void *key32
     return outLen;
 }
 
-static const uint8_t sbox[256] = {
-    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
-    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
-    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
-    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
-    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
-    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
-    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
-    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
-    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
-    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
-    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
-    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
-    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
-    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
-    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
-    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
-};
+#define xt(x) (((x) << 1) ^ ((((x) >> 7) & 1)*0x1b))
 
-static const uint8_t sboxi[256] = {
-    0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb,
-    0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87, 0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb,
-    0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e,
-    0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2, 0x76, 0x5b, 0xa2, 0x49, 0x6d, 0x8b, 0xd1, 0x25,
-    0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92,
-    0x6c, 0x70, 0x48, 0x50, 0xfd, 0xed, 0xb9, 0xda, 0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84,
-    0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a, 0xf7, 0xe4, 0x58, 0x05, 0xb8, 0xb3, 0x45, 0x06,
-    0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02, 0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b,
-    0x3a, 0x91, 0x11, 0x41, 0x4f, 0x67, 0xdc, 0xea, 0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73,
-    0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85, 0xe2, 0xf9, 0x37, 0xe8, 0x1c, 0x75, 0xdf, 0x6e,
-    0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89, 0x6f, 0xb7, 0x62, 0x0e, 0xaa, 0x18, 0xbe, 0x1b,
-    0xfc, 0x56, 0x3e, 0x4b, 0xc6, 0xd2, 0x79, 0x20, 0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4,
-    0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31, 0xb1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xec, 0x5f,
-    0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d, 0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef,
-    0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61,
-    0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d
-};
+// 8x8 bit matrix transpose, bit j of byte i moves to bit i of byte j
+static uint64_t _BRAESTranspose8(uint64_t x)
+{
+    uint64_t t;
 
-#define xt(x) (((x) << 1) ^ ((((x) >> 7) & 1)*0x1b))
+    t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaULL, x ^= t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL, x ^= t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL, x ^= t ^ (t << 28);
+    return x;
+}
+
+// sets bit j of q[i] to bit i of x[j], for the 64 bytes of x
+static void _BRAESBitsliceIn(uint64_t q[8], const uint8_t x[64])
+{
+    uint64_t t[8];
+    size_t i, j;
+
+    for (i = 0; i < 8; i++) {
+        for (j = 0, t[i] = 0; j < 8; j++) t[i] |= (uint64_t)x[i*8 + j] << (j*8);
+        t[i] = _BRAESTranspose8(t[i]); // byte j of t[i] holds bit j of x[i*8] through x[i*8 + 7]
+    }
+
+    for (i = 0; i < 8; i++) {
+        for (j = 0, q[i] = 0; j < 8; j++) q[i] |= ((t[j] >> (i*8)) & 0xff) << (j*8);
+    }
+
+    mem_clean(t, sizeof(t));
+}
+
+static void _BRAESBitsliceOut(uint8_t x[64], const uint64_t q[8])
+{
+    uint64_t t[8];
+    size_t i, j;
+
+    for (i = 0; i < 8; i++) {
+        for (j = 0, t[i] = 0; j < 8; j++) t[i] |= ((q[j] >> (i*8)) & 0xff) << (j*8);
+        t[i] = _BRAESTranspose8(t[i]);
+        for (j = 0; j < 8; j++) x[i*8 + j] = (uint8_t)(t[i] >> (j*8));
+    }
+
+    mem_clean(t, sizeof(t));
+}
+
+// aes s-box of 64 bytes at once, in bitsliced form, using the boyar-peralta circuit: https://eprint.iacr.org/2011/332
+// the bytes are never used as table indexes, so this runs in constant time
+// it runs on every round, so callers clean the state when done rather than cleaning the temporaries on each call
+static void _BRAESSboxBitsliced(uint64_t q[8])
+{
+    uint64_t x0 = q[7], x1 = q[6], x2 = q[5], x3 = q[4], x4 = q[3], x5 = q[2], x6 = q[1], x7 = q[0],
+             y1, y2, y3, y4, y5, y6, y7, y8, y9, y10, y11, y12, y13, y14, y15, y16, y17, y18, y19, y20, y21,
+             z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14, z15, z16, z17, t[68];
+
+    // top linear transformation
+    y14 = x3 ^ x5, y13 = x0 ^ x6, y9 = x0 ^ x3, y8 = x0 ^ x5, t[0] = x1 ^ x2, y1 = t[0] ^ x7, y4 = y1 ^ x3;
+    y12 = y13 ^ y14, y2 = y1 ^ x0, y5 = y1 ^ x6, y3 = y5 ^ y8, t[1] = x4 ^ y12, y15 = t[1] ^ x5, y20 = t[1] ^ x1;
+    y6 = y15 ^ x7, y10 = y15 ^ t[0], y11 = y20 ^ y9, y7 = x7 ^ y11, y17 = y10 ^ y11, y19 = y10 ^ y8;
+    y16 = t[0] ^ y11, y21 = y13 ^ y16, y18 = x0 ^ y16;
+
+    // non-linear section
+    t[2] = y12 & y15, t[3] = y3 & y6, t[4] = t[3] ^ t[2], t[5] = y4 & x7, t[6] = t[5] ^ t[2], t[7] = y13 & y16;
+    t[8] = y5 & y1, t[9] = t[8] ^ t[7], t[10] = y2 & y7, t[11] = t[10] ^ t[7], t[12] = y9 & y11;
+    t[13] = y14 & y17, t[14] = t[13] ^ t[12], t[15] = y8 & y10, t[16] = t[15] ^ t[12], t[17] = t[4] ^ t[14];
+    t[18] = t[6] ^ t[16], t[19] = t[9] ^ t[14], t[20] = t[11] ^ t[16], t[21] = t[17] ^ y20, t[22] = t[18] ^ y19;
+    t[23] = t[19] ^ y21, t[24] = t[20] ^ y18;
+
+    t[25] = t[21] ^ t[22], t[26] = t[21] & t[23], t[27] = t[24] ^ t[26], t[28] = t[25] & t[27];
+    t[29] = t[28] ^ t[22], t[30] = t[23] ^ t[24], t[31] = t[22] ^ t[26], t[32] = t[31] & t[30];
+    t[33] = t[32] ^ t[24], t[34] = t[23] ^ t[33], t[35] = t[27] ^ t[33], t[36] = t[24] & t[35];
+    t[37] = t[36] ^ t[34], t[38] = t[27] ^ t[36], t[39] = t[29] & t[38], t[40] = t[25] ^ t[39];
+
+    t[41] = t[40] ^ t[37], t[42] = t[29] ^ t[33], t[43] = t[29] ^ t[40], t[44] = t[33] ^ t[37];
+    t[45] = t[42] ^ t[41], z0 = t[44] & y15, z1 = t[37] & y6, z2 = t[33] & x7, z3 = t[43] & y16, z4 = t[40] & y1;
+    z5 = t[29] & y7, z6 = t[42] & y11, z7 = t[45] & y17, z8 = t[41] & y10, z9 = t[44] & y12, z10 = t[37] & y3;
+    z11 = t[33] & y4, z12 = t[43] & y13, z13 = t[40] & y5, z14 = t[29] & y2, z15 = t[42] & y9, z16 = t[45] & y14;
+    z17 = t[41] & y8;
+
+    // bottom linear transformation
+    t[46] = z15 ^ z16, t[47] = z10 ^ z11, t[48] = z5 ^ z13, t[49] = z9 ^ z10, t[50] = z2 ^ z12, t[51] = z2 ^ z5;
+    t[52] = z7 ^ z8, t[53] = z0 ^ z3, t[54] = z6 ^ z7, t[55] = z16 ^ z17, t[56] = z12 ^ t[48];
+    t[57] = t[50] ^ t[53], t[58] = z4 ^ t[46], t[59] = z3 ^ t[54], t[60] = t[46] ^ t[57], t[61] = z14 ^ t[57];
+    t[62] = t[52] ^ t[58], t[63] = t[49] ^ t[58], t[64] = z4 ^ t[59], t[65] = t[61] ^ t[62], t[66] = z1 ^ t[63];
+    q[7] = t[59] ^ t[63], q[1] = t[56] ^ ~t[62], q[0] = t[48] ^ ~t[60], t[67] = t[64] ^ t[65];
+    q[4] = t[53] ^ t[66], q[3] = t[51] ^ t[66], q[2] = t[47] ^ t[65], q[6] = t[64] ^ ~q[4], q[5] = t[55] ^ ~t[67];
+}
+
+static void _BRAESSubBytes(uint8_t x[64])
+{
+    uint64_t q[8];
+
+    _BRAESBitsliceIn(q, x);
+    _BRAESSboxBitsliced(q);
+    _BRAESBitsliceOut(x, q);
+    mem_clean(q, sizeof(q));
+}
+
+// inverse of the affine map in the s-box, so that sbox^-1(x) = invaffine(sbox(invaffine(x)))
+#define invaffine(x) ((uint8_t)(((x) << 1 | (x) >> 7) ^ ((x) << 3 | (x) >> 5) ^ ((x) << 6 | (x) >> 2) ^ 0x05))
+
+static void _BRAESInvSubBytes(uint8_t x[64])
+{
+    size_t j;
+
+    for (j = 0; j < 64; j++) x[j] = invaffine(x[j]);
+    _BRAESSubBytes(x);
+    for (j = 0; j < 64; j++) x[j] = invaffine(x[j]);
+}
 
-static void _BRAESExpandKey(uint8_t k[256], const void *key, size_t kl)
+static void _BRAESExpandKey(uint8_t k[240], const void *key, size_t kl)
 {
-    uint8_t r = 1;
+    uint8_t r = 1, w[64];
     size_t i, j, rounds = kl/4 + 6;
-    
+
+    memset(w, 0, sizeof(w));
     memcpy(k, key, kl);
-    
-    for (i = kl; i <= 16*rounds; i += kl) {
-        k[i] = k[i - kl] ^ sbox[k[i - 3]] ^ r, k[i + 1] = k[i + 1 - kl] ^ sbox[k[i - 2]];
-        k[i + 2] = k[i + 2 - kl] ^ sbox[k[i - 1]], k[i + 3] = k[i + 3 - kl] ^ sbox[k[i - 4]], r = xt(r);
-        for (j = i + 4; j < i + kl; j++) k[j] = k[j - kl] ^ ((kl == 32 && (j % 16) < 4) ? sbox[k[j - 4]] : k[j - 4]);
+
+    for (i = kl; i < 16*(rounds + 1); i += 4) {
+        if ((i % kl) == 0) { // rotate and sub word, add round constant
+            w[0] = k[i - 3], w[1] = k[i - 2], w[2] = k[i - 1], w[3] = k[i - 4];
+            _BRAESSubBytes(w);
+            w[0] ^= r, r = xt(r);
+        }
+        else if (kl == 32 && (i % kl) == 16) { // sub word
+            memcpy(w, &k[i - 4], 4);
+            _BRAESSubBytes(w);
+        }
+        else memcpy(w, &k[i - 4], 4);
+
+        for (j = 0; j < 4; j++) k[i + j] = k[i + j - kl] ^ w[j];
     }
+
+    var_clean(&r);
+    mem_clean(w, sizeof(w));
 }
 
-static void _BRAESCipher(uint8_t x[16], const uint8_t k[256], size_t kl)
+// bitsliced round keys, each replicated across the four blocks
+static void _BRAESBitsliceKey(uint64_t sk[120], const uint8_t *k, size_t rounds)
 {
-    uint8_t a, b, c, d, e;
-    size_t i, j, rounds = kl/4 + 6;
-    
-    for (j = 0; j < 16; j++) x[j] ^= k[j]; // first add round key
-    
-    for (i = 0; i < rounds; i++) {
-        for (j = 0; j < 16; j++) x[j] = sbox[x[j]]; // sub bytes
-        
-        // shift rows
-        a = x[1], x[1] = x[5], x[5] = x[9], x[9] = x[13], x[13] = a, a = x[10], x[10] = x[2], x[2] = a;
-        a = x[3], x[3] = x[15], x[15] = x[11], x[11] = x[7], x[7] = a, a = x[14], x[14] = x[6], x[6] = a;
-        
-        for (j = 0; i < rounds - 1 && j < 16; j += 4) { // mix columns
-            a = x[j], b = x[j + 1], c = x[j + 2], d = x[j + 3], e = a ^ b ^ c ^ d;
-            x[j] ^= e ^ xt(a ^ b), x[j + 1] ^= e ^ xt(b ^ c), x[j + 2] ^= e ^ xt(c ^ d), x[j + 3] ^= e ^ xt(d ^ a);
+    uint8_t w[64];
+    size_t i, j;
+
+    for (i = 0; i <= rounds; i++) {
+        for (j = 0; j < 64; j += 16) memcpy(&w[j], &k[i*16], 16);
+        _BRAESBitsliceIn(&sk[i*8], w);
+    }
+
+    mem_clean(w, sizeof(w));
+}
+
+// shift rows on one bit plane, where byte j of each block is bit j of its 16 bit lane, and row j % 4 rotates left
+// by j % 4 columns
+static uint64_t _BRAESShiftRows(uint64_t q)
+{
+    return (q & 0x1111111111111111ULL) |
+           ((q >> 4) & 0x0222022202220222ULL) | ((q << 12) & 0x2000200020002000ULL) |
+           ((q >> 8) & 0x0044004400440044ULL) | ((q << 8) & 0x4400440044004400ULL) |
+           ((q >> 12) & 0x0008000800080008ULL) | ((q << 4) & 0x8880888088808880ULL);
+}
+
+// moves each byte of a column in a bit plane up one or two rows, wrapping around
+#define rotr1(q) ((((q) >> 1) & 0x7777777777777777ULL) | (((q) << 3) & 0x8888888888888888ULL))
+#define rotr2(q) ((((q) >> 2) & 0x3333333333333333ULL) | (((q) << 2) & 0xccccccccccccccccULL))
+
+// encrypts the four blocks in x, keeping them in bitsliced form for all rounds
+static void _BRAESCipherBitsliced(uint8_t x[64], const uint64_t *sk, size_t rounds)
+{
+    uint64_t q[8], s[8], t;
+    size_t i, j;
+
+    _BRAESBitsliceIn(q, x);
+    for (j = 0; j < 8; j++) q[j] ^= sk[j]; // first add round key
+
+    for (i = 1; i <= rounds; i++) {
+        _BRAESSboxBitsliced(q); // sub bytes
+        for (j = 0; j < 8; j++) q[j] = _BRAESShiftRows(q[j]); // shift rows
+
+        if (i < rounds) { // mix columns, a_r ^= e ^ xt(a_r ^ a_r+1), which is xt(s_r) ^ a_r+1 ^ s_r+2 for s = a ^ a_r+1
+            for (j = 0; j < 8; j++) s[j] = q[j] ^ rotr1(q[j]), q[j] = rotr1(q[j]) ^ rotr2(s[j]);
+            t = s[7], q[7] ^= s[6], q[6] ^= s[5], q[5] ^= s[4], q[4] ^= s[3] ^ t, q[3] ^= s[2] ^ t;
+            q[2] ^= s[1], q[1] ^= s[0] ^ t, q[0] ^= t;
         }
-        
-        for (j = 0; j < 16; j++) x[j] ^= k[(i + 1)*16 + j]; // add round key
+
+        for (j = 0; j < 8; j++) q[j] ^= sk[i*8 + j]; // add round key
     }
-    
-    var_clean(&a, &b, &c, &d, &e);
+
+    _BRAESBitsliceOut(x, q);
+    mem_clean(q, sizeof(q));
+    mem_clean(s, sizeof(s));
+    var_clean(&t);
 }
 
-static void _BRAESDecipher(uint8_t x[16], const uint8_t k[256], size_t kl)
+// decrypts the four blocks in x
+static void _BRAESDecipherBitsliced(uint8_t x[64], const uint8_t *k, size_t rounds)
 {
-    uint8_t a, b, c, d, e, f, g;
-    size_t i, j, rounds = kl/4 + 6;
-    
-    for (j = 0; j < 16; j++) x[j] ^= k[rounds*16 + j]; // first add round key
-    
+    uint8_t a, b, c, d, e, f, g, *y;
+    size_t i, j;
+
+    for (j = 0; j < 64; j++) x[j] ^= k[rounds*16 + j % 16]; // first add round key
+
     for (i = rounds; i > 0; i--) {
-        // unshift rows
-        a = x[1], x[1] = x[13], x[13] = x[9], x[9] = x[5], x[5] = a, a = x[2], x[2] = x[10], x[10] = a;
-        a = x[3], x[3] = x[7], x[7] = x[11], x[11] = x[15], x[15] = a, a = x[6], x[6] = x[14], x[14] = a;
-        
-        for (j = 0; j < 16; j++) x[j] = sboxi[x[j]]; // unsub bytes
-        
-        for (j = 0; j < 16; j++) x[j] ^= k[(i - 1)*16 + j]; // add round key
-        
-        for (j = 0; i > 1 && j < 16; j += 4) { // unmix columns
-            a = x[j], b = x[j + 1], c = x[j + 2], d = x[j + 3], e = a ^ b ^ c ^ d;
-            f = e ^ xt(xt(xt(e) ^ a ^ c)), g = e ^ xt(xt(xt(e) ^ b ^ d));
-            x[j] ^= f ^ xt(a ^ b), x[j + 1] ^= g ^ xt(b ^ c), x[j + 2] ^= f ^ xt(c ^ d), x[j + 3] ^= g ^ xt(d ^ a);
+        for (y = x; y < x + 64; y += 16) { // unshift rows
+            a = y[1], y[1] = y[13], y[13] = y[9], y[9] = y[5], y[5] = a, a = y[2], y[2] = y[10], y[10] = a;
+            a = y[3], y[3] = y[7], y[7] = y[11], y[11] = y[15], y[15] = a, a = y[6], y[6] = y[14], y[14] = a;
+        }
+
+        _BRAESInvSubBytes(x); // unsub bytes
+
+        for (y = x; y < x + 64; y += 16) {
+            for (j = 0; j < 16; j++) y[j] ^= k[(i - 1)*16 + j]; // add round key
+
+            for (j = 0; i > 1 && j < 16; j += 4) { // unmix columns
+                a = y[j], b = y[j + 1], c = y[j + 2], d = y[j + 3], e = a ^ b ^ c ^ d;
+                f = e ^ xt(xt(xt(e) ^ a ^ c)), g = e ^ xt(xt(xt(e) ^ b ^ d));
+                y[j] ^= f ^ xt(a ^ b), y[j + 1] ^= g ^ xt(b ^ c), y[j + 2] ^= f ^ xt(c ^ d), y[j + 3] ^= g ^ xt(d ^ a);
+            }
         }
     }
-    
+
     var_clean(&a, &b, &c, &d, &e, &f, &g);
 }
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BR_AES_X86 1
+#include <immintrin.h>
+#include <cpuid.h>
+
+// encrypts count blocks in x, interleaving the rounds of all of them to keep the aes unit busy
+__attribute__((target("aes,sse2")))
+static void _BRAESCipherNI(uint8_t *x, const uint8_t *k, size_t rounds, size_t count)
+{
+    __m128i b[AES_PARALLEL_BLOCKS], rk = _mm_loadu_si128((const __m128i *)k);
+    size_t i, j;
+
+    for (j = 0; j < count; j++) b[j] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&x[j*16]), rk);
+
+    for (i = 1; i < rounds; i++) {
+        rk = _mm_loadu_si128((const __m128i *)&k[i*16]);
+        for (j = 0; j < count; j++) b[j] = _mm_aesenc_si128(b[j], rk);
+    }
+
+    rk = _mm_loadu_si128((const __m128i *)&k[rounds*16]);
+    for (j = 0; j < count; j++) _mm_storeu_si128((__m128i *)&x[j*16], _mm_aesenclast_si128(b[j], rk));
+}
+
+__attribute__((target("aes,sse2")))
+static void _BRAESDecipherNI(uint8_t x[16], const uint8_t *k, size_t rounds)
+{
+    __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i *)x), _mm_loadu_si128((const __m128i *)&k[rounds*16]));
+
+    for (size_t i = rounds - 1; i > 0; i--) { // equivalent inverse cipher, with inverse mixed round keys
+        b = _mm_aesdec_si128(b, _mm_aesimc_si128(_mm_loadu_si128((const __m128i *)&k[i*16])));
+    }
+
+    _mm_storeu_si128((__m128i *)x, _mm_aesdeclast_si128(b, _mm_loadu_si128((const __m128i *)k)));
+}
+
+static int _BRAESBackendIsSupported(BRAESBackend backend)
+{
+    unsigned int eax, ebx, ecx = 0, edx;
+
+    if (backend == BR_AES_BACKEND_AES_NI && ! __get_cpuid(1, &eax, &ebx, &ecx, &edx)) ecx = 0;
+    return (backend == BR_AES_BACKEND_BITSLICED || (backend == BR_AES_BACKEND_AES_NI && (ecx & bit_AES)));
+}
+#else
+static int _BRAESBackendIsSupported(BRAESBackend backend)
+{
+    return (backend == BR_AES_BACKEND_BITSLICED);
+}
+#endif // BR_AES_X86
+
+// set on first use to the fastest backend; racing threads all set the same value
+static BRAESBackend _BRAESBackend = BR_AES_BACKEND_BITSLICED;
+static int _BRAESBackendIsSet = 0;
+
+int BRAESSetBackend(BRAESBackend backend)
+{
+    if (! _BRAESBackendIsSupported(backend)) return 0;
+    _BRAESBackend = backend;
+    _BRAESBackendIsSet = 1;
+    return 1;
+}
+
+BRAESBackend BRAESGetBackend(void)
+{
+    if (! _BRAESBackendIsSet && ! BRAESSetBackend(BR_AES_BACKEND_AES_NI)) BRAESSetBackend(BR_AES_BACKEND_BITSLICED);
+    return _BRAESBackend;
+}
+
+// encrypts count blocks in x, at most AES_PARALLEL_BLOCKS; x must hold count rounded up to a multiple of 4 blocks
+static void _BRAESEncryptBlocks(const BRAESContext *ctx, uint8_t *x, size_t count)
+{
+    size_t i, rounds = ctx->keyLen/4 + 6;
+
+#if BR_AES_X86
+    if (BRAESGetBackend() == BR_AES_BACKEND_AES_NI) _BRAESCipherNI(x, ctx->k, rounds, count);
+    else
+#endif
+    for (i = 0; i < count; i += 4) _BRAESCipherBitsliced(&x[i*16], ctx->sk, rounds);
+}
+
+// expands the aes key schedule, for encrypting or decrypting many blocks with the same key
+void BRAESContextInit(BRAESContext *ctx, const void *key, size_t keyLen)
+{
+    assert(ctx != NULL);
+    assert(key != NULL);
+    assert(keyLen == 16 || keyLen == 24 || keyLen == 32);
+
+    _BRAESExpandKey(ctx->k, key, keyLen);
+    _BRAESBitsliceKey(ctx->sk, ctx->k, keyLen/4 + 6);
+    ctx->keyLen = keyLen;
+}
+
+void BRAESContextEncrypt(const BRAESContext *ctx, void *buf16)
+{
+    uint8_t x[64];
+
+    assert(ctx != NULL);
+    assert(buf16 != NULL);
+
+    memcpy(x, buf16, 16);
+    _BRAESEncryptBlocks(ctx, x, 1);
+    memcpy(buf16, x, 16);
+    mem_clean(x, sizeof(x));
+}
+
+void BRAESContextDecrypt(const BRAESContext *ctx, void *buf16)
+{
+    uint8_t x[64];
+
+    assert(ctx != NULL);
+    assert(buf16 != NULL);
+
+    memcpy(x, buf16, 16);
+#if BR_AES_X86
+    if (BRAESGetBackend() == BR_AES_BACKEND_AES_NI) _BRAESDecipherNI(x, ctx->k, ctx->keyLen/4 + 6);
+    else
+#endif
+    _BRAESDecipherBitsliced(x, ctx->k, ctx->keyLen/4 + 6);
+    memcpy(buf16, x, 16);
+    mem_clean(x, sizeof(x));
+}
+
+// aes-ctr, continuing the stream at counter iv16, which is advanced past each block used, including a final partial one
+// the keystream is generated AES_PARALLEL_BLOCKS blocks at a time
+void BRAESContextCTR(const BRAESContext *ctx, void *out, void *iv16, const void *data, size_t dataLen)
+{
+    uint8_t x[AES_PARALLEL_BLOCKS*16], iv[16];
+    size_t off, n, i, j;
+
+    assert(ctx != NULL);
+    assert(out != NULL || dataLen == 0);
+    assert(iv16 != NULL);
+    assert(data != NULL || dataLen == 0);
+
+    memcpy(iv, iv16, 16);
+
+    for (off = 0; off < dataLen; off += n) {
+        n = (dataLen - off < sizeof(x)) ? dataLen - off : sizeof(x);
+
+        for (i = 0; i < n; i += 16) { // counter blocks
+            memcpy(&x[i], iv, 16);
+            j = 16;
+            do { iv[--j]++; } while (iv[j] == 0 && j > 0); // increment iv with overflow
+        }
+
+        _BRAESEncryptBlocks(ctx, x, (n + 15)/16);
+        for (i = 0; i < n; i++) ((uint8_t *)out)[off + i] = ((const uint8_t *)data)[off + i] ^ x[i];
+    }
+
+    memcpy(iv16, iv, 16);
+    mem_clean(x, sizeof(x));
+}
+
 // aes-ecb block cipher
 void BRAESECBEncrypt(void *buf16, const void *key, size_t keyLen)
 {
-    uint8_t k[256];
-    
+    BRAESContext ctx;
+
     assert(buf16 != NULL);
     assert(key != NULL);
     assert(keyLen == 16 || keyLen == 24 || keyLen == 32);
-    
-    _BRAESExpandKey(k, key, keyLen);
-    _BRAESCipher(buf16, k, keyLen);
-    mem_clean(k, sizeof(k));
+
+    BRAESContextInit(&ctx, key, keyLen);
+    BRAESContextEncrypt(&ctx, buf16);
+    mem_clean(&ctx, sizeof(ctx));
 }
 
 void BRAESECBDecrypt(void *buf16, const void *key, size_t keyLen)
 {
-    uint8_t k[256];
-    
+    BRAESContext ctx;
+
     assert(buf16 != NULL);
     assert(key != NULL);
     assert(keyLen == 16 || keyLen == 24 || keyLen == 32);
-    
-    _BRAESExpandKey(k, key, keyLen);
-    _BRAESDecipher(buf16, k, keyLen);
-    mem_clean(k, sizeof(k));
+
+    BRAESContextInit(&ctx, key, keyLen);
+    BRAESContextDecrypt(&ctx, buf16);
+    mem_clean(&ctx, sizeof(ctx));
 }
 
 // aes-ctr stream cipher encrypt/decrypt
 void BRAESCTR(void *out, const void *key, size_t keyLen, const void *iv16, const void *data, size_t dataLen)
 {
-    uint8_t x[16], iv[16], k[256];
-    size_t off, i;
-    
+    BRAESContext ctx;
+    uint8_t iv[16];
+
     assert(out != NULL);
     assert(key != NULL);
     assert(keyLen == 16 || keyLen == 24 || keyLen == 32);
     assert(iv16 != NULL);
     assert(data != NULL || dataLen == 0);
-    
+
     memcpy(iv, iv16, 16);
-    _BRAESExpandKey(k, key, keyLen);
-    
-    for (off = 0; off < dataLen; off++) {
-        if ((off % 16) == 0) { // generate xor compliment
-            memcpy(x, iv, 16);
-            _BRAESCipher(x, k, keyLen);
-            i = 16;
-            do { iv[--i]++; } while (iv[i] == 0 && i > 0); // increment iv with overflow
-        }
-        
-        ((uint8_t *)out)[off] = (((uint8_t *)data)[off] ^ x[off % 16]);
-    }
-    
-    mem_clean(k, sizeof(k));
-    mem_clean(x, sizeof(x));
+    BRAESContextInit(&ctx, key, keyLen);
+    BRAESContextCTR(&ctx, out, iv, data, dataLen);
+    mem_clean(&ctx, sizeof(ctx));
 }
-// aes-ctr stream cipher encrypt/decrypt
+
+// aes-ctr stream cipher encrypt/decrypt, of outLen bytes that end a stream of dataLen bytes so far, with iv16 the
+// counter for the first of them; the stream must be at a block boundary, and iv16 is advanced past the blocks used
 void BRAESCTR_OFFSET(void *out, size_t outLen, const void *key, size_t keyLen, void *iv16, const void *data, size_t dataLen)
 {
-    uint8_t x[16], iv[16], k[256];
-    size_t off, i, outIdx = 0;
-    
+    BRAESContext ctx;
+
     assert(out != NULL);
     assert(key != NULL);
     assert(keyLen == 16 || keyLen == 24 || keyLen == 32);
     assert(iv16 != NULL);
     assert(data != NULL || dataLen == 0);
-    
-    memcpy(iv, iv16, 16);
-    _BRAESExpandKey(k, key, keyLen);
-    
-    for (off = (dataLen - outLen); off < dataLen; off++, outIdx++) {
-        if ((off % 16) == 0) { // generate xor compliment
-            memcpy(x, iv, 16);
-            _BRAESCipher(x, k, keyLen);
-            i = 16;
-            do { iv[--i]++; } while (iv[i] == 0 && i > 0); // increment iv with overflow
-        }
-        ((uint8_t *)out)[outIdx] = (((uint8_t *)data)[outIdx] ^ x[outIdx % 16]);
-    }
-    memcpy(iv16, iv, 16);
-    mem_clean(k, sizeof(k));
-    mem_clean(x, sizeof(x));
-}
-
 
+    BRAESContextInit(&ctx, key, keyLen);
+    BRAESContextCTR(&ctx, out, iv16, data, outLen);
+    mem_clean(&ctx, sizeof(ctx));
+}
 
 // dk = T1 || T2 || ... || Tdklen/hlen
 // Ti = U1 xor U2 xor ... xor Urounds
@@ -1117,6 +1797,11 @@ void BRPBKDF2(void *dk, size_t dkLen, void (*hash)(void *, const void *, size_t)
     assert(salt != NULL || saltLen == 0);
     assert(rounds > 0);
     
+    if (hash == BRSHA512 && hashLen == 512/8) {
+        BRPBKDF2SHA512(dk, dkLen, pw, pwLen, salt, saltLen, rounds);
+        return;
+    }
+
     memcpy(s, salt, saltLen);
     
     for (i = 0; i < (dkLen + hashLen - 1)/hashLen; i++) {
@@ -1139,6 +1824,53 @@ void BRPBKDF2(void *dk, size_t dkLen, void (*hash)(void *, const void *, size_t)
     mem_clean(T, sizeof(T));
 }
 
+// each round after the first is one compression for the inner hash and one for the outer, as the 64 byte U and the
+// inner hash each fit in a single padded block that follows a precomputed pad block state
+void BRPBKDF2SHA512(void *dk, size_t dkLen, const void *pw, size_t pwLen, const void *salt, size_t saltLen,
+                    unsigned rounds)
+{
+    BRHMACSHA512Context ctx;
+    uint8_t s[saltLen + sizeof(uint32_t)];
+    uint64_t x[16], T[8], buf[8];
+    uint32_t i, j;
+
+    assert(dk != NULL || dkLen == 0);
+    assert(pw != NULL || pwLen == 0);
+    assert(salt != NULL || saltLen == 0);
+    assert(rounds > 0);
+
+    BRHMACSHA512Init(&ctx, pw, pwLen);
+    memcpy(s, salt, saltLen);
+
+    for (i = 0; i < (dkLen + 63)/64; i++) {
+        j = be32(i + 1);
+        memcpy(s + saltLen, &j, sizeof(j));
+        BRHMACSHA512(x, &ctx, s, sizeof(s)); // U1 = hmac_hash(pw, salt || be32(i))
+        memcpy(T, x, sizeof(T));
+        memset(&x[8], 0, 64); // x holds Urounds-1 followed by the padding and length of a message after one block
+        ((uint8_t *)x)[64] = 0x80;
+        x[15] = be64((uint64_t)(128 + 64)*8);
+
+        for (unsigned r = 1; r < rounds; r++) { // Urounds = hmac_hash(pw, Urounds-1)
+            memcpy(buf, ctx.inner, sizeof(buf));
+            _BRSHA512Compress(buf, x);
+            for (j = 0; j < 8; j++) x[j] = be64(buf[j]);
+            memcpy(buf, ctx.outer, sizeof(buf));
+            _BRSHA512Compress(buf, x);
+            for (j = 0; j < 8; j++) x[j] = be64(buf[j]), T[j] ^= x[j]; // Ti = U1 ^ U2 ^ ... ^ Urounds
+        }
+
+        // dk = T1 || T2 || ... || Tdklen/hlen
+        memcpy((uint8_t *)dk + i*64, T, (i*64 + 64 <= dkLen) ? 64 : dkLen % 64);
+    }
+
+    mem_clean(&ctx, sizeof(ctx));
+    mem_clean(s, sizeof(s));
+    mem_clean(x, sizeof(x));
+    mem_clean(T, sizeof(T));
+    mem_clean(buf, sizeof(buf));
+}
+
 // salsa20/8 stream cipher: http://cr.yp.to/snuffle.html
 static void _salsa20_8(uint32_t b[16])
 {
@@ -44,6 +44,24 @@ void BRSHA224(void *md28, const void *data, size_t dataLen);
 // double-sha-256 = sha-256(sha-256(x))
 void BRSHA256_2(void *md32, const void *data, size_t dataLen);
 
+// sha-256 of count messages, each dataLen bytes and stored one after another at data, written 32 bytes apart to md32s
+void BRSHA256Batch(void *md32s, const void *data, size_t dataLen, size_t count);
+
+// double-sha-256 of count messages, laid out as for BRSHA256Batch(), e.g. the nodes of a merkle tree level
+void BRSHA256_2Batch(void *md32s, const void *data, size_t dataLen, size_t count);
+
+// sha-256 implementations, the fastest the cpu supports is selected on first use
+typedef enum {
+    BR_SHA256_BACKEND_PORTABLE,
+    BR_SHA256_BACKEND_AVX2,  // x86-64 8-way multi-buffer, for batches of 8 or more, portable otherwise
+    BR_SHA256_BACKEND_SHA_NI // x86-64 sha extensions
+} BRSHA256Backend;
+
+BRSHA256Backend BRSHA256GetBackend(void);
+
+// selects backend, for testing and benchmarks; returns true if the cpu supports it
+int BRSHA256SetBackend(BRSHA256Backend backend);
+
 void BRSHA384(void *md48, const void *data, size_t dataLen);
 
 void BRSHA512(void *md64, const void *data, size_t dataLen);
@@ -60,6 +78,25 @@ void BRSHA3_256(void *md32, const void *data, size_t dataLen);
 // keccak-256: https://keccak.team/files/Keccak-submission-3.pdf
 void BRKeccak256(void *md32, const void *data, size_t dataLen);
 
+// keccak-256 of count messages, each dataLen bytes and stored one after another at data, written 32 bytes apart to
+// md32s, e.g. addresses or log topics
+void BRKeccak256Batch(void *md32s, const void *data, size_t dataLen, size_t count);
+
+// keccak-f[1600] permutation of the 25 lane state s, for incremental keccak and sha3 implementations
+void BRKeccakF1600(uint64_t s[25]);
+
+// multi-buffer keccak implementations for BRKeccak256Batch(), the widest the cpu supports is selected on first use
+typedef enum {
+    BR_KECCAK_BACKEND_PORTABLE,
+    BR_KECCAK_BACKEND_SSE2, // x86-64 2-way multi-buffer, for batches of 2 or more
+    BR_KECCAK_BACKEND_AVX2  // x86-64 4-way multi-buffer, for batches of 4 or more, 2-way for the remainder
+} BRKeccakBackend;
+
+BRKeccakBackend BRKeccakGetBackend(void);
+
+// selects backend, for testing and benchmarks; returns true if the cpu supports it
+int BRKeccakSetBackend(BRKeccakBackend backend);
+
 // md5 - for non-cryptographic use only
 void BRMD5(void *md16, const void *data, size_t dataLen);
 
@@ -72,6 +109,16 @@ uint64_t BRSip64(const void *key16, const void *data, size_t dataLen);
 void BRHMAC(void *mac, void (*hash)(void *, const void *, size_t), size_t hashLen, const void *key, size_t keyLen,
             const void *data, size_t dataLen);
 
+// hmac-sha512 with the hash states after the key's inner and outer pad blocks precomputed, so each mac with the same
+// key costs two fewer compressions than BRHMAC(); mem_clean() the context when done, it is as sensitive as the key
+typedef struct {
+    uint64_t inner[8], outer[8];
+} BRHMACSHA512Context;
+
+void BRHMACSHA512Init(BRHMACSHA512Context *ctx, const void *key, size_t keyLen);
+
+void BRHMACSHA512(void *mac64, const BRHMACSHA512Context *ctx, const void *data, size_t dataLen);
+
 // hmac-drbg with no prediction resistance or additional input
 // K and V must point to buffers of size hashLen, and ps (personalization string) may be NULL
 // to generate additional drbg output, use K and V from the previous call, and set seed, nonce and ps to NULL
@@ -92,6 +139,33 @@ size_t BRChacha20Poly1305AEADEncrypt(void *out, size_t outLen, const void *key32
 size_t BRChacha20Poly1305AEADDecrypt(void *out, size_t outLen, const void *key32, const void *nonce12,
                                      const void *data, size_t dataLen, const void *ad, size_t adLen);
     
+// aes with the key schedule expanded once, for many blocks with the same key; mem_clean() the context when done
+typedef struct {
+    uint8_t k[240]; // round keys
+    uint64_t sk[120]; // round keys in bitsliced form, for the bitsliced backend
+    size_t keyLen;
+} BRAESContext;
+
+void BRAESContextInit(BRAESContext *ctx, const void *key, size_t keyLen);
+
+void BRAESContextEncrypt(const BRAESContext *ctx, void *buf16);
+
+void BRAESContextDecrypt(const BRAESContext *ctx, void *buf16);
+
+// aes-ctr, continuing the stream at counter iv16, which is advanced past each block used, including a final partial one
+void BRAESContextCTR(const BRAESContext *ctx, void *out, void *iv16, const void *data, size_t dataLen);
+
+// aes implementations, both constant time, the fastest the cpu supports is selected on first use
+typedef enum {
+    BR_AES_BACKEND_BITSLICED, // bitsliced state, four blocks at a time
+    BR_AES_BACKEND_AES_NI     // x86-64 aes instructions
+} BRAESBackend;
+
+BRAESBackend BRAESGetBackend(void);
+
+// selects backend, for testing and benchmarks; returns true if the cpu supports it
+int BRAESSetBackend(BRAESBackend backend);
+
 // aes-ecb block cipher
 void BRAESECBEncrypt(void *buf16, const void *key, size_t keyLen);
 
@@ -104,6 +178,10 @@ void BRAESCTR_OFFSET(void *out, size_t outLen, const void *key, size_t keyLen, v
 void BRPBKDF2(void *dk, size_t dkLen, void (*hash)(void *, const void *, size_t), size_t hashLen,
               const void *pw, size_t pwLen, const void *salt, size_t saltLen, unsigned rounds);
 
+// pbkdf2 with hmac-sha512, using a BRHMACSHA512Context; BRPBKDF2() calls this when hash is BRSHA512
+void BRPBKDF2SHA512(void *dk, size_t dkLen, const void *pw, size_t pwLen, const void *salt, size_t saltLen,
+                    unsigned rounds);
+
 // scrypt key derivation: http://www.tarsnap.com/scrypt.html
 void BRScrypt(void *dk, size_t dkLen, const void *pw, size_t pwLen, const void *salt, size_t saltLen,
               unsigned n, unsigned r, unsigned p);
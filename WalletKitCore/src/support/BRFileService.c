@@ -42,13 +42,47 @@ typedef int sqlite3_status_code;
 
 #define FILE_SERVICE_SDB_FILENAME      "entities.db"
 
+//
+// The DB schema version, recorded as the SQLite `user_version`.  Version 0 stored each entity
+// as hex-encoded TEXT; version 1 stores each entity as a BLOB.  A version 0 DB is migrated
+// when opened.
+//
+#define FILE_SERVICE_SDB_SCHEMA_VERSION_HEX     (0)
+#define FILE_SERVICE_SDB_SCHEMA_VERSION_BLOB    (1)
+#define FILE_SERVICE_SDB_SCHEMA_VERSION         FILE_SERVICE_SDB_SCHEMA_VERSION_BLOB
+
 #define FILE_SERVICE_SDB_ENTITY_TABLE     \
 "CREATE TABLE IF NOT EXISTS Entity(     \n\
   Type      CHAR(64)    NOT NULL,       \n\
   Hash      CHAR(64)    NOT NULL,       \n\
-  Data      TEXT        NOT NULL,       \n\
+  Data      BLOB        NOT NULL,       \n\
   PRIMARY KEY (Type, Hash));"
 
+#define FILE_SERVICE_SDB_QUERY_SCHEMA_VERSION     \
+"PRAGMA user_version;"
+
+#define FILE_SERVICE_SDB_UPDATE_SCHEMA_VERSION    \
+"PRAGMA user_version = %d;"
+
+#define FILE_SERVICE_SDB_QUERY_ENTITY_TABLE     \
+"SELECT count(*) FROM sqlite_master WHERE type = 'table' AND name = 'Entity';"
+
+#define FILE_SERVICE_SDB_MIGRATE_ENTITY_TABLE     \
+"CREATE TABLE EntityMigrate(            \n\
+  Type      CHAR(64)    NOT NULL,       \n\
+  Hash      CHAR(64)    NOT NULL,       \n\
+  Data      BLOB        NOT NULL,       \n\
+  PRIMARY KEY (Type, Hash));"
+
+#define FILE_SERVICE_SDB_MIGRATE_INSERT_ENTITY     \
+"INSERT INTO EntityMigrate (Type, Hash, Data) VALUES (?, ?, ?);"
+
+#define FILE_SERVICE_SDB_MIGRATE_QUERY_ALL_ENTITY     \
+"SELECT Type, Hash, Data FROM Entity;"
+
+#define FILE_SERVICE_SDB_MIGRATE_RENAME_ENTITY_TABLE     \
+"DROP TABLE Entity; ALTER TABLE EntityMigrate RENAME TO Entity;"
+
 typedef char FileServiceSQL[1024];
 
 #define FILE_SERVICE_SDB_INSERT_ENTITY    \
@@ -57,8 +91,8 @@ typedef char FileServiceSQL[1024];
 #define FILE_SERVICE_SDB_QUERY_ENTITY     \
 "SELECT Data FROM Entity WHERE Type = ? AND Hash = ?;"
 
-#define FILE_SERVICE_SDB_QUERY_ALL_ENTITY     \
-"SELECT Hash, Data FROM Entity WHERE Type = ?;"
+#define FILE_SERVICE_SDB_QUERY_RANGE_ENTITY     \
+"SELECT Hash, Data FROM Entity WHERE Type = ? AND Hash >= ? AND Hash <= ?;"
 
 #define FILE_SERVICE_SDB_UPDATE_ENTITY     \
 "UPDATE Entity SET Data = ? WHERE Type = ? AND Hash = ?;"
@@ -75,14 +109,11 @@ typedef char FileServiceSQL[1024];
 #if defined(DEBUG)
 static int needSQLiteCompileOptions = 1;
 #endif
-// HEX Encode/Decode - Cribbed from ethereum/util/BRUtilHex.c
+// HEX Decode - Cribbed from ethereum/util/BRUtilHex.c; only used to migrate a hex-encoded DB.
 
 // Convert a char into uint8_t (decode)
 #define decodeChar(c)           ((uint8_t) _hexu(c))
 
-// Convert a uint8_t into a char (encode)
-#define encodeChar(u)           ((char)    _hexc(u))
-
 static void
 hexDecode (uint8_t *target, size_t targetLen, const char *source, size_t sourceLen) {
     //
@@ -94,23 +125,20 @@ hexDecode (uint8_t *target, size_t targetLen, const char *source, size_t sourceL
     }
 }
 
-static void
-hexEncode (char *target, size_t targetLen, const uint8_t *source, size_t sourceLen) {
-    assert (targetLen == 2 * sourceLen  + 1);
-
-    for (int i = 0; i < sourceLen; i++) {
-        target[2*i + 0] = encodeChar (source[i] >> 4);
-        target[2*i + 1] = encodeChar (source[i]);
-    }
-    target[2*sourceLen] = '\0';
-}
-
 /** Forward Declarations */
 static int
 fileServiceFailedSDB (BRFileService fs,
                       int releaseLock,
                       sqlite3_status_code code);
 
+static int
+fileServiceFailedEntity(BRFileService fs,
+                        int releaseLock,
+                        void* bufferToFree,
+                        FILE* fileToClose,
+                        const char *type,
+                        const char *reason);
+
 /// Return 0 on success, -1 otherwise
 static int directoryMake (const char *path) {
     struct stat dirStat;
@@ -188,12 +216,15 @@ struct BRFileServiceRecord {
     sqlite3 *sdb;
     sqlite3_stmt *sdbInsertStmt;
     sqlite3_stmt *sdbSelectStmt;
-    sqlite3_stmt *sdbSelectAllStmt;
+    sqlite3_stmt *sdbSelectRangeStmt;
     sqlite3_stmt *sdbUpdateStmt;
     sqlite3_stmt *sdbDeleteStmt;
     sqlite3_stmt *sdbDeleteAllTypeStmt;
     sqlite3_stmt *sdbDeleteAllStmt;
     bool  sdbClosed;
+
+    /// The nesting depth of DB transactions (as SQLite savepoints); see `fileServiceBeginBatch()`
+    size_t sdbTransactionDepth;
 #endif
 
     BRArrayOf(BRFileServiceEntityType) entityTypes;
@@ -203,6 +234,9 @@ struct BRFileServiceRecord {
     pthread_mutex_t lock;
 };
 
+///
+/// Fail `fileServiceCreate()`, which never holds `fs->lock`; thus `releaseLock` is always 0.
+///
 static BRFileService
 fileServiceCreateReturnError (BRFileService fs,
                               int releaseLock,
@@ -224,6 +258,135 @@ fileServiceCreateFilePath (const char *basePath,
     return sdbPath;
 }
 
+#if !defined(NEUTER_FILE_SERVICE)
+static sqlite3_status_code
+fileServiceQueryInteger (sqlite3 *sdb,
+                         const char *sql,
+                         int *value) {
+    sqlite3_stmt *stmt;
+    sqlite3_status_code status = sqlite3_prepare_v2 (sdb, sql, -1, &stmt, NULL);
+    if (SQLITE_OK != status) return status;
+
+    status = sqlite3_step (stmt);
+    if (SQLITE_ROW == status) {
+        *value = sqlite3_column_int (stmt, 0);
+        status = SQLITE_OK;
+    }
+
+    sqlite3_finalize (stmt);
+    return status;
+}
+
+///
+/// Migrate each hex-encoded TEXT entity to a BLOB entity, in a new table, and then replace
+/// the existing table.  An entity that cannot be decoded is not migrated; each one is reported
+/// to `fs`'s error handler as a FILE_SERVICE_ENTITY error.  Called within a DB transaction.
+///
+static sqlite3_status_code
+fileServiceMigrateHexToBlob (BRFileService fs, sqlite3 *sdb) {
+    sqlite3_stmt *sdbSelectStmt = NULL;
+    sqlite3_stmt *sdbInsertStmt = NULL;
+
+    uint8_t *dataBytes = NULL;
+    size_t   dataBytesCount = 0;
+
+    sqlite3_status_code status = sqlite3_exec (sdb, FILE_SERVICE_SDB_MIGRATE_ENTITY_TABLE, NULL, NULL, NULL);
+
+    if (SQLITE_OK == status)
+        status = sqlite3_prepare_v2 (sdb, FILE_SERVICE_SDB_MIGRATE_QUERY_ALL_ENTITY, -1, &sdbSelectStmt, NULL);
+
+    if (SQLITE_OK == status)
+        status = sqlite3_prepare_v2 (sdb, FILE_SERVICE_SDB_MIGRATE_INSERT_ENTITY, -1, &sdbInsertStmt, NULL);
+
+    while (SQLITE_OK == status && SQLITE_ROW == (status = sqlite3_step (sdbSelectStmt))) {
+        const char *type = (const char *) sqlite3_column_text (sdbSelectStmt, 0);
+        const char *hash = (const char *) sqlite3_column_text (sdbSelectStmt, 1);
+        const char *data = (const char *) sqlite3_column_text (sdbSelectStmt, 2);
+
+        size_t dataCount = (NULL == data ? 0 : strlen (data));
+
+        // Report, and skip, an entity that cannot be decoded; it could not be loaded anyways.
+        if (NULL == type || NULL == hash || 0 == dataCount || 0 != dataCount % 2 ||
+            dataCount != strspn (data, "0123456789abcdefABCDEF")) {
+            fileServiceFailedEntity (fs, 0, NULL, NULL,
+                                     (NULL == type ? "" : type),
+                                     "migrate: undecodable; dropped");
+            status = SQLITE_OK;
+            continue;
+        }
+
+        // Ensure `dataBytes` is large enough for hex-decoded `data`
+        if ((dataCount/2) > dataBytesCount) {
+            dataBytesCount = dataCount/2;
+            dataBytes = realloc (dataBytes, dataBytesCount);
+        }
+        hexDecode (dataBytes, dataCount/2, data, dataCount);
+
+        sqlite3_reset (sdbInsertStmt);
+        sqlite3_clear_bindings (sdbInsertStmt);
+
+        status = sqlite3_bind_text (sdbInsertStmt, 1, type, -1, SQLITE_STATIC);
+        if (SQLITE_OK == status) status = sqlite3_bind_text (sdbInsertStmt, 2, hash, -1, SQLITE_STATIC);
+        if (SQLITE_OK == status) status = sqlite3_bind_blob (sdbInsertStmt, 3, dataBytes, (int) (dataCount/2), SQLITE_STATIC);
+        if (SQLITE_OK == status) status = sqlite3_step (sdbInsertStmt);
+        if (SQLITE_DONE == status) status = SQLITE_OK;
+    }
+    if (SQLITE_DONE == status) status = SQLITE_OK;
+
+    if (NULL != sdbInsertStmt) sqlite3_finalize (sdbInsertStmt);
+    if (NULL != sdbSelectStmt) sqlite3_finalize (sdbSelectStmt);
+    if (NULL != dataBytes) free (dataBytes);
+
+    if (SQLITE_OK == status)
+        status = sqlite3_exec (sdb, FILE_SERVICE_SDB_MIGRATE_RENAME_ENTITY_TABLE, NULL, NULL, NULL);
+
+    return status;
+}
+
+///
+/// Create the 'Entity' table or, if it exists at an older schema version, migrate it to the
+/// current schema version.
+///
+static sqlite3_status_code
+fileServiceUpdateSchema (BRFileService fs, sqlite3 *sdb) {
+    int version = 0;
+    int hasEntityTable = 0;
+
+    sqlite3_status_code status = fileServiceQueryInteger (sdb, FILE_SERVICE_SDB_QUERY_SCHEMA_VERSION, &version);
+    if (SQLITE_OK != status) return status;
+
+    // Current; nothing to do.
+    if (FILE_SERVICE_SDB_SCHEMA_VERSION == version) return SQLITE_OK;
+
+    // From the future; we can't know the schema.
+    if (FILE_SERVICE_SDB_SCHEMA_VERSION < version) return SQLITE_MISMATCH;
+
+    status = sqlite3_exec (sdb, "BEGIN", NULL, NULL, NULL);
+    if (SQLITE_OK != status) return status;
+
+    status = fileServiceQueryInteger (sdb, FILE_SERVICE_SDB_QUERY_ENTITY_TABLE, &hasEntityTable);
+
+    if (SQLITE_OK == status)
+        status = (hasEntityTable && FILE_SERVICE_SDB_SCHEMA_VERSION_HEX == version
+                  ? fileServiceMigrateHexToBlob (fs, sdb)
+                  : sqlite3_exec (sdb, FILE_SERVICE_SDB_ENTITY_TABLE, NULL, NULL, NULL));
+
+    if (SQLITE_OK == status) {
+        FileServiceSQL sql;
+        snprintf (sql, sizeof (FileServiceSQL), FILE_SERVICE_SDB_UPDATE_SCHEMA_VERSION, FILE_SERVICE_SDB_SCHEMA_VERSION);
+        status = sqlite3_exec (sdb, sql, NULL, NULL, NULL);
+    }
+
+    if (SQLITE_OK == status)
+        status = sqlite3_exec (sdb, "COMMIT", NULL, NULL, NULL);
+
+    if (SQLITE_OK != status)
+        sqlite3_exec (sdb, "ROLLBACK", NULL, NULL, NULL);
+
+    return status;
+}
+#endif // !defined(NEUTER_FILE_SERVICE)
+
 extern BRFileService
 fileServiceCreate (const char *basePath,
                    const char *currency,
@@ -281,26 +444,18 @@ fileServiceCreate (const char *basePath,
     // Allow an absurdly long timeout for DB creation
     sqlite3_busy_timeout (fs->sdb, 10 * 1000); // 10 seconds
 
-    // Create the SQLite 'Entity' Table
-    sqlite3_stmt *sdbCreateTableStmt;
-    status = sqlite3_prepare_v2 (fs->sdb, FILE_SERVICE_SDB_ENTITY_TABLE, -1, &sdbCreateTableStmt, NULL);
+    // Create the SQLite 'Entity' Table; migrate an existing one, if needed.
+    status = fileServiceUpdateSchema (fs, fs->sdb);
     if (SQLITE_OK != status)
-        return fileServiceCreateReturnError (fs, 1, (BRFileServiceError) {
-            FILE_SERVICE_SDB,
-            { .sdb = { status }}
-        });
-
-    if (SQLITE_DONE != sqlite3_step(sdbCreateTableStmt))
-        return fileServiceCreateReturnError (fs, 1, (BRFileServiceError) {
+        return fileServiceCreateReturnError (fs, 0, (BRFileServiceError) {
             FILE_SERVICE_SDB,
             { .sdb = { status }}
         });
-    sqlite3_finalize(sdbCreateTableStmt);
 
     // Create the SQLITE 'Insert into Entity' Statement
     status = sqlite3_prepare_v2 (fs->sdb, FILE_SERVICE_SDB_INSERT_ENTITY, -1, &fs->sdbInsertStmt, NULL);
     if (SQLITE_OK != status)
-        return fileServiceCreateReturnError (fs, 1, (BRFileServiceError) {
+        return fileServiceCreateReturnError (fs, 0, (BRFileServiceError) {
             FILE_SERVICE_SDB,
             { .sdb = { status }}
         });
@@ -308,36 +463,36 @@ fileServiceCreate (const char *basePath,
     // Create the SQLITE "Select Entity By Hash' Statement
     status = sqlite3_prepare_v2 (fs->sdb, FILE_SERVICE_SDB_QUERY_ENTITY, -1, &fs->sdbSelectStmt, NULL);
     if (SQLITE_OK != status)
-        return fileServiceCreateReturnError (fs, 1, (BRFileServiceError) {
+        return fileServiceCreateReturnError (fs, 0, (BRFileServiceError) {
             FILE_SERVICE_SDB,
             { .sdb = { status }}
         });
 
-    // Create the SQLITE "Select Entity ' Statement
-    status = sqlite3_prepare_v2 (fs->sdb, FILE_SERVICE_SDB_QUERY_ALL_ENTITY, -1, &fs->sdbSelectAllStmt, NULL);
+    // Create the SQLITE "Select Entity By Hash Range' Statement
+    status = sqlite3_prepare_v2 (fs->sdb, FILE_SERVICE_SDB_QUERY_RANGE_ENTITY, -1, &fs->sdbSelectRangeStmt, NULL);
     if (SQLITE_OK != status)
-        return fileServiceCreateReturnError (fs, 1, (BRFileServiceError) {
+        return fileServiceCreateReturnError (fs, 0, (BRFileServiceError) {
             FILE_SERVICE_SDB,
             { .sdb = { status }}
         });
 
     status = sqlite3_prepare_v2 (fs->sdb, FILE_SERVICE_SDB_UPDATE_ENTITY, -1, &fs->sdbUpdateStmt, NULL);
     if (SQLITE_OK != status)
-        return fileServiceCreateReturnError (fs, 1, (BRFileServiceError) {
+        return fileServiceCreateReturnError (fs, 0, (BRFileServiceError) {
             FILE_SERVICE_SDB,
             { .sdb = { status }}
         });
 
     status = sqlite3_prepare_v2 (fs->sdb, FILE_SERVICE_SDB_DELETE_ENTITY, -1, &fs->sdbDeleteStmt, NULL);
     if (SQLITE_OK != status)
-        return fileServiceCreateReturnError (fs, 1, (BRFileServiceError) {
+        return fileServiceCreateReturnError (fs, 0, (BRFileServiceError) {
             FILE_SERVICE_SDB,
             { .sdb = { status }}
         });
 
     status = sqlite3_prepare_v2 (fs->sdb, FILE_SERVICE_SDB_DELETE_ALL_TYPE_ENTITY, -1, &fs->sdbDeleteAllTypeStmt, NULL);
     if (SQLITE_OK != status)
-        return fileServiceCreateReturnError (fs, 1, (BRFileServiceError) {
+        return fileServiceCreateReturnError (fs, 0, (BRFileServiceError) {
             FILE_SERVICE_SDB,
             { .sdb = { status }}
         });
@@ -381,14 +536,16 @@ _fileServiceCloseInternal (BRFileService fs) {
     fs->sdbClosed = true;
     _fileServiceFinalizeStmt (fs, &fs->sdbInsertStmt);
     _fileServiceFinalizeStmt (fs, &fs->sdbSelectStmt);
-    _fileServiceFinalizeStmt (fs, &fs->sdbSelectAllStmt);
+    _fileServiceFinalizeStmt (fs, &fs->sdbSelectRangeStmt);
     _fileServiceFinalizeStmt (fs, &fs->sdbUpdateStmt);
     _fileServiceFinalizeStmt (fs, &fs->sdbDeleteStmt);
     _fileServiceFinalizeStmt (fs, &fs->sdbDeleteAllTypeStmt);
     _fileServiceFinalizeStmt (fs, &fs->sdbDeleteAllStmt);
 
+    // Any uncommitted DB transaction is rolled back.
     if (NULL != fs->sdb) sqlite3_close (fs->sdb);
     fs->sdb = NULL;
+    fs->sdbTransactionDepth = 0;
 #endif
 }
 
@@ -555,93 +712,159 @@ fileServiceFailedEntity(BRFileService fs,
                                       });
 }
 
-/// MARK: - Save
+/// MARK: - Transaction
 
-static int
-_fileServiceSave (BRFileService fs,
-                  const char *type,  /* block, peers, transactions, logs, ... */
-                  const void *entity,
-                  int needLock) {     /* BRMerkleBlock*, BRTransaction, BREthereumTransaction, ... */
+#if !defined(NEUTER_FILE_SERVICE)
+///
+/// Begin a DB transaction, as a SQLite savepoint.  DB transactions nest; only the outermost one
+/// actually commits, with its release.  Called while locked.
+///
+static sqlite3_status_code
+_fileServiceBegin (BRFileService fs) {
+    sqlite3_status_code status = sqlite3_exec (fs->sdb, "SAVEPOINT FileService", NULL, NULL, NULL);
+    if (SQLITE_OK != status) return status;
 
-    BRFileServiceEntityType *entityType = fileServiceLookupType (fs, type);
-    if (NULL == entityType) { fileServiceFailedImpl (fs, 0, NULL, NULL, "missed type"); return 0; };
+    fs->sdbTransactionDepth += 1;
+    return SQLITE_OK;
+}
 
-    BRFileServiceEntityHandler *handler = fileServiceEntityTypeLookupHandler(entityType, entityType->currentVersion);
-    if (NULL == handler) { fileServiceFailedImpl (fs, 0, NULL, NULL, "missed type handler"); return 0; };
+///
+/// End a DB transaction, committing if `commit` and otherwise rolling back.  A roll back only
+/// undoes the changes made since the matching `_fileServiceBegin()`; an enclosing transaction,
+/// such as another caller's batch, is unaffected and still commits.  Called while locked.
+///
+static sqlite3_status_code
+_fileServiceEnd (BRFileService fs, bool commit) {
+    assert (fs->sdbTransactionDepth > 0);
+    if (0 == fs->sdbTransactionDepth) return SQLITE_MISUSE;
+
+    if (!commit) {
+        sqlite3_status_code status = sqlite3_exec (fs->sdb, "ROLLBACK TO FileService", NULL, NULL, NULL);
+        if (SQLITE_OK != status) return status;
+    }
 
+    fs->sdbTransactionDepth -= 1;
+    return sqlite3_exec (fs->sdb, "RELEASE FileService", NULL, NULL, NULL);
+}
+#endif // !defined(NEUTER_FILE_SERVICE)
+
+extern int
+fileServiceBeginBatch (BRFileService fs) {
 #if !defined(NEUTER_FILE_SERVICE)
-    // Get then hex-encode the identifer
-    UInt256 identifier = handler->identifier (handler->context, fs, entity);
-    const char *hash = u256hex(identifier);
+    pthread_mutex_lock (&fs->lock);
+    if (fs->sdbClosed)
+        return fileServiceFailedImpl (fs, 1, NULL, NULL, "closed");
+
+    sqlite3_status_code status = _fileServiceBegin (fs);
+    if (SQLITE_OK != status)
+        return fileServiceFailedSDB (fs, 1, status);
+
+    pthread_mutex_unlock (&fs->lock);
+#endif // !defined(NEUTER_FILE_SERVICE)
+
+    return 1;
+}
+
+extern int
+fileServiceCommitBatch (BRFileService fs) {
+#if !defined(NEUTER_FILE_SERVICE)
+    pthread_mutex_lock (&fs->lock);
+    if (fs->sdbClosed)
+        return fileServiceFailedImpl (fs, 1, NULL, NULL, "closed");
+
+    sqlite3_status_code status = _fileServiceEnd (fs, true);
+    if (SQLITE_OK != status)
+        return fileServiceFailedSDB (fs, 1, status);
+
+    pthread_mutex_unlock (&fs->lock);
+#endif // !defined(NEUTER_FILE_SERVICE)
+
+    return 1;
+}
+
+/// MARK: - Save
+
+#if !defined(NEUTER_FILE_SERVICE)
+///
+/// Encode `entity` with `handler` as the bytes to store in the DB.  The entity bytes are extended
+/// with the current header format, which is:
+///   {HeaderFormatVersion, Current(Type)Version, EntityBytesCount, EntityBytes}
+/// Fills `identifier` and `bytesCount`; the returned bytes are owned by the caller.
+///
+static uint8_t *
+_fileServiceEncode (BRFileService fs,
+                    BRFileServiceEntityHandler *handler,
+                    const void *entity,
+                    UInt256 *identifier,
+                    size_t  *bytesCount) {
+    *identifier = handler->identifier (handler->context, fs, entity);
 
     // Get the entity bytes
     uint32_t entityBytesCount;
     uint8_t *entityBytes = handler->writer (handler->context, fs, entity, &entityBytesCount);
 
     // Always, always write the header for the currentHeaderFormatVersion
-
-    // Extend the entity bytes with the current header format, which is:
-    //   {HeaderFormatVersion, Current(Type)Version, EntityBytesCount, EntityBytes}
     size_t  offset = 0;
-    size_t  bytesCount = 1 + 1 + sizeof(uint32_t) + entityBytesCount;
-    uint8_t *bytes = malloc (bytesCount);
+    uint8_t *bytes = malloc (1 + 1 + sizeof(uint32_t) + entityBytesCount);
 
     bytes[offset] = (uint8_t) currentHeaderFormatVersion;
     offset += 1;
 
-    bytes[offset] = (uint8_t) entityType->currentVersion;
+    bytes[offset] = (uint8_t) handler->version;
     offset += 1;
 
     UInt32SetBE (&bytes[offset], entityBytesCount);
     offset += sizeof (uint32_t);
 
     memcpy (&bytes[offset], entityBytes, entityBytesCount);
+    offset += entityBytesCount;
     free (entityBytes);
 
-    // Nex encode bytes
-    size_t dataCount = 2 * bytesCount + 1;
-    char *data = malloc (dataCount);
-    hexEncode (data, dataCount, bytes, bytesCount);
-    free (bytes);
+    *bytesCount = offset;
+    return bytes;
+}
 
-    // Fill out the SQL statement
+///
+/// Insert (or replace) the encoded `bytes` of `type` at `hash`.  The `bytes` are freed.
+///
+static int
+_fileServiceInsert (BRFileService fs,
+                    const char *type,
+                    const char *hash,
+                    uint8_t *bytes,
+                    size_t   bytesCount,
+                    int needLock) {
     sqlite3_status_code status;
 
     if (needLock)
         pthread_mutex_lock (&fs->lock);
 
     if (fs->sdbClosed)
-        return fileServiceFailedImpl (fs, needLock, NULL, NULL, "closed");
+        return fileServiceFailedImpl (fs, needLock, bytes, NULL, "closed");
 
     sqlite3_reset (fs->sdbInsertStmt);
     sqlite3_clear_bindings(fs->sdbInsertStmt);
 
     status = sqlite3_bind_text (fs->sdbInsertStmt, 1, type, -1, SQLITE_STATIC);
-    if (SQLITE_OK != status) {
-        free (data);
-        return fileServiceFailedSDB (fs, needLock, status);
-    }
+    if (SQLITE_OK != status)
+        return fileServiceFailedSDBWithBufferFree (fs, needLock, bytes, status);
 
     status = sqlite3_bind_text (fs->sdbInsertStmt, 2, hash, -1, SQLITE_STATIC);
-    if (SQLITE_OK != status) {
-        free (data);
-        return fileServiceFailedSDB (fs, needLock, status);
-    }
+    if (SQLITE_OK != status)
+        return fileServiceFailedSDBWithBufferFree (fs, needLock, bytes, status);
 
-    status = sqlite3_bind_text (fs->sdbInsertStmt, 3, data, -1, SQLITE_STATIC);
-    if (SQLITE_OK != status) {
-        free (data);
-        return fileServiceFailedSDB (fs, needLock, status);
-    }
+    status = sqlite3_bind_blob (fs->sdbInsertStmt, 3, bytes, (int) bytesCount, SQLITE_STATIC);
+    if (SQLITE_OK != status)
+        return fileServiceFailedSDBWithBufferFree (fs, needLock, bytes, status);
 
     status = sqlite3_step (fs->sdbInsertStmt);
     if (SQLITE_DONE != status) {
         int retries = 3;
         while (retries-- > 0 && status != SQLITE_DONE && status != SQLITE_BUSY)
             status = sqlite3_step (fs->sdbInsertStmt);
-        if (0 == retries) {
-            free (data);
-            return fileServiceFailedSDB (fs, needLock, status);
+        if (SQLITE_DONE != status) {
+            sqlite3_reset (fs->sdbInsertStmt);
+            return fileServiceFailedSDBWithBufferFree (fs, needLock, bytes, status);
         }
     }
 
@@ -651,10 +874,32 @@ _fileServiceSave (BRFileService fs,
     if (needLock)
         pthread_mutex_unlock (&fs->lock);
 
-    free (data);
+    free (bytes);
+    return 1;
+}
 #endif // !defined(NEUTER_FILE_SERVICE)
 
+static int
+_fileServiceSave (BRFileService fs,
+                  const char *type,  /* block, peers, transactions, logs, ... */
+                  const void *entity,
+                  int needLock) {     /* BRMerkleBlock*, BRTransaction, BREthereumTransaction, ... */
+
+    BRFileServiceEntityType *entityType = fileServiceLookupType (fs, type);
+    if (NULL == entityType) { fileServiceFailedImpl (fs, 0, NULL, NULL, "missed type"); return 0; };
+
+    BRFileServiceEntityHandler *handler = fileServiceEntityTypeLookupHandler(entityType, entityType->currentVersion);
+    if (NULL == handler) { fileServiceFailedImpl (fs, 0, NULL, NULL, "missed type handler"); return 0; };
+
+#if !defined(NEUTER_FILE_SERVICE)
+    UInt256 identifier;
+    size_t  bytesCount;
+    uint8_t *bytes = _fileServiceEncode (fs, handler, entity, &identifier, &bytesCount);
+
+    return _fileServiceInsert (fs, type, u256hex(identifier), bytes, bytesCount, needLock);
+#else
     return 1;
+#endif // !defined(NEUTER_FILE_SERVICE)
 }
 
 extern int
@@ -664,13 +909,64 @@ fileServiceSave (BRFileService fs,
     return _fileServiceSave (fs, type, entity, 1);
 }
 
+extern int
+fileServiceSaveBatch (BRFileService fs,
+                      const char *type,
+                      const void **entities,
+                      size_t entitiesCount) {
+    BRFileServiceEntityType *entityType = fileServiceLookupType (fs, type);
+    if (NULL == entityType)
+        return fileServiceFailedImpl (fs, 0, NULL, NULL, "missed type");
+
+#if !defined(NEUTER_FILE_SERVICE)
+    sqlite3_status_code status;
+
+    pthread_mutex_lock (&fs->lock);
+    if (fs->sdbClosed)
+        return fileServiceFailedImpl (fs, 1, NULL, NULL, "closed");
+
+    status = _fileServiceBegin (fs);
+    if (SQLITE_OK != status)
+        return fileServiceFailedSDB (fs, 1, status);
+
+    for (size_t index = 0; index < entitiesCount; index++)
+        if (0 == _fileServiceSave (fs, type, entities[index], 0)) {
+            _fileServiceEnd (fs, false);
+            pthread_mutex_unlock (&fs->lock);
+            return 0;
+        }
+
+    status = _fileServiceEnd (fs, true);
+    if (SQLITE_OK != status)
+        return fileServiceFailedSDB (fs, 1, status);
+
+    pthread_mutex_unlock (&fs->lock);
+#endif // !defined(NEUTER_FILE_SERVICE)
+
+    return 1;
+}
+
 /// MARK: - Load
 
+#if !defined(NEUTER_FILE_SERVICE)
+///
+/// An entity read in an old version and encoded, pending its save, in the current version.
+///
+typedef struct {
+    UInt256 identifier;
+    uint8_t *bytes;
+    size_t   bytesCount;
+} BRFileServiceUpgrade;
+#endif
+
 extern int
-fileServiceLoad (BRFileService fs,
-                 BRSet *results,
-                 const char *type,
-                 int updateVersion) {
+fileServiceLoadIterate (BRFileService fs,
+                        const char *type,
+                        int updateVersion,
+                        const UInt256 *identifierMin,
+                        const UInt256 *identifierMax,
+                        BRFileServiceContext context,
+                        BRFileServiceLoadHandler loadHandler) {
     BRFileServiceEntityType *entityType = fileServiceLookupType (fs, type);
     if (NULL == entityType) return fileServiceFailedImpl (fs, 0, NULL, NULL, "missed type");
 
@@ -680,53 +976,68 @@ fileServiceLoad (BRFileService fs,
 #if !defined(NEUTER_FILE_SERVICE)
     sqlite3_status_code status;
 
+    // An unfiltered load uses the bounds covering every identifier; the hex encoding of an
+    // identifier sorts identically to its bytes.
+    UInt256 identifierFirst = UINT256_ZERO;
+    UInt256 identifierLast;
+    memset (identifierLast.u8, 0xff, sizeof (identifierLast.u8));
+
+    char hashMin[65], hashMax[65];
+    strcpy (hashMin, u256hex (NULL == identifierMin ? identifierFirst : *identifierMin));
+    strcpy (hashMax, u256hex (NULL == identifierMax ? identifierLast  : *identifierMax));
+
     pthread_mutex_lock (&fs->lock);
     if (fs->sdbClosed)
         return fileServiceFailedImpl (fs, 1, NULL, NULL, "closed");
 
-    sqlite3_reset (fs->sdbSelectAllStmt);
-    sqlite3_clear_bindings (fs->sdbSelectAllStmt);
+    sqlite3_stmt *stmt = fs->sdbSelectRangeStmt;
+
+    sqlite3_reset (stmt);
+    sqlite3_clear_bindings (stmt);
 
-    status = sqlite3_bind_text (fs->sdbSelectAllStmt, 1, type, -1, SQLITE_STATIC);
+    status = sqlite3_bind_text (stmt, 1, type, -1, SQLITE_STATIC);
     if (SQLITE_OK != status)
         return fileServiceFailedSDB (fs, 1, status);
 
-    uint8_t  dataBytesBuffer[8196];
-    uint8_t *dataBytes = dataBytesBuffer;
-    size_t   dataBytesCount = 8196;
+    status = sqlite3_bind_text (stmt, 2, hashMin, -1, SQLITE_TRANSIENT);
+    if (SQLITE_OK != status)
+        return fileServiceFailedSDB (fs, 1, status);
 
-    // Zero out the dataByte memory to avoid subsequent Clang Static Analysis errors releted
-    // to dereferencing uninitialized memory.  We accept this minimal, extraneous function call.
-    memset(dataBytes, 0, dataBytesCount);
+    status = sqlite3_bind_text (stmt, 3, hashMax, -1, SQLITE_TRANSIENT);
+    if (SQLITE_OK != status)
+        return fileServiceFailedSDB (fs, 1, status);
 
-    BRArrayOf(void*) entitiesToSave = NULL;
+    BRArrayOf(BRFileServiceUpgrade) upgrades = NULL;
 
-    while (SQLITE_ROW == sqlite3_step(fs->sdbSelectAllStmt)) {
-        const char *hash = (const char *) sqlite3_column_text (fs->sdbSelectAllStmt, 0);
-        const char *data = (const char *) sqlite3_column_text (fs->sdbSelectAllStmt, 1);
+    // On a failure we stop stepping and record the reason; reported once `stmt` is reset.
+    const char *failure = NULL;
+    bool failureIsEntity = false;
 
-        if (NULL == hash || NULL == data)
-            return fileServiceFailedImpl (fs, 1, (dataBytes == dataBytesBuffer ? NULL : dataBytes), NULL,
-                                          "missed query `hash` or `data`");
+    while (SQLITE_ROW == sqlite3_step (stmt)) {
+        const char *hash = (const char *) sqlite3_column_text (stmt, 0);
 
-        assert (64 == strlen (hash));
-        
-        // Ensure `dataBytes` is large enough for hex-decoded `data`
-        size_t dataCount = strlen (data);
-        assert (0 == dataCount % 2);  // Surely 'even'
-        if ((dataCount/2) > dataBytesCount) {
-            if (dataBytes != dataBytesBuffer) free (dataBytes);
-            dataBytesCount = dataCount/2;
-            dataBytes = malloc (dataBytesCount);
+        // The entity's bytes, directly from SQLite; valid until the next step.
+        const uint8_t *dataBytes      = sqlite3_column_blob  (stmt, 1);
+        size_t         dataBytesCount = (size_t) sqlite3_column_bytes (stmt, 1);
+
+        if (NULL == hash || NULL == dataBytes) {
+            failure = "missed query `hash` or `data`";
+            break;
         }
 
-        // Actually decode `data` into `dataBytes`
-        hexDecode (dataBytes, dataCount/2, data, dataCount);
+        assert (64 == strlen (hash));
+
+        // Assert the header remains in dataBytes
+        if (1 + 1 + sizeof (uint32_t) > dataBytesCount) {
+            assert (0); // In DEBUG builds.
+            failure = "missed header bytes count";
+            break;
+        }
 
         size_t offset = 0;
         BRFileServiceVersion version;
         uint32_t  entityBytesCount;
-        uint8_t  *entityBytes;
+        const uint8_t *entityBytes;
 
         BRFileServiceHeaderFormatVersion headerVersion = dataBytes[offset];
         offset += 1;
@@ -745,8 +1056,8 @@ fileServiceLoad (BRFileService fs,
         // Assert entityBytesCount remain in dataBytes
         if (offset + entityBytesCount > dataBytesCount) {
             assert (0); // In DEBUG builds.
-            return fileServiceFailedImpl (fs, 1, (dataBytes == dataBytesBuffer ? NULL : dataBytes), NULL,
-                                          "missed bytes count");
+            failure = "missed bytes count";
+            break;
         }
 
         entityBytes = &dataBytes[offset];
@@ -759,57 +1070,110 @@ fileServiceLoad (BRFileService fs,
 
         // Look up the entity handler
         BRFileServiceEntityHandler *handler = fileServiceEntityTypeLookupHandler(entityType, version);
-        if (NULL == handler)
-            return fileServiceFailedImpl (fs, 1, (dataBytes == dataBytesBuffer ? NULL : dataBytes), NULL,
-                                          "missed type handler");
-
-        // Read the entity from buffer and add to results.
-        void *entity = handler->reader (handler->context, fs, entityBytes, entityBytesCount);
-        if (NULL == entity)
-            return fileServiceFailedEntity (fs, 1, (dataBytes == dataBytesBuffer ? NULL : dataBytes), NULL,
-                                            type, "reader");
-
-        // Update results with the newly restored entity
-        void *oldEntity = BRSetAdd (results, entity);
-
-        // We should never have a `oldEntity` - there was an identifier clash.
-        if (NULL != oldEntity) {
-            assert (true);  // DEBUG builds
-            // TODO: Is this too harsh?
-            return fileServiceFailedEntity (fs, 1, (dataBytes == dataBytesBuffer ? NULL : dataBytes), NULL,
-                                            type, "duplicate set entry");
+        if (NULL == handler) {
+            failure = "missed type handler";
+            break;
         }
 
-        // If the read version is not the current version, update
+        // Read the entity from buffer.
+        void *entity = handler->reader (handler->context, fs, (uint8_t *) entityBytes, entityBytesCount);
+        if (NULL == entity) {
+            failure = "reader";
+            failureIsEntity = true;
+            break;
+        }
+
+        // If the read version is not the current version, encode the entity in the current
+        // version now - once handed off we can't reference it.  Save it after the query.
         if (updateVersion &&
             (version != entityType->currentVersion ||
              headerVersion != currentHeaderFormatVersion)) {
-            if (NULL == entitiesToSave) array_new (entitiesToSave, 100);
-            array_add (entitiesToSave, entity);
+            BRFileServiceUpgrade upgrade;
+            upgrade.bytes = _fileServiceEncode (fs, entityHandlerCurrent, entity,
+                                                &upgrade.identifier,
+                                                &upgrade.bytesCount);
+
+            if (NULL == upgrades) array_new (upgrades, 100);
+            array_add (upgrades, upgrade);
         }
+
+        // Hand off the entity; stop iterating if so directed.
+        if (!loadHandler (context, fs, type, entity))
+            break;
     }
 
     // Ensure the 'implicit DB transaction' is committed.
-    sqlite3_reset (fs->sdbSelectAllStmt);
+    sqlite3_reset (stmt);
 
     // Save any entities for which we upgraded a version.
-    if (NULL != entitiesToSave) {
-        for (size_t index = 0; index < array_count(entitiesToSave); index++)
+    if (NULL != upgrades) {
+        bool inTransaction = (SQLITE_OK == _fileServiceBegin (fs));
+        for (size_t index = 0; index < array_count(upgrades); index++)
             // This could signal an error.  Perhaps we should test the return result and
             // if `0` skip out here?  We won't - we couldn't save the entity in the new format
             // but we'll continue and will try next time we load it.
-            _fileServiceSave (fs, type, entitiesToSave[index], 0);
-        array_free (entitiesToSave);
+            _fileServiceInsert (fs, type,
+                                u256hex (upgrades[index].identifier),
+                                upgrades[index].bytes,
+                                upgrades[index].bytesCount,
+                                0);
+        if (inTransaction) _fileServiceEnd (fs, true);
+        array_free (upgrades);
     }
 
-    pthread_mutex_unlock (&fs->lock);
+    if (NULL != failure)
+        return (failureIsEntity
+                ? fileServiceFailedEntity (fs, 1, NULL, NULL, type, failure)
+                : fileServiceFailedImpl   (fs, 1, NULL, NULL, failure));
 
-    if (dataBytes != dataBytesBuffer) free (dataBytes);
+    pthread_mutex_unlock (&fs->lock);
 #endif // !defined(NEUTER_FILE_SERVICE)
 
     return 1;
 }
 
+typedef struct {
+    BRSet *results;
+    bool   duplicate;
+} BRFileServiceLoadSetContext;
+
+static int
+fileServiceLoadSetHandler (BRFileServiceContext context,
+                           BRFileService fs,
+                           const char *type,
+                           void *entity) {
+    BRFileServiceLoadSetContext *setContext = (BRFileServiceLoadSetContext *) context;
+
+    // Update results with the newly restored entity
+    void *oldEntity = BRSetAdd (setContext->results, entity);
+
+    // We should never have a `oldEntity` - there was an identifier clash.
+    if (NULL != oldEntity) {
+        assert (true);  // DEBUG builds
+        // TODO: Is this too harsh?
+        setContext->duplicate = true;
+        return 0;
+    }
+
+    return 1;
+}
+
+extern int
+fileServiceLoad (BRFileService fs,
+                 BRSet *results,
+                 const char *type,
+                 int updateVersion) {
+    BRFileServiceLoadSetContext context = { results, false };
+
+    if (!fileServiceLoadIterate (fs, type, updateVersion, NULL, NULL, &context, fileServiceLoadSetHandler))
+        return 0;
+
+    if (context.duplicate)
+        return fileServiceFailedEntity (fs, 0, NULL, NULL, type, "duplicate set entry");
+
+    return 1;
+}
+
 /// MARK: - Remove, Clear
 
 extern int
@@ -919,6 +1283,9 @@ fileServiceClearAll (BRFileService fs) {
 
 static int
 fileServiceReplaceFailed (BRFileService fs, int needUnlock) {
+#if !defined(NEUTER_FILE_SERVICE)
+    _fileServiceEnd (fs, false);
+#endif
     if (needUnlock) pthread_mutex_unlock (&fs->lock);
     return 0;
 }
@@ -939,7 +1306,7 @@ fileServiceReplace (BRFileService fs,
     if (fs->sdbClosed)
         return fileServiceFailedImpl (fs, 1, NULL, NULL, "closed");
 
-    status = sqlite3_exec (fs->sdb, "BEGIN", NULL, NULL, NULL);
+    status = _fileServiceBegin (fs);
     if (SQLITE_OK != status)
         return fileServiceFailedSDB (fs, 1, status);
 
@@ -950,7 +1317,7 @@ fileServiceReplace (BRFileService fs,
         if (0 == _fileServiceSave (fs, type, entities[index], 0))
             return fileServiceReplaceFailed (fs, 1);
 
-    status = sqlite3_exec (fs->sdb, "COMMIT", NULL, NULL, NULL);
+    status = _fileServiceEnd (fs, true);
     if (SQLITE_OK != status)
         return fileServiceFailedSDB (fs, 1, status);
 
@@ -1016,15 +1383,17 @@ fileServicePurge (BRFileService fs) {
     if (fs->sdbClosed)
         return fileServiceFailedImpl (fs, 1, sql, NULL, "closed");
 
-    status = sqlite3_exec (fs->sdb, "BEGIN", NULL, NULL, NULL);
+    status = _fileServiceBegin (fs);
     if (SQLITE_OK != status)
         return fileServiceFailedSDBWithBufferFree (fs, 1, sql, status);
 
     status = sqlite3_exec(fs->sdb, sql, NULL, NULL, NULL);
-    if (SQLITE_OK != status)
+    if (SQLITE_OK != status) {
+        _fileServiceEnd (fs, false);
         return fileServiceFailedSDBWithBufferFree (fs, 1, sql, status);
+    }
 
-    status = sqlite3_exec (fs->sdb, "COMMIT", NULL, NULL, NULL);
+    status = _fileServiceEnd (fs, true);
     if (SQLITE_OK != status)
         return fileServiceFailedSDBWithBufferFree (fs, 1, sql, status);
 
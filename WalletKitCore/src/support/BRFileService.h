@@ -129,11 +129,83 @@ fileServiceLoad (BRFileService fs,
                  const char *type,   /* blocks, peers, transactions, logs, ... */
                  int updateVersion);
 
+/**
+ * A function type to handle an entity loaded by `fileServiceLoadIterate()`.  The handler owns
+ * `entity`.  The handler is invoked with `fs` locked; therefore the handler must not itself
+ * invoke any `fs` function.
+ *
+ * @return true (1) to continue loading, false (0) to stop.
+ */
+typedef int
+(*BRFileServiceLoadHandler) (BRFileServiceContext context,
+                             BRFileService fs,
+                             const char *type,
+                             void *entity);
+
+/**
+ * Load entities of `type`, handing each, one at a time, to `handler`.  Unlike
+ * `fileServiceLoad()` the entities are never all held in memory by `fs`.  If `identifierMin`
+ * and/or `identifierMax` is not NULL then only entities with an identifier in the (inclusive)
+ * range, as compared bytewise, are loaded.  If there is an error then the fileServices' error
+ * handler is invoked and 0 is returned; entities already handed to `handler` remain with it.
+ *
+ * @param fs The fileService
+ * @param type The type to restore
+ * @param updateVersion If true (1) update old versions with newer ones.
+ * @param identifierMin The minimum identifier or NULL
+ * @param identifierMax The maximum identifier or NULL
+ * @param context The handler's context
+ * @param handler The handler
+ *
+ * @return true (1) if success, false (0) otherwise;
+ */
+extern int
+fileServiceLoadIterate (BRFileService fs,
+                        const char *type,
+                        int updateVersion,
+                        const UInt256 *identifierMin,
+                        const UInt256 *identifierMax,
+                        BRFileServiceContext context,
+                        BRFileServiceLoadHandler handler);
+
 extern int  // 1 -> success, 0 -> failure
 fileServiceSave (BRFileService fs,
                  const char *type,  /* block, peers, transactions, logs, ... */
                  const void *entity);     /* BRMerkleBlock*, BRTransaction, BREthereumTransaction, ... */
 
+/**
+ * Save all `entities` of `type` in a single DB transaction.  If there is an error then none are
+ * saved, the fileService's error handler is invoked and 0 is returned.
+ *
+ * @return true (1) if success, false (0) otherwise;
+ */
+extern int  // 1 -> success, 0 -> failure
+fileServiceSaveBatch (BRFileService fs,
+                      const char *type,
+                      const void **entities,
+                      size_t entitiesCount);
+
+/**
+ * Begin a batch.  Until the matching `fileServiceCommitBatch()` every save, remove, replace and
+ * clear is grouped into a single DB transaction - thereby avoiding a DB transaction (and a disk
+ * sync) for each one.  Batches nest; only the outermost commit actually commits.  A save,
+ * replace, purge, etc that fails within the batch rolls back only its own changes, and fails; the
+ * rest of the batch, including any other thread's batch, still commits.  Note that changes made
+ * by other threads, while a batch is in progress, are committed with the batch.
+ *
+ * @return true (1) if success, false (0) otherwise;
+ */
+extern int  // 1 -> success, 0 -> failure
+fileServiceBeginBatch (BRFileService fs);
+
+/**
+ * Commit a batch started with `fileServiceBeginBatch()`.
+ *
+ * @return true (1) if success, false (0) otherwise;
+ */
+extern int  // 1 -> success, 0 -> failure
+fileServiceCommitBatch (BRFileService fs);
+
 extern int  // 1 -> success, 0 -> failure
 fileServiceRemove (BRFileService fs,
                    const char *type,
@@ -173,7 +245,8 @@ typedef UInt256
                             const void* entity);
 
 /**
- * A function type to read an entity from a byte array.  You own the entity.
+ * A function type to read an entity from a byte array.  You own the entity.  The byte array is
+ * only valid for the duration of the call; it must not be modified.
  */
 typedef void*
 (*BRFileServiceReader) (BRFileServiceContext context,
@@ -39,6 +39,12 @@
 #define USE_BASIC_CONFIG       1
 #define ENABLE_MODULE_RECOVERY 1
 
+// window size of the precomputed ecmult tables used to verify signatures and recover pubkeys: 2^(w - 2) points of
+// 64 bytes, 512KiB for the default of 15; a smaller window trades verification speed for memory and startup time
+#ifndef BR_SECP256K1_ECMULT_WINDOW_SIZE
+#define BR_SECP256K1_ECMULT_WINDOW_SIZE 15
+#endif
+
 #pragma clang diagnostic push
 #pragma GCC diagnostic push
 #pragma clang diagnostic ignored "-Wconversion"
@@ -50,6 +56,8 @@
 #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
 #endif
 #include "secp256k1/src/basic-config.h"
+#undef ECMULT_WINDOW_SIZE
+#define ECMULT_WINDOW_SIZE     BR_SECP256K1_ECMULT_WINDOW_SIZE
 #include "secp256k1/src/secp256k1.c"
 #pragma clang diagnostic pop
 #pragma GCC diagnostic pop
@@ -85,6 +93,15 @@ static void _ctx_init()
     _ctx = secp256k1_context_create(SECP256K1_CONTEXT_SIGN | SECP256K1_CONTEXT_VERIFY);
 }
 
+// builds the shared secp256k1 context and its precomputed ecmult tables ahead of first use
+// the table size is set at build time with BR_SECP256K1_ECMULT_WINDOW_SIZE
+// returns the size in bytes of the verification tables
+size_t BRSecp256k1Precompute(void)
+{
+    pthread_once(&_ctx_once, _ctx_init);
+    return ECMULT_TABLE_SIZE(WINDOW_G)*sizeof(secp256k1_ge_storage);
+}
+
 // adds 256bit big endian ints a and b (mod secp256k1 order) and stores the result in a
 // returns true on success
 int BRSecp256k1ModAdd(UInt256 *a, const UInt256 *b)
@@ -126,6 +143,59 @@ int BRSecp256k1PointAdd(BRECPoint *p, const UInt256 *i)
             secp256k1_ec_pubkey_serialize(_ctx, (unsigned char *)p, &pLen, &pubkey, SECP256K1_EC_COMPRESSED));
 }
 
+// multiplies secp256k1 generator by each 256bit big endian int i[n] and adds the result to ec-point p, writing the sums
+// to points; the sums are converted from jacobian coordinates with a single shared field inversion
+// returns the number of leading points that are valid, count if all are
+size_t BRSecp256k1PointAddList(BRECPoint points[], const BRECPoint *p, const UInt256 i[], size_t count)
+{
+    secp256k1_ge ge, *ges = (count > 0) ? malloc(count*sizeof(*ges)) : NULL;
+    secp256k1_gej *gejs = (count > 0) ? malloc(count*sizeof(*gejs)) : NULL;
+    secp256k1_fe *zs = (count > 0) ? malloc(count*sizeof(*zs)) : NULL, zinv, acc;
+    secp256k1_scalar s;
+    size_t n, pLen;
+    int overflow;
+
+    assert(points != NULL || count == 0);
+    assert(p != NULL);
+    assert(i != NULL || count == 0);
+    assert(count == 0 || (ges != NULL && gejs != NULL && zs != NULL));
+    pthread_once(&_ctx_once, _ctx_init);
+
+    if (count == 0 || ! secp256k1_eckey_pubkey_parse(&ge, (const unsigned char *)p, sizeof(*p))) count = 0;
+
+    for (n = 0; n < count; n++) { // P(i[n]) + p, and the running product of the z coordinates of the valid sums
+        secp256k1_scalar_set_b32(&s, i[n].u8, &overflow);
+        secp256k1_ecmult_gen(&_ctx->ecmult_gen_ctx, &gejs[n], &s);
+        secp256k1_gej_add_ge_var(&gejs[n], &gejs[n], &ge, NULL);
+        if (overflow || secp256k1_gej_is_infinity(&gejs[n])) { count = n; break; }
+        if (n > 0) secp256k1_fe_mul(&zs[n], &zs[n - 1], &gejs[n].z);
+        else zs[n] = gejs[n].z;
+    }
+
+    if (count > 0) {
+        secp256k1_fe_inv_var(&acc, &zs[count - 1]); // acc = 1/(z[0]*...*z[count - 1])
+
+        for (n = count - 1; n > 0; n--) { // 1/z[n] = acc*z[0]*...*z[n - 1], then remove z[n] from acc
+            secp256k1_fe_mul(&zinv, &acc, &zs[n - 1]);
+            secp256k1_fe_mul(&acc, &acc, &gejs[n].z);
+            secp256k1_ge_set_gej_zinv(&ges[n], &gejs[n], &zinv);
+        }
+
+        secp256k1_ge_set_gej_zinv(&ges[0], &gejs[0], &acc);
+    }
+
+    for (n = 0; n < count; n++) {
+        pLen = sizeof(points[n]);
+        secp256k1_eckey_pubkey_serialize(&ges[n], points[n].p, &pLen, 1);
+    }
+
+    if (zs) free(zs);
+    if (gejs) free(gejs);
+    if (ges) free(ges);
+    secp256k1_scalar_clear(&s);
+    return count;
+}
+
 // multiplies secp256k1 ec-point p by 256bit big endian int i and stores the result in p
 // returns true on success
 int BRSecp256k1PointMul(BRECPoint *p, const UInt256 *i)
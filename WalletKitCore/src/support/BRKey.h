@@ -43,6 +43,11 @@ typedef struct {
     uint8_t p[33];
 } BRECPoint;
 
+// builds the shared secp256k1 context and its precomputed ecmult tables ahead of first use, e.g. from a background
+// thread at startup; the table size is set at build time with BR_SECP256K1_ECMULT_WINDOW_SIZE
+// returns the size in bytes of the verification tables
+size_t BRSecp256k1Precompute(void);
+
 // adds 256bit big endian ints a and b (mod secp256k1 order) and stores the result in a
 // returns true on success
 int BRSecp256k1ModAdd(UInt256 *a, const UInt256 *b);
@@ -59,6 +64,11 @@ int BRSecp256k1PointGen(BRECPoint *p, const UInt256 *i);
 // returns true on success
 int BRSecp256k1PointAdd(BRECPoint *p, const UInt256 *i);
 
+// multiplies secp256k1 generator by each 256bit big endian int i[n] and adds the result to ec-point p, writing the sums
+// to points; faster than calling BRSecp256k1PointAdd() for each
+// returns the number of leading points that are valid, count if all are
+size_t BRSecp256k1PointAddList(BRECPoint points[], const BRECPoint *p, const UInt256 i[], size_t count);
+
 // multiplies secp256k1 ec-point p by 256bit big endian int i and stores the result in p
 // returns true on success
 int BRSecp256k1PointMul(BRECPoint *p, const UInt256 *i);
@@ -26,6 +26,7 @@
 #include "BROSCompat.h"
 #include "time.h"
 #include "sys/time.h"
+#include <unistd.h>         // sysconf()
 
 #if defined (__APPLE__)
 #include <Security/Security.h>
@@ -87,6 +88,35 @@ pthread_cond_timedwait_relative_brd (pthread_cond_t *cond,
 #endif
 }
 
+extern size_t
+pthread_workers_count_brd (size_t count, size_t maxWorkers) {
+    long   cpus    = (count < 2 ? 1 : sysconf (_SC_NPROCESSORS_ONLN));
+    size_t workers = (cpus < 1 ? 1 : (size_t) cpus);
+
+    if (workers > maxWorkers) workers = maxWorkers;
+    if (workers > count)      workers = count;
+    return (0 == workers ? 1 : workers);
+}
+
+extern void
+pthread_run_jobs_brd (ThreadRoutine routine, void *jobs, size_t jobSize, size_t jobsCount) {
+    if (0 == jobsCount) return;
+
+    uint8_t  *bytes = jobs;
+    pthread_t threads[jobsCount];
+    int       started[jobsCount];
+
+    for (size_t index = 1; index < jobsCount; index++)
+        started[index] = (0 == pthread_create (&threads[index], NULL, routine, &bytes[index * jobSize]));
+
+    routine (&bytes[0]);
+
+    for (size_t index = 1; index < jobsCount; index++) {
+        if (started[index]) pthread_join (threads[index], NULL);
+        else routine (&bytes[index * jobSize]);
+    }
+}
+
 extern void
 arc4random_buf_brd (void *bytes, size_t bytesCount) {
 #if defined (__ANDROID__) || defined (__linux__)
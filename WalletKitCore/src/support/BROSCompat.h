@@ -84,6 +84,17 @@ pthread_cond_timedwait_relative_brd (pthread_cond_t *cond,
                                      pthread_mutex_t *mutex,
                                      const struct timespec *reltime);
 
+// The number of workers to split `count` items across: one per cpu, but at most `maxWorkers`
+// and at most `count`; at least one.
+extern size_t
+pthread_workers_count_brd (size_t count, size_t maxWorkers);
+
+// Runs `routine` on each of `jobsCount` jobs, each `jobSize` bytes and contiguous at `jobs`.  The
+// first job runs on the calling thread and each other job on a thread of its own, or on the calling
+// thread if its thread can't be created.  Returns once every job has run.
+extern void
+pthread_run_jobs_brd (ThreadRoutine routine, void *jobs, size_t jobSize, size_t jobsCount);
+
 extern void
 arc4random_buf_brd (void *bytes, size_t bytesCount);
 
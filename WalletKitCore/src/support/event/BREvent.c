@@ -20,10 +20,18 @@
 #define PTHREAD_STACK_SIZE (512 * 1024)
 #define PTHREAD_NAME_SIZE   (33)
 
+// The maximum number of events an executor thread dispatches for one handler before moving on
+// to the next handler with pending events.
+#define EVENT_EXECUTOR_DISPATCH_LIMIT   (16)
+
 /* Forward Declarations */
 static void *
 eventHandlerThread (BREventHandler handler);
 
+static void
+eventExecutorSchedule (BREventExecutor executor,
+                       BREventHandler handler);
+
 //
 // Event Handler
 //
@@ -69,6 +77,50 @@ struct BREventHandlerRecord {
 
     // A lock for protecting the dispatch call.  Optional but recommended.
     pthread_mutex_t *lockOnDispatch;
+
+    // (Optional) Executor; if provided, `thread` is unused.  The `executor*` fields are
+    // protected by the executor's lock.
+
+    BREventExecutor executor;
+
+    /// True (1) if started.
+    int executorRunning;
+
+    /// True (1) if on the executor's ready list or if dispatching.
+    int executorScheduled;
+
+    /// The executor thread dispatching events, if any.
+    pthread_t executorThread;
+
+    /// The next handler on the executor's ready list.
+    BREventHandler executorNext;
+};
+
+//
+// Event Executor
+//
+struct BREventExecutorRecord {
+    char name[PTHREAD_NAME_SIZE];
+
+    // The threads dispatching events.
+    size_t threadsCount;
+    pthread_t *threads;
+
+    // A linked-list (through handler->executorNext) of handlers with pending events.
+    BREventHandler ready;
+    BREventHandler readyLast;
+
+    // A 'quit' flag
+    int quit;
+
+    // A lock on internal state, including each handler's `executor*` fields.
+    pthread_mutex_t lock;
+
+    // Signaled when `ready` is extended or on `quit`
+    pthread_cond_t readyCond;
+
+    // Signaled when a handler's dispatch completes.
+    pthread_cond_t idleCond;
 };
 
 extern BREventHandler
@@ -106,8 +158,11 @@ eventHandlerCreate (const char *name,
 
     handler->thread = PTHREAD_NULL;
 
+    handler->executor = NULL;
+    handler->executorThread = PTHREAD_NULL;
+
     handler->scratch = (BREvent*) calloc (1, handler->eventSize);
-    handler->queue = eventQueueCreate (handler->eventSize);
+    handler->queue = eventQueueCreate (handler->eventSize, EVENT_QUEUE_TYPE_RING);
 
     return handler;
 }
@@ -175,13 +230,22 @@ eventHandlerThread (BREventHandler handler) {
     return NULL;
 }
 
+extern void
+eventHandlerSetExecutor (BREventHandler handler,
+                         BREventExecutor executor) {
+    pthread_mutex_lock (&handler->lock);
+    assert (PTHREAD_NULL == handler->thread && !handler->executorRunning);
+    handler->executor = executor;
+    pthread_mutex_unlock (&handler->lock);
+}
+
 extern void
 eventHandlerDestroy (BREventHandler handler) {
     // First stop...
     eventHandlerStop(handler);
 
     // ... then kill
-    assert (PTHREAD_NULL == handler->thread);
+    assert (PTHREAD_NULL == handler->thread && !handler->executorRunning);
     pthread_mutex_destroy(&handler->lock);
 
     // release memory
@@ -204,7 +268,29 @@ extern void
 eventHandlerStart (BREventHandler handler) {
     alarmClockCreateIfNecessary(1);
     pthread_mutex_lock(&handler->lock);
-    if (PTHREAD_NULL == handler->thread) {
+    if (NULL != handler->executor) {
+        // Only changed with `handler->lock` held; thus safe to read.
+        if (!handler->executorRunning) {
+            BREventExecutor executor = handler->executor;
+
+            pthread_mutex_lock (&executor->lock);
+            handler->executorRunning = 1;
+            pthread_mutex_unlock (&executor->lock);
+
+            // If we have an timeout event dispatcher, then add an alarm.
+            if (NULL != handler->timeoutEventType.eventDispatcher) {
+                handler->timeoutAlarmId = alarmClockAddAlarmPeriodic (alarmClock,
+                                                                      (BREventAlarmContext) handler,
+                                                                      (BREventAlarmCallback) eventHandlerAlarmCallback,
+                                                                      handler->timeout);
+            }
+
+            // Dispatch any already queued events.
+            if (eventQueueHasPending (handler->queue))
+                eventExecutorSchedule (executor, handler);
+        }
+    }
+    else if (PTHREAD_NULL == handler->thread) {
         // If we have an timeout event dispatcher, then add an alarm.
         if (NULL != handler->timeoutEventType.eventDispatcher) {
             handler->timeoutAlarmId = alarmClockAddAlarmPeriodic (alarmClock,
@@ -249,7 +335,46 @@ eventHandlerStart (BREventHandler handler) {
 extern void
 eventHandlerStop (BREventHandler handler) {
     pthread_mutex_lock(&handler->lock);
-    if (PTHREAD_NULL != handler->thread) {
+    if (NULL != handler->executor) {
+        // Only changed with `handler->lock` held; thus safe to read.
+        if (handler->executorRunning) {
+            BREventExecutor executor = handler->executor;
+
+            // Remove a timeout alarm, if it exists.  Not with `executor->lock` held, as the
+            // alarm's callback schedules the handler.
+            if (ALARM_ID_NONE != handler->timeoutAlarmId) {
+                alarmClockRemAlarm (alarmClock, handler->timeoutAlarmId);
+                handler->timeoutAlarmId = ALARM_ID_NONE;
+            }
+
+            pthread_mutex_lock (&executor->lock);
+            handler->executorRunning = 0;
+
+            // If on the ready list, remove it ...
+            if (handler->executorScheduled && PTHREAD_NULL == handler->executorThread) {
+                BREventHandler prev = NULL, this = executor->ready;
+                while (this != handler) { prev = this; this = this->executorNext; }
+
+                if (NULL == prev) executor->ready = handler->executorNext;
+                else prev->executorNext = handler->executorNext;
+
+                if (executor->readyLast == handler) executor->readyLast = prev;
+
+                handler->executorNext = NULL;
+                handler->executorScheduled = 0;
+            }
+
+            // ... otherwise wait for the dispatch to complete, unless stopping from a dispatch.
+            else
+                while (handler->executorScheduled &&
+                       !pthread_equal (pthread_self(), handler->executorThread))
+                    pthread_cond_wait (&executor->idleCond, &executor->lock);
+            pthread_mutex_unlock (&executor->lock);
+
+            eventHandlerClear (handler);
+        }
+    }
+    else if (PTHREAD_NULL != handler->thread) {
         // Remove a timeout alarm, if it exists.
         if (ALARM_ID_NONE != handler->timeoutAlarmId) {
             alarmClockRemAlarm (alarmClock, handler->timeoutAlarmId);
@@ -273,6 +398,17 @@ eventHandlerStop (BREventHandler handler) {
 
 extern int
 eventHandlerIsCurrentThread (BREventHandler handler) {
+    if (NULL != handler->executor) {
+        // `executorRunning` and `executorThread` are changed with `executor->lock` held.
+        BREventExecutor executor = handler->executor;
+
+        pthread_mutex_lock (&executor->lock);
+        int isCurrent = !handler->executorRunning || pthread_equal (pthread_self(), handler->executorThread);
+        pthread_mutex_unlock (&executor->lock);
+
+        return isCurrent;
+    }
+
     // TODO(fix): This is a hack; fix the ordering such that `handler->thread` is
     //            is properly set by the time `eventHandlerThread()` runs (CORE-564)
     return PTHREAD_NULL == handler->thread || pthread_self() == handler->thread;
@@ -280,20 +416,40 @@ eventHandlerIsCurrentThread (BREventHandler handler) {
 
 extern int
 eventHandlerIsRunning (BREventHandler handler) {
+    if (NULL != handler->executor) {
+        BREventExecutor executor = handler->executor;
+
+        pthread_mutex_lock (&executor->lock);
+        int isRunning = handler->executorRunning;
+        pthread_mutex_unlock (&executor->lock);
+
+        return isRunning;
+    }
+
     return PTHREAD_NULL != handler->thread;
 }
 
 extern BREventStatus
 eventHandlerSignalEvent (BREventHandler handler,
                          BREvent *event) {
-    eventQueueEnqueueTailSignal (handler->queue, event);
+    if (NULL != handler->executor) {
+        eventQueueEnqueueTail (handler->queue, event);
+        eventExecutorSchedule (handler->executor, handler);
+    }
+    else
+        eventQueueEnqueueTailSignal (handler->queue, event);
     return EVENT_STATUS_SUCCESS;
 }
 
 extern BREventStatus
 eventHandlerSignalEventOOB (BREventHandler handler,
                             BREvent *event) {
-    eventQueueEnqueueHeadSignal (handler->queue, event);
+    if (NULL != handler->executor) {
+        eventQueueEnqueueHead (handler->queue, event);
+        eventExecutorSchedule (handler->executor, handler);
+    }
+    else
+        eventQueueEnqueueHeadSignal (handler->queue, event);
     return EVENT_STATUS_SUCCESS;
 }
 
@@ -301,3 +457,148 @@ extern void
 eventHandlerClear (BREventHandler handler) {
     eventQueueClear(handler->queue);
 }
+
+BREventExecutor eventExecutor = NULL;
+static pthread_mutex_t eventExecutorLock = PTHREAD_MUTEX_INITIALIZER;
+
+extern void
+eventExecutorCreateIfNecessary (size_t threadsCount) {
+    pthread_mutex_lock (&eventExecutorLock);
+    if (NULL == eventExecutor)
+        eventExecutor = eventExecutorCreate ("Core Executor", threadsCount);
+    pthread_mutex_unlock (&eventExecutorLock);
+}
+
+static void
+eventExecutorSchedule (BREventExecutor executor,
+                       BREventHandler handler) {
+    pthread_mutex_lock (&executor->lock);
+
+    // If the handler is dispatching, it will be rescheduled if it has pending events.
+    if (handler->executorRunning && !handler->executorScheduled) {
+        handler->executorScheduled = 1;
+        handler->executorNext = NULL;
+
+        if (NULL == executor->ready)
+            executor->ready = handler;
+        else
+            executor->readyLast->executorNext = handler;
+        executor->readyLast = handler;
+
+        pthread_cond_signal (&executor->readyCond);
+    }
+
+    pthread_mutex_unlock (&executor->lock);
+}
+
+static void *
+eventExecutorThread (BREventExecutor executor) {
+    pthread_setname_brd (pthread_self(), executor->name);
+
+    pthread_mutex_lock (&executor->lock);
+    while (1) {
+        while (!executor->quit && NULL == executor->ready)
+            pthread_cond_wait (&executor->readyCond, &executor->lock);
+
+        if (executor->quit) break;
+
+        // Take the first ready handler; it remains scheduled and thus no other thread will
+        // dispatch its events.
+        BREventHandler handler = executor->ready;
+
+        executor->ready = handler->executorNext;
+        if (NULL == executor->ready) executor->readyLast = NULL;
+
+        handler->executorNext = NULL;
+        handler->executorThread = pthread_self();
+        pthread_mutex_unlock (&executor->lock);
+
+        for (size_t count = 0;
+             count < EVENT_EXECUTOR_DISPATCH_LIMIT &&
+             EVENT_STATUS_SUCCESS == eventQueueDequeue (handler->queue, handler->scratch);
+             count++) {
+            if (handler->lockOnDispatch) pthread_mutex_lock (handler->lockOnDispatch);
+            handler->scratch->type->eventDispatcher (handler, handler->scratch);
+            if (handler->lockOnDispatch) pthread_mutex_unlock (handler->lockOnDispatch);
+        }
+
+        pthread_mutex_lock (&executor->lock);
+        handler->executorThread = PTHREAD_NULL;
+
+        // With more events, go to the back of the line; other handlers are waiting.
+        if (handler->executorRunning && eventQueueHasPending (handler->queue)) {
+            if (NULL == executor->ready)
+                executor->ready = handler;
+            else
+                executor->readyLast->executorNext = handler;
+            executor->readyLast = handler;
+        }
+        else {
+            handler->executorScheduled = 0;
+            pthread_cond_broadcast (&executor->idleCond);
+        }
+    }
+    pthread_mutex_unlock (&executor->lock);
+
+    return NULL;
+}
+
+extern BREventExecutor
+eventExecutorCreate (const char *name,
+                     size_t threadsCount) {
+    BREventExecutor executor = calloc (1, sizeof (struct BREventExecutorRecord));
+
+    strlcpy (executor->name, name, PTHREAD_NAME_SIZE);
+
+    executor->ready = NULL;
+    executor->readyLast = NULL;
+    executor->quit = 0;
+
+    pthread_mutex_init_brd (&executor->lock, PTHREAD_MUTEX_NORMAL);
+
+    // Create the PTHREAD CONDition variables
+    {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_cond_init(&executor->readyCond, &attr);
+        pthread_cond_init(&executor->idleCond,  &attr);
+        pthread_condattr_destroy(&attr);
+    }
+
+    executor->threadsCount = threadsCount;
+    executor->threads = calloc (threadsCount, sizeof (pthread_t));
+
+    // Spawn the eventExecutorThreads
+    {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+        pthread_attr_setstacksize(&attr, PTHREAD_STACK_SIZE);
+
+        for (size_t index = 0; index < threadsCount; index++)
+            pthread_create (&executor->threads[index], &attr, (ThreadRoutine) eventExecutorThread, executor);
+
+        pthread_attr_destroy(&attr);
+    }
+
+    return executor;
+}
+
+extern void
+eventExecutorDestroy (BREventExecutor executor) {
+    pthread_mutex_lock (&executor->lock);
+    assert (NULL == executor->ready);
+    executor->quit = 1;
+    pthread_cond_broadcast (&executor->readyCond);
+    pthread_mutex_unlock (&executor->lock);
+
+    for (size_t index = 0; index < executor->threadsCount; index++)
+        pthread_join (executor->threads[index], NULL);
+
+    pthread_cond_destroy (&executor->readyCond);
+    pthread_cond_destroy (&executor->idleCond);
+    pthread_mutex_destroy (&executor->lock);
+
+    free (executor->threads);
+    free (executor);
+}
@@ -21,6 +21,7 @@ extern "C" {
 
 /* Forward Declarations */
 typedef struct BREventHandlerRecord *BREventHandler;
+typedef struct BREventExecutorRecord *BREventExecutor;
 
 typedef struct BREventTypeRecord BREventType;
 typedef struct BREventRecord BREvent;
@@ -124,6 +125,15 @@ eventHandlerSetTimeoutDispatcher (BREventHandler handler,
                                   BREventDispatcher dispatcher,
                                   BREventTimeoutContext context);
 
+/**
+ * Optionally dispatch `handler` events on the threads of `executor` rather than on a thread of
+ * the handler's own.  Events remain dispatched one at a time, in order, and with the handler's
+ * `lock` held.  Must be called before `eventHandlerStart()`.
+ */
+extern void
+eventHandlerSetExecutor (BREventHandler handler,
+                         BREventExecutor executor);
+
 extern void
 eventHandlerDestroy (BREventHandler handler);
 
@@ -175,6 +185,31 @@ eventHandlerSignalEventOOB (BREventHandler handler,
 extern void
 eventHandlerClear (BREventHandler handler);
 
+//
+// Event Executor
+//
+// An executor dispatches the events of many handlers on a fixed number of threads.  A handler
+// is dispatched by at most one executor thread at a time.
+//
+
+extern BREventExecutor eventExecutor;
+
+/**
+ * Create `eventExecutor`, the default executor, with `threadsCount` threads.
+ */
+extern void
+eventExecutorCreateIfNecessary (size_t threadsCount);
+
+extern BREventExecutor
+eventExecutorCreate (const char *name,
+                     size_t threadsCount);
+
+/**
+ * Destroy `executor`.  All handlers using `executor` must be stopped.
+ */
+extern void
+eventExecutorDestroy (BREventExecutor executor);
+
 #ifdef __cplusplus
 }
 #endif
@@ -15,12 +15,16 @@
 #include <sys/time.h>
 #include "support/BRAssert.h"
 #include "support/BRArray.h"
+#include "support/BRSet.h"
 #include "support/BROSCompat.h"
 #include "BREvent.h"
 #include "BREventAlarm.h"
 
 #define PTHREAD_STACK_SIZE   (32 * 1024)
 
+// Alarms expiring within this period of one another are expired on the same wakeup.
+#define ALARM_CLOCK_COALESCE_NANOSECONDS   (1000000)     // 1 millisecond
+
 /* Explicitly import (from BREvent.c) */
 extern void
 eventHandlerInvokeTimeout (BREventHandler handler);
@@ -98,35 +102,65 @@ typedef struct {
 
     /// The alarm's period.  For a ONE_SHOT alarm, this is ignored/zeroed.
     struct timespec period;
+
+    /// The order of insertion into the clock; orders alarms with identical expirations.
+    uint64_t sequence;
+
+    /// The index in the clock's heap of alarms.
+    size_t index;
 } BREventAlarm;
 
-static BREventAlarm
+static BREventAlarm *
 alarmCreatePeriodic (BREventAlarmContext context,
                      BREventAlarmCallback callback,
                      struct timespec expiration,  // first expiration...
                      struct timespec period,      // ...thereafter increment
                      BREventAlarmId identifier) {
-    return (BREventAlarm) {
+    BREventAlarm *alarm = malloc (sizeof (BREventAlarm));
+    *alarm = (BREventAlarm) {
         .type = ALARM_PERIODIC,
         .identifier = identifier,
         .context = context,
         .callback = callback,
         .expiration = expiration,
         .period = period };
+    return alarm;
 }
 
-static BREventAlarm
+static BREventAlarm *
 alarmCreate (BREventAlarmContext context,
              BREventAlarmCallback callback,
              struct timespec expiration,
              BREventAlarmId identifier) {
-    return (BREventAlarm) {
+    BREventAlarm *alarm = malloc (sizeof (BREventAlarm));
+    *alarm = (BREventAlarm) {
         .type = ALARM_ONE_SHOT,
         .identifier = identifier,
         .context = context,
         .callback = callback,
         .expiration = expiration,
         .period = { .tv_sec = 0, .tv_nsec = 0 } };
+    return alarm;
+}
+
+static size_t
+alarmHashValue (const void *alarm) {
+    // Identifiers are sequential; spread them so as to avoid long BRSet probe sequences.
+    return (size_t) (((const BREventAlarm *) alarm)->identifier * 2654435761u);
+}
+
+static int
+alarmHashEqual (const void *alarm1, const void *alarm2) {
+    return ((const BREventAlarm *) alarm1)->identifier == ((const BREventAlarm *) alarm2)->identifier;
+}
+
+///
+/// Check if `alarm1` expires before `alarm2`.
+///
+static int
+alarmPrecedes (BREventAlarm *alarm1, BREventAlarm *alarm2) {
+    int compare = timespecCompare (&alarm1->expiration, &alarm2->expiration);
+    return -1 == compare || (0 == compare && alarm1->sequence < alarm2->sequence);
 }
 
 static int
@@ -160,8 +194,14 @@ struct BREventAlarmClock {
     /// Identifier of the next alarm created.
     BREventAlarmId identifier;
 
-    /// An BRArrayOf alarms, sorted by alarm.expiration ascending.
-    BREventAlarm *alarms;
+    /// A BRArrayOf alarms, as a binary min-heap on alarm.expiration.  The first alarm expires next.
+    BRArrayOf(BREventAlarm*) alarms;
+
+    /// A BRSetOf alarms, by identifier.
+    BRSetOf(BREventAlarm*) alarmsByIdentifier;
+
+    /// The sequence of the next alarm inserted.
+    uint64_t sequence;
 
     /// The time of the next timeout
     struct timespec timeout;
@@ -189,6 +229,7 @@ alarmClockCreate (void) {
 
     clock->identifier = ALARM_ID_NONE;
     array_new(clock->alarms, 5);
+    clock->alarmsByIdentifier = BRSetNew (alarmHashValue, alarmHashEqual, 5);
 
     // Create the PTHREAD CONDition variable
     {
@@ -223,23 +264,91 @@ alarmClockDestroy (BREventAlarmClock clock) {
     pthread_mutex_destroy(&clock->lockOnStartStop);
 
     array_free (clock->alarms);
+    BRSetFreeAll (clock->alarmsByIdentifier, free);
     if (clock == alarmClock)
-        free (alarmClock);
         alarmClock = NULL;
+    free (clock);
 }
 
+/// MARK: - Heap
+
 static void
-alarmClockInsertAlarm (BREventAlarmClock clock,
-                       BREventAlarm alarm) {
+alarmClockHeapSet (BREventAlarmClock clock,
+                   size_t index,
+                   BREventAlarm *alarm) {
+    clock->alarms[index] = alarm;
+    alarm->index = index;
+}
+
+static void
+alarmClockHeapUp (BREventAlarmClock clock,
+                  size_t index) {
+    BREventAlarm *alarm = clock->alarms[index];
+
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (!alarmPrecedes (alarm, clock->alarms[parent])) break;
+
+        alarmClockHeapSet (clock, index, clock->alarms[parent]);
+        index = parent;
+    }
+    alarmClockHeapSet (clock, index, alarm);
+}
+
+static void
+alarmClockHeapDown (BREventAlarmClock clock,
+                    size_t index) {
     size_t count = array_count (clock->alarms);
-    size_t index = count;
+    BREventAlarm *alarm = clock->alarms[index];
+
+    while (1) {
+        size_t child = 2 * index + 1;
+        if (child >= count) break;
+
+        // The earlier of the two children
+        if (child + 1 < count && alarmPrecedes (clock->alarms[child + 1], clock->alarms[child]))
+            child += 1;
+
+        if (!alarmPrecedes (clock->alarms[child], alarm)) break;
 
-    for (; index > 0; index--) {
-        // If alarm.expiration is not less than 'alarm at index-1', then insert alarm at index
-        if (-1 != timespecCompare(&alarm.expiration, &clock->alarms[index - 1].expiration))
-            break;
+        alarmClockHeapSet (clock, index, clock->alarms[child]);
+        index = child;
+    }
+    alarmClockHeapSet (clock, index, alarm);
+}
+
+///
+/// Insert `alarm` into the heap; O(log n).  Return true (1) if `alarm` now expires first.
+///
+static int
+alarmClockInsertAlarm (BREventAlarmClock clock,
+                       BREventAlarm *alarm) {
+    alarm->sequence = clock->sequence++;
+
+    array_add (clock->alarms, alarm);
+    alarmClockHeapUp (clock, array_count (clock->alarms) - 1);
+
+    return alarm == clock->alarms[0];
+}
+
+///
+/// Remove `alarm` from the heap; O(log n).
+///
+static void
+alarmClockRemoveAlarm (BREventAlarmClock clock,
+                       BREventAlarm *alarm) {
+    size_t index = alarm->index;
+    size_t last  = array_count (clock->alarms) - 1;
+
+    BREventAlarm *alarmLast = clock->alarms[last];
+    array_rm_last (clock->alarms);
+
+    // Fill the hole with the last alarm and restore the heap, either up or down.
+    if (index != last) {
+        alarmClockHeapSet (clock, index, alarmLast);
+        alarmClockHeapDown (clock, index);
+        alarmClockHeapUp   (clock, alarmLast->index);
     }
-    array_insert (clock->alarms, index, alarm);
 }
 
 static void *
@@ -251,42 +360,40 @@ alarmClockThread (BREventAlarmClock clock) {
     clock->threadQuit = 0;
 
     while (!clock->threadQuit) {
+        // Expire every alarm that has expired, or will shortly, so that alarms with nearly the
+        // same expiration need but one wakeup.
+        struct timespec now = getTime();
+        struct timespec coalesce = { .tv_sec = 0, .tv_nsec = ALARM_CLOCK_COALESCE_NANOSECONDS };
+        timespecInc (&now, &coalesce);
+
+        while (array_count (clock->alarms) > 0 &&
+               1 != timespecCompare (&clock->alarms[0]->expiration, &now)) {
+            BREventAlarm *alarm = clock->alarms[0];
+
+            // Remove the alarm from the clock's alarms (for now; if periodic, add it back)
+            alarmClockRemoveAlarm (clock, alarm);
+
+            // Expire the alarm - invokes the callback.
+            alarmExpire (alarm, clock);
+
+            // If periodic, update the alarm expiration and reinsert
+            if (alarmIsPeriodic (alarm)) {
+                alarmPeriodUpdate (alarm);
+                alarmClockInsertAlarm (clock, alarm);
+            }
+            else {
+                BRSetRemove (clock->alarmsByIdentifier, alarm);
+                free (alarm);
+            }
+        }
+
         // Set the next timeout - based on an existing alarm or 'forever in the future'
         clock->timeout = (array_count(clock->alarms) > 0
-                          ? clock->alarms[0].expiration
+                          ? clock->alarms[0]->expiration
                           : (struct timespec) { .tv_sec = LONG_MAX, .tv_nsec = 0 });
 
-        switch (pthread_cond_timedwait (&clock->cond, &clock->lock, &clock->timeout)) {
-            case ETIMEDOUT: {
-                // Check if alarm was removed while we slept...
-                if (0 == array_count(clock->alarms) ||
-                    0 != timespecCompare(&clock->alarms[0].expiration, &clock->timeout)) {
-                    // ... ignore the timeout, its alarm is for the birds now
-                    break;
-                }
-
-                // If we timed-out, then get the alarm that has expired...
-                BREventAlarm alarm = clock->alarms[0];
-                // ... and remove it from the clock's alarms (for now; if periodic, add it back)
-                array_rm (clock->alarms, 0);
-
-                // Expire the alarm - invokes the callback.
-                alarmExpire(&alarm, clock);
-
-                // If periodic, update the alarm expiration and reinsert
-                if (alarmIsPeriodic(&alarm)) {
-                    alarmPeriodUpdate(&alarm);
-                    alarmClockInsertAlarm(clock, alarm);
-                }
-
-                break;
-            }
-
-            default:
-                // Update clock->timeout (above, presumably an alarm was added) and wait again.
-                // Or clock->threadQuit is set.
-                break;
-        }
+        // Wait for the timeout, for an alarm that expires before the timeout or to quit.
+        pthread_cond_timedwait (&clock->cond, &clock->lock, &clock->timeout);
     }
 
     // Requires as `cond_wait` takes its mutex when signalled.
@@ -336,9 +443,24 @@ alarmClockAssertRecovery (BREventAlarmClock clock) {
     alarmClockStop(clock);
     pthread_mutex_lock(&clock->lockOnStartStop);
     array_clear(clock->alarms);
+    BRSetFreeAll (clock->alarmsByIdentifier, free);
+    clock->alarmsByIdentifier = BRSetNew (alarmHashValue, alarmHashEqual, 5);
     pthread_mutex_unlock(&clock->lockOnStartStop);
 }
 
+static BREventAlarmId
+alarmClockAddAlarmInternal (BREventAlarmClock clock,
+                            BREventAlarm *alarm) {
+    BRSetAdd (clock->alarmsByIdentifier, alarm);
+
+    // Having modified `alarms` we might need to compute a new 'next expiration'; but only if
+    // `alarm` is now the first to expire.
+    if (alarmClockInsertAlarm (clock, alarm))
+        pthread_cond_signal(&clock->cond);
+
+    return alarm->identifier;
+}
+
 extern BREventAlarmId
 alarmClockAddAlarmPeriodic (BREventAlarmClock clock,
                             BREventAlarmContext context,
@@ -346,9 +468,7 @@ alarmClockAddAlarmPeriodic (BREventAlarmClock clock,
                             struct timespec period) {
     pthread_mutex_lock(&clock->lock);
     BREventAlarmId identifier = ++clock->identifier;
-    alarmClockInsertAlarm(clock, alarmCreatePeriodic(context, callback, getTime(), period, identifier));
-    // Having modified `alarms` we need to compute a new 'next expiration'
-    pthread_cond_signal(&clock->cond);
+    alarmClockAddAlarmInternal (clock, alarmCreatePeriodic(context, callback, getTime(), period, identifier));
     pthread_mutex_unlock(&clock->lock);
     return identifier;
 }
@@ -360,9 +480,7 @@ alarmClockAddAlarm (BREventAlarmClock clock,
                     struct timespec expiration) {
     pthread_mutex_lock(&clock->lock);
     BREventAlarmId identifier = ++clock->identifier;
-    alarmClockInsertAlarm(clock, alarmCreate(context, callback, expiration, identifier));
-    // Having modified `alarms` we need to compute a new 'next expiration'
-    pthread_cond_signal(&clock->cond);
+    alarmClockAddAlarmInternal (clock, alarmCreate(context, callback, expiration, identifier));
     pthread_mutex_unlock(&clock->lock);
     return identifier;
 }
@@ -370,28 +488,25 @@ alarmClockAddAlarm (BREventAlarmClock clock,
 extern void
 alarmClockRemAlarm (BREventAlarmClock clock,
                     BREventAlarmId identifier) {
+    BREventAlarm key = { .identifier = identifier };
+
     pthread_mutex_lock(&clock->lock);
-    for (size_t index = 0; index < array_count (clock->alarms); index++)
-        if (identifier == clock->alarms[index].identifier) {
-            array_rm(clock->alarms, index);
-            break;
-        }
-    // Having modified `alarms` we need to compute a new 'next expiration'
-    pthread_cond_signal(&clock->cond);
+    BREventAlarm *alarm = BRSetRemove (clock->alarmsByIdentifier, &key);
+    if (NULL != alarm) {
+        alarmClockRemoveAlarm (clock, alarm);
+        free (alarm);
+    }
+    // No need to signal; if `alarm` was the first to expire, the wakeup finds nothing expired.
     pthread_mutex_unlock(&clock->lock);
 }
 
 extern int
 alarmClockHasAlarm (BREventAlarmClock clock,
                     BREventAlarmId identifier) {
-    int hasAlarm = 0;
+    BREventAlarm key = { .identifier = identifier };
 
     pthread_mutex_lock(&clock->lock);
-    for (int index = 0; index < array_count (clock->alarms); index++)
-        if (identifier == clock->alarms[index].identifier) {
-            hasAlarm = 1;
-            break;
-        }
+    int hasAlarm = (NULL != BRSetGet (clock->alarmsByIdentifier, &key));
     pthread_mutex_unlock(&clock->lock);
 
     return hasAlarm;
@@ -10,6 +10,9 @@
 //
 
 #include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
 #include <pthread.h>
 #include "support/BROSCompat.h"
 
@@ -17,19 +20,50 @@
 
 #define EVENT_QUEUE_DEFAULT_INITIAL_CAPACITY   (1)
 
+// The number of slots in an EVENT_QUEUE_TYPE_RING ring; must be a power of two.
+#define EVENT_QUEUE_RING_CAPACITY              (256)
+
+///
+/// A ring slot holds an event, of up to the queue's `size`, and a sequence number.  Relative to
+/// a position in the ring, the sequence number says if the slot is free, at `position`, or filled,
+/// at `position + 1`.  (See D. Vyukov, 'Bounded MPMC queue')
+///
+typedef struct {
+    atomic_size_t sequence;
+    struct BREventRecord event;  // ... extended to the queue's `size`
+} BREventQueueSlot;
+
 struct BREventQueueRecord {
-    // A linked-list (through event->next) of pending events.
+    BREventQueueType type;
+
+    // A linked-list (through event->next) of pending events.  For EVENT_QUEUE_TYPE_RING, these
+    // are the events enqueued when the ring was full.
     BREvent *pending;
+    BREvent *pendingLast;
+    atomic_size_t pendingCount;
+
+    // A linked-list (through event->next) of pending OOB events; these precede all others.
+    BREvent *pendingOOB;
 
     // A linked-list (through event->next) of available events
     BREvent *available;
 
+    // The EVENT_QUEUE_TYPE_RING ring.  Producers claim a slot by advancing `ringTail`; the one
+    // consumer, holding `lock`, advances `ringHead`.
+    uint8_t *ring;
+    size_t ringSlotSize;
+    size_t ringHead;
+    atomic_size_t ringTail;
+
     // If not provided with a lock, use this one.
     pthread_mutex_t lock;
 
     // A 'cond var'
     pthread_cond_t cond;
 
+    // Set when the consumer waits on `cond`; a lock-free enqueue must then signal.
+    atomic_int waiting;
+
     // An 'abort wait' flag
     int abort;
 
@@ -37,21 +71,46 @@ struct BREventQueueRecord {
     size_t size;
 };
 
+static BREventQueueSlot *
+eventQueueRingSlot (BREventQueue queue, size_t position) {
+    return (BREventQueueSlot *) &queue->ring[(position & (EVENT_QUEUE_RING_CAPACITY - 1)) * queue->ringSlotSize];
+}
+
 extern BREventQueue
-eventQueueCreate (size_t size) {
+eventQueueCreate (size_t size,
+                  BREventQueueType type) {
     BREventQueue queue = calloc (1, sizeof (struct BREventQueueRecord));
 
+    queue->type = type;
     queue->pending = NULL;
+    queue->pendingLast = NULL;
+    queue->pendingOOB = NULL;
     queue->available = NULL;
     queue->abort = 0;
     queue->size  = size;
 
+    atomic_init (&queue->pendingCount, 0);
+    atomic_init (&queue->ringTail, 0);
+    atomic_init (&queue->waiting, 0);
+
     for (int i = 0; i < EVENT_QUEUE_DEFAULT_INITIAL_CAPACITY; i++) {
         BREvent *event = calloc (1, queue->size);
         event->next = queue->available;
         queue->available = event;
     }
 
+    if (EVENT_QUEUE_TYPE_RING == queue->type) {
+        // Keep each slot aligned for the slot's `sequence` and the event's pointers.
+        queue->ringSlotSize = offsetof (BREventQueueSlot, event) + queue->size;
+        queue->ringSlotSize = (queue->ringSlotSize + 15) & ~((size_t) 15);
+
+        queue->ring = calloc (EVENT_QUEUE_RING_CAPACITY, queue->ringSlotSize);
+        queue->ringHead = 0;
+
+        for (size_t position = 0; position < EVENT_QUEUE_RING_CAPACITY; position++)
+            atomic_init (&eventQueueRingSlot (queue, position)->sequence, position);
+    }
+
     // Create the PTHREAD CONDition variable
     {
         pthread_condattr_t attr;
@@ -84,15 +143,107 @@ eventFreeAll (BREvent *event,
     }
 }
 
+/// MARK: - Ring
+
+///
+/// Enqueue `event` at the ring's tail; lock-free.  Return 0 if the ring is full.
+///
+static int
+eventQueueRingEnqueue (BREventQueue queue,
+                       const BREvent *event) {
+    size_t position = atomic_load_explicit (&queue->ringTail, memory_order_relaxed);
+    BREventQueueSlot *slot;
+
+    while (1) {
+        slot = eventQueueRingSlot (queue, position);
+
+        size_t   sequence = atomic_load_explicit (&slot->sequence, memory_order_acquire);
+        intptr_t distance = (intptr_t) sequence - (intptr_t) position;
+
+        // The slot is free; claim it, unless another producer does first.
+        if (0 == distance) {
+            if (atomic_compare_exchange_weak (&queue->ringTail, &position, position + 1))
+                break;
+        }
+
+        // The slot is still filled from one lap ago; the ring is full.
+        else if (distance < 0)
+            return 0;
+
+        // Another producer claimed the slot; try again.
+        else
+            position = atomic_load_explicit (&queue->ringTail, memory_order_relaxed);
+    }
+
+    // Fill `slot` then mark it as filled.
+    memcpy (&slot->event, event, event->type->eventSize);
+    slot->event.next = NULL;
+
+    atomic_store_explicit (&slot->sequence, position + 1, memory_order_release);
+    return 1;
+}
+
+///
+/// Dequeue the ring's head into `event`; the caller holds `lock`.  Return 0 if the ring is empty
+/// or if the head is claimed but not yet filled.
+///
+static int
+eventQueueRingDequeue (BREventQueue queue,
+                       BREvent *event) {
+    BREventQueueSlot *slot = eventQueueRingSlot (queue, queue->ringHead);
+
+    if (queue->ringHead + 1 != atomic_load_explicit (&slot->sequence, memory_order_acquire))
+        return 0;
+
+    // Fill in the provided event, then mark `slot` as free for the next lap.
+    memcpy (event, &slot->event, queue->size);
+    event->next = NULL;
+
+    atomic_store_explicit (&slot->sequence, queue->ringHead + EVENT_QUEUE_RING_CAPACITY, memory_order_release);
+    queue->ringHead += 1;
+
+    return 1;
+}
+
+static void
+eventQueueRingClear (BREventQueue queue) {
+    while (1) {
+        BREventQueueSlot *slot = eventQueueRingSlot (queue, queue->ringHead);
+
+        if (queue->ringHead + 1 != atomic_load_explicit (&slot->sequence, memory_order_acquire))
+            break;
+
+        BREventDestroyer destroyer = slot->event.type->eventDestroyer;
+        if (NULL != destroyer) destroyer (&slot->event);
+
+        atomic_store_explicit (&slot->sequence, queue->ringHead + EVENT_QUEUE_RING_CAPACITY, memory_order_release);
+        queue->ringHead += 1;
+    }
+}
+
+static int
+eventQueueRingIsEmpty (BREventQueue queue) {
+    return queue->ringHead == atomic_load (&queue->ringTail);
+}
+
+/// MARK: - Clear, Destroy
+
 extern void
 eventQueueClear (BREventQueue queue) {
     pthread_mutex_lock(&queue->lock);
 
+    eventFreeAll(queue->pendingOOB, 1);
     eventFreeAll(queue->pending, 1);
     eventFreeAll(queue->available, 0);
 
+    queue->pendingOOB = NULL;
     queue->pending = NULL;
+    queue->pendingLast = NULL;
     queue->available = NULL;
+    atomic_store (&queue->pendingCount, 0);
+
+    if (EVENT_QUEUE_TYPE_RING == queue->type)
+        eventQueueRingClear (queue);
 
     pthread_mutex_unlock(&queue->lock);
 }
@@ -105,15 +256,36 @@ eventQueueDestroy (BREventQueue queue) {
     pthread_cond_destroy(&queue->cond);
     pthread_mutex_destroy(&queue->lock);
 
+    if (NULL != queue->ring) free (queue->ring);
+
     memset (queue, 0, sizeof (struct BREventQueueRecord));
     free (queue);
 }
 
+/// MARK: - Enqueue
+
 static void
 eventQueueEnqueue (BREventQueue queue,
                    const BREvent *event,
                    int tail,
                    int signal) {
+    // For a ring, enqueue at the tail without the lock - unless events are already pending
+    // because the ring was full; those must be dequeued first.
+    if (EVENT_QUEUE_TYPE_RING == queue->type &&
+        tail &&
+        0 == atomic_load (&queue->pendingCount) &&
+        eventQueueRingEnqueue (queue, event)) {
+
+        // Only if the consumer is waiting, or about to wait, do we need the lock.  The consumer
+        // sets `waiting` and then checks the ring; we've filled the ring and then check `waiting`.
+        if (signal && atomic_load (&queue->waiting)) {
+            pthread_mutex_lock(&queue->lock);
+            pthread_cond_signal (&queue->cond);
+            pthread_mutex_unlock(&queue->lock);
+        }
+        return;
+    }
+
     pthread_mutex_lock(&queue->lock);
 
     // Get the next available event
@@ -129,18 +301,18 @@ eventQueueEnqueue (BREventQueue queue,
     memcpy (this, event, event->type->eventSize);
     this->next = NULL;
 
-    // Nothing pending, simply add.
-    if (NULL == queue->pending)
-        queue->pending = this;
-    else if (tail) {
-        // Find the last event
-        BREvent *last = queue->pending;
-        while (NULL != last->next) last = last->next;
-        last->next = this;
+    if (tail) {
+        if (NULL == queue->pending)
+            queue->pending = this;
+        else
+            queue->pendingLast->next = this;
+
+        queue->pendingLast = this;
+        atomic_fetch_add (&queue->pendingCount, 1);
     }
     else /* (head) */ {
-        this->next = queue->pending;
-        queue->pending = this;
+        this->next = queue->pendingOOB;
+        queue->pendingOOB = this;
     }
 
     if (signal) pthread_cond_signal (&queue->cond);
@@ -170,17 +342,39 @@ eventQueueEnqueueHeadSignal (BREventQueue queue,
     eventQueueEnqueue (queue, event, 0, 1);
 }
 
+/// MARK: - Dequeue
+
+static int
+_eventQueueIsEmpty (BREventQueue queue) {
+    return (NULL == queue->pendingOOB &&
+            NULL == queue->pending    &&
+            (EVENT_QUEUE_TYPE_LIST == queue->type || eventQueueRingIsEmpty (queue)));
+}
+
 static int
 _eventQueueDequeue (BREventQueue queue,
                     BREvent *event) {
-    // Get the next pending event
-    BREvent *this = queue->pending;
+    // Get the next pending event; OOB events first.  For a ring, the ring's events precede those
+    // pending, which were enqueued when the ring was full.
+    BREvent *this = queue->pendingOOB;
 
-    // if there is one, process it
-    if (NULL == this) return 0;
+    if (NULL != this)
+        queue->pendingOOB = this->next;
 
-    // Remove `this` from the pending list.
-    queue->pending = this->next;
+    else if (EVENT_QUEUE_TYPE_RING == queue->type && !eventQueueRingIsEmpty (queue))
+        return eventQueueRingDequeue (queue, event);
+
+    else {
+        this = queue->pending;
+
+        // if there is one, process it
+        if (NULL == this) return 0;
+
+        // Remove `this` from the pending list.
+        queue->pending = this->next;
+        if (NULL == queue->pending) queue->pendingLast = NULL;
+        atomic_fetch_sub (&queue->pendingCount, 1);
+    }
 
     // Fill in the provided event;
     this->next = NULL;
@@ -217,11 +411,28 @@ eventQueueDequeueWait (BREventQueue queue,
     BREventStatus status = EVENT_STATUS_SUCCESS;
 
     pthread_mutex_lock (&queue->lock);
-    while (!queue->abort && !_eventQueueDequeue (queue, event))
-        if (0 != pthread_cond_wait (&queue->cond, &queue->lock)) {
+    while (!queue->abort && !_eventQueueDequeue (queue, event)) {
+        // Not empty but nothing dequeued; a producer has claimed the ring's head but has yet to
+        // fill it.  It will shortly.
+        if (!_eventQueueIsEmpty (queue)) {
+            pthread_mutex_unlock (&queue->lock);
+            pthread_yield_brd();
+            pthread_mutex_lock (&queue->lock);
+            continue;
+        }
+
+        // Announce the wait and then check again, in case a lock-free enqueue missed `waiting`.
+        atomic_store (&queue->waiting, 1);
+        int error = (_eventQueueIsEmpty (queue)
+                     ? pthread_cond_wait (&queue->cond, &queue->lock)
+                     : 0);
+        atomic_store (&queue->waiting, 0);
+
+        if (0 != error) {
             status = EVENT_STATUS_WAIT_ERROR;
             break; /* from while */
         }
+    }
     if (queue->abort) status = EVENT_STATUS_WAIT_ABORT;
     pthread_mutex_unlock(&queue->lock);
 
@@ -248,7 +459,7 @@ extern int
 eventQueueHasPending (BREventQueue queue) {
     int pending = 0;
     pthread_mutex_lock(&queue->lock);
-    pending = NULL != queue->pending;
+    pending = !_eventQueueIsEmpty (queue);
     pthread_mutex_unlock(&queue->lock);
     return pending;
 }
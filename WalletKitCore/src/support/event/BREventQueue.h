@@ -21,11 +21,24 @@ extern "C" {
 typedef struct BREventQueueRecord *BREventQueue;
 
 /**
- * Create an Event Queue with `size` as the maximum event size and with the
- * optional `lock`.
+ * The implementation of an Event Queue.
+ */
+typedef enum {
+    /// A linked-list of events; every enqueue and dequeue holds the queue's lock.
+    EVENT_QUEUE_TYPE_LIST,
+
+    /// A bounded, multi-producer/single-consumer ring of events; a (tail) enqueue is lock-free
+    /// unless the consumer must be woken.  A HEAD (OOB) enqueue, or a TAIL enqueue onto a full
+    /// ring, falls back to a linked-list held with the queue's lock.
+    EVENT_QUEUE_TYPE_RING
+} BREventQueueType;
+
+/**
+ * Create an Event Queue of `type` with `size` as the maximum event size.
  */
 extern BREventQueue
-eventQueueCreate (size_t size);
+eventQueueCreate (size_t size,
+                  BREventQueueType type);
 
 extern void
 eventQueueDestroy (BREventQueue queue);
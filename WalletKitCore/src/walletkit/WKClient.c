@@ -202,6 +202,14 @@ wkClientP2PManagerSetNetworkReachable (WKClientP2PManager p2p,
     }
 }
 
+extern void
+wkClientP2PManagerSetSyncFilter (WKClientP2PManager p2p,
+                                     WKSyncFilter filter) {
+    if (NULL != p2p->handlers->setSyncFilter) {
+        p2p->handlers->setSyncFilter (p2p, filter);
+    }
+}
+
 // MARK: Client QRY (QueRY)
 
 static void wkClientQRYRequestBlockNumber  (WKClientQRYManager qry);
@@ -360,6 +368,9 @@ wkClientQRYManagerUpdateSync (WKClientQRYManager qry,
     }
 
     if (needLock) pthread_mutex_unlock(&qry->lock);
+
+    if (needEndEvent && success)
+        wkWalletManagerSyncCompleted (qry->manager);
 }
 
 extern void
@@ -682,8 +693,7 @@ wkClientHandleTransactions (OwnershipKept WKWalletManager manager,
             size_t bundlesCount = array_count(bundles);
 
             // Save the transaction bundles immediately
-            for (size_t index = 0; index < bundlesCount; index++)
-                wkWalletManagerSaveTransactionBundle(manager, bundles[index]);
+            wkWalletManagerSaveTransactionBundles (manager, bundles);
 
             // Sort bundles to have the lowest blocknumber first.  Use of `mergesort` is
             // appropriate given that the bundles are likely already ordered.  This minimizes
@@ -822,8 +832,7 @@ wkClientHandleTransfers (OwnershipKept WKWalletManager manager,
         if (NULL == error) {
             size_t bundlesCount = array_count(bundles);
 
-            for (size_t index = 0; index < bundlesCount; index++)
-                wkWalletManagerSaveTransferBundle(manager, bundles[index]);
+            wkWalletManagerSaveTransferBundles (manager, bundles);
 
             // Sort bundles to have the lowest blocknumber first.  Use of `mergesort` is
             // appropriate given that the bundles are likely already ordered.  This minimizes
@@ -1089,6 +1098,9 @@ wkClientHandleSubmit (OwnershipKept WKWalletManager manager,
         WKBoolean hashChanged = wkTransferSetHash (transfer, hash);
 
         if (WK_TRUE == hashChanged) {
+            // The wallet indexes `transfer` by hash
+            wkWalletUpdTransferIndex (wallet, transfer);
+
             WKTransferState state = wkTransferGetState(transfer);
 
             wkTransferGenerateEvent (transfer, (WKTransferEvent) {
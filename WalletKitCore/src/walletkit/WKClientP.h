@@ -289,6 +289,10 @@ typedef void
 (*WKClientP2PManagerSetNetworkReachableHandler) (WKClientP2PManager p2p,
                                                        int isNetworkReachable);
 
+typedef void
+(*WKClientP2PManagerSetSyncFilterHandler) (WKClientP2PManager p2p,
+                                                 WKSyncFilter filter);
+
 typedef struct {
     WKClientP2PManagerReleaseHandler release;
     WKClientP2PManagerConnectHandler connect;
@@ -296,6 +300,7 @@ typedef struct {
     WKClientP2PManagerSyncHandler sync;
     WKClientP2PManagerSendHandler send;
     WKClientP2PManagerSetNetworkReachableHandler setNetworkReachable;
+    WKClientP2PManagerSetSyncFilterHandler setSyncFilter; // optional
 } WKClientP2PHandlers;
 
 struct WKClientP2PManagerRecord {
@@ -327,6 +332,10 @@ extern void
 wkClientP2PManagerSetNetworkReachable (WKClientP2PManager p2p,
                                            WKBoolean isNetworkReachable);
 
+extern void
+wkClientP2PManagerSetSyncFilter (WKClientP2PManager p2p,
+                                     WKSyncFilter filter);
+
 static inline WKClientSync
 wkClientP2PManagerAsSync (WKClientP2PManager p2p) {
     return (WKClientSync) {
@@ -710,8 +710,7 @@ private_extern void
 wkSystemHandleCurrencyBundles (WKSystem system,
                                OwnershipKept BRArrayOf (WKClientCurrencyBundle) bundles) {
     // Save the bundles straight away
-    for (size_t bundleIndex = 0; bundleIndex < array_count(bundles); bundleIndex++)
-        fileServiceSave (system->fileService, FILE_SERVICE_TYPE_CURRENCY_BUNDLE, bundles[bundleIndex]);
+    fileServiceSaveBatch (system->fileService, FILE_SERVICE_TYPE_CURRENCY_BUNDLE, (const void **) bundles, array_count(bundles));
 
     pthread_mutex_lock (&system->lock);
 
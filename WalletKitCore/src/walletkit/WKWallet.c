@@ -10,6 +10,9 @@
 
 #include <strings.h>
 
+#include "support/BROSCompat.h"
+#include "support/BRCrypto.h"
+
 #include "WKWalletP.h"
 
 #include "WKAmountP.h"
@@ -27,10 +30,6 @@ wkWalletUpdTransfer (WKWallet wallet,
                      WKTransfer transfer,
                      OwnershipKept WKTransferState oldState);
 
-static void
-wkWalletUpdBalanceOnTransferConfirmation (WKWallet wallet,
-                                              WKTransfer transfer);
-
 // MARK: - Wallet Event
 
 struct WKWalletEventRecord {
@@ -295,6 +294,437 @@ wkWalletEventIsEqual (WKWalletEvent event1,
     }
 }
 
+// MARK: - Wallet Transfer Index
+
+struct WKWalletTransferEntryRecord {
+    /// The transfer; the reference is held by `wallet->transfers`
+    WKTransfer transfer;
+
+    /// The keys, captured when indexed.  Any of these might be 'unknown'.
+    WKHash hash;
+    char  *uids;
+    WKBlockNumber blockNumber;
+
+    /// The next entry with an identical `hash`
+    WKWalletTransferEntry nextWithHash;
+
+    /// The transfer's contribution to the wallet's balance, as last applied.  NULL until applied.
+    WKAmount balance;
+
+    /// The order in which the transfer was added; `wallet->transfers` is in `sequence` order.
+    size_t sequence;
+};
+
+static size_t
+wkWalletTransferEntryGetHashValueByTransfer (const WKWalletTransferEntry entry) {
+    return (size_t) entry->transfer;
+}
+
+static int
+wkWalletTransferEntryIsEqualByTransfer (const WKWalletTransferEntry e1,
+                                        const WKWalletTransferEntry e2) {
+    return e1->transfer == e2->transfer;
+}
+
+static size_t
+wkWalletTransferEntryGetHashValueByHash (const WKWalletTransferEntry entry) {
+    return (size_t) wkHashGetHashValue (entry->hash);
+}
+
+static int
+wkWalletTransferEntryIsEqualByHash (const WKWalletTransferEntry e1,
+                                    const WKWalletTransferEntry e2) {
+    return WK_TRUE == wkHashEqual (e1->hash, e2->hash);
+}
+
+static size_t
+wkWalletTransferEntryGetHashValueByUIDS (const WKWalletTransferEntry entry) {
+    // As for `wkClientTransferBundleGetHashValue()`
+    uint8_t md16[16];
+    BRMD5 (md16, entry->uids, strlen (entry->uids));
+    return *((size_t *) md16);
+}
+
+static int
+wkWalletTransferEntryIsEqualByUIDS (const WKWalletTransferEntry e1,
+                                    const WKWalletTransferEntry e2) {
+    return 0 == strcmp (e1->uids, e2->uids);
+}
+
+static int
+wkWalletTransferEntryCompareByBlockNumberForSort (const void *p1, const void *p2) {
+    WKWalletTransferEntry e1 = * (WKWalletTransferEntry *) p1;
+    WKWalletTransferEntry e2 = * (WKWalletTransferEntry *) p2;
+
+    return (e1->blockNumber < e2->blockNumber
+            ? -1
+            : (e1->blockNumber > e2->blockNumber
+               ? +1
+               :  0));
+}
+
+static WKBlockNumber
+wkWalletTransferGetBlockNumber (WKTransfer transfer) {
+    WKTransferState state = wkTransferGetState (transfer);
+    WKBlockNumber blockNumber = (WK_TRANSFER_STATE_INCLUDED == state->type
+                                 ? state->u.included.blockNumber
+                                 : BLOCK_NUMBER_UNKNOWN);
+    wkTransferStateGive (state);
+
+    return blockNumber;
+}
+
+static char *
+wkWalletTransferGetUIDS (WKTransfer transfer) {
+    pthread_mutex_lock (&transfer->lock);
+    char *uids = (NULL == transfer->uids ? NULL : strdup (transfer->uids));
+    pthread_mutex_unlock (&transfer->lock);
+
+    return uids;
+}
+
+static bool
+wkWalletTransferHasUIDS (WKTransfer transfer) {
+    pthread_mutex_lock (&transfer->lock);
+    bool hasUIDS = (NULL != transfer->uids);
+    pthread_mutex_unlock (&transfer->lock);
+
+    return hasUIDS;
+}
+
+static void
+wkWalletTransferIndexInit (WKWalletTransferIndex *index) {
+    index->byTransfer = BRSetNew ((size_t (*) (const void *)) wkWalletTransferEntryGetHashValueByTransfer,
+                                  (int (*) (const void *, const void *)) wkWalletTransferEntryIsEqualByTransfer,
+                                  100);
+    index->byHash     = BRSetNew ((size_t (*) (const void *)) wkWalletTransferEntryGetHashValueByHash,
+                                  (int (*) (const void *, const void *)) wkWalletTransferEntryIsEqualByHash,
+                                  100);
+    index->byUIDS     = BRSetNew ((size_t (*) (const void *)) wkWalletTransferEntryGetHashValueByUIDS,
+                                  (int (*) (const void *, const void *)) wkWalletTransferEntryIsEqualByUIDS,
+                                  100);
+
+    array_new (index->withoutHash, 5);
+    array_new (index->withoutUIDS, 5);
+    array_new (index->byBlock, 100);
+    index->byBlockIsSorted = true;
+    index->sequence = 0;
+}
+
+static void
+wkWalletTransferEntryRelease (WKWalletTransferEntry entry) {
+    if (NULL != entry->hash) wkHashGive (entry->hash);
+    if (NULL != entry->uids) free (entry->uids);
+    if (NULL != entry->balance) wkAmountGive (entry->balance);
+
+    memset (entry, 0, sizeof (*entry));
+    free (entry);
+}
+
+static void
+wkWalletTransferIndexRelease (WKWalletTransferIndex *index) {
+    BRSetFree (index->byHash);
+    BRSetFree (index->byUIDS);
+    BRSetFreeAll (index->byTransfer, (void (*) (void *)) wkWalletTransferEntryRelease);
+
+    array_free (index->withoutHash);
+    array_free (index->withoutUIDS);
+    array_free (index->byBlock);
+}
+
+static void
+wkWalletTransferIndexArrayRemove (BRArrayOf(WKWalletTransferEntry) entries,
+                                  WKWalletTransferEntry entry) {
+    for (size_t i = array_count (entries); i > 0; i--)
+        if (entry == entries[i - 1]) {
+            array_rm (entries, i - 1);
+            break;
+        }
+}
+
+static void
+wkWalletTransferIndexAddHash (WKWalletTransferIndex *index,
+                              WKWalletTransferEntry entry) {
+    entry->nextWithHash = NULL;
+
+    if (NULL == entry->hash) {
+        array_add (index->withoutHash, entry);
+        return;
+    }
+
+    // Append `entry` to the chain of entries sharing this hash; preserves insertion order
+    WKWalletTransferEntry chain = BRSetGet (index->byHash, entry);
+    if (NULL == chain) BRSetAdd (index->byHash, entry);
+    else {
+        while (NULL != chain->nextWithHash) chain = chain->nextWithHash;
+        chain->nextWithHash = entry;
+    }
+}
+
+static void
+wkWalletTransferIndexRemHash (WKWalletTransferIndex *index,
+                              WKWalletTransferEntry entry) {
+    if (NULL == entry->hash) {
+        wkWalletTransferIndexArrayRemove (index->withoutHash, entry);
+        return;
+    }
+
+    WKWalletTransferEntry chain = BRSetGet (index->byHash, entry);
+    if (chain == entry) {
+        BRSetRemove (index->byHash, entry);
+        if (NULL != entry->nextWithHash) BRSetAdd (index->byHash, entry->nextWithHash);
+    }
+    else {
+        while (NULL != chain && chain->nextWithHash != entry) chain = chain->nextWithHash;
+        if (NULL != chain) chain->nextWithHash = entry->nextWithHash;
+    }
+    entry->nextWithHash = NULL;
+}
+
+static void
+wkWalletTransferIndexAddUIDS (WKWalletTransferIndex *index,
+                              WKWalletTransferEntry entry) {
+    if (NULL == entry->uids)
+        array_add (index->withoutUIDS, entry);
+    else
+        BRSetAdd (index->byUIDS, entry);
+}
+
+static void
+wkWalletTransferIndexRemUIDS (WKWalletTransferIndex *index,
+                              WKWalletTransferEntry entry) {
+    if (NULL == entry->uids)
+        wkWalletTransferIndexArrayRemove (index->withoutUIDS, entry);
+    else
+        BRSetRemove (index->byUIDS, entry);
+}
+
+static void
+wkWalletTransferIndexAddBlock (WKWalletTransferIndex *index,
+                               WKWalletTransferEntry entry) {
+    size_t count = array_count (index->byBlock);
+
+    // Transfers typically arrive in block order; appending keeps the index sorted.
+    if (count > 0 && index->byBlock[count - 1]->blockNumber > entry->blockNumber)
+        index->byBlockIsSorted = false;
+
+    array_add (index->byBlock, entry);
+}
+
+static void
+wkWalletTransferIndexSortBlock (WKWalletTransferIndex *index) {
+    if (!index->byBlockIsSorted) {
+        mergesort_brd (index->byBlock, array_count (index->byBlock), sizeof (WKWalletTransferEntry),
+                       wkWalletTransferEntryCompareByBlockNumberForSort);
+        index->byBlockIsSorted = true;
+    }
+}
+
+/// The position of the first entry in the sorted `byBlock` at or beyond `blockNumber`
+static size_t
+wkWalletTransferIndexFindBlock (WKWalletTransferIndex *index,
+                                WKBlockNumber blockNumber) {
+    size_t lower = 0, upper = array_count (index->byBlock);
+
+    while (lower < upper) {
+        size_t middle = lower + (upper - lower) / 2;
+        if (index->byBlock[middle]->blockNumber < blockNumber) lower = middle + 1;
+        else upper = middle;
+    }
+
+    return lower;
+}
+
+static void
+wkWalletTransferIndexRemBlock (WKWalletTransferIndex *index,
+                               WKWalletTransferEntry entry) {
+    wkWalletTransferIndexSortBlock (index);
+
+    // Search only the entries sharing `entry`'s block number
+    for (size_t i = wkWalletTransferIndexFindBlock (index, entry->blockNumber);
+         i < array_count (index->byBlock) && index->byBlock[i]->blockNumber == entry->blockNumber;
+         i++)
+        if (entry == index->byBlock[i]) {
+            array_rm (index->byBlock, i);
+            break;
+        }
+}
+
+static WKWalletTransferEntry
+wkWalletTransferIndexAdd (WKWalletTransferIndex *index,
+                          WKTransfer transfer) {
+    WKWalletTransferEntry entry = calloc (1, sizeof (struct WKWalletTransferEntryRecord));
+
+    entry->transfer    = transfer;
+    entry->sequence    = index->sequence++;
+    entry->hash        = wkTransferGetHash (transfer);
+    entry->uids        = wkWalletTransferGetUIDS (transfer);
+    entry->blockNumber = wkWalletTransferGetBlockNumber (transfer);
+
+    BRSetAdd (index->byTransfer, entry);
+    wkWalletTransferIndexAddHash  (index, entry);
+    wkWalletTransferIndexAddUIDS  (index, entry);
+    wkWalletTransferIndexAddBlock (index, entry);
+
+    return entry;
+}
+
+static void
+wkWalletTransferIndexRem (WKWalletTransferIndex *index,
+                          WKTransfer transfer) {
+    struct WKWalletTransferEntryRecord key = { transfer };
+    WKWalletTransferEntry entry = BRSetRemove (index->byTransfer, &key);
+    if (NULL == entry) return;
+
+    wkWalletTransferIndexRemHash (index, entry);
+    wkWalletTransferIndexRemUIDS (index, entry);
+    wkWalletTransferIndexRemBlock (index, entry);
+
+    wkWalletTransferEntryRelease (entry);
+}
+
+/**
+ * Refresh the keys of `entry` from its transfer; re-index only those keys that changed.
+ */
+static void
+wkWalletTransferIndexUpdEntry (WKWalletTransferIndex *index,
+                               WKWalletTransferEntry entry) {
+    WKTransfer transfer = entry->transfer;
+
+    WKHash hash = wkTransferGetHash (transfer);
+    if ((NULL == hash) != (NULL == entry->hash) ||
+        (NULL != hash && WK_FALSE == wkHashEqual (hash, entry->hash))) {
+        wkWalletTransferIndexRemHash (index, entry);
+        if (NULL != entry->hash) wkHashGive (entry->hash);
+        entry->hash = wkHashTake (hash);
+        wkWalletTransferIndexAddHash (index, entry);
+    }
+    if (NULL != hash) wkHashGive (hash);
+
+    // A transfer's uids is only ever assigned, once; see `wkTransferSetUids()`
+    if (NULL == entry->uids && wkWalletTransferHasUIDS (transfer)) {
+        wkWalletTransferIndexRemUIDS (index, entry);
+        entry->uids = wkWalletTransferGetUIDS (transfer);
+        wkWalletTransferIndexAddUIDS (index, entry);
+    }
+
+    WKBlockNumber blockNumber = wkWalletTransferGetBlockNumber (transfer);
+    if (blockNumber != entry->blockNumber) {
+        entry->blockNumber = blockNumber;
+        index->byBlockIsSorted = false;
+    }
+}
+
+static WKWalletTransferEntry
+wkWalletTransferIndexGetEntry (WKWalletTransferIndex *index,
+                               WKTransfer transfer) {
+    struct WKWalletTransferEntryRecord key = { transfer };
+    return BRSetGet (index->byTransfer, &key);
+}
+
+///
+/// Find the position of `entry`'s transfer in `transfers`, which is in `sequence` order, with a
+/// binary search.
+///
+static size_t
+wkWalletTransferIndexGetPosition (WKWalletTransferIndex *index,
+                                  BRArrayOf(WKTransfer) transfers,
+                                  WKWalletTransferEntry entry) {
+    size_t lower = 0, upper = array_count (transfers);
+
+    while (lower < upper) {
+        size_t middle = lower + (upper - lower) / 2;
+        if (wkWalletTransferIndexGetEntry (index, transfers[middle])->sequence < entry->sequence) lower = middle + 1;
+        else upper = middle;
+    }
+
+    assert (lower < array_count (transfers) && entry->transfer == transfers[lower]);
+    return lower;
+}
+
+///
+/// Find an entry, lacking a hash when indexed, that now has one and matches `transfer`.  Any
+/// entry found with a hash is re-indexed, whether or not it matches.
+///
+static WKWalletTransferEntry
+wkWalletTransferIndexFindWithoutHash (WKWalletTransferIndex *index,
+                                      WKTransfer transfer) {
+    WKWalletTransferEntry found = NULL;
+
+    // Iterate in reverse; re-indexing `entry` removes it from `withoutHash`
+    for (size_t i = array_count (index->withoutHash); i > 0; i--) {
+        WKWalletTransferEntry entry = index->withoutHash[i - 1];
+
+        WKHash hash = wkTransferGetHash (entry->transfer);
+        if (NULL != hash) {
+            wkWalletTransferIndexUpdEntry (index, entry);
+            wkHashGive (hash);
+        }
+
+        if (NULL == found && WK_TRUE == wkTransferEqual (entry->transfer, transfer))
+            found = entry;
+    }
+
+    return found;
+}
+
+///
+/// Find an entry, lacking a uids when indexed, that now has one and matches `uids`.
+///
+static WKWalletTransferEntry
+wkWalletTransferIndexFindWithoutUIDS (WKWalletTransferIndex *index,
+                                      const char *uids) {
+    WKWalletTransferEntry found = NULL;
+
+    for (size_t i = array_count (index->withoutUIDS); i > 0; i--) {
+        WKWalletTransferEntry entry = index->withoutUIDS[i - 1];
+
+        if (wkWalletTransferHasUIDS (entry->transfer)) {
+            wkWalletTransferIndexUpdEntry (index, entry);
+
+            if (NULL == found && 0 == strcmp (entry->uids, uids))
+                found = entry;
+        }
+    }
+
+    return found;
+}
+
+///
+/// Find the entry for a transfer that is `wkTransferEqual()` to `transfer`.  Identical
+/// transfers, matching UIDS and then matching hashes are checked in turn.
+///
+static WKWalletTransferEntry
+wkWalletTransferIndexFind (WKWalletTransferIndex *index,
+                           WKTransfer transfer) {
+    WKWalletTransferEntry entry = wkWalletTransferIndexGetEntry (index, transfer);
+    if (NULL != entry) return entry;
+
+    char *uids = wkWalletTransferGetUIDS (transfer);
+    if (NULL != uids) {
+        struct WKWalletTransferEntryRecord key = { NULL, NULL, uids };
+        entry = BRSetGet (index->byUIDS, &key);
+
+        if (NULL == entry)
+            entry = wkWalletTransferIndexFindWithoutUIDS (index, uids);
+
+        free (uids);
+        if (NULL != entry && WK_TRUE == wkTransferEqual (entry->transfer, transfer)) return entry;
+    }
+
+    WKHash hash = wkTransferGetHash (transfer);
+    if (NULL != hash) {
+        struct WKWalletTransferEntryRecord key = { NULL, hash };
+        for (entry = BRSetGet (index->byHash, &key); NULL != entry; entry = entry->nextWithHash)
+            if (WK_TRUE == wkTransferEqual (entry->transfer, transfer)) break;
+
+        wkHashGive (hash);
+        if (NULL != entry) return entry;
+    }
+
+    return wkWalletTransferIndexFindWithoutHash (index, transfer);
+}
+
 // MARK: - Wallet
 
 IMPLEMENT_WK_GIVE_TAKE (WKWallet, wkWallet)
@@ -335,6 +765,7 @@ wkWalletAllocAndInit (size_t sizeInBytes,
     wallet->defaultFeeBasis = wkFeeBasisTake (defaultFeeBasis);
 
     array_new (wallet->transfers, 5);
+    wkWalletTransferIndexInit (&wallet->transfersIndex);
 
     wallet->ref = WK_REF_ASSIGN (wkWalletRelease);
 
@@ -363,6 +794,7 @@ wkWalletRelease (WKWallet wallet) {
 
     wkFeeBasisGive (wallet->defaultFeeBasis);
 
+    wkWalletTransferIndexRelease (&wallet->transfersIndex);
     for (size_t index = 0; index < array_count(wallet->transfers); index++)
         wkTransferGive (wallet->transfers[index]);
     array_free (wallet->transfers);
@@ -468,13 +900,6 @@ wkWalletIncBalance (WKWallet wallet,
     wkAmountGive(amount);
 }
 
-static void // called wtih wallet->lock
-wkWalletDecBalance (WKWallet wallet,
-                        OwnershipGiven WKAmount amount) {
-    wkWalletSetBalance (wallet, wkAmountSub (wallet->balance, amount));
-    wkAmountGive(amount);
-}
-
 /**
  * Return the amount from `transfer` that applies to the balance of `wallet`.  The result must
  * be in the wallet's unit
@@ -504,81 +929,145 @@ wkWalletGetTransferAmountDirectedNet (WKWallet wallet,
     return transferNet;
 }
 
+/**
+ * Return the contribution of `transfer` to the balance of `wallet`.  An ERRORED transfer does
+ * not contribute.
+ */
+static OwnershipGiven WKAmount // called wtih wallet->lock
+wkWalletGetTransferAmountForBalance (WKWallet wallet,
+                                     WKTransfer transfer) {
+    return (WK_TRANSFER_STATE_ERRORED != wkTransferGetStateType (transfer)
+            ? wkWalletGetTransferAmountDirectedNet (wallet, transfer)
+            : wkAmountCreateInteger (0, wallet->unit));
+}
+
+//
+// The balance is maintained incrementally.  Each transfer's index entry records the transfer's
+// contribution to the balance, as last applied.  When a transfer is added, removed, replaced or
+// changes state, only the difference between its new and its recorded contributions is applied.
+// This handles, with one mechanism, an estimated vs confirmed fee (the common case of a transfer
+// becoming INCLUDED), a re-org that changes an included fee, and an ERRORED transfer - all of
+// which formerly required iterating over every transfer.
+//
+// There are BTC cases where the amount changes when *another* transfer is confirmed.  Those are
+// handled by the BTC wallet manager replacing the transfer; see `wkWalletReplaceTransfer()`.
+//
+
+/**
+ * Replace `entry`'s contribution to the balance with `amount`; a NULL `amount` implies `entry`
+ * no longer contributes.  Return the resulting change in the balance, or NULL if none.
+ */
+static OwnershipGiven WKAmount // called wtih wallet->lock
+wkWalletTransferEntrySetBalance (WKWalletTransferEntry entry,
+                                 OwnershipGiven WKAmount amount) {
+    WKAmount change = (NULL == entry->balance
+                       ? (NULL == amount ? NULL : wkAmountTake   (amount))
+                       : (NULL == amount ? wkAmountNegate (entry->balance) : wkAmountSub (amount, entry->balance)));
+
+    wkAmountGive (entry->balance);
+    entry->balance = amount;
+
+    if (NULL != change && WK_TRUE == wkAmountIsZero (change)) {
+        wkAmountGive (change);
+        change = NULL;
+    }
+
+    return change;
+}
+
+/// Validate the balance, after each update, by a full recompute; define as 1 to enable.
+#if !defined (WK_WALLET_BALANCE_VALIDATE)
+#define WK_WALLET_BALANCE_VALIDATE           (0)
+#endif
+
+#if WK_WALLET_BALANCE_VALIDATE
+/// Validate the balance, after each update, for wallets with at most this many transfers.
+#if !defined (WK_WALLET_BALANCE_VALIDATE_LIMIT)
+#define WK_WALLET_BALANCE_VALIDATE_LIMIT     (1000)
+#endif
 
 /**
  * Recompute the balance by iterating over all transfers and summing the 'amount directed net'.
- * This is appropriately used when the 'amount directed net' has changed; typically when a
- * transfer's state is become 'included' and thus the fee has been finalized.  Note, however, we
- *  handle an estimated vs confirmed fee explicitly in the subsequent function.
-*/
-static WKAmount
-wkWalletComputeBalance (WKWallet wallet, bool needLock) {
-    if (needLock) pthread_mutex_lock (&wallet->lock);
+ * Only used to validate the incrementally maintained balance.
+ */
+static WKAmount // called wtih wallet->lock
+wkWalletComputeBalance (WKWallet wallet) {
     WKAmount balance = wkAmountCreateInteger (0, wallet->unit);
 
     for (size_t index = 0; index < array_count(wallet->transfers); index++) {
-        // If the transfer has ERRORED, ignore it immediately
-        if (WK_TRANSFER_STATE_ERRORED != wkTransferGetStateType (wallet->transfers[index])) {
-            WKAmount amount     = wkWalletGetTransferAmountDirectedNet (wallet, wallet->transfers[index]);
-            WKAmount newBalance = wkAmountAdd (balance, amount);
+        WKAmount amount     = wkWalletGetTransferAmountForBalance (wallet, wallet->transfers[index]);
+        WKAmount newBalance = wkAmountAdd (balance, amount);
 
-            wkAmountGive(amount);
-            wkAmountGive(balance);
+        wkAmountGive(amount);
+        wkAmountGive(balance);
 
-            balance = newBalance;
-        }
+        balance = newBalance;
     }
-    if (needLock) pthread_mutex_unlock (&wallet->lock);
 
     return balance;
 }
 
+static void // called wtih wallet->lock
+wkWalletValidateBalance (WKWallet wallet) {
+    // The validation is O(n); skip it for large wallets (think performance tests).
+    if (array_count (wallet->transfers) > WK_WALLET_BALANCE_VALIDATE_LIMIT) return;
+
+    WKAmount balance = wkWalletComputeBalance (wallet);
+    assert (WK_COMPARE_EQ == wkAmountCompare (balance, wallet->balance));
+    wkAmountGive (balance);
+}
+#endif
+
+/**
+ * Update `entry`'s contribution to the balance to be `amount`, which may be NULL, and then
+ * update the balance with any change.
+ */
+static void // called wtih wallet->lock
+wkWalletUpdBalanceForEntry (WKWallet wallet,
+                            WKWalletTransferEntry entry,
+                            OwnershipGiven WKAmount amount) {
+    WKAmount change = wkWalletTransferEntrySetBalance (entry, amount);
+    if (NULL != change) wkWalletIncBalance (wallet, change);
+
+    wallet->balanceCounters.updates += 1;
+#if WK_WALLET_BALANCE_VALIDATE
+    wkWalletValidateBalance (wallet);
+#endif
+}
+
+/**
+ * Recompute the balance by iterating over all transfers and summing their contributions.  The
+ * incrementally maintained balance does not need this; however, if the contribution of a transfer
+ * changes, absent a change in its state, then this is the only recourse.
+ */
 private_extern void
 wkWalletUpdBalance (WKWallet wallet, bool needLock) {
     if (needLock) pthread_mutex_lock (&wallet->lock);
-    wkWalletSetBalance (wallet, wkWalletComputeBalance (wallet, false));
-    if (needLock) pthread_mutex_unlock (&wallet->lock);
-}
+    WKAmount balance = wkAmountCreateInteger (0, wallet->unit);
 
-//
-// When a transfer is confirmed, the fee can change.  A typical example is that for ETH a transfer
-// has an estimated fee based on `gasLimit` but an actual, included fee based on `gasUsed`.  The
-// following code handles a fee change - and only a fee change.
-//
-// There are BTC cases where the amount changes when *another* transfer is confirmed.  Specifically,
-// BRWallet has a BRTransaction 'in the future' where one of the inputs is an early UTXO.  The
-// other inputs and the outputs of the BRTransaction aren't resolved until early transactions are
-// added to the BRWallet, and then addresses are generated upto the gap_limit.  Only then can the
-// later transactions inputs and outputs be resovled.  We don't handle that case in this function.
-//
-static void // called wtih wallet->lock
-wkWalletUpdBalanceOnTransferConfirmation (WKWallet wallet,
-                                              WKTransfer transfer) {
-    // if this wallet does not pay fees, then there is nothing to do
-    if (WK_FALSE == wkUnitIsCompatible (wallet->unit, wallet->unitForFee))
-        return;
+    for (size_t index = 0; index < array_count(wallet->transfers); index++) {
+        WKTransfer            transfer = wallet->transfers[index];
+        WKWalletTransferEntry entry    = wkWalletTransferIndexGetEntry (&wallet->transfersIndex, transfer);
 
-    WKAmount feeEstimated = wkTransferGetEstimatedFee (transfer);
-    WKAmount feeConfirmed = wkTransferGetConfirmedFee (transfer);
-    assert (NULL == feeConfirmed || NULL == feeEstimated || WK_TRUE == wkAmountIsCompatible (feeEstimated, feeConfirmed));
-    assert (NULL == feeConfirmed || WK_TRUE == wkAmountIsCompatible (feeConfirmed, wallet->balance));
-    // TODO: assert (NULL != feeConfirmed)
+        wkAmountGive (wkWalletTransferEntrySetBalance (entry, wkWalletGetTransferAmountForBalance (wallet, transfer)));
 
-    WKAmount change = NULL;
+        WKAmount newBalance = wkAmountAdd (balance, entry->balance);
+        wkAmountGive (balance);
+        balance = newBalance;
+    }
 
-    if (NULL != feeConfirmed && NULL != feeEstimated)
-        change = wkAmountSub (feeConfirmed, feeEstimated);
-    else if (NULL != feeConfirmed)
-        change = wkAmountTake (feeConfirmed);
-    else if (NULL != feeEstimated)
-        change = wkAmountNegate (feeEstimated);
+    wkWalletSetBalance (wallet, balance);
+    wallet->balanceCounters.recomputes += 1;
+    if (needLock) pthread_mutex_unlock (&wallet->lock);
+}
 
-    if (NULL != change && WK_FALSE == wkAmountIsZero(change))
-        wkWalletIncBalance (wallet, wkAmountTake(change));
+private_extern WKWalletBalanceCounters
+wkWalletGetBalanceCounters (WKWallet wallet) {
+    pthread_mutex_lock (&wallet->lock);
+    WKWalletBalanceCounters counters = wallet->balanceCounters;
+    pthread_mutex_unlock (&wallet->lock);
 
-    wkAmountGive (change);
-    wkAmountGive (feeEstimated);
-    wkAmountGive (feeConfirmed);
+    return counters;
 }
 
 extern WKAmount /* nullable */
@@ -595,11 +1084,8 @@ static WKBoolean
 wkWalletHasTransferLock (WKWallet wallet,
                              WKTransfer transfer,
                              bool needLock) {
-    WKBoolean r = WK_FALSE;
     if (needLock) pthread_mutex_lock (&wallet->lock);
-    for (size_t index = 0; index < array_count(wallet->transfers) && WK_FALSE == r; index++) {
-        r = wkTransferEqual (transfer, wallet->transfers[index]);
-    }
+    WKBoolean r = AS_WK_BOOLEAN (NULL != wkWalletTransferIndexFind (&wallet->transfersIndex, transfer));
     if (needLock) pthread_mutex_unlock (&wallet->lock);
     return r;
 }
@@ -627,9 +1113,10 @@ wkWalletAddTransfer (WKWallet wallet,
     pthread_mutex_lock (&wallet->lock);
     if (WK_FALSE == wkWalletHasTransferLock (wallet, transfer, false)) {
         array_add (wallet->transfers, wkTransferTake(transfer));
+        WKWalletTransferEntry entry = wkWalletTransferIndexAdd (&wallet->transfersIndex, transfer);
         wkWalletAnnounceTransfer (wallet, transfer, WK_WALLET_EVENT_TRANSFER_ADDED);
         wkWalletGenerateEvent (wallet, wkWalletEventCreateTransfer (WK_WALLET_EVENT_TRANSFER_ADDED, transfer));
-        wkWalletIncBalance (wallet, wkWalletGetTransferAmountDirectedNet(wallet, transfer));
+        wkWalletUpdBalanceForEntry (wallet, entry, wkWalletGetTransferAmountForBalance (wallet, transfer));
      }
     pthread_mutex_unlock (&wallet->lock);
 }
@@ -638,24 +1125,44 @@ private_extern void
 wkWalletAddTransfers (WKWallet wallet,
                           OwnershipGiven BRArrayOf(WKTransfer) transfers) {
     pthread_mutex_lock (&wallet->lock);
+    WKAmount change = wkAmountCreateInteger (0, wallet->unit);
+    size_t   added  = 0;
+
     for (size_t index = 0; index < array_count(transfers); index++) {
         WKTransfer transfer = transfers[index];
         if (WK_FALSE == wkWalletHasTransferLock (wallet, transfer, false)) {
+            added += 1;
             array_add (wallet->transfers, wkTransferTake(transfer));
+            WKWalletTransferEntry entry = wkWalletTransferIndexAdd (&wallet->transfersIndex, transfer);
             wkWalletAnnounceTransfer (wallet, transfer, WK_WALLET_EVENT_TRANSFER_ADDED);
             // Must announce
 
             // TODO: replace w/ bulk announcement
             wkWalletGenerateEvent (wallet, wkWalletEventCreateTransfer (WK_WALLET_EVENT_TRANSFER_ADDED, transfer));
 
-//            wkWalletIncBalance (wallet, wkTransferGetAmountDirectedNet(transfer));
+            // Accumulate the balance change; a single balance update follows.
+            WKAmount entryChange = wkWalletTransferEntrySetBalance (entry, wkWalletGetTransferAmountForBalance (wallet, transfer));
+            if (NULL != entryChange) {
+                WKAmount newChange = wkAmountAdd (change, entryChange);
+                wkAmountGive (entryChange);
+                wkAmountGive (change);
+                change = newChange;
+            }
         }
     }
 
     // generate event
 
-    // new balance
-    wkWalletUpdBalance(wallet, false);
+    // new balance; only a bulk add that added something would have required a recompute
+    if (added > 0) {
+        wkWalletIncBalance (wallet, change);
+        wallet->balanceCounters.updates           += 1;
+        wallet->balanceCounters.recomputesAvoided += 1;
+#if WK_WALLET_BALANCE_VALIDATE
+        wkWalletValidateBalance (wallet);
+#endif
+    }
+    else wkAmountGive (change);
 
     array_free_all (transfers, wkTransferGive);
     pthread_mutex_unlock (&wallet->lock);
@@ -665,15 +1172,19 @@ private_extern void
 wkWalletRemTransfer (WKWallet wallet, WKTransfer transfer) {
     WKTransfer walletTransfer = NULL;
     pthread_mutex_lock (&wallet->lock);
-    for (size_t index = 0; index < array_count(wallet->transfers); index++) {
-        if (WK_TRUE == wkTransferEqual (wallet->transfers[index], transfer)) {
-            walletTransfer = wallet->transfers[index];
-            array_rm (wallet->transfers, index);
-            wkWalletAnnounceTransfer (wallet, transfer, WK_WALLET_EVENT_TRANSFER_DELETED);
-            wkWalletGenerateEvent (wallet, wkWalletEventCreateTransfer (WK_WALLET_EVENT_TRANSFER_DELETED, transfer));
-            wkWalletDecBalance (wallet, wkWalletGetTransferAmountDirectedNet(wallet, transfer));
-            break;
-        }
+    WKWalletTransferEntry entry = wkWalletTransferIndexFind (&wallet->transfersIndex, transfer);
+    if (NULL != entry) {
+        walletTransfer = entry->transfer;
+
+        array_rm (wallet->transfers, wkWalletTransferIndexGetPosition (&wallet->transfersIndex,
+                                                                       wallet->transfers,
+                                                                       entry));
+
+        wkWalletAnnounceTransfer (wallet, transfer, WK_WALLET_EVENT_TRANSFER_DELETED);
+        wkWalletGenerateEvent (wallet, wkWalletEventCreateTransfer (WK_WALLET_EVENT_TRANSFER_DELETED, transfer));
+        wkWalletUpdBalanceForEntry (wallet, entry, NULL);
+
+        wkWalletTransferIndexRem (&wallet->transfersIndex, walletTransfer);
     }
     pthread_mutex_unlock (&wallet->lock);
 
@@ -688,23 +1199,32 @@ wkWalletReplaceTransfer (WKWallet wallet,
     WKTransfer walletTransfer = NULL;
     
     pthread_mutex_lock (&wallet->lock);
-    for (size_t index = 0; index < array_count(wallet->transfers); index++) {
-        if (oldTransfer == wallet->transfers[index] ||
-            WK_TRUE == wkTransferEqual (wallet->transfers[index], oldTransfer)) {
-
-            walletTransfer = wallet->transfers[index];
-            wallet->transfers[index] = wkTransferTake (newTransfer);
-
-            wkWalletAnnounceTransfer (wallet, oldTransfer, WK_WALLET_EVENT_TRANSFER_DELETED);
-            wkWalletGenerateEvent (wallet, wkWalletEventCreateTransfer (WK_WALLET_EVENT_TRANSFER_DELETED, oldTransfer));
-            wkWalletDecBalance (wallet, wkWalletGetTransferAmountDirectedNet(wallet, oldTransfer));
-
-            wkWalletAnnounceTransfer (wallet, newTransfer, WK_WALLET_EVENT_TRANSFER_ADDED);
-            wkWalletGenerateEvent (wallet, wkWalletEventCreateTransfer (WK_WALLET_EVENT_TRANSFER_ADDED, newTransfer));
-            wkWalletIncBalance (wallet, wkWalletGetTransferAmountDirectedNet(wallet, newTransfer));
-
-            break;
-        }
+    WKWalletTransferEntry entry = wkWalletTransferIndexFind (&wallet->transfersIndex, oldTransfer);
+    if (NULL != entry) {
+        walletTransfer = entry->transfer;
+
+        size_t sequence = entry->sequence;
+        size_t position = wkWalletTransferIndexGetPosition (&wallet->transfersIndex,
+                                                            wallet->transfers,
+                                                            entry);
+
+        // Remove the old transfer's contribution to the balance; the balance is validated only
+        // once the new transfer has taken the old transfer's slot.
+        wkWalletAnnounceTransfer (wallet, oldTransfer, WK_WALLET_EVENT_TRANSFER_DELETED);
+        wkWalletGenerateEvent (wallet, wkWalletEventCreateTransfer (WK_WALLET_EVENT_TRANSFER_DELETED, oldTransfer));
+        WKAmount change = wkWalletTransferEntrySetBalance (entry, NULL);
+        if (NULL != change) wkWalletIncBalance (wallet, change);
+        wallet->balanceCounters.updates += 1;
+        wkWalletTransferIndexRem (&wallet->transfersIndex, walletTransfer);
+
+        // Overwrite the slot in place; `wallet->transfers` stays in `sequence` order.
+        wallet->transfers[position] = wkTransferTake (newTransfer);
+        entry = wkWalletTransferIndexAdd (&wallet->transfersIndex, newTransfer);
+        entry->sequence = sequence;
+
+        wkWalletAnnounceTransfer (wallet, newTransfer, WK_WALLET_EVENT_TRANSFER_ADDED);
+        wkWalletGenerateEvent (wallet, wkWalletEventCreateTransfer (WK_WALLET_EVENT_TRANSFER_ADDED, newTransfer));
+        wkWalletUpdBalanceForEntry (wallet, entry, wkWalletGetTransferAmountForBalance (wallet, newTransfer));
     }
     pthread_mutex_unlock (&wallet->lock);
 
@@ -722,30 +1242,33 @@ wkWalletUpdTransfer (WKWallet wallet,
     // The transfer's state has changed.  This implies a possible amount/fee change as well as
     // perhaps other wallet changes, such a nonce change.
     pthread_mutex_lock (&wallet->lock);
-    if (WK_TRUE == wkWalletHasTransferLock (wallet, transfer, false)) {
+    WKWalletTransferEntry entry = wkWalletTransferIndexFind (&wallet->transfersIndex, transfer);
+    if (NULL != entry) {
+        // The new state might have a different block number and, if signed, a hash.
+        wkWalletTransferIndexUpdEntry (&wallet->transfersIndex, entry);
+
         switch (transfer->state->type) {
             case WK_TRANSFER_STATE_CREATED:
             case WK_TRANSFER_STATE_SIGNED:
             case WK_TRANSFER_STATE_SUBMITTED:
             case WK_TRANSFER_STATE_DELETED:
-                break; // nothing
+                break;
             case WK_TRANSFER_STATE_INCLUDED:
                 // If the `oldState` is INCLUDED, then this is a re-org and (somehow) the oldState
-                // and the newState can have completely different fees.  Just recompute the wallet
-                // balance with `transfer` (and its `newState`).  This case is highly uncommon.
+                // and the newState can have completely different fees.  This case is highly
+                // uncommon but, like an ERRORED transfer, once required a full recompute.
                 if (WK_TRANSFER_STATE_INCLUDED == oldState->type)
-                    wkWalletUpdBalance (wallet, false);
-                else
-                    // If `oldState` is not INCLUDED, the updae the balance based on a different
-                    // between the estimated and confirmed fees. This case is common.
-                    wkWalletUpdBalanceOnTransferConfirmation (wallet, transfer);
+                    wallet->balanceCounters.recomputesAvoided += 1;
                 break;
             case WK_TRANSFER_STATE_ERRORED:
-                // Recompute the balance
-                wkWalletUpdBalance (wallet, false);
+                wallet->balanceCounters.recomputesAvoided += 1;
                 break;
         }
 
+        // Update the balance for the transfer's new contribution.  Commonly this is the
+        // difference between the estimated and the confirmed fee.
+        wkWalletUpdBalanceForEntry (wallet, entry, wkWalletGetTransferAmountForBalance (wallet, entry->transfer));
+
         // Announce a 'TRANSFER_CHANGED'; each currency might respond differently.
         wkWalletAnnounceTransfer (wallet, transfer, WK_WALLET_EVENT_TRANSFER_CHANGED);
     }
@@ -772,12 +1295,19 @@ wkWalletGetTransferByHash (WKWallet wallet, WKHash hashToMatch) {
     WKTransfer transfer = NULL;
 
     pthread_mutex_lock (&wallet->lock);
-    for (size_t index = 0; NULL == transfer && index < array_count(wallet->transfers); index++) {
-        WKHash hash = wkTransferGetHash (wallet->transfers[index]);
-        if (WK_TRUE == wkHashEqual(hash, hashToMatch))
-            transfer = wallet->transfers[index];
-        wkHashGive(hash);
+    struct WKWalletTransferEntryRecord key = { NULL, hashToMatch };
+    WKWalletTransferEntry entry = BRSetGet (wallet->transfersIndex.byHash, &key);
+
+    // Perhaps the transfer acquired its hash after being indexed
+    if (NULL == entry) {
+        for (size_t i = array_count (wallet->transfersIndex.withoutHash); i > 0; i--) {
+            WKWalletTransferEntry entryWithoutHash = wallet->transfersIndex.withoutHash[i - 1];
+            wkWalletTransferIndexUpdEntry (&wallet->transfersIndex, entryWithoutHash);
+        }
+        entry = BRSetGet (wallet->transfersIndex.byHash, &key);
     }
+
+    if (NULL != entry) transfer = entry->transfer;
     pthread_mutex_unlock (&wallet->lock);
 
     return wkTransferTake (transfer);
@@ -788,16 +1318,49 @@ wkWalletGetTransferByUIDS (WKWallet wallet, const char *uids) {
     WKTransfer transfer = NULL;
 
     pthread_mutex_lock (&wallet->lock);
-    for (size_t index = 0; NULL == transfer && index < array_count(wallet->transfers); index++) {
-        const char *transferUIDS = wallet->transfers[index]->uids;
-        if (NULL != transferUIDS && 0 == strcmp (transferUIDS, uids))
-            transfer = wallet->transfers[index];
-    }
+    struct WKWalletTransferEntryRecord key = { NULL, NULL, (char *) uids };
+    WKWalletTransferEntry entry = BRSetGet (wallet->transfersIndex.byUIDS, &key);
+
+    // Perhaps the transfer acquired its uids after being indexed
+    if (NULL == entry)
+        entry = wkWalletTransferIndexFindWithoutUIDS (&wallet->transfersIndex, uids);
+
+    if (NULL != entry) transfer = entry->transfer;
     pthread_mutex_unlock (&wallet->lock);
 
     return wkTransferTake (transfer);
 }
 
+private_extern OwnershipGiven BRArrayOf(WKTransfer)
+wkWalletGetTransfersInBlockRange (WKWallet wallet,
+                                  WKBlockNumber begBlockNumber,
+                                  WKBlockNumber endBlockNumber) {
+    BRArrayOf(WKTransfer) transfers;
+    array_new (transfers, 10);
+
+    pthread_mutex_lock (&wallet->lock);
+    WKWalletTransferIndex *index = &wallet->transfersIndex;
+    size_t count = array_count (index->byBlock);
+
+    wkWalletTransferIndexSortBlock (index);
+
+    for (size_t i = wkWalletTransferIndexFindBlock (index, begBlockNumber); i < count && index->byBlock[i]->blockNumber < endBlockNumber; i++)
+        if (BLOCK_NUMBER_UNKNOWN != index->byBlock[i]->blockNumber)
+            array_add (transfers, wkTransferTake (index->byBlock[i]->transfer));
+    pthread_mutex_unlock (&wallet->lock);
+
+    return transfers;
+}
+
+private_extern void
+wkWalletUpdTransferIndex (WKWallet wallet,
+                          WKTransfer transfer) {
+    pthread_mutex_lock (&wallet->lock);
+    WKWalletTransferEntry entry = wkWalletTransferIndexGetEntry (&wallet->transfersIndex, transfer);
+    if (NULL != entry) wkWalletTransferIndexUpdEntry (&wallet->transfersIndex, entry);
+    pthread_mutex_unlock (&wallet->lock);
+}
+
 private_extern WKTransfer
 wkWalletGetTransferByHashOrUIDS (WKWallet wallet, WKHash hash, const char *uids) {
     WKTransfer transfer = NULL;
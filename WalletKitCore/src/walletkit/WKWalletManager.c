@@ -56,6 +56,13 @@
 #define CWM_MAXIMUM_SAMPLING_PERIOD_IN_MILLISECONDS   (1 * 60 * 1000)    //  1 minute
 #define CWM_MINIMUM_SAMPLING_PERIOD_IN_MILLISECONDS   (    10 * 1000)    // 10 seconds
 
+/// The number of threads, shared by all managers, to dispatch manager events.  If zero, then each
+/// manager has its own thread.  Off by default; define as, say, 4 to share threads when many
+/// managers are created.
+#if !defined (CWM_EXECUTOR_THREADS_COUNT)
+#define CWM_EXECUTOR_THREADS_COUNT   (0)
+#endif
+
 static unsigned int
 wkWalletManagerBoundSamplingPeriod (unsigned int milliseconds) {
     return (milliseconds > CWM_MAXIMUM_SAMPLING_PERIOD_IN_MILLISECONDS
@@ -303,6 +310,11 @@ wkWalletManagerAllocAndInit (size_t sizeInBytes,
                                            eventTypesCount,
                                            &manager->lock);
 
+    if (0 < CWM_EXECUTOR_THREADS_COUNT) {
+        eventExecutorCreateIfNecessary (CWM_EXECUTOR_THREADS_COUNT);
+        eventHandlerSetExecutor (manager->handler, eventExecutor);
+    }
+
     eventHandlerSetTimeoutDispatcher (manager->handler,
                                       wkWalletManagerBoundSamplingPeriod ((1000 * wkNetworkGetConfirmationPeriodInSeconds(network)) / CWM_CONFIRMATION_PERIOD_FACTOR),
                                       (BREventDispatcher) wkWalletManagerPeriodicDispatcher,
@@ -532,6 +544,25 @@ wkWalletManagerGetMode (WKWalletManager cwm) {
     return mode;
 }
 
+extern WKSyncFilter
+wkWalletManagerGetSyncFilter (WKWalletManager cwm) {
+    pthread_mutex_lock (&cwm->lock);
+    WKSyncFilter filter = cwm->syncFilter;
+    pthread_mutex_unlock (&cwm->lock);
+    return filter;
+}
+
+extern void
+wkWalletManagerSetSyncFilter (WKWalletManager cwm, WKSyncFilter filter) {
+    pthread_mutex_lock (&cwm->lock);
+    cwm->syncFilter = filter;
+    pthread_mutex_unlock (&cwm->lock);
+
+    if (NULL != cwm->p2pManager) {
+        wkClientP2PManagerSetSyncFilter (cwm->p2pManager, filter);
+    }
+}
+
 extern WKWalletManagerState
 wkWalletManagerGetState (WKWalletManager cwm) {
     pthread_mutex_lock (&cwm->lock);
@@ -824,8 +855,11 @@ wkWalletManagerSign (WKWalletManager manager,
                                                                           wallet,
                                                                           transfer,
                                                                           seed);
-    if (WK_TRUE == success)
+    if (WK_TRUE == success) {
+        // Signing assigns the hash, or a new one if re-signed; the wallet indexes `transfer` by hash
+        wkWalletUpdTransferIndex (wallet, transfer);
         wkTransferSetState (transfer, wkTransferStateInit (WK_TRANSFER_STATE_SIGNED));
+    }
 
     // Zero-out the seed.
     seed = UINT512_ZERO;
@@ -842,8 +876,10 @@ wkWalletManagerSignWithKey (WKWalletManager manager,
                                                                           wallet,
                                                                           transfer,
                                                                           key);
-    if (WK_TRUE == success)
+    if (WK_TRUE == success) {
+        wkWalletUpdTransferIndex (wallet, transfer);
         wkTransferSetState (transfer, wkTransferStateInit (WK_TRANSFER_STATE_SIGNED));
+    }
 
     return success;
 }
@@ -1168,6 +1204,14 @@ wkWalletManagerPeriodicDispatcher (BREventHandler handler,
     wkClientSyncPeriodic (cwm->canSync);
 }
 
+// MARK: - Sync Completed
+
+private_extern void
+wkWalletManagerSyncCompleted (WKWalletManager manager) {
+    if (NULL != manager->handlers->syncCompleted)
+        manager->handlers->syncCompleted (manager);
+}
+
 // MARK: - Transaction/Transfer Bundle
 
 private_extern void
@@ -1188,6 +1232,26 @@ wkWalletManagerSaveTransferBundle (WKWalletManager manager,
         fileServiceSave (manager->fileService, WK_FILE_SERVICE_TYPE_TRANSFER, bundle);
 }
 
+private_extern void
+wkWalletManagerSaveTransactionBundles (WKWalletManager manager,
+                                       OwnershipKept BRArrayOf (WKClientTransactionBundle) bundles) {
+    // Save every bundle in a single fileService batch; avoid a DB transaction per bundle.
+    fileServiceBeginBatch (manager->fileService);
+    for (size_t index = 0; index < array_count (bundles); index++)
+        wkWalletManagerSaveTransactionBundle (manager, bundles[index]);
+    fileServiceCommitBatch (manager->fileService);
+}
+
+private_extern void
+wkWalletManagerSaveTransferBundles (WKWalletManager manager,
+                                    OwnershipKept BRArrayOf (WKClientTransferBundle) bundles) {
+    // Save every bundle in a single fileService batch; avoid a DB transaction per bundle.
+    fileServiceBeginBatch (manager->fileService);
+    for (size_t index = 0; index < array_count (bundles); index++)
+        wkWalletManagerSaveTransferBundle (manager, bundles[index]);
+    fileServiceCommitBatch (manager->fileService);
+}
+
 private_extern void
 wkWalletManagerRecoverTransfersFromTransactionBundle (WKWalletManager cwm,
                                                           OwnershipKept WKClientTransactionBundle bundle) {
@@ -134,6 +134,10 @@ typedef WKWalletSweeper
                                                     WKWallet wallet,
                                                     WKKey key);
 
+// Optional; called once a full sync, API or P2P, has completed successfully
+typedef void
+(*WKWalletManagerSyncCompletedHandler) (WKWalletManager cwm);
+
 typedef struct {
     WKWalletManagerCreateHandler create;
     WKWalletManagerReleaseHandler release;
@@ -152,6 +156,7 @@ typedef struct {
     WKWalletManagerRecoverFeeBasisFromFeeEstimateHandler        recoverFeeBasisFromFeeEstimate;
     WKWalletManagerWalletSweeperValidateSupportedHandler validateSweeperSupported;
     WKWalletManagerCreateWalletSweeperHandler createSweeper;
+    WKWalletManagerSyncCompletedHandler syncCompleted;
 } WKWalletManagerHandlers;
 
 // MARK: - Wallet Manager State
@@ -188,6 +193,7 @@ struct WKWalletManagerRecord {
     WKClientQRYByType byType;
     
     WKSyncMode syncMode;
+    WKSyncFilter syncFilter;
     WKClientSync canSync;
     WKClientSend canSend;
 
@@ -270,6 +276,9 @@ private_extern void
 wkWalletManagerRemWallet (WKWalletManager cwm,
                               WKWallet wallet);
 
+private_extern void
+wkWalletManagerSyncCompleted (WKWalletManager manager);
+
 private_extern void
 wkWalletManagerSaveTransactionBundle (WKWalletManager manager,
                                           OwnershipKept WKClientTransactionBundle bundle);
@@ -278,6 +287,14 @@ private_extern void
 wkWalletManagerSaveTransferBundle (WKWalletManager manager,
                                        OwnershipKept WKClientTransferBundle bundle);
 
+private_extern void
+wkWalletManagerSaveTransactionBundles (WKWalletManager manager,
+                                       OwnershipKept BRArrayOf (WKClientTransactionBundle) bundles);
+
+private_extern void
+wkWalletManagerSaveTransferBundles (WKWalletManager manager,
+                                    OwnershipKept BRArrayOf (WKClientTransferBundle) bundles);
+
 private_extern WKWallet
 wkWalletManagerCreateWalletInitialized (WKWalletManager cwm,
                                             WKCurrency currency,
@@ -128,6 +128,52 @@ typedef struct {
 } WKWalletHandlers;
 
 
+// MARK: - Wallet Transfer Index
+
+/**
+ * A WKWalletTransferEntry records the keys - hash, uids and block number - under which a
+ * transfer is indexed.  The keys are captured when the transfer is added and are refreshed
+ * when the transfer's state changes; lookups always confirm a match with `wkTransferEqual()`.
+ */
+typedef struct WKWalletTransferEntryRecord *WKWalletTransferEntry;
+
+typedef struct {
+    /// Every entry, keyed by the WKTransfer pointer
+    BRSetOf (WKWalletTransferEntry) byTransfer;
+
+    /// Entries with a hash, keyed by hash.  Entries sharing a hash are chained (think XTZ
+    /// 'reveal' + 'transaction' or multiple ETH logs in a single transaction).
+    BRSetOf (WKWalletTransferEntry) byHash;
+
+    /// Entries with a uids, keyed by uids.
+    BRSetOf (WKWalletTransferEntry) byUIDS;
+
+    /// Entries lacking a hash or a uids when indexed.  A transfer will acquire a hash when
+    /// signed and a uids once seen by the 'Blockset'; these are re-keyed when found.
+    BRArrayOf (WKWalletTransferEntry) withoutHash;
+    BRArrayOf (WKWalletTransferEntry) withoutUIDS;
+
+    /// Every entry, ordered by block number once `byBlockIsSorted`; not-included transfers last.
+    BRArrayOf (WKWalletTransferEntry) byBlock;
+    bool byBlockIsSorted;
+
+    /// The `sequence` of the next entry added
+    size_t sequence;
+} WKWalletTransferIndex;
+
+// MARK: - Wallet Balance Counters
+
+/**
+ * The balance is maintained incrementally, by applying a per-transfer change.  These counters
+ * record the number of incremental updates, the number of full recomputes and the number of
+ * events (a bulk add, a re-org or an error) that would formerly have required a full recompute.
+ */
+typedef struct {
+    size_t updates;
+    size_t recomputes;
+    size_t recomputesAvoided;
+} WKWalletBalanceCounters;
+
 // MARK: - Wallet
 
 struct WKWalletRecord {
@@ -148,10 +194,14 @@ struct WKWalletRecord {
     /// The transfers (modifiable)
     BRArrayOf (WKTransfer) transfers;
 
+    /// The index of `transfers` (modifiable)
+    WKWalletTransferIndex transfersIndex;
+
     /// The balance (modifiable)
     WKAmount balance;
     WKAmount balanceMinimum;
     WKAmount balanceMaximum;
+    WKWalletBalanceCounters balanceCounters;
 
     /// The defaultFeeBaiss (modifiable)
     WKFeeBasis defaultFeeBasis;
@@ -191,6 +241,11 @@ wkWalletGetTransferByUIDS (WKWallet wallet, const char *identifier);
 private_extern WKTransfer
 wkWalletGetTransferByHashOrUIDS (WKWallet wallet, WKHash hash, const char *uids);
 
+private_extern OwnershipGiven BRArrayOf(WKTransfer)
+wkWalletGetTransfersInBlockRange (WKWallet wallet,
+                                  WKBlockNumber begBlockNumber,
+                                  WKBlockNumber endBlockNumber);
+
 private_extern void
 wkWalletAddTransfer (WKWallet wallet, WKTransfer transfer);
 
@@ -206,12 +261,19 @@ wkWalletReplaceTransfer (WKWallet wallet,
                              OwnershipKept  WKTransfer oldTransfer,
                              OwnershipGiven WKTransfer newTransfer);
 
+private_extern void
+wkWalletUpdTransferIndex (WKWallet wallet,
+                          WKTransfer transfer);
+
 private_extern OwnershipGiven BRSetOf(BRCyptoAddress)
 wkWalletGetAddressesForRecovery (WKWallet wallet);
 
 private_extern void
 wkWalletUpdBalance (WKWallet wallet, bool needLock);
 
+private_extern WKWalletBalanceCounters
+wkWalletGetBalanceCounters (WKWallet wallet);
+
 static inline void
 wkWalletGenerateEvent (WKWallet wallet,
                            OwnershipGiven WKWalletEvent event) {
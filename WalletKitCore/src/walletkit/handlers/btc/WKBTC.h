@@ -121,6 +121,9 @@ wkTransferInitializeStateBTC (BRBitcoinTransaction *tid,
 
 // MARK: - Wallet
 
+/// An optional transfer attribute; its value names a BRBitcoinCoinSelection, such as "BranchAndBound"
+#define FIELD_OPTION_COIN_SELECTION         "CoinSelection"
+
 typedef struct WKWalletBTCRecord {
     struct WKWalletRecord base;
     BRBitcoinWallet *wid;
@@ -165,10 +168,17 @@ wkWalletRemResolvedAsBTC (WKWallet wallet,
                               BRBitcoinTransaction **tids,
                               size_t tidsCount);
 
+private_extern BRBitcoinCoinSelection
+wkWalletGetCoinSelectionBTC (size_t attributesCount,
+                             OwnershipKept WKTransferAttribute *attributes);
+
 // MARK: - (Wallet) Manager
 
 typedef struct WKWalletManagerBTCRecord {
     struct WKWalletManagerRecord base;
+
+    // The number of external and internal chain pkhs last saved; see addressChainsSaveBTC()
+    size_t addressChainsSavedCount[2];
 } *WKWalletManagerBTC;
 
 extern WKWalletManagerBTC
@@ -251,6 +261,8 @@ wkHashCreateAsBTC (UInt256 btc);
 extern const char *fileServiceTypeTransactionsBTC;
 extern const char *fileServiceTypeBlocksBTC;
 extern const char *fileServiceTypePeersBTC;
+extern const char *fileServiceTypeAddressChainsBTC;
+extern const char *fileServiceTypeWalletSnapshotsBTC;
 
 extern size_t fileServiceSpecificationsCountBTC;
 extern BRFileServiceTypeSpecification *fileServiceSpecificationsBTC;
@@ -258,6 +270,11 @@ extern BRFileServiceTypeSpecification *fileServiceSpecificationsBTC;
 extern BRArrayOf(BRBitcoinTransaction*) initialTransactionsLoadBTC (WKWalletManager manager);
 extern BRArrayOf(BRBitcoinPeer)         initialPeersLoadBTC        (WKWalletManager manager);
 extern BRArrayOf(BRBitcoinMerkleBlock*) initialBlocksLoadBTC       (WKWalletManager manager);
+extern BRArrayOf(UInt160)               initialAddressChainLoadBTC (WKWalletManager manager, uint32_t chain);
+extern uint8_t                         *initialWalletSnapshotLoadBTC (WKWalletManager manager, size_t *bytesCount);
+
+extern void addressChainsSaveBTC (WKWalletManager manager, BRBitcoinWallet *wallet);
+extern void walletSnapshotSaveBTC (WKWalletManager manager, BRBitcoinWallet *wallet);
 
 #ifdef __cplusplus
 }
@@ -11,6 +11,7 @@
 #include "WKBTC.h"
 
 #include "bitcoin/BRBitcoinWallet.h"
+#include <strings.h>
 
 #define DEFAULT_FEE_BASIS_SIZE_IN_BYTES     (200)
 #define DEFAULT_TIDS_UNRESOLVED_COUNT         (2)
@@ -101,18 +102,16 @@ private_extern WKTransferBTC
 wkWalletFindTransferByHashAsBTC (WKWallet wallet,
                                      UInt256 hash) {
 
-    WKTransferBTC transfer = NULL;
+    WKTransfer transfer = NULL;
     if (! UInt256IsZero(hash)) {
-        pthread_mutex_lock (&wallet->lock);
-        for (size_t index = 0; index < array_count(wallet->transfers); index++) {
-            transfer = (WKTransferBTC) wallet->transfers[index];
-            if (UInt256Eq (hash, transfer->tid->txHash))
-                break;
-            transfer = NULL;
-        }
-        pthread_mutex_unlock (&wallet->lock);
+        WKHash hashToMatch = wkHashCreateAsBTC (hash);
+        transfer = wkWalletGetTransferByHash (wallet, hashToMatch);
+        wkHashGive (hashToMatch);
+
+        // The wallet holds a reference; return as borrowed
+        wkTransferGive (transfer);
     }
-    return transfer;
+    return (WKTransferBTC) transfer;
 }
 
 private_extern void
@@ -231,24 +230,55 @@ wkWalletIsEqualBTC (WKWallet wb1, WKWallet wb2) {
 extern size_t
 wkWalletGetTransferAttributeCountBTC (WKWallet wallet,
                                           WKAddress target) {
-    return 0;
+    return 1;
 }
 
 extern WKTransferAttribute
 wkWalletGetTransferAttributeAtBTC (WKWallet wallet,
                                        WKAddress target,
                                        size_t index) {
-    return NULL;
+    assert (0 == index);
+    return wkTransferAttributeCreate (FIELD_OPTION_COIN_SELECTION, NULL, WK_FALSE);
 }
 
 extern WKTransferAttributeValidationError
 wkWalletValidateTransferAttributeBTC (WKWallet wallet,
                                           OwnershipKept WKTransferAttribute attribute,
                                           WKBoolean *validates) {
+    const char *key = wkTransferAttributeGetKey (attribute);
+    const char *val = wkTransferAttributeGetValue (attribute);
+
+    // The only attribute, FIELD_OPTION_COIN_SELECTION, is optional
+    if (0 != strcasecmp (key, FIELD_OPTION_COIN_SELECTION)) {
+        *validates = WK_FALSE;
+        return WK_TRANSFER_ATTRIBUTE_VALIDATION_ERROR_RELATIONSHIP_INCONSISTENCY;
+    }
+
+    if (NULL != val && !btcCoinSelectionFromName (val, NULL)) {
+        *validates = WK_FALSE;
+        return WK_TRANSFER_ATTRIBUTE_VALIDATION_ERROR_MISMATCHED_TYPE;
+    }
+
     *validates = WK_TRUE;
     return (WKTransferAttributeValidationError) 0;
 }
 
+private_extern BRBitcoinCoinSelection
+wkWalletGetCoinSelectionBTC (size_t attributesCount,
+                             OwnershipKept WKTransferAttribute *attributes) {
+    BRBitcoinCoinSelection selection = BITCOIN_COIN_SELECTION_WALLET_ORDER;
+
+    for (size_t index = 0; index < attributesCount; index++) {
+        WKTransferAttribute attribute = attributes[index];
+        const char *val = wkTransferAttributeGetValue (attribute);
+
+        if (NULL != val && 0 == strcasecmp (wkTransferAttributeGetKey (attribute), FIELD_OPTION_COIN_SELECTION))
+            btcCoinSelectionFromName (val, &selection);
+    }
+
+    return selection;
+}
+
 extern WKTransfer
 wkWalletCreateTransferBTC (WKWallet  wallet,
                                WKAddress target,
@@ -273,7 +303,14 @@ wkWalletCreateTransferBTC (WKWallet  wallet,
 
     uint64_t feePerKb = wkFeeBasisAsBTC(estimatedFeeBasis);
 
-    BRBitcoinTransaction *tid = btcWalletCreateTransactionWithFeePerKb (wid, feePerKb, value, address.s);
+    BRBitcoinTxOutput output = BR_TX_OUTPUT_NONE;
+    output.amount = value;
+    btcTxOutputSetAddress (&output, btcWalletGetAddressParams (wid), address.s);
+
+    BRBitcoinTransaction *tid = btcWalletCreateTxForOutputsWithCoinSelection (wid, feePerKb, &output, 1,
+                                                                              wkWalletGetCoinSelectionBTC (attributesCount,
+                                                                                                           attributes));
+    btcTxOutputSetAddress (&output, btcWalletGetAddressParams (wid), NULL);
 
     return (NULL == tid
             ? NULL
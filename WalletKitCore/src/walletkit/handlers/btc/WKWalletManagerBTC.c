@@ -171,8 +171,12 @@ wkWalletManagerEstimateFeeBasisBTC (WKWalletManager cwm,
     uint64_t btcAmount   = wkAmountGetIntegerRaw (amount, &overflow);
     assert(WK_FALSE == overflow);
 
-    // No margin needed.
-    uint64_t btcFee = (0 == btcAmount ? 0 : btcWalletFeeForTxAmountWithFeePerKb (btcWallet, btcFeePerKB, btcAmount));
+    // No margin needed.  Select coins as wkWalletCreateTransferBTC() will, so the fee matches.
+    uint64_t btcFee = (0 == btcAmount
+                       ? 0
+                       : btcWalletFeeForTxAmountWithCoinSelection (btcWallet, btcFeePerKB, btcAmount,
+                                                                   wkWalletGetCoinSelectionBTC (attributesCount,
+                                                                                                attributes)));
 
     return wkFeeBasisCreateAsBTC (wallet->unitForFee, btcFee, btcFeePerKB, WK_FEE_BASIS_BTC_SIZE_UNKNOWN);
 }
@@ -184,6 +188,21 @@ wkWalletManagerGetMPK (WKWalletManager manager) {
                                             manager->type));
 }
 
+// The number of pkhs loaded for chain, or zero if btcWallet ignored them as not matching its mpk
+static size_t
+wkWalletManagerAddrChainKeptCountBTC (BRBitcoinWallet *btcWallet,
+                                      uint32_t chain,
+                                      const UInt160 *pkhs,
+                                      size_t pkhsCount) {
+    UInt160 pkh;
+
+    return (pkhsCount > 0 &&
+            1 == btcWalletAddrChain (btcWallet, chain, &pkh, 1) &&
+            UInt160Eq (pkh, pkhs[0])
+            ? pkhsCount
+            : 0);
+}
+
 static WKWallet
 wkWalletManagerCreateWalletBTC (WKWalletManager manager,
                                 WKCurrency currency,
@@ -202,17 +221,45 @@ wkWalletManagerCreateWalletBTC (WKWalletManager manager,
 
     BRArrayOf(BRBitcoinTransaction*) transactions = initialTransactionsLoadBTC(manager);
 
+    // The address chains derived by an earlier btcWallet; may be empty.
+    BRArrayOf(UInt160) externalPKHs = initialAddressChainLoadBTC (manager, SEQUENCE_EXTERNAL_CHAIN);
+    BRArrayOf(UInt160) internalPKHs = initialAddressChainLoadBTC (manager, SEQUENCE_INTERNAL_CHAIN);
+    size_t externalCount = (NULL == externalPKHs ? 0 : array_count (externalPKHs));
+    size_t internalCount = (NULL == internalPKHs ? 0 : array_count (internalPKHs));
+
+    // The snapshot of an earlier btcWallet's balance; ignored by the btcWallet if stale.
+    size_t   snapshotCount = 0;
+    uint8_t *snapshot      = initialWalletSnapshotLoadBTC (manager, &snapshotCount);
+
     // Create the BTC wallet
     //
     // Since the BRBitcoinWallet callbacks are not set, none of these transactions generate callbacks.
     // And, in fact, looking at btcWalletNew(), there is not even an attempt to generate callbacks
     // even if they could have been specified.
-    BRBitcoinWallet *btcWallet = btcWalletNew (btcChainParams->addrParams, transactions, array_count(transactions), btcMPK);
+    BRBitcoinWallet *btcWallet = btcWalletNewWithSnapshot (btcChainParams->addrParams,
+                                                           transactions, array_count(transactions),
+                                                           btcMPK,
+                                                           externalPKHs, externalCount,
+                                                           internalPKHs, internalCount,
+                                                           snapshot, snapshotCount);
     assert (NULL != btcWallet);
 
+    if (NULL != snapshot) free (snapshot);
+
     // The btcWallet now should include *all* the transactions
     array_free (transactions);
 
+    // Save the address chains if the btcWallet had to derive any more (or the saved ones didn't match)
+    WKWalletManagerBTC managerBTC = wkWalletManagerCoerceBTC (manager, manager->type);
+    managerBTC->addressChainsSavedCount[0] = wkWalletManagerAddrChainKeptCountBTC (btcWallet, SEQUENCE_EXTERNAL_CHAIN,
+                                                                                   externalPKHs, externalCount);
+    managerBTC->addressChainsSavedCount[1] = wkWalletManagerAddrChainKeptCountBTC (btcWallet, SEQUENCE_INTERNAL_CHAIN,
+                                                                                   internalPKHs, internalCount);
+    addressChainsSaveBTC (manager, btcWallet);
+
+    if (NULL != externalPKHs) array_free (externalPKHs);
+    if (NULL != internalPKHs) array_free (internalPKHs);
+
     // Set the callbacks
     btcWalletSetCallbacks (btcWallet,
                           wkWalletManagerCoerceBTC(manager, manager->network->type),
@@ -438,6 +485,16 @@ wkWalletManagerCreateWalletSweeperBTC (WKWalletManager cwm,
     return sweeper;
 }
 
+// Upon a completed sync, API or P2P, snapshot the wallet so that it is restored, rather than
+// replayed, next time, and save the address chains if the sync extended them.
+static void
+wkWalletManagerSyncCompletedBTC (WKWalletManager manager) {
+    BRBitcoinWallet *btcWallet = wkWalletAsBTC (manager->wallet);
+
+    walletSnapshotSaveBTC (manager, btcWallet);
+    addressChainsSaveBTC  (manager, btcWallet);
+}
+
 // MARK: BRBitcoinWallet Callback Balance Changed
 
 static void wkWalletManagerBTCBalanceChanged (void *info, uint64_t balanceInSatoshi) {
@@ -562,6 +619,9 @@ static void wkWalletManagerBTCTxUpdated (void *info,
 
     WKWallet wallet = manager->base.wallet;
 
+    // Save every modified `tid` in one fileService batch
+    fileServiceBeginBatch (manager->base.fileService);
+
     for (size_t index = 0; index < count; index++) {
         // TODO: This is here to allow events to flow; otherwise we'd block for too long??
         pthread_mutex_lock (&manager->base.lock);
@@ -608,6 +668,8 @@ static void wkWalletManagerBTCTxUpdated (void *info,
         pthread_mutex_unlock (&manager->base.lock);
     }
 
+    fileServiceCommitBatch (manager->base.fileService);
+
     pthread_mutex_lock (&manager->base.lock);
     // Find other transations in `wallet` that are now resolved.
     size_t resolvedTransactionsCount = wkWalletRemResolvedAsBTC (wallet, NULL, 0);
@@ -685,7 +747,8 @@ WKWalletManagerHandlers wkWalletManagerHandlersBTC = {
     wkWalletManagerRecoverTransferFromTransferBundleBTC,
     NULL,//WKWalletManagerRecoverFeeBasisFromFeeEstimateHandler not supported
     wkWalletManagerWalletSweeperValidateSupportedBTC,
-    wkWalletManagerCreateWalletSweeperBTC
+    wkWalletManagerCreateWalletSweeperBTC,
+    wkWalletManagerSyncCompletedBTC
 };
 
 WKWalletManagerHandlers wkWalletManagerHandlersBCH = {
@@ -705,7 +768,8 @@ WKWalletManagerHandlers wkWalletManagerHandlersBCH = {
     wkWalletManagerRecoverTransferFromTransferBundleBTC,
     NULL,//WKWalletManagerRecoverFeeBasisFromFeeEstimateHandler not supported
     wkWalletManagerWalletSweeperValidateSupportedBTC,
-    wkWalletManagerCreateWalletSweeperBTC
+    wkWalletManagerCreateWalletSweeperBTC,
+    wkWalletManagerSyncCompletedBTC
 };
 
 WKWalletManagerHandlers wkWalletManagerHandlersBSV = {
@@ -725,7 +789,8 @@ WKWalletManagerHandlers wkWalletManagerHandlersBSV = {
     wkWalletManagerRecoverTransferFromTransferBundleBTC,
     NULL,//WKWalletManagerRecoverFeeBasisFromFeeEstimateHandler not supported
     wkWalletManagerWalletSweeperValidateSupportedBTC,
-    wkWalletManagerCreateWalletSweeperBTC
+    wkWalletManagerCreateWalletSweeperBTC,
+    wkWalletManagerSyncCompletedBTC
 };
 
 WKWalletManagerHandlers wkWalletManagerHandlersLTC = {
@@ -745,7 +810,8 @@ WKWalletManagerHandlers wkWalletManagerHandlersLTC = {
     wkWalletManagerRecoverTransferFromTransferBundleBTC,
     NULL,//WKWalletManagerRecoverFeeBasisFromFeeEstimateHandler not supported
     wkWalletManagerWalletSweeperValidateSupportedBTC,
-    wkWalletManagerCreateWalletSweeperBTC
+    wkWalletManagerCreateWalletSweeperBTC,
+    wkWalletManagerSyncCompletedBTC
 };
 
 WKWalletManagerHandlers wkWalletManagerHandlersDOGE = {
@@ -765,5 +831,6 @@ WKWalletManagerHandlers wkWalletManagerHandlersDOGE = {
     wkWalletManagerRecoverTransferFromTransferBundleBTC,
     NULL,//WKWalletManagerRecoverFeeBasisFromFeeEstimateHandler not supported
     wkWalletManagerWalletSweeperValidateSupportedBTC,
-    wkWalletManagerCreateWalletSweeperBTC
+    wkWalletManagerCreateWalletSweeperBTC,
+    wkWalletManagerSyncCompletedBTC
 };
@@ -192,13 +192,26 @@ wkClientP2PManagerSetNetworkReachableBTC (WKClientP2PManager baseManager,
     atomic_store (&manager->isNetworkReachable, isNetworkReachable);
 }
 
+static void
+wkClientP2PManagerSetSyncFilterBTC (WKClientP2PManager baseManager,
+                                        WKSyncFilter filter) {
+    WKClientP2PManagerBTC manager = wkClientP2PManagerCoerce (baseManager);
+
+    // Switching filters disconnects; if we were connected, reconnect to sync with the new filter.
+    int wasConnected = (BRPeerStatusDisconnected != btcPeerManagerConnectStatus (manager->btcPeerManager));
+
+    btcPeerManagerSetCompactFilters (manager->btcPeerManager, WK_SYNC_FILTER_COMPACT == filter);
+    if (wasConnected) btcPeerManagerConnect (manager->btcPeerManager);
+}
+
 static WKClientP2PHandlers p2pHandlersBTC = {
     wkClientP2PManagerReleaseBTC,
     wkClientP2PManagerConnectBTC,
     wkClientP2PManagerDisconnectBTC,
     wkClientP2PManagerSyncBTC,
     wkClientP2PManagerSendBTC,
-    wkClientP2PManagerSetNetworkReachableBTC
+    wkClientP2PManagerSetNetworkReachableBTC,
+    wkClientP2PManagerSetSyncFilterBTC
 };
 
 // MARK: BRPeerManager Callbacks
@@ -281,6 +294,9 @@ static void wkWalletManagerBTCSyncStopped (void *info, int reason) {
 
     pthread_mutex_unlock (&p2p->base.lock);
 
+    if (syncCompleted && 0 == reason)
+        wkWalletManagerSyncCompleted (&manager->base);
+
     if (needStop) {
         WKSyncStoppedReason stopReason = (reason
                                                 ? wkSyncStoppedReasonPosix(reason)
@@ -351,8 +367,7 @@ static void wkWalletManagerBTCSaveBlocks (void *info, int replace, BRBitcoinMerk
         fileServiceReplace (manager->base.fileService, fileServiceTypeBlocksBTC, (const void **) blocks, count);
     }
     else {
-        for (size_t index = 0; index < count; index++)
-            fileServiceSave (manager->base.fileService, fileServiceTypeBlocksBTC, blocks[index]);
+        fileServiceSaveBatch (manager->base.fileService, fileServiceTypeBlocksBTC, (const void **) blocks, count);
     }
 }
 
@@ -361,27 +376,25 @@ static void wkWalletManagerBTCSavePeers  (void *info, int replace, const BRBitco
 
     // filesystem changes are NOT queued; they are acted upon immediately
 
-    if (!replace) {
-        // save each peer, one-by-one
-        for (size_t index = 0; index < count; index++)
-            fileServiceSave (manager->base.fileService, fileServiceTypePeersBTC, &peers[index]);
-    }
-
-    else if (0 == count) {
+    if (replace && 0 == count) {
         // no peers to set, just do a clear
         fileServiceClear (manager->base.fileService, fileServiceTypePeersBTC);
     }
 
     else {
-        // fileServiceReplace expects an array of pointers to entities, instead of an array of
-        // structures so let's do the conversion here
+        // fileServiceSaveBatch and fileServiceReplace expect an array of pointers to entities,
+        // instead of an array of structures so let's do the conversion here
         const BRBitcoinPeer **peerRefs = calloc (count, sizeof(BRBitcoinPeer *));
 
         for (size_t i = 0; i < count; i++) {
             peerRefs[i] = &peers[i];
         }
 
-        fileServiceReplace (manager->base.fileService, fileServiceTypePeersBTC, (const void **) peerRefs, count);
+        if (!replace)
+            // save every peer, in one batch
+            fileServiceSaveBatch (manager->base.fileService, fileServiceTypePeersBTC, (const void **) peerRefs, count);
+        else
+            fileServiceReplace (manager->base.fileService, fileServiceTypePeersBTC, (const void **) peerRefs, count);
         free (peerRefs);
     }
 }
@@ -12,6 +12,34 @@
 #include "walletkit/WKFileService.h"
 
 
+/// MARK: - Load Handlers
+
+///
+/// The context for streaming loaded entities into a BRArrayOf(<entity>*).  Each entity is
+/// appended as it is read, rather than collected into a BRSet that is then copied into an array;
+/// `loaded` holds the same entities, by hash, only to drop a duplicate as it is read.
+///
+typedef struct {
+    BRArrayOf(void*) entities;
+    BRSet *loaded;
+    void (*entityFree) (void *entity);
+} WKLoadContextBTC;
+
+static int
+fileServiceLoadHandlerArrayBTC (BRFileServiceContext context,
+                                BRFileService fs,
+                                const char *type,
+                                void *entity) {
+    WKLoadContextBTC *load = (WKLoadContextBTC *) context;
+
+    if (NULL != BRSetGet (load->loaded, entity)) load->entityFree (entity);
+    else {
+        BRSetAdd  (load->loaded,   entity);
+        array_add (load->entities, entity);
+    }
+    return 1;
+}
+
 /// MARK: - Transaction File Service
 
 #define FILE_SERVICE_TYPE_TRANSACTION     "transactions"
@@ -77,27 +105,32 @@ fileServiceTypeTransactionV1Reader (BRFileServiceContext context,
     return transaction;
 }
 
+static void
+initialTransactionFreeBTC (void *transaction) {
+    btcTransactionFree (transaction);
+}
+
 extern BRArrayOf(BRBitcoinTransaction*)
 initialTransactionsLoadBTC (WKWalletManager manager) {
-    BRSetOf(BRBitcoinTransaction*) transactionSet = BRSetNew(btcTransactionHash, btcTransactionEq, 100);
-    if (1 != fileServiceLoad (manager->fileService, transactionSet, FILE_SERVICE_TYPE_TRANSACTION, 1)) {
-        BRSetFreeAll(transactionSet, (void (*) (void*)) btcTransactionFree);
-        _peer_log ("BWM: failed to load transactions");
-        return NULL;
-    }
+    WKLoadContextBTC load = { NULL, BRSetNew (btcTransactionHash, btcTransactionEq, 100), initialTransactionFreeBTC };
+    array_new (load.entities, 100);
 
-    size_t transactionsCount = BRSetCount(transactionSet);
+    int success = fileServiceLoadIterate (manager->fileService, FILE_SERVICE_TYPE_TRANSACTION, 1,
+                                          NULL, NULL,
+                                          &load, fileServiceLoadHandlerArrayBTC);
+    BRSetFree (load.loaded);
 
-    BRArrayOf(BRBitcoinTransaction*) transactions;
-    array_new (transactions, transactionsCount);
-    array_set_count(transactions, transactionsCount);
+    BRArrayOf(BRBitcoinTransaction*) transactions = (BRArrayOf(BRBitcoinTransaction*)) load.entities;
 
-    BRSetAll(transactionSet, (void**) transactions, transactionsCount);
-    BRSetFree(transactionSet);
+    if (1 != success) {
+        array_free_all (transactions, btcTransactionFree);
+        _peer_log ("BWM: failed to load transactions");
+        return NULL;
+    }
 
     _peer_log ("BWM: %4s: loaded %4zu transactions\n",
                wkNetworkTypeGetCurrencyCode (manager->type),
-               transactionsCount);
+               array_count (transactions));
     return transactions;
 }
 
@@ -165,28 +198,33 @@ fileServiceTypeBlockV1Reader (BRFileServiceContext context,
     return block;
 }
 
+static void
+initialBlockFreeBTC (void *block) {
+    btcMerkleBlockFree (block);
+}
+
 extern BRArrayOf(BRBitcoinMerkleBlock*)
 initialBlocksLoadBTC (WKWalletManager manager) {
-    BRSetOf(BRMerkleBlock*) blockSet = BRSetNew(btcMerkleBlockHash, btcMerkleBlockEq, 100);
-    if (1 != fileServiceLoad (manager->fileService, blockSet, fileServiceTypeBlocksBTC, 1)) {
-        BRSetFreeAll(blockSet, (void (*) (void*)) btcMerkleBlockFree);
+    WKLoadContextBTC load = { NULL, BRSetNew (btcMerkleBlockHash, btcMerkleBlockEq, 100), initialBlockFreeBTC };
+    array_new (load.entities, 100);
+
+    int success = fileServiceLoadIterate (manager->fileService, fileServiceTypeBlocksBTC, 1,
+                                          NULL, NULL,
+                                          &load, fileServiceLoadHandlerArrayBTC);
+    BRSetFree (load.loaded);
+
+    BRArrayOf(BRBitcoinMerkleBlock*) blocks = (BRArrayOf(BRBitcoinMerkleBlock*)) load.entities;
+
+    if (1 != success) {
+        array_free_all (blocks, btcMerkleBlockFree);
         _peer_log ("BWM: %4s: failed to load blocks",
                    wkNetworkTypeGetCurrencyCode (manager->type));
         return NULL;
     }
 
-    size_t blocksCount = BRSetCount(blockSet);
-
-    BRArrayOf(BRBitcoinMerkleBlock*) blocks;
-    array_new (blocks, blocksCount);
-    array_set_count(blocks, blocksCount);
-
-    BRSetAll(blockSet, (void**) blocks, blocksCount);
-    BRSetFree(blockSet);
-
     _peer_log ("BWM: %4s: loaded %4zu blocks\n",
                wkNetworkTypeGetCurrencyCode (manager->type),
-               blocksCount);
+               array_count (blocks));
     return blocks;
 }
 
@@ -268,29 +306,310 @@ fileServiceTypePeerV1Reader (BRFileServiceContext context,
     return peer;
 }
 
+///
+/// A peer's identifier covers its timestamp, so the DB can hold one peer (by address and port)
+/// more than once; `loaded`, by `btcPeerEq`, drops all but the first read.  Each peer is copied,
+/// as a value, into `peers` as it is read.
+///
+typedef struct {
+    BRArrayOf(BRBitcoinPeer) peers;
+    BRSetOf(BRBitcoinPeer*) loaded;
+} WKLoadPeersContextBTC;
+
+static int
+fileServiceLoadHandlerPeerBTC (BRFileServiceContext context,
+                               BRFileService fs,
+                               const char *type,
+                               void *entity) {
+    WKLoadPeersContextBTC *load = (WKLoadPeersContextBTC *) context;
+
+    if (NULL != BRSetGet (load->loaded, entity)) free (entity);
+    else {
+        BRSetAdd  (load->loaded, entity);
+        array_add (load->peers, *((BRBitcoinPeer *) entity));
+    }
+    return 1;
+}
+
 extern BRArrayOf(BRBitcoinPeer)
 initialPeersLoadBTC (WKWalletManager manager) {
     /// Load peers for the wallet manager.
-    BRSetOf(BRPeer*) peerSet = BRSetNew(btcPeerHash, btcPeerEq, 100);
-    if (1 != fileServiceLoad (manager->fileService, peerSet, fileServiceTypePeersBTC, 1)) {
-        BRSetFreeAll(peerSet, free);
+    WKLoadPeersContextBTC load = { NULL, BRSetNew (btcPeerHash, btcPeerEq, 100) };
+    array_new (load.peers, 100);
+
+    int success = fileServiceLoadIterate (manager->fileService, fileServiceTypePeersBTC, 1,
+                                          NULL, NULL,
+                                          &load, fileServiceLoadHandlerPeerBTC);
+    BRSetFreeAll (load.loaded, free);
+
+    BRArrayOf(BRBitcoinPeer) peers = load.peers;
+
+    if (1 != success) {
+        array_free (peers);
         _peer_log ("BWM: %4s: failed to load peers",
                    wkNetworkTypeGetCurrencyCode (manager->type));
         return NULL;
     }
 
-    size_t peersCount = BRSetCount(peerSet);
+    _peer_log ("BWM: %4s: loaded %4zu peers\n",
+               wkNetworkTypeGetCurrencyCode (manager->type),
+               array_count (peers));
+    return peers;
+}
 
-    BRArrayOf(BRBitcoinPeer) peers;
-    array_new (peers, peersCount);
+/// MARK: - Address Chain File Service
 
-    FOR_SET (BRBitcoinPeer*, peer, peerSet) array_add (peers, *peer);
-    BRSetFreeAll(peerSet, free);
+#define FILE_SERVICE_TYPE_ADDRESS_CHAIN     "address-chains"
 
-    _peer_log ("BWM: %4s: loaded %4zu peers\n",
+enum {
+    FILE_SERVICE_TYPE_ADDRESS_CHAIN_VERSION_1
+};
+
+///
+/// The pkhs derived so far for one of the wallet's chains, external or internal.  Deriving each
+/// requires EC math; for a wallet with many used addresses reloading them is far faster.
+///
+/// The btcWallet checks only that the first and last pkhs match its mpk, so a SHA256 digest of the
+/// chain and every pkh is saved with them; a chain whose digest doesn't match is not loaded.
+///
+typedef struct {
+    uint32_t chain;
+    BRArrayOf(UInt160) pkhs;
+} WKAddressChainBTC;
+
+static UInt256
+fileServiceTypeAddressChainIdentifier (uint32_t chain) {
+    UInt256 identifier = UINT256_ZERO;
+    UInt32SetLE (identifier.u8, chain);
+    return identifier;
+}
+
+static UInt256
+fileServiceTypeAddressChainV1Identifier (BRFileServiceContext context,
+                                         BRFileService fs,
+                                         const void *entity) {
+    const WKAddressChainBTC *addressChain = entity;
+    return fileServiceTypeAddressChainIdentifier (addressChain->chain);
+}
+
+static uint8_t *
+fileServiceTypeAddressChainV1Writer (BRFileServiceContext context,
+                                     BRFileService fs,
+                                     const void* entity,
+                                     uint32_t *bytesCount) {
+    const WKAddressChainBTC *addressChain = entity;
+    size_t pkhsCount = array_count (addressChain->pkhs);
+
+    size_t chainBytesCount = sizeof (uint32_t) + pkhsCount * sizeof (UInt160);
+
+    *bytesCount = (uint32_t) (chainBytesCount + sizeof (UInt256));
+    uint8_t *bytes = malloc (*bytesCount);
+
+    UInt32SetLE (bytes, addressChain->chain);
+    memcpy (&bytes[sizeof (uint32_t)], addressChain->pkhs, pkhsCount * sizeof (UInt160));
+    BRSHA256 (&bytes[chainBytesCount], bytes, chainBytesCount);   // digest is the last 32 bytes
+
+    return bytes;
+}
+
+static void *
+fileServiceTypeAddressChainV1Reader (BRFileServiceContext context,
+                                     BRFileService fs,
+                                     uint8_t *bytes,
+                                     uint32_t bytesCount) {
+    if (bytesCount < sizeof (uint32_t) + sizeof (UInt256) ||
+        0 != (bytesCount - sizeof (uint32_t) - sizeof (UInt256)) % sizeof (UInt160)) return NULL;
+
+    size_t chainBytesCount = bytesCount - sizeof (UInt256);
+    size_t pkhsCount = (chainBytesCount - sizeof (uint32_t)) / sizeof (UInt160);
+
+    UInt256 digest;
+    BRSHA256 (digest.u8, bytes, chainBytesCount);
+    if (0 != memcmp (digest.u8, &bytes[chainBytesCount], sizeof (UInt256))) return NULL;
+
+    WKAddressChainBTC *addressChain = malloc (sizeof (WKAddressChainBTC));
+
+    addressChain->chain = UInt32GetLE (bytes);
+    array_new (addressChain->pkhs, pkhsCount);
+    array_add_array (addressChain->pkhs, (UInt160 *) &bytes[sizeof (uint32_t)], pkhsCount);
+
+    return addressChain;
+}
+
+static int
+fileServiceLoadHandlerAddressChainBTC (BRFileServiceContext context,
+                                       BRFileService fs,
+                                       const char *type,
+                                       void *entity) {
+    BRArrayOf(UInt160) *pkhs = (BRArrayOf(UInt160) *) context;
+    WKAddressChainBTC  *addressChain = entity;
+
+    if (NULL != *pkhs) array_free (*pkhs);
+    *pkhs = addressChain->pkhs;
+    free (addressChain);
+    return 1;
+}
+
+extern BRArrayOf(UInt160)
+initialAddressChainLoadBTC (WKWalletManager manager,
+                            uint32_t chain) {
+    BRArrayOf(UInt160) pkhs = NULL;
+    UInt256 identifier = fileServiceTypeAddressChainIdentifier (chain);
+
+    if (1 != fileServiceLoadIterate (manager->fileService, fileServiceTypeAddressChainsBTC, 1,
+                                     &identifier, &identifier,
+                                     &pkhs, fileServiceLoadHandlerAddressChainBTC)) {
+        if (NULL != pkhs) array_free (pkhs);
+        _peer_log ("BWM: %4s: failed to load address chain %"PRIu32,
+                   wkNetworkTypeGetCurrencyCode (manager->type),
+                   chain);
+        return NULL;
+    }
+
+    if (NULL == pkhs) array_new (pkhs, 0);
+
+    _peer_log ("BWM: %4s: loaded %4zu addresses of chain %"PRIu32"\n",
                wkNetworkTypeGetCurrencyCode (manager->type),
-               peersCount);
-    return peers;
+               array_count (pkhs),
+               chain);
+    return pkhs;
+}
+
+///
+/// Save the wallet's address chains if it has derived more pkhs, as when extending a chain's gap
+/// limit, since they were last saved.  The chains only grow; an unchanged count is an unchanged chain.
+///
+extern void
+addressChainsSaveBTC (WKWalletManager manager,
+                      BRBitcoinWallet *wallet) {
+    WKWalletManagerBTC managerBTC = wkWalletManagerCoerceBTC (manager, manager->type);
+    WKAddressChainBTC addressChains[2] = {
+        { SEQUENCE_EXTERNAL_CHAIN, NULL },
+        { SEQUENCE_INTERNAL_CHAIN, NULL }
+    };
+    const void *entities[2] = { &addressChains[0], &addressChains[1] };
+    bool needSave = false;
+
+    for (size_t index = 0; index < 2; index++) {
+        size_t pkhsCount = btcWalletAddrChain (wallet, addressChains[index].chain, NULL, 0);
+        array_new (addressChains[index].pkhs, pkhsCount);
+        array_set_count (addressChains[index].pkhs, btcWalletAddrChain (wallet, addressChains[index].chain,
+                                                                         addressChains[index].pkhs, pkhsCount));
+        needSave |= (array_count (addressChains[index].pkhs) != managerBTC->addressChainsSavedCount[index]);
+    }
+
+    if (needSave) {
+        fileServiceSaveBatch (manager->fileService, fileServiceTypeAddressChainsBTC, entities, 2);
+
+        for (size_t index = 0; index < 2; index++)
+            managerBTC->addressChainsSavedCount[index] = array_count (addressChains[index].pkhs);
+    }
+
+    for (size_t index = 0; index < 2; index++)
+        array_free (addressChains[index].pkhs);
+}
+
+/// MARK: - Wallet Snapshot File Service
+
+#define FILE_SERVICE_TYPE_WALLET_SNAPSHOT     "wallet-snapshots"
+
+enum {
+    FILE_SERVICE_TYPE_WALLET_SNAPSHOT_VERSION_1
+};
+
+///
+/// The wallet's confirmed transaction order, balance history and UTXOs, from btcWalletSnapshot().
+/// Restoring these avoids sorting and replaying every transaction when the wallet is created.
+///
+typedef struct {
+    uint8_t *bytes;
+    size_t bytesCount;
+} WKWalletSnapshotBTC;
+
+static UInt256
+fileServiceTypeWalletSnapshotV1Identifier (BRFileServiceContext context,
+                                           BRFileService fs,
+                                           const void *entity) {
+    return UINT256_ZERO; // there is only one
+}
+
+static uint8_t *
+fileServiceTypeWalletSnapshotV1Writer (BRFileServiceContext context,
+                                       BRFileService fs,
+                                       const void* entity,
+                                       uint32_t *bytesCount) {
+    const WKWalletSnapshotBTC *snapshot = entity;
+    uint8_t *bytes = malloc (snapshot->bytesCount);
+
+    memcpy (bytes, snapshot->bytes, snapshot->bytesCount);
+    *bytesCount = (uint32_t) snapshot->bytesCount;
+
+    return bytes;
+}
+
+static void *
+fileServiceTypeWalletSnapshotV1Reader (BRFileServiceContext context,
+                                       BRFileService fs,
+                                       uint8_t *bytes,
+                                       uint32_t bytesCount) {
+    WKWalletSnapshotBTC *snapshot = malloc (sizeof (WKWalletSnapshotBTC));
+
+    snapshot->bytes = malloc (bytesCount > 0 ? bytesCount : 1);
+    snapshot->bytesCount = bytesCount;
+    memcpy (snapshot->bytes, bytes, bytesCount);
+
+    return snapshot;
+}
+
+static int
+fileServiceLoadHandlerWalletSnapshotBTC (BRFileServiceContext context,
+                                         BRFileService fs,
+                                         const char *type,
+                                         void *entity) {
+    WKWalletSnapshotBTC *loaded   = (WKWalletSnapshotBTC *) context;
+    WKWalletSnapshotBTC *snapshot = entity;
+
+    if (NULL != loaded->bytes) free (loaded->bytes);
+    *loaded = *snapshot;
+    free (snapshot);
+    return 1;
+}
+
+extern uint8_t *
+initialWalletSnapshotLoadBTC (WKWalletManager manager,
+                              size_t *bytesCount) {
+    WKWalletSnapshotBTC snapshot = { NULL, 0 };
+    UInt256 identifier = UINT256_ZERO;
+
+    if (1 != fileServiceLoadIterate (manager->fileService, fileServiceTypeWalletSnapshotsBTC, 1,
+                                     &identifier, &identifier,
+                                     &snapshot, fileServiceLoadHandlerWalletSnapshotBTC)) {
+        if (NULL != snapshot.bytes) free (snapshot.bytes);
+        _peer_log ("BWM: %4s: failed to load wallet snapshot",
+                   wkNetworkTypeGetCurrencyCode (manager->type));
+        snapshot = (WKWalletSnapshotBTC) { NULL, 0 };
+    }
+
+    *bytesCount = snapshot.bytesCount;
+    return snapshot.bytes;
+}
+
+extern void
+walletSnapshotSaveBTC (WKWalletManager manager,
+                       BRBitcoinWallet *wallet) {
+    WKWalletSnapshotBTC snapshot = { NULL, btcWalletSnapshot (wallet, NULL, 0) };
+
+    // No snapshot while any transaction is unconfirmed; keep the last one, which may still be restored
+    if (0 == snapshot.bytesCount) return;
+
+    snapshot.bytes = malloc (snapshot.bytesCount);
+    snapshot.bytesCount = btcWalletSnapshot (wallet, snapshot.bytes, snapshot.bytesCount);
+
+    // Zero if the wallet changed between the two calls; the next save will catch up
+    if (0 != snapshot.bytesCount)
+        fileServiceSave (manager->fileService, fileServiceTypeWalletSnapshotsBTC, &snapshot);
+
+    free (snapshot.bytes);
 }
 
 ///
@@ -342,12 +661,42 @@ static BRFileServiceTypeSpecification fileServiceSpecificationsArrayBTC[] = {
                 fileServiceTypePeerV1Writer
             }
         }
+    },
+
+    {
+        FILE_SERVICE_TYPE_ADDRESS_CHAIN,
+        FILE_SERVICE_TYPE_ADDRESS_CHAIN_VERSION_1,
+        1,
+        {
+            {
+                FILE_SERVICE_TYPE_ADDRESS_CHAIN_VERSION_1,
+                fileServiceTypeAddressChainV1Identifier,
+                fileServiceTypeAddressChainV1Reader,
+                fileServiceTypeAddressChainV1Writer
+            }
+        }
+    },
+
+    {
+        FILE_SERVICE_TYPE_WALLET_SNAPSHOT,
+        FILE_SERVICE_TYPE_WALLET_SNAPSHOT_VERSION_1,
+        1,
+        {
+            {
+                FILE_SERVICE_TYPE_WALLET_SNAPSHOT_VERSION_1,
+                fileServiceTypeWalletSnapshotV1Identifier,
+                fileServiceTypeWalletSnapshotV1Reader,
+                fileServiceTypeWalletSnapshotV1Writer
+            }
+        }
     }
 };
 
 const char *fileServiceTypeTransactionsBTC = FILE_SERVICE_TYPE_TRANSACTION;
 const char *fileServiceTypeBlocksBTC       = FILE_SERVICE_TYPE_BLOCK;
 const char *fileServiceTypePeersBTC        = FILE_SERVICE_TYPE_PEER;
+const char *fileServiceTypeAddressChainsBTC = FILE_SERVICE_TYPE_ADDRESS_CHAIN;
+const char *fileServiceTypeWalletSnapshotsBTC = FILE_SERVICE_TYPE_WALLET_SNAPSHOT;
 
 size_t fileServiceSpecificationsCountBTC = sizeof(fileServiceSpecificationsArrayBTC)/sizeof(BRFileServiceTypeSpecification);
 BRFileServiceTypeSpecification *fileServiceSpecificationsBTC = fileServiceSpecificationsArrayBTC;
@@ -1024,4 +1024,5 @@ WKWalletManagerHandlers wkWalletManagerHandlersETH = {
     wkWalletManagerRecoverFeeBasisFromFeeEstimateETH,
     NULL,//WKWalletManagerWalletSweeperValidateSupportedHandler not supported
     NULL,//WKWalletManagerCreateWalletSweeperHandler not supported
+    NULL  // WKWalletManagerSyncCompletedHandler
 };
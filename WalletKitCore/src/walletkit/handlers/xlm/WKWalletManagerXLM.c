@@ -307,5 +307,6 @@ WKWalletManagerHandlers wkWalletManagerHandlersXLM = {
     wkWalletManagerRecoverTransferFromTransferBundleXLM,
     NULL,//WKWalletManagerRecoverFeeBasisFromFeeEstimateHandler not supported
     wkWalletManagerWalletSweeperValidateSupportedXLM,
-    wkWalletManagerCreateWalletSweeperXLM
+    wkWalletManagerCreateWalletSweeperXLM,
+    NULL  // WKWalletManagerSyncCompletedHandler
 };
@@ -465,5 +465,6 @@ WKWalletManagerHandlers wkWalletManagerHandlersXTZ = {
     wkWalletManagerRecoverTransferFromTransferBundleXTZ,
     wkWalletManagerRecoverFeeBasisFromFeeEstimateXTZ,
     wkWalletManagerWalletSweeperValidateSupportedXTZ,
-    wkWalletManagerCreateWalletSweeperXTZ
+    wkWalletManagerCreateWalletSweeperXTZ,
+    NULL  // WKWalletManagerSyncCompletedHandler
 };